@@ -19,22 +19,170 @@
  */
 
 #include "data_storage.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stddef.h>
+#include <pthread.h>
 
 static const char *tag = "data_storage";
 
 static sqlite3 *db = NULL;
 PGconn *conn = NULL;
 char* fp_table = "flightPlan";
+char* payload_table = "payloads";
 char fs_db_name[15];
 char postgres_conf_s[30];
 
+#if SCH_STORAGE_MODE != 3
 static int dummy_callback(void *data, int argc, char **argv, char **names);
 
+/*
+ * Storage lock. The database connection is shared by all the tasks, and a
+ * transaction includes every statement executed in the connection until it
+ * ends, so the lock is held during each statement and from the beginning to
+ * the end of each transaction. It is recursive because the statements of a
+ * transaction take it again.
+ */
+static pthread_mutex_t storage_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+static void _storage_lock(void);
+static void _storage_unlock(void);
+static int _storage_begin(void);
+static int _storage_end(int commit);
+#endif
+
+#define STORAGE_STMT_CACHE (32)     ///< Max. number of cached prepared statements
+
+/**
+ * Kind of query kept in the prepared statements cache. A cached statement is
+ * identified by its kind and table name.
+ */
+typedef enum storage_stmt_kind {
+    STMT_REPO_GET_IDX=0,    ///< Get a repo value by index
+    STMT_REPO_GET_ALL,      ///< Get the first n repo values
+    STMT_REPO_SET_IDX,      ///< Set a repo value by index
+    STMT_FP_SET,            ///< Insert a flight plan entry
+    STMT_FP_GET,            ///< Get a flight plan entry by time
+    STMT_FP_ERASE,          ///< Delete a flight plan entry by time
+    STMT_PAYLOAD_SET,       ///< Insert a payload sample
+    STMT_PAYLOAD_GET,       ///< Get a payload sample by index
+    STMT_PAYLOAD_GET_N      ///< Get a range of payload samples
+} storage_stmt_kind_t;
+
+/**
+ * Prepared statements cache entry
+ */
+typedef struct storage_stmt {
+    sqlite3_stmt *stmt;     ///< Prepared statement, NULL if the entry is free
+    int kind;               ///< Query kind, see storage_stmt_kind_t
+    char table[32];         ///< Table name
+} storage_stmt_t;
+
+static storage_stmt_t stmt_cache[STORAGE_STMT_CACHE];
+
+#if SCH_STORAGE_MODE != 3
+static int stmt_cache_next = 0;
+
+static sqlite3_stmt *_storage_stmt_find(int kind, const char *table);
+static sqlite3_stmt *_storage_stmt_prepare(int kind, const char *table, const char *sql);
+static sqlite3_stmt *_storage_stmt_get(int kind, const char *table, const char *sql_fmt);
+static void _storage_stmt_release(sqlite3_stmt *stmt);
+#endif
+static void _storage_stmt_clear(const char *table);
+#if SCH_STORAGE_MODE == 1
+static void _storage_set_profile(void);
+#endif
+
+/** Payload samples stored in the database as packed structs */
+#define STORAGE_PAYLOAD_BLOB ((SCH_STORAGE_MODE == 1 || SCH_STORAGE_MODE == 2) && SCH_STORAGE_PAYLOAD_BLOB)
+/** Payload samples stored in the database with one column per field */
+#define STORAGE_PAYLOAD_COLUMNS ((SCH_STORAGE_MODE == 1 || SCH_STORAGE_MODE == 2) && !SCH_STORAGE_PAYLOAD_BLOB)
+
+#if STORAGE_PAYLOAD_BLOB
+static int _storage_table_payload_blob_init(void);
+static int _storage_set_payload_blob(int index, void* data, int payload);
+static int _storage_get_payload_blob(int index, void* data, int n, int payload);
+#endif
+
+#if SCH_STORAGE_MODE == 3
+/*
+ * Memory mapped files storage. Each table is stored in a file named
+ * <SCH_STORAGE_FILE>.<table> and mapped in memory:
+ *  - Repo tables are arrays of STORAGE_MAP_REPO_SIZE values, -1 if not set.
+ *  - The flight plan is an array of SCH_FP_MAX_ENTRIES entries.
+ *  - Each payload is a circular log of fixed size samples, with the same
+ *    capacity as its flash sections (SCH_SECTIONS_PER_PAYLOAD). The log
+ *    head and tail are kept in two metadata copies that are written
+ *    alternately, so a torn write leaves the previous copy valid. Stored
+ *    samples are only overwritten, or dropped by a sample that does not
+ *    follow them, if they were acknowledged (sys_ack), otherwise the new
+ *    samples are refused.
+ */
+#define STORAGE_MAP_MAGIC     (0x53434852)  ///< Payload log file magic number
+#define STORAGE_MAP_REPO      (4)           ///< Max. number of repo tables
+#define STORAGE_MAP_REPO_SIZE (1024)        ///< Max. number of values per repo table
+#define STORAGE_RING_HEADER   (64)          ///< Bytes reserved for the payload log metadata
+
+/**
+ * Memory mapped table
+ */
+typedef struct storage_map {
+    char name[32];          ///< Table name, empty if the entry is free
+    void *addr;             ///< Mapped file, NULL if not mapped
+    size_t len;             ///< Mapped bytes
+    int meta;               ///< Current metadata copy (0 | 1), only for payloads
+} storage_map_t;
+
+/**
+ * Payload log metadata, stored twice at the beginning of the file
+ */
+typedef struct storage_ring_meta {
+    uint32_t magic;         ///< STORAGE_MAP_MAGIC
+    uint32_t seq;           ///< Metadata version, the valid copy with the greatest one is current
+    uint32_t size;          ///< Sample size in bytes
+    uint32_t capacity;      ///< Max. number of samples
+    uint32_t head;          ///< Index of the next sample
+    uint32_t tail;          ///< Index of the oldest sample
+    uint32_t check;         ///< Checksum of the previous fields
+} storage_ring_meta_t;
+
+/**
+ * Flight plan entry stored in the mapped file
+ */
+typedef struct storage_map_fp {
+    int32_t unixtime;                   ///< Time to execute the command, 0 if the entry is free
+    int32_t executions;                 ///< Amount of times the command will be executed per periodic cycle
+    int32_t periodical;                 ///< Period of time between executions
+    char cmd[SCH_CMD_MAX_STR_NAME];     ///< Command to execute
+    char args[SCH_CMD_MAX_STR_PARAMS];  ///< Command's arguments
+} storage_map_fp_t;
+
+static char map_path[128];
+static storage_map_t map_repo[STORAGE_MAP_REPO];
+static storage_map_t map_fp;
+static storage_map_fp_t map_fp_backup[SCH_FP_MAX_ENTRIES];  ///< Flight plan copy to roll back a transaction
+static storage_map_t map_payload[last_sensor];
+
+static int _storage_map_open(storage_map_t *map, const char *name, size_t len, int drop);
+static void _storage_map_close(storage_map_t *map);
+static void _storage_map_close_all(void);
+static void _storage_map_sync(storage_map_t *map, size_t offset, size_t len);
+static storage_map_t *_storage_map_repo(const char *table);
+static storage_map_fp_t *_storage_map_fp_find(int timetodo);
+static int _storage_ring_init(int payload, int drop);
+static int _storage_ring_set(int index, void *data, int n, int payload);
+static int _storage_ring_get(int index, void *data, int n, int payload);
+#endif
+
 int storage_init(const char *file)
 {
     if(db != NULL)
     {
         LOGW(tag, "Database already open, closing it");
+        _storage_stmt_clear(NULL);
         sqlite3_close(db);
     }
 
@@ -48,6 +196,7 @@ int storage_init(const char *file)
     else
     {
         LOGD(tag, "Opened database successfully");
+        _storage_set_profile();
         return 0;
     }
 #elif SCH_STORAGE_MODE == 2
@@ -112,6 +261,10 @@ int storage_init(const char *file)
     int ver = PQserverVersion(conn);
     LOGI(tag, "Server version: %d", ver);
 
+#elif SCH_STORAGE_MODE == 3
+    _storage_map_close_all();
+    strncpy(map_path, file, sizeof(map_path)-1);
+    LOGD(tag, "Storing tables in files %s.*", map_path);
 #endif
     return 0;
 }
@@ -125,9 +278,10 @@ int storage_table_repo_init(char* table, int drop)
 #if SCH_STORAGE_MODE == 1
 
     /* Drop table if selected */
+    _storage_lock();
     if(drop)
     {
-
+        _storage_stmt_clear(table);
         sql = sqlite3_mprintf("DROP TABLE %s", table);
         rc = sqlite3_exec(db, sql, 0, 0, &err_msg);
 
@@ -136,6 +290,7 @@ int storage_table_repo_init(char* table, int drop)
             LOGE(tag, "Failed to drop table %s. Error: %s. SQL: %s", table, err_msg, sql);
             sqlite3_free(err_msg);
             sqlite3_free(sql);
+            _storage_unlock();
             return -1;
         }
         else
@@ -152,6 +307,7 @@ int storage_table_repo_init(char* table, int drop)
                           table);
 
     rc = sqlite3_exec(db, sql, 0, 0, &err_msg);
+    _storage_unlock();
 
     if (rc != SQLITE_OK )
     {
@@ -195,6 +351,29 @@ int storage_table_repo_init(char* table, int drop)
     }
     PQclear(res);
     return 0;
+#elif SCH_STORAGE_MODE == 3
+    storage_map_t *map = _storage_map_repo(table);
+    if(map == NULL)
+        map = _storage_map_repo("");
+    if(map == NULL)
+    {
+        LOGE(tag, "Failed to create table %s, max. %d tables", table, STORAGE_MAP_REPO);
+        return -1;
+    }
+
+    rc = _storage_map_open(map, table, STORAGE_MAP_REPO_SIZE*sizeof(int), drop);
+    if(rc < 0)
+        return -1;
+    if(rc == 1)
+    {
+        // New table, all values are unset
+        int i;
+        for(i=0; i<STORAGE_MAP_REPO_SIZE; i++)
+            ((int *)map->addr)[i] = -1;
+        _storage_map_sync(map, 0, map->len);
+    }
+    LOGD(tag, "Table %s created successfully", table);
+    return 0;
 #endif
 }
 
@@ -207,8 +386,10 @@ int storage_table_flight_plan_init(int drop)
 #if SCH_STORAGE_MODE == 1
 
     /* Drop table if selected */
+    _storage_lock();
     if (drop)
     {
+        _storage_stmt_clear(fp_table);
         sql = sqlite3_mprintf("DROP TABLE IF EXISTS %s", fp_table);
         rc = sqlite3_exec(db, sql, 0, 0, &err_msg);
 
@@ -217,6 +398,7 @@ int storage_table_flight_plan_init(int drop)
             LOGE(tag, "Failed to drop table %s. Error: %s. SQL: %s", fp_table, err_msg, sql);
             sqlite3_free(err_msg);
             sqlite3_free(sql);
+            _storage_unlock();
             return -1;
         }
         else
@@ -235,6 +417,7 @@ int storage_table_flight_plan_init(int drop)
                           fp_table);
 
     rc = sqlite3_exec(db, sql, 0, 0, &err_msg);
+    _storage_unlock();
 
     if (rc != SQLITE_OK )
     {
@@ -249,30 +432,61 @@ int storage_table_flight_plan_init(int drop)
         sqlite3_free(sql);
         return 0;
     }
+#elif SCH_STORAGE_MODE == 3
+    rc = _storage_map_open(&map_fp, fp_table, SCH_FP_MAX_ENTRIES*sizeof(storage_map_fp_t), drop);
+    if(rc < 0)
+        return -1;
+    LOGD(tag, "Table %s created successfully", fp_table);
 #endif
     return 0;
 }
 
-const char* get_sql_type(char* c_type)
+const char* get_sql_type(char c_type)
 {
 
-    if(strcmp(c_type, "%f") == 0) {
+    if(c_type == 'f') {
         return "REAL";
     }
-    else if(strcmp(c_type, "%d") == 0) {
+    else if(c_type == 'd') {
         return "INTEGER";
-    } else if(strcmp(c_type, "%u") == 0) {
+    } else if(c_type == 'u') {
         return "BIGINT";
     } else {
         return "TEXT";
     }
 }
 
+#if STORAGE_PAYLOAD_COLUMNS
+/**
+ * Write the payload fields names to @names as a comma separated list
+ */
+static void get_payload_columns(char *names, const dat_payload_desc_t *desc)
+{
+    int j;
+    strcpy(names, "");
+    for(j=0; j < desc->nfields; ++j) {
+        strcat(names, " ");
+        strcat(names, desc->fields[j].name);
+        if(j != desc->nfields-1) {
+            strcat(names, ",");
+        }
+    }
+}
+#endif
 
 int storage_table_payload_init(int drop)
 {
 
-#if SCH_STORAGE_MODE > 0
+#if STORAGE_PAYLOAD_BLOB
+    return _storage_table_payload_blob_init();
+#elif SCH_STORAGE_MODE == 3
+    int i;
+    for(i=0; i< last_sensor; ++i)
+    {
+        if(_storage_ring_init(i, drop) != 0)
+            return -1;
+    }
+#elif STORAGE_PAYLOAD_COLUMNS
     if(drop)
     {
 
@@ -281,23 +495,17 @@ int storage_table_payload_init(int drop)
     int i = 0;
     for(i=0; i< last_sensor; ++i)
     {
+        const dat_payload_desc_t *desc = dat_get_payload_desc(i);
         char create_table[300];
         sprintf(create_table, "CREATE TABLE IF NOT EXISTS %s(id INTEGER, tstz TIMESTAMPTZ,", data_map[i].table);
-        char* tok_sym[30];
-        char* tok_var[30];
-        char order[50];
-        strcpy(order, data_map[i].data_order);
-        char var_names[200];
-        strcpy(var_names, data_map[i].var_names);
-        int nparams = get_payloads_tokens(tok_sym, tok_var, order, var_names, i);
 
         int j=0;
-        for(j=0; j < nparams; ++j)
+        for(j=0; j < desc->nfields; ++j)
         {
             char line[100];
-            sprintf(line, "%s %s", tok_var[j], get_sql_type(tok_sym[j]));
+            sprintf(line, "%s %s", desc->fields[j].name, get_sql_type(desc->fields[j].type));
             strcat(create_table, line);
-            if(j != nparams-1) {
+            if(j != desc->nfields-1) {
                 strcat(create_table, ",");
             }
         }
@@ -333,32 +541,25 @@ int storage_table_payload_init(int drop)
     return 0;
 }
 
-
 int storage_repo_get_value_idx(int index, char *table)
 {
     int value = -1;
 #if SCH_STORAGE_MODE == 1
-    sqlite3_stmt* stmt = NULL;
-    char *sql = sqlite3_mprintf("SELECT value FROM %s WHERE idx=\"%d\";", table, index);
-
-    // execute statement
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
-    if(rc != SQLITE_OK)
-    {
-        LOGE(tag, "Selecting data from DB Failed (rc=%d)", rc);
+    sqlite3_stmt* stmt = _storage_stmt_get(STMT_REPO_GET_IDX, table,
+                                           "SELECT value FROM %s WHERE idx=?1;");
+    if(stmt == NULL)
         return -1;
-    }
 
     // fetch only one row's status
-    rc = sqlite3_step(stmt);
+    sqlite3_bind_int(stmt, 1, index);
+    int rc = sqlite3_step(stmt);
     value = -1;
     if(rc == SQLITE_ROW)
         value = sqlite3_column_int(stmt, 0);
     else
-    LOGE(tag, "Some error encountered (rc=%d)", rc);
+        LOGE(tag, "Some error encountered (rc=%d)", rc);
 
-    sqlite3_finalize(stmt);
-    sqlite3_free(sql);
+    _storage_stmt_release(stmt);
 #elif SCH_STORAGE_MODE == 2
     char get_value_query[100];
     sprintf(get_value_query, "SELECT value FROM %s WHERE idx=%d;", table, index);
@@ -378,10 +579,73 @@ int storage_repo_get_value_idx(int index, char *table)
         LOGE(tag, "The value wasn't found");
     }
     PQclear(res);
+#elif SCH_STORAGE_MODE == 3
+    storage_map_t *map = _storage_map_repo(table);
+    if(map == NULL || index < 0 || index >= STORAGE_MAP_REPO_SIZE)
+    {
+        LOGE(tag, "Value %d not found in table %s", index, table);
+        return -1;
+    }
+    value = ((int *)map->addr)[index];
 #endif
     return value;
 }
 
+int storage_repo_get_values(int *values, int n, char *table)
+{
+    int i;
+    for(i=0; i<n; i++)
+        values[i] = -1;
+#if SCH_STORAGE_MODE == 1
+    sqlite3_stmt* stmt = _storage_stmt_get(STMT_REPO_GET_ALL, table,
+                                           "SELECT idx, value FROM %s WHERE idx >= 0 AND idx < ?1 ORDER BY idx;");
+    if(stmt == NULL)
+        return -1;
+
+    // fetch all the rows
+    int rc;
+    sqlite3_bind_int(stmt, 1, n);
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        int idx = sqlite3_column_int(stmt, 0);
+        if(idx >= 0 && idx < n)
+            values[idx] = sqlite3_column_int(stmt, 1);
+    }
+    if(rc != SQLITE_DONE)
+        LOGE(tag, "Some error encountered (rc=%d)", rc);
+
+    _storage_stmt_release(stmt);
+    return rc == SQLITE_DONE ? 0 : -1;
+#elif SCH_STORAGE_MODE == 2
+    char get_values_query[100];
+    sprintf(get_values_query, "SELECT idx, value FROM %s WHERE idx >= 0 AND idx < %d ORDER BY idx;", table, n);
+    LOGD(tag, "%s",  get_values_query);
+    PGresult *res = PQexec(conn, get_values_query);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        LOGE(tag, "command storage_repo_get_values failed: %s", PQerrorMessage(conn));
+        PQclear(res);
+        return -1;
+    }
+    int rows = PQntuples(res);
+    for(i=0; i<rows; i++)
+    {
+        int idx = atoi(PQgetvalue(res, i, 0));
+        if(idx >= 0 && idx < n)
+            values[idx] = atoi(PQgetvalue(res, i, 1));
+    }
+    PQclear(res);
+#elif SCH_STORAGE_MODE == 3
+    storage_map_t *map = _storage_map_repo(table);
+    if(map == NULL)
+    {
+        LOGE(tag, "Table %s not found", table);
+        return -1;
+    }
+    memcpy(values, map->addr, (n < STORAGE_MAP_REPO_SIZE ? n : STORAGE_MAP_REPO_SIZE)*sizeof(int));
+#endif
+    return 0;
+}
+
 int storage_repo_get_value_str(char *name, char *table)
 {
     int value = -1;
@@ -390,9 +654,12 @@ int storage_repo_get_value_str(char *name, char *table)
     char *sql = sqlite3_mprintf("SELECT value FROM %s WHERE name=\"%s\";", table, name);
 
     // execute statement
+    _storage_lock();
     int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    sqlite3_free(sql);
     if(rc != 0)
     {
+        _storage_unlock();
         LOGE(tag, "Selecting data from DB Failed (rc=%d)", rc);
         return -1;
     }
@@ -405,7 +672,7 @@ int storage_repo_get_value_str(char *name, char *table)
         LOGE(tag, "Some error encountered (rc=%d)", rc);
 
     sqlite3_finalize(stmt);
-    sqlite3_free(sql);
+    _storage_unlock();
 #elif SCH_STORAGE_MODE == 2
     char get_value_query[100];
     sprintf(get_value_query, "SELECT value FROM %s WHERE name=\"%s\";", table, name);
@@ -417,6 +684,8 @@ int storage_repo_get_value_str(char *name, char *table)
         return -1;
     }
     value = atoi(PQgetvalue(res, 0, 0));
+#elif SCH_STORAGE_MODE == 3
+    LOGE(tag, "Values by name are not stored in table %s", table);
 #endif
     return value;
 }
@@ -425,29 +694,26 @@ int storage_repo_set_value_idx(int index, int value, char *table)
 {
 
 #if SCH_STORAGE_MODE == 1
-    char *err_msg;
-    char *sql = sqlite3_mprintf("INSERT OR REPLACE INTO %s (idx, name, value) "
-                                "VALUES ("
-                                "%d, "
-                                "(SELECT name FROM %s WHERE idx = \"%d\"), "
-                                "%d);",
-                                table, index, table, index, value);
+    sqlite3_stmt* stmt = _storage_stmt_get(STMT_REPO_SET_IDX, table,
+                                           "INSERT OR REPLACE INTO %s (idx, name, value) "
+                                           "VALUES (?1, (SELECT name FROM %s WHERE idx = ?1), ?2);");
+    if(stmt == NULL)
+        return -1;
 
     /* Execute SQL statement */
-    int rc = sqlite3_exec(db, sql, dummy_callback, 0, &err_msg);
+    sqlite3_bind_int(stmt, 1, index);
+    sqlite3_bind_int(stmt, 2, value);
+    int rc = sqlite3_step(stmt);
+    _storage_stmt_release(stmt);
 
-    if( rc != SQLITE_OK )
+    if( rc != SQLITE_DONE )
     {
-        LOGE(tag, "SQL error: %s", err_msg);
-        sqlite3_free(err_msg);
-        sqlite3_free(sql);
+        LOGE(tag, "SQL error: %s", sqlite3_errmsg(db));
         return -1;
     }
     else
     {
         LOGV(tag, "Inserted %d to %d in %s", value, index, table);
-        sqlite3_free(err_msg);
-        sqlite3_free(sql);
         return 0;
     }
 
@@ -469,12 +735,111 @@ int storage_repo_set_value_idx(int index, int value, char *table)
         return -1;
     }
     PQclear(res);
+#elif SCH_STORAGE_MODE == 3
+    storage_map_t *map = _storage_map_repo(table);
+    if(map == NULL || index < 0 || index >= STORAGE_MAP_REPO_SIZE)
+    {
+        LOGE(tag, "Failed to set value %d in table %s", index, table);
+        return -1;
+    }
+    ((int *)map->addr)[index] = value;
+    _storage_map_sync(map, index*sizeof(int), sizeof(int));
+    LOGV(tag, "Inserted %d to %d in %s", value, index, table);
 #endif
     return 0;
 }
 
+int storage_repo_set_values(int *index, int *values, int n, char *table)
+{
+#if SCH_STORAGE_MODE == 1
+    int i;
+    int rc = SQLITE_OK;
+    sqlite3_stmt* stmt = _storage_stmt_get(STMT_REPO_SET_IDX, table,
+                                           "INSERT OR REPLACE INTO %s (idx, name, value) "
+                                           "VALUES (?1, (SELECT name FROM %s WHERE idx = ?1), ?2);");
+    if(stmt == NULL)
+        return -1;
+
+    if(_storage_begin() != 0)
+    {
+        _storage_stmt_release(stmt);
+        return -1;
+    }
+    for(i=0; i<n && rc == SQLITE_OK; i++)
+    {
+        sqlite3_bind_int(stmt, 1, index[i]);
+        sqlite3_bind_int(stmt, 2, values[i]);
+        rc = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+        sqlite3_reset(stmt);
+    }
+    if(rc != SQLITE_OK)
+        LOGE(tag, "SQL error: %s", sqlite3_errmsg(db));
+    _storage_stmt_release(stmt);
+
+    if(_storage_end(rc == SQLITE_OK) != 0 || rc != SQLITE_OK)
+        return -1;
+    LOGV(tag, "Inserted %d values in %s", n, table);
+    return 0;
+
+#elif SCH_STORAGE_MODE == 2
+    int i;
+    char set_value_query[200];
+    PGresult *res = PQexec(conn, "BEGIN;");
+    PQclear(res);
+    for(i=0; i<n; i++)
+    {
+        sprintf(set_value_query, "INSERT INTO %s (idx, value) "
+                                 "VALUES ("
+                                 "%d, "
+                                 "%d) "
+                                 "ON CONFLICT (idx) DO UPDATE "
+                                 "SET value = %d; "
+                                 , table, index[i], values[i], values[i]);
+        res = PQexec(conn, set_value_query);
+        if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+            LOGE(tag, "command storage_repo_set_values failed: %s", PQerrorMessage(conn));
+            PQclear(res);
+            res = PQexec(conn, "ROLLBACK;");
+            PQclear(res);
+            return -1;
+        }
+        PQclear(res);
+    }
+    res = PQexec(conn, "COMMIT;");
+    PQclear(res);
+    return 0;
+#elif SCH_STORAGE_MODE == 3
+    int i;
+    storage_map_t *map = _storage_map_repo(table);
+    if(map == NULL)
+    {
+        LOGE(tag, "Table %s not found", table);
+        return -1;
+    }
+    for(i=0; i<n; i++)
+    {
+        if(index[i] < 0 || index[i] >= STORAGE_MAP_REPO_SIZE)
+        {
+            LOGE(tag, "Failed to set value %d in table %s", index[i], table);
+            return -1;
+        }
+    }
+    for(i=0; i<n; i++)
+        ((int *)map->addr)[index[i]] = values[i];
+    _storage_map_sync(map, 0, map->len);
+    LOGV(tag, "Inserted %d values in %s", n, table);
+    return 0;
+#else
+    return 0;
+#endif
+}
+
 int storage_repo_set_value_str(char *name, int value, char *table)
 {
+#if SCH_STORAGE_MODE == 3
+    LOGE(tag, "Values by name are not stored in table %s", table);
+    return -1;
+#else
     char *err_msg;
     char *sql = sqlite3_mprintf("INSERT OR REPLACE INTO %s (idx, name, value) "
                                 "VALUES ("
@@ -484,7 +849,9 @@ int storage_repo_set_value_str(char *name, int value, char *table)
                                 table, table, name, name, value);
 
     /* Execute SQL statement */
+    _storage_lock();
     int rc = sqlite3_exec(db, sql, dummy_callback, 0, &err_msg);
+    _storage_unlock();
 
     if( rc != SQLITE_OK )
     {
@@ -500,93 +867,183 @@ int storage_repo_set_value_str(char *name, int value, char *table)
         sqlite3_free(sql);
         return 0;
     }
+#endif
 }
 
 int storage_flight_plan_set(int timetodo, char* command, char* args, int executions, int periodical)
 {
-    char *err_msg;
-    char *sql = sqlite3_mprintf(
-            "INSERT OR REPLACE INTO %s (time, command, args, executions, periodical)\n VALUES (%d, \"%s\", \"%s\", %d, %d);",
-            fp_table, timetodo, command, args, executions, periodical);
+#if SCH_STORAGE_MODE == 3
+    storage_map_fp_t *entries = map_fp.addr;
+    if(entries == NULL)
+        return -1;
 
-    /* Execute SQL statement */
-    int rc = sqlite3_exec(db, sql, dummy_callback, 0, &err_msg);
+    // Replace the entry with the same time, or use the first free one
+    int i, slot = -1;
+    for(i=0; i<SCH_FP_MAX_ENTRIES; i++)
+    {
+        if(entries[i].unixtime == timetodo)
+        {
+            slot = i;
+            break;
+        }
+        if(entries[i].unixtime == 0 && slot < 0)
+            slot = i;
+    }
+    if(slot < 0)
+    {
+        LOGE(tag, "Flight plan table full, max. %d entries", SCH_FP_MAX_ENTRIES);
+        return -1;
+    }
+
+    storage_map_fp_t *entry = &entries[slot];
+    strncpy(entry->cmd, command, SCH_CMD_MAX_STR_NAME-1);
+    entry->cmd[SCH_CMD_MAX_STR_NAME-1] = '\0';
+    strncpy(entry->args, args, SCH_CMD_MAX_STR_PARAMS-1);
+    entry->args[SCH_CMD_MAX_STR_PARAMS-1] = '\0';
+    entry->executions = executions;
+    entry->periodical = periodical;
+    entry->unixtime = timetodo;
+    _storage_map_sync(&map_fp, slot*sizeof(storage_map_fp_t), sizeof(storage_map_fp_t));
+    LOGV(tag, "Inserted (%d, %s, %s, %d, %d) in %s", timetodo, command, args, executions, periodical, fp_table);
+    return 0;
+#else
+    sqlite3_stmt* stmt = _storage_stmt_get(STMT_FP_SET, fp_table,
+            "INSERT OR REPLACE INTO %s (time, command, args, executions, periodical)\n VALUES (?1, ?2, ?3, ?4, ?5);");
+    if(stmt == NULL)
+        return -1;
 
-    if (rc != SQLITE_OK)
+    /* Execute SQL statement */
+    sqlite3_bind_int(stmt, 1, timetodo);
+    sqlite3_bind_text(stmt, 2, command, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, args, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 4, executions);
+    sqlite3_bind_int(stmt, 5, periodical);
+    int rc = sqlite3_step(stmt);
+    _storage_stmt_release(stmt);
+
+    if (rc != SQLITE_DONE)
     {
-        LOGE(tag, "SQL error: %s", err_msg);
-        sqlite3_free(err_msg);
-        sqlite3_free(sql);
+        LOGE(tag, "SQL error: %s", sqlite3_errmsg(db));
         return -1;
     }
     else
     {
         LOGV(tag, "Inserted (%d, %s, %s, %d, %d) in %s", timetodo, command, args, executions, periodical, fp_table);
-        sqlite3_free(err_msg);
-        sqlite3_free(sql);
         return 0;
     }
+#endif
 }
 
 int storage_flight_plan_get(int timetodo, char* command, char* args, int* executions, int* periodical)
 {
-    char **results;
-    char *err_msg;
-    int row;
-    int col;
+#if SCH_STORAGE_MODE == 3
+    storage_map_fp_t *entry = _storage_map_fp_find(timetodo);
+    if(entry == NULL)
+        return -1;
 
-    char* sql = sqlite3_mprintf("SELECT * FROM %s WHERE time = %d", fp_table, timetodo);
+    strcpy(command, entry->cmd);
+    strcpy(args, entry->args);
+    *executions = entry->executions;
+    *periodical = entry->periodical;
+#else
+    sqlite3_stmt* stmt = _storage_stmt_get(STMT_FP_GET, fp_table,
+            "SELECT command, args, executions, periodical FROM %s WHERE time = ?1");
+    if(stmt == NULL)
+        return -1;
 
-    sqlite3_get_table(db, sql, &results,&row,&col,&err_msg);
+    sqlite3_bind_int(stmt, 1, timetodo);
+    int rc = sqlite3_step(stmt);
 
-    if(row==0 || col==0)
+    if(rc != SQLITE_ROW)
     {
-        sqlite3_free(sql);
-        LOGV(tag, "SQL error: %s", err_msg);
-        sqlite3_free(err_msg);
-        sqlite3_free_table(results);
+        LOGV(tag, "SQL error: %s", sqlite3_errmsg(db));
+        _storage_stmt_release(stmt);
         return -1;
     }
-    else
-    {
-        strcpy(command, results[6]);
-        strcpy(args,results[7]);
-        *executions = atoi(results[8]);
-        *periodical = atoi(results[9]);
 
-        storage_flight_plan_erase(timetodo);
+    const char *command_str = (const char *)sqlite3_column_text(stmt, 0);
+    const char *args_str = (const char *)sqlite3_column_text(stmt, 1);
+    strcpy(command, command_str != NULL ? command_str : "");
+    strcpy(args, args_str != NULL ? args_str : "");
+    *executions = sqlite3_column_int(stmt, 2);
+    *periodical = sqlite3_column_int(stmt, 3);
+    _storage_stmt_release(stmt);
+#endif
+
+    storage_flight_plan_erase(timetodo);
 
-        if (atoi(results[9]) > 0)
-            storage_flight_plan_set(timetodo+*periodical,results[6],results[7],*executions,*periodical);
+    if (*periodical > 0)
+        storage_flight_plan_set(timetodo+*periodical, command, args, *executions, *periodical);
 
-        sqlite3_free(sql);
-        return 0;
-    }
+    return 0;
 }
 
 int storage_flight_plan_erase(int timetodo)
 {
-
-    char *err_msg;
-    char *sql = sqlite3_mprintf("DELETE FROM %s\n WHERE time = %d", fp_table, timetodo);
+#if SCH_STORAGE_MODE == 3
+    storage_map_fp_t *entry = _storage_map_fp_find(timetodo);
+    if(entry != NULL)
+    {
+        memset(entry, 0, sizeof(storage_map_fp_t));
+        _storage_map_sync(&map_fp, (char *)entry - (char *)map_fp.addr, sizeof(storage_map_fp_t));
+    }
+    LOGV(tag, "Command in time %d, table %s was deleted", timetodo, fp_table);
+    return 0;
+#else
+    sqlite3_stmt* stmt = _storage_stmt_get(STMT_FP_ERASE, fp_table,
+                                           "DELETE FROM %s\n WHERE time = ?1");
+    if(stmt == NULL)
+        return -1;
 
     /* Execute SQL statement */
-    int rc = sqlite3_exec(db, sql, dummy_callback, 0, &err_msg);
+    sqlite3_bind_int(stmt, 1, timetodo);
+    int rc = sqlite3_step(stmt);
+    _storage_stmt_release(stmt);
 
-    if (rc != SQLITE_OK)
+    if (rc != SQLITE_DONE)
     {
-        LOGE(tag, "SQL error: %s", err_msg);
-        sqlite3_free(err_msg);
-        sqlite3_free(sql);
+        LOGE(tag, "SQL error: %s", sqlite3_errmsg(db));
         return -1;
     }
     else
     {
         LOGV(tag, "Command in time %d, table %s was deleted", timetodo, fp_table);
-        sqlite3_free(err_msg);
-        sqlite3_free(sql);
         return 0;
     }
+#endif
+}
+
+int storage_flight_plan_get_times(int *times, int n)
+{
+    int found = 0;
+#if SCH_STORAGE_MODE == 3
+    storage_map_fp_t *entries = map_fp.addr;
+    int i;
+    for(i=0; entries != NULL && i<SCH_FP_MAX_ENTRIES && found < n; i++)
+    {
+        if(entries[i].unixtime != 0)
+            times[found++] = entries[i].unixtime;
+    }
+#else
+    sqlite3_stmt* stmt = NULL;
+    char *sql = sqlite3_mprintf("SELECT time FROM %s ORDER BY time LIMIT %d", fp_table, n);
+
+    _storage_lock();
+    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    sqlite3_free(sql);
+    if(rc != SQLITE_OK)
+    {
+        _storage_unlock();
+        LOGE(tag, "Selecting data from DB Failed (rc=%d)", rc);
+        return -1;
+    }
+
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW && found < n)
+        times[found++] = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    _storage_unlock();
+#endif
+    return found;
 }
 
 int storage_flight_plan_reset(void)
@@ -594,7 +1051,54 @@ int storage_flight_plan_reset(void)
     return storage_table_flight_plan_init(1);
 }
 
+int storage_flight_plan_begin(void)
+{
+#if SCH_STORAGE_MODE == 3
+    if(map_fp.addr == NULL)
+        return -1;
+    // Keep a copy of the table to roll back the changes
+    memcpy(map_fp_backup, map_fp.addr, sizeof(map_fp_backup));
+    return 0;
+#else
+    return _storage_begin();
+#endif
+}
+
+int storage_flight_plan_end(int commit)
+{
+#if SCH_STORAGE_MODE == 3
+    if(map_fp.addr == NULL)
+        return -1;
+    if(!commit)
+        memcpy(map_fp.addr, map_fp_backup, sizeof(map_fp_backup));
+    _storage_map_sync(&map_fp, 0, map_fp.len);
+    return 0;
+#else
+    return _storage_end(commit);
+#endif
+}
+
 int storage_show_table (void) {
+#if SCH_STORAGE_MODE == 3
+    storage_map_fp_t *entries = map_fp.addr;
+    int i, rows = 0;
+    for(i=0; entries != NULL && i<SCH_FP_MAX_ENTRIES; i++)
+    {
+        if(entries[i].unixtime == 0)
+            continue;
+        if(rows++ == 0)
+        {
+            LOGI(tag, "Flight plan table");
+            printf("When\tCommand\tArguments\tExecutions\tPeriodical\n");
+        }
+        time_t timef = entries[i].unixtime;
+        printf("%s\t%s\t%s\t%d\t%d\n", ctime(&timef), entries[i].cmd, entries[i].args,
+               entries[i].executions, entries[i].periodical);
+    }
+    if(rows == 0)
+        LOGI(tag, "Flight plan table empty");
+    return 0;
+#else
     char **results;
     char *err_msg;
     int row;
@@ -625,9 +1129,40 @@ int storage_show_table (void) {
             printf("\n");
     }
     return 0;
+#endif
 }
 
 
+#if SCH_STORAGE_MODE == 1 && !SCH_STORAGE_PAYLOAD_BLOB
+static void bind_sqlite_value(char c_type, void* buff, sqlite3_stmt* stmt, int j)
+{
+    if(c_type == 'f') {
+        sqlite3_bind_double(stmt, j, *((float*)buff));
+    }
+    else if(c_type == 'd') {
+        sqlite3_bind_int(stmt, j, *((int*)buff));
+    }
+    else if(c_type == 'u') {
+        sqlite3_bind_int64(stmt, j, *((unsigned int*)buff));
+    }
+}
+#endif
+
+#if SCH_STORAGE_MODE == 2 && !SCH_STORAGE_PAYLOAD_BLOB
+static void get_value_string_psql(char* ret_string, char c_type, void* buff)
+{
+    if(c_type == 'f') {
+        sprintf(ret_string, " %f", *((float*)buff));
+    }
+    else if(c_type == 'u') {
+        sprintf(ret_string, " %u", *((unsigned int*)buff));
+    }
+    else {
+        sprintf(ret_string, " %d", *((int*)buff));
+    }
+}
+#endif
+
 int storage_set_payload_data(int index, void* data, int payload)
 {
     if(payload >= last_sensor)
@@ -636,58 +1171,66 @@ int storage_set_payload_data(int index, void* data, int payload)
         return -1;
     }
 
-#if SCH_STORAGE_MODE > 0
-    char* tok_sym[30];
-    char* tok_var[30];
-    char order[50];
-    strcpy(order, data_map[payload].data_order);
-    char var_names[200];
-    strcpy(var_names, data_map[payload].var_names);
-    int nparams = get_payloads_tokens(tok_sym, tok_var, order, var_names, payload);
+#if STORAGE_PAYLOAD_BLOB
+    return _storage_set_payload_blob(index, data, payload);
+#elif SCH_STORAGE_MODE == 3
+    return _storage_ring_set(index, data, 1, payload);
+#elif STORAGE_PAYLOAD_COLUMNS
+    const dat_payload_desc_t *desc = dat_get_payload_desc(payload);
+    int j;
 
-    char values[500];
-    char names[500];
-    strcpy(names, "(id, tstz,");
-    sprintf(values, "(%d, current_timestamp,", index);
-
-    int j;
-    for(j=0; j < nparams; ++j) {
-        int param_size = get_sizeof_type(tok_sym[j]);
-        char buff[param_size];
-        memcpy(buff, data+(j*param_size), param_size);
-
-        char name[20];
-        sprintf(name, " %s", tok_var[j]);
-        strcat(names, name);
-
-        char val[20];
-        get_value_string(val, tok_sym[j], buff);
-        strcat(values, val);
-
-        if(j != nparams-1){
-            strcat(names, ",");
-            strcat(values, ",");
+#if SCH_STORAGE_MODE == 1
+    sqlite3_stmt* stmt = _storage_stmt_find(STMT_PAYLOAD_SET, data_map[payload].table);
+    if(stmt == NULL)
+    {
+        char values[500];
+        char names[500];
+        get_payload_columns(names, desc);
+        strcpy(values, "?, current_timestamp");
+        for(j=0; j < desc->nfields; ++j)
+            strcat(values, ", ?");
+
+        char *insert_row = sqlite3_mprintf("INSERT INTO %s (id, tstz,%s) VALUES (%s)",
+                                           data_map[payload].table, names, values);
+        LOGD(tag, "%s", insert_row);
+        stmt = _storage_stmt_prepare(STMT_PAYLOAD_SET, data_map[payload].table, insert_row);
+        sqlite3_free(insert_row);
+        if(stmt == NULL)
+        {
+            _storage_unlock();
+            return -1;
         }
     }
 
-    strcat(names, ")");
-    strcat(values, ")");
-    char insert_row[200];
-    sprintf(insert_row, "INSERT INTO %s %s VALUES %s",data_map[payload].table, names, values);
-    LOGD(tag, "%s", insert_row);
+    sqlite3_bind_int(stmt, 1, index);
+    for(j=0; j < desc->nfields; ++j)
+        bind_sqlite_value(desc->fields[j].type, (char *)data + desc->fields[j].offset, stmt, j+2);
 
-#if SCH_STORAGE_MODE == 1
-    char* err_msg;
-    int rc;
-    rc = sqlite3_exec(db, insert_row, 0, 0, &err_msg);
+    int rc = sqlite3_step(stmt);
+    _storage_stmt_release(stmt);
 
-    if (rc != SQLITE_OK )
+    if (rc != SQLITE_DONE)
     {
-        LOGE(tag, "Failed to add value to table %s. Error: %s. SQL: %s", data_map[payload].table, err_msg, insert_row);
-        sqlite3_free(err_msg);
+        LOGE(tag, "Failed to add value to table %s. Error: %s", data_map[payload].table, sqlite3_errmsg(db));
         return -1;
     }
 #elif SCH_STORAGE_MODE == 2
+    char values[500];
+    char names[500];
+    get_payload_columns(names, desc);
+    sprintf(values, "%d, current_timestamp", index);
+
+    for(j=0; j < desc->nfields; ++j) {
+        char val[20];
+        get_value_string_psql(val, desc->fields[j].type, (char *)data + desc->fields[j].offset);
+        strcat(values, ",");
+        strcat(values, val);
+    }
+
+    char insert_row[1100];
+    sprintf(insert_row, "INSERT INTO %s (id, tstz,%s) VALUES (%s)",data_map[payload].table, names, values);
+    LOGD(tag, "%s", insert_row);
+
     // TODO: manage connection error in res
     PGresult *res = PQexec(conn, insert_row);
     if (PQresultStatus(res) != PGRES_COMMAND_OK) {
@@ -701,108 +1244,135 @@ int storage_set_payload_data(int index, void* data, int payload)
     return 0;
 }
 
-void get_sqlite_value(char* c_type, void* buff, sqlite3_stmt* stmt, int j)
+int storage_set_payload_data_n(int index, void* data, int n, int payload)
+{
+    if(payload >= last_sensor)
+    {
+        LOGE(tag, "Payload id: %d greater than maximum id: %d", payload, last_sensor);
+        return -1;
+    }
+
+#if SCH_STORAGE_MODE == 3
+    // The log metadata is updated once, after writing all the samples
+    if(_storage_ring_set(index, data, n, payload) != 0)
+        return -1;
+#else
+    int i, rc = 0;
+    if(_storage_begin() != 0)
+        return -1;
+
+    for(i=0; i<n && rc == 0; i++)
+        rc = storage_set_payload_data(index+i, (char *)data + i*data_map[payload].size, payload);
+
+    if(_storage_end(rc == 0) != 0 || rc != 0)
+    {
+        LOGE(tag, "Failed to add %d samples to payload %d, none were added", n, payload);
+        return -1;
+    }
+#endif
+    LOGV(tag, "Inserted %d samples of payload %d from index %d", n, payload, index);
+    return 0;
+}
+
+int storage_flush_payload_data(void)
 {
-    if(strcmp(c_type, "%f") == 0) {
+    // Payload samples are written to the storage when they are set
+    return 0;
+}
+
+void get_sqlite_value(char c_type, void* buff, sqlite3_stmt* stmt, int j)
+{
+    if(c_type == 'f') {
         float val;
         val =(float) sqlite3_column_double(stmt, j);
         memcpy(buff, &val, sizeof(float));
     }
-    else if(strcmp(c_type, "%d") == 0) {
+    else if(c_type == 'd') {
         int val;
         val = sqlite3_column_int(stmt, j);
         memcpy(buff, &val, sizeof(int));
     }
-    else if(strcmp(c_type, "%u") == 0) {
+    else if(c_type == 'u') {
         unsigned int val;
-        val = (unsigned int) sqlite3_column_int(stmt, j);
+        val = (unsigned int) sqlite3_column_int64(stmt, j);
         memcpy(buff, &val, sizeof(unsigned int));
     }
 }
 
-void get_psql_value(char* c_type, void* buff, PGresult *res, int j)
+void get_psql_value(char c_type, void* buff, PGresult *res, int i, int j)
 {
-    if(strcmp(c_type, "%f") == 0) {
+    if(c_type == 'f') {
         float val;
-        val =(float) atof(PQgetvalue(res, 0, j));
+        val =(float) atof(PQgetvalue(res, i, j));
         memcpy(buff, &val, sizeof(float));
     }
-    else if(strcmp(c_type, "%d") == 0) {
+    else if(c_type == 'd') {
         int val;
-        val =  atoi(PQgetvalue(res, 0, j));
+        val =  atoi(PQgetvalue(res, i, j));
         memcpy(buff, &val, sizeof(int));
     }
-    else if(strcmp(c_type, "%u") == 0) {
+    else if(c_type == 'u') {
         unsigned int val;
-        // TODO: Change to  strtoul()
-        val = (unsigned int) atol(PQgetvalue(res, 0, j));
+        val = (unsigned int) strtoul(PQgetvalue(res, i, j), NULL, 10);
         memcpy(buff, &val, sizeof(unsigned int));
     }
 }
 
 int storage_get_payload_data(int index, void* data, int payload)
 {
-#if SCH_STORAGE_MODE > 0
-    char* tok_sym[30];
-    char* tok_var[30];
-    char order[50];
-    strcpy(order, data_map[payload].data_order);
-    char var_names[200];
-    strcpy(var_names, data_map[payload].var_names);
-    int nparams = get_payloads_tokens(tok_sym, tok_var, order, var_names, payload);
+    if(payload >= last_sensor)
+    {
+        LOGE(tag, "Payload id: %d greater than maximum id: %d", payload, last_sensor);
+        return -1;
+    }
 
-    char values[500];
+#if STORAGE_PAYLOAD_BLOB
+    return _storage_get_payload_blob(index, data, 1, payload);
+#elif SCH_STORAGE_MODE == 3
+    return _storage_ring_get(index, data, 1, payload) == 1 ? 0 : -1;
+#elif STORAGE_PAYLOAD_COLUMNS
+    const dat_payload_desc_t *desc = dat_get_payload_desc(payload);
     char names[500];
-
-    strcpy(names, "");
     int j;
-    for(j=0; j < nparams; ++j) {
-
-        char name[20];
-        sprintf(name, " %s", tok_var[j]);
-        strcat(names, name);
-
-        if(j != nparams-1){
-            strcat(names, ",");
-        }
-    }
-
-    char get_value[200];
-    sprintf(get_value,"SELECT %s FROM %s WHERE id=%d LIMIT 1"
-            ,names, data_map[payload].table, index);
-    LOGD(tag, "%s",  get_value);
 
 #if SCH_STORAGE_MODE == 1
-    char* err_msg;
     int rc;
-    sqlite3_stmt* stmt = NULL;
-
-    // execute statement
-    rc = sqlite3_prepare_v2(db, get_value, -1, &stmt, 0);
-    if(rc != SQLITE_OK)
+    sqlite3_stmt* stmt = _storage_stmt_find(STMT_PAYLOAD_GET, data_map[payload].table);
+    if(stmt == NULL)
     {
-        LOGE(tag, "Selecting data from DB Failed (rc=%d)", rc);
-        return -1;
+        get_payload_columns(names, desc);
+        char *get_value = sqlite3_mprintf("SELECT %s FROM %s WHERE id=?1 LIMIT 1",
+                                          names, data_map[payload].table);
+        LOGD(tag, "%s",  get_value);
+        stmt = _storage_stmt_prepare(STMT_PAYLOAD_GET, data_map[payload].table, get_value);
+        sqlite3_free(get_value);
+        if(stmt == NULL)
+        {
+            _storage_unlock();
+            return -1;
+        }
     }
 
     // fetch only one row's status
+    sqlite3_bind_int(stmt, 1, index);
     rc = sqlite3_step(stmt);
-    int val;
     if(rc == SQLITE_ROW) {
-        for(j=0; j < nparams; ++j) {
-            int param_size = get_sizeof_type(tok_sym[j]);
-            get_sqlite_value(tok_sym[j], &val, stmt, j);
-            // TODO: sum data pointer with accumulative param sizes
-            memcpy(data+(j*4), &val, param_size);
-        }
+        for(j=0; j < desc->nfields; ++j)
+            get_sqlite_value(desc->fields[j].type, (char *)data + desc->fields[j].offset, stmt, j);
     }
     else {
         LOGE(tag, "Some error encountered (rc=%d)", rc);
     }
 
-    sqlite3_finalize(stmt);
+    _storage_stmt_release(stmt);
 
 #elif SCH_STORAGE_MODE == 2
+    get_payload_columns(names, desc);
+    char get_value[600];
+    sprintf(get_value,"SELECT %s FROM %s WHERE id=%d LIMIT 1"
+            ,names, data_map[payload].table, index);
+    LOGD(tag, "%s",  get_value);
+
     PGresult *res = PQexec(conn, get_value);
     if (PQresultStatus(res) != PGRES_TUPLES_OK) {
         LOGE(tag, "command storage_get_recent_payload_data failed: %s", PQerrorMessage(conn));
@@ -811,12 +1381,9 @@ int storage_get_payload_data(int index, void* data, int payload)
     }
     // TODO: manage connection error in res
 
-    int val;
-    for(j=0; j < nparams; ++j) {
-        int param_size = get_sizeof_type(tok_sym[j]);
-        get_psql_value(tok_sym[j], &val, res, j);
-        // TODO: sum data pointer with accumulative param sizes
-        memcpy(data+(j*4), &val, param_size);
+    if(PQntuples(res) > 0) {
+        for(j=0; j < desc->nfields; ++j)
+            get_psql_value(desc->fields[j].type, (char *)data + desc->fields[j].offset, res, 0, j);
     }
     PQclear(res);
 #endif
@@ -824,13 +1391,112 @@ int storage_get_payload_data(int index, void* data, int payload)
     return 0;
 }
 
+int storage_get_payload_data_n(int index, void* data, int n, int payload)
+{
+    if(payload >= last_sensor)
+    {
+        LOGE(tag, "Payload id: %d greater than maximum id: %d", payload, last_sensor);
+        return -1;
+    }
+
+#if STORAGE_PAYLOAD_BLOB
+    return _storage_get_payload_blob(index, data, n, payload);
+#elif SCH_STORAGE_MODE == 3
+    return _storage_ring_get(index, data, n, payload) < 0 ? -1 : 0;
+#elif STORAGE_PAYLOAD_COLUMNS
+    const dat_payload_desc_t *desc = dat_get_payload_desc(payload);
+    char names[500];
+    int j;
+
+    // Samples not found are left in zero
+    int size = data_map[payload].size;
+    int rows = 0;
+    memset(data, 0, n*size);
+
+#if SCH_STORAGE_MODE == 1
+    int rc;
+    sqlite3_stmt* stmt = _storage_stmt_find(STMT_PAYLOAD_GET_N, data_map[payload].table);
+    if(stmt == NULL)
+    {
+        get_payload_columns(names, desc);
+        char *get_values = sqlite3_mprintf("SELECT id, %s FROM %s WHERE id BETWEEN ?1 AND ?2 ORDER BY id",
+                                           names, data_map[payload].table);
+        LOGD(tag, "%s",  get_values);
+        stmt = _storage_stmt_prepare(STMT_PAYLOAD_GET_N, data_map[payload].table, get_values);
+        sqlite3_free(get_values);
+        if(stmt == NULL)
+        {
+            _storage_unlock();
+            return -1;
+        }
+    }
+
+    // fetch all the rows in the range
+    sqlite3_bind_int(stmt, 1, index);
+    sqlite3_bind_int(stmt, 2, index+n-1);
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        char *sample = (char *)data + (sqlite3_column_int(stmt, 0)-index)*size;
+        for(j=0; j < desc->nfields; ++j)
+            get_sqlite_value(desc->fields[j].type, sample + desc->fields[j].offset, stmt, j+1);
+        rows++;
+    }
+    _storage_stmt_release(stmt);
+
+    if(rc != SQLITE_DONE)
+    {
+        LOGE(tag, "Some error encountered (rc=%d)", rc);
+        return -1;
+    }
+
+#elif SCH_STORAGE_MODE == 2
+    get_payload_columns(names, desc);
+    char get_values[600];
+    sprintf(get_values,"SELECT id, %s FROM %s WHERE id BETWEEN %d AND %d ORDER BY id"
+            ,names, data_map[payload].table, index, index+n-1);
+    LOGD(tag, "%s",  get_values);
+
+    PGresult *res = PQexec(conn, get_values);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        LOGE(tag, "command storage_get_payload_data_n failed: %s", PQerrorMessage(conn));
+        PQclear(res);
+        return -1;
+    }
+
+    rows = PQntuples(res);
+    int i;
+    for(i=0; i < rows; ++i) {
+        char *sample = (char *)data + (atoi(PQgetvalue(res, i, 0))-index)*size;
+        for(j=0; j < desc->nfields; ++j)
+            get_psql_value(desc->fields[j].type, sample + desc->fields[j].offset, res, i, j+1);
+    }
+    PQclear(res);
+#endif
+    if(rows != n)
+        LOGE(tag, "Only %d of %d samples of payload %d found", rows, n, payload);
+#endif
+    return 0;
+}
+
 int storage_close(void)
 {
+#if SCH_STORAGE_MODE == 3
+    LOGD(tag, "Closing mapped files");
+    _storage_map_close_all();
+    return 0;
+#else
     if(db != NULL)
     {
         LOGD(tag, "Closing database");
+        _storage_lock();
+        _storage_stmt_clear(NULL);
+#if SCH_STORAGE_WAL
+        // Move the write-ahead log into the database and truncate it
+        sqlite3_wal_checkpoint_v2(db, NULL, SQLITE_CHECKPOINT_TRUNCATE, NULL, NULL);
+#endif
         sqlite3_close(db);
         db = NULL;
+        _storage_unlock();
         return 0;
     }
     else
@@ -838,14 +1504,677 @@ int storage_close(void)
         LOGW(tag, "Attempting to close a NULL pointer database");
         return -1;
     }
+#endif
 }
 
+#if SCH_STORAGE_MODE != 3
 static int dummy_callback(void *data, int argc, char **argv, char **names)
 {
     return 0;
 }
 
+static void _storage_lock(void)
+{
+    pthread_mutex_lock(&storage_lock);
+}
+
+static void _storage_unlock(void)
+{
+    pthread_mutex_unlock(&storage_lock);
+}
+
+/**
+ * Take the storage lock and begin a transaction. The lock is kept until
+ * _storage_end, or released if the transaction can not be started.
+ *
+ * @return 0 OK, -1 Error
+ */
+static int _storage_begin(void)
+{
+    _storage_lock();
+#if SCH_STORAGE_MODE == 2
+    PGresult *res = PQexec(conn, "BEGIN;");
+    int ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    PQclear(res);
+    if(!ok)
+    {
+        LOGE(tag, "Unable to begin transaction: %s", PQerrorMessage(conn));
+        _storage_unlock();
+        return -1;
+    }
+#else
+    if(sqlite3_exec(db, "BEGIN TRANSACTION;", NULL, NULL, NULL) != SQLITE_OK)
+    {
+        LOGE(tag, "Unable to begin transaction: %s", sqlite3_errmsg(db));
+        _storage_unlock();
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+/**
+ * Commit or roll back the transaction started with _storage_begin and
+ * release the storage lock. If the commit fails the transaction is rolled
+ * back.
+ *
+ * @param commit 1 to commit the changes, 0 to discard them
+ * @return 0 if the changes were committed or discarded, -1 Error
+ */
+static int _storage_end(int commit)
+{
+    int rc = 0;
+#if SCH_STORAGE_MODE == 2
+    PGresult *res = PQexec(conn, commit ? "COMMIT;" : "ROLLBACK;");
+    if(PQresultStatus(res) != PGRES_COMMAND_OK)
+    {
+        LOGE(tag, "Unable to end transaction: %s", PQerrorMessage(conn));
+        rc = -1;
+    }
+    PQclear(res);
+#else
+    if(sqlite3_exec(db, commit ? "COMMIT;" : "ROLLBACK;", NULL, NULL, NULL) != SQLITE_OK)
+    {
+        LOGE(tag, "Unable to end transaction: %s", sqlite3_errmsg(db));
+        if(commit && !sqlite3_get_autocommit(db))
+            sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        rc = -1;
+    }
+#endif
+    _storage_unlock();
+    return rc;
+}
+
+/**
+ * Take the storage lock and find a cached statement. The lock is released
+ * by _storage_stmt_release, or with _storage_unlock if no statement is used.
+ */
+static sqlite3_stmt *_storage_stmt_find(int kind, const char *table)
+{
+    int i;
+    _storage_lock();
+    for(i=0; i<STORAGE_STMT_CACHE; i++)
+    {
+        if(stmt_cache[i].stmt != NULL && stmt_cache[i].kind == kind &&
+           strcmp(stmt_cache[i].table, table) == 0)
+            return stmt_cache[i].stmt;
+    }
+    return NULL;
+}
+
+static sqlite3_stmt *_storage_stmt_prepare(int kind, const char *table, const char *sql)
+{
+    sqlite3_stmt *stmt = NULL;
+    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
+    if(rc != SQLITE_OK)
+    {
+        LOGE(tag, "SQL error preparing statement (rc=%d): %s", rc, sqlite3_errmsg(db));
+        return NULL;
+    }
+
+    // Use a free entry, or replace the cached statements in round robin
+    int i, slot = -1;
+    for(i=0; i<STORAGE_STMT_CACHE && slot < 0; i++)
+    {
+        if(stmt_cache[i].stmt == NULL)
+            slot = i;
+    }
+    if(slot < 0)
+    {
+        slot = stmt_cache_next;
+        stmt_cache_next = (stmt_cache_next + 1) % STORAGE_STMT_CACHE;
+        sqlite3_finalize(stmt_cache[slot].stmt);
+    }
+
+    stmt_cache[slot].stmt = stmt;
+    stmt_cache[slot].kind = kind;
+    strncpy(stmt_cache[slot].table, table, sizeof(stmt_cache[slot].table)-1);
+    stmt_cache[slot].table[sizeof(stmt_cache[slot].table)-1] = '\0';
+    return stmt;
+}
+
+static sqlite3_stmt *_storage_stmt_get(int kind, const char *table, const char *sql_fmt)
+{
+    sqlite3_stmt *stmt = _storage_stmt_find(kind, table);
+    if(stmt == NULL)
+    {
+        // The table name can appear once or twice in the query
+        char *sql = sqlite3_mprintf(sql_fmt, table, table);
+        stmt = _storage_stmt_prepare(kind, table, sql);
+        sqlite3_free(sql);
+    }
+    if(stmt == NULL)
+        _storage_unlock();
+    return stmt;
+}
+
+static void _storage_stmt_release(sqlite3_stmt *stmt)
+{
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    _storage_unlock();
+}
+#endif
+
+static void _storage_stmt_clear(const char *table)
+{
+    int i;
+    for(i=0; i<STORAGE_STMT_CACHE; i++)
+    {
+        if(stmt_cache[i].stmt != NULL && (table == NULL || strcmp(stmt_cache[i].table, table) == 0))
+        {
+            sqlite3_finalize(stmt_cache[i].stmt);
+            stmt_cache[i].stmt = NULL;
+        }
+    }
+}
+
+#if SCH_STORAGE_MODE == 1
+/**
+ * Set the database durability and performance profile from config.h:
+ * journal mode, synchronous level, memory map and page cache sizes,
+ * checkpoint period and busy timeout. Errors are not fatal, the database
+ * keeps the SQLite defaults.
+ */
+static void _storage_set_profile(void)
+{
+    char *err_msg = NULL;
+    char *sql = sqlite3_mprintf("PRAGMA journal_mode=%s;"
+                                "PRAGMA synchronous=%d;"
+                                "PRAGMA mmap_size=%d;"
+                                "PRAGMA cache_size=-%d;"
+                                "PRAGMA wal_autocheckpoint=%d;",
+                                SCH_STORAGE_WAL ? "WAL" : "DELETE",
+                                SCH_STORAGE_SYNC,
+                                SCH_STORAGE_MMAP_SIZE,
+                                SCH_STORAGE_PAGE_CACHE,
+                                SCH_STORAGE_CHECKPOINT);
+
+    int rc = sqlite3_exec(db, sql, dummy_callback, 0, &err_msg);
+    if(rc != SQLITE_OK)
+    {
+        LOGW(tag, "Unable to set the database profile. Error: %s. SQL: %s", err_msg, sql);
+        sqlite3_free(err_msg);
+    }
+    sqlite3_free(sql);
+
+    sqlite3_busy_timeout(db, SCH_STORAGE_BUSY_TIMEOUT);
+}
+#endif
+
+#if STORAGE_PAYLOAD_BLOB
+/**
+ * Create the payloads table, that stores every payload sample as a packed
+ * struct, keyed by (payload, id). The sample timestamp is an indexed column.
+ */
+static int _storage_table_payload_blob_init(void)
+{
+#if SCH_STORAGE_MODE == 1
+    // Rows are stored in the primary key b-tree, without a rowid
+    const char *blob_type = "BLOB";
+    const char *table_opts = "WITHOUT ROWID";
+#else
+    const char *blob_type = "BYTEA";
+    const char *table_opts = "";
+#endif
+    char create_table[400];
+    sprintf(create_table, "CREATE TABLE IF NOT EXISTS %s("
+                          "payload INTEGER, id INTEGER, tstz TIMESTAMPTZ, "
+                          "timestamp BIGINT, data %s, "
+                          "PRIMARY KEY (payload, id)) %s;"
+                          "CREATE INDEX IF NOT EXISTS %s_timestamp ON %s (payload, timestamp);",
+                          payload_table, blob_type, table_opts, payload_table, payload_table);
+    LOGD(tag, "SQL command: %s", create_table);
+
+#if SCH_STORAGE_MODE == 1
+    char* err_msg;
+    int rc = sqlite3_exec(db, create_table, 0, 0, &err_msg);
+    if (rc != SQLITE_OK )
+    {
+        LOGE(tag, "Failed to crate table %s. Error: %s. SQL: %s", payload_table, err_msg, create_table);
+        sqlite3_free(err_msg);
+        return -1;
+    }
+#elif SCH_STORAGE_MODE == 2
+    PGresult *res = PQexec(conn, create_table);
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        LOGE(tag, "command CREATE PAYLOAD failed: %s", PQerrorMessage(conn));
+        PQclear(res);
+        return -1;
+    }
+    PQclear(res);
+#endif
+    LOGD(tag, "Table %s created successfully", payload_table);
+    return 0;
+}
+
+/**
+ * Store one payload sample as a BLOB, replacing the sample with the same index
+ */
+static int _storage_set_payload_blob(int index, void* data, int payload)
+{
+    const dat_payload_desc_t *desc = dat_get_payload_desc(payload);
+    int size = data_map[payload].size;
+    unsigned int timestamp = 0;
+    if(desc->time_field >= 0)
+        memcpy(&timestamp, (char *)data + desc->fields[desc->time_field].offset, sizeof(timestamp));
 
+#if SCH_STORAGE_MODE == 1
+    sqlite3_stmt* stmt = _storage_stmt_get(STMT_PAYLOAD_SET, payload_table,
+            "INSERT OR REPLACE INTO %s (payload, id, tstz, timestamp, data) "
+            "VALUES (?1, ?2, current_timestamp, ?3, ?4);");
+    if(stmt == NULL)
+        return -1;
 
+    sqlite3_bind_int(stmt, 1, payload);
+    sqlite3_bind_int(stmt, 2, index);
+    sqlite3_bind_int64(stmt, 3, timestamp);
+    sqlite3_bind_blob(stmt, 4, data, size, SQLITE_STATIC);
+    int rc = sqlite3_step(stmt);
+    _storage_stmt_release(stmt);
 
+    if (rc != SQLITE_DONE)
+    {
+        LOGE(tag, "Failed to add value to table %s. Error: %s", payload_table, sqlite3_errmsg(db));
+        return -1;
+    }
+#elif SCH_STORAGE_MODE == 2
+    char insert_row[300];
+    sprintf(insert_row, "INSERT INTO %s (payload, id, tstz, timestamp, data) "
+                        "VALUES ($1, $2, current_timestamp, $3, $4) "
+                        "ON CONFLICT (payload, id) DO UPDATE "
+                        "SET tstz = current_timestamp, timestamp = $3, data = $4;", payload_table);
+    char payload_s[12], index_s[12], timestamp_s[12];
+    sprintf(payload_s, "%d", payload);
+    sprintf(index_s, "%d", index);
+    sprintf(timestamp_s, "%u", timestamp);
+    const char *values[4] = {payload_s, index_s, timestamp_s, (const char *)data};
+    int lengths[4] = {0, 0, 0, size};
+    int formats[4] = {0, 0, 0, 1};
+
+    PGresult *res = PQexecParams(conn, insert_row, 4, NULL, values, lengths, formats, 0);
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        LOGE(tag, "command INSERT failed: %s", PQerrorMessage(conn));
+        PQclear(res);
+        return -1;
+    }
+    PQclear(res);
+#endif
+    return 0;
+}
+
+/**
+ * Get @n payload samples stored as BLOBs, from @index to @index+n-1. Samples
+ * not found are left in zero.
+ */
+static int _storage_get_payload_blob(int index, void* data, int n, int payload)
+{
+    int size = data_map[payload].size;
+    int rows = 0;
+    memset(data, 0, n*size);
+
+#if SCH_STORAGE_MODE == 1
+    int rc;
+    sqlite3_stmt* stmt = _storage_stmt_get(STMT_PAYLOAD_GET_N, payload_table,
+            "SELECT id, data FROM %s WHERE payload=?1 AND id BETWEEN ?2 AND ?3 ORDER BY id;");
+    if(stmt == NULL)
+        return -1;
+
+    sqlite3_bind_int(stmt, 1, payload);
+    sqlite3_bind_int(stmt, 2, index);
+    sqlite3_bind_int(stmt, 3, index+n-1);
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        int bytes = sqlite3_column_bytes(stmt, 1);
+        char *sample = (char *)data + (sqlite3_column_int(stmt, 0)-index)*size;
+        memcpy(sample, sqlite3_column_blob(stmt, 1), bytes < size ? bytes : size);
+        rows++;
+    }
+    _storage_stmt_release(stmt);
+
+    if(rc != SQLITE_DONE)
+    {
+        LOGE(tag, "Some error encountered (rc=%d)", rc);
+        return -1;
+    }
+#elif SCH_STORAGE_MODE == 2
+    char get_values[200];
+    sprintf(get_values, "SELECT id, data FROM %s WHERE payload=$1 AND id BETWEEN $2 AND $3 ORDER BY id;",
+            payload_table);
+    char payload_s[12], from_s[12], to_s[12];
+    sprintf(payload_s, "%d", payload);
+    sprintf(from_s, "%d", index);
+    sprintf(to_s, "%d", index+n-1);
+    const char *values[3] = {payload_s, from_s, to_s};
+
+    // Binary results, the id is a network order int
+    PGresult *res = PQexecParams(conn, get_values, 3, NULL, values, NULL, NULL, 1);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        LOGE(tag, "command storage_get_payload_data_n failed: %s", PQerrorMessage(conn));
+        PQclear(res);
+        return -1;
+    }
+
+    rows = PQntuples(res);
+    int i;
+    for(i=0; i < rows; ++i) {
+        uint32_t id;
+        memcpy(&id, PQgetvalue(res, i, 0), sizeof(id));
+        int bytes = PQgetlength(res, i, 1);
+        char *sample = (char *)data + ((int)ntohl(id)-index)*size;
+        memcpy(sample, PQgetvalue(res, i, 1), bytes < size ? bytes : size);
+    }
+    PQclear(res);
+#endif
+    if(rows != n)
+        LOGE(tag, "Only %d of %d samples of payload %d found", rows, n, payload);
+    return 0;
+}
+#endif
+
+#if SCH_STORAGE_MODE == 3
+/**
+ * Map the file <SCH_STORAGE_FILE>.<name> of @len bytes, creating it if it
+ * does not exist. If the file has another size, or @drop is set, it is
+ * truncated and mapped filled with zeros.
+ *
+ * @return 1 if the file was created or truncated, 0 if it was opened, -1 Error
+ */
+static int _storage_map_open(storage_map_t *map, const char *name, size_t len, int drop)
+{
+    char path[sizeof(map_path)+sizeof(map->name)+1];
+    struct stat st;
+
+    _storage_map_close(map);
+    snprintf(path, sizeof(path), "%s.%s", map_path, name);
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0 || fstat(fd, &st) != 0)
+    {
+        LOGE(tag, "Can't open file %s. Error: %s", path, strerror(errno));
+        if(fd >= 0)
+            close(fd);
+        return -1;
+    }
 
+    int created = drop || st.st_size != (off_t)len;
+    if(created)
+    {
+        if(!drop && st.st_size != 0)
+            LOGW(tag, "File %s has %ld bytes instead of %lu, resetting it", path, (long)st.st_size, (unsigned long)len);
+        if(ftruncate(fd, 0) != 0 || ftruncate(fd, len) != 0)
+        {
+            LOGE(tag, "Can't resize file %s. Error: %s", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+
+    // The mapping keeps a reference to the file
+    void *addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED)
+    {
+        LOGE(tag, "Can't map file %s. Error: %s", path, strerror(errno));
+        return -1;
+    }
+
+    strncpy(map->name, name, sizeof(map->name)-1);
+    map->addr = addr;
+    map->len = len;
+    map->meta = 0;
+    LOGD(tag, "File %s mapped (%lu bytes)", path, (unsigned long)len);
+    return created;
+}
+
+static void _storage_map_close(storage_map_t *map)
+{
+    if(map->addr != NULL)
+    {
+        msync(map->addr, map->len, MS_SYNC);
+        munmap(map->addr, map->len);
+    }
+    memset(map, 0, sizeof(storage_map_t));
+}
+
+static void _storage_map_close_all(void)
+{
+    int i;
+    for(i=0; i<STORAGE_MAP_REPO; i++)
+        _storage_map_close(&map_repo[i]);
+    _storage_map_close(&map_fp);
+    for(i=0; i<last_sensor; i++)
+        _storage_map_close(&map_payload[i]);
+}
+
+/**
+ * Write @len bytes from @offset of a mapped file to the disk, only if
+ * SCH_STORAGE_SYNC is FULL. Otherwise the kernel writes them back later,
+ * which already survives a crash of the flight software.
+ */
+static void _storage_map_sync(storage_map_t *map, size_t offset, size_t len)
+{
+#if SCH_STORAGE_SYNC > 1
+    if(len == 0)
+        return;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = offset - offset%page;
+    msync((char *)map->addr + start, offset + len - start, MS_SYNC);
+#endif
+}
+
+/**
+ * Find the mapped repo table named @table
+ */
+static storage_map_t *_storage_map_repo(const char *table)
+{
+    int i;
+    for(i=0; i<STORAGE_MAP_REPO; i++)
+    {
+        if(strcmp(map_repo[i].name, table) == 0)
+            return &map_repo[i];
+    }
+    return NULL;
+}
+
+/**
+ * Find the flight plan entry of time @timetodo, NULL if not found
+ */
+static storage_map_fp_t *_storage_map_fp_find(int timetodo)
+{
+    storage_map_fp_t *entries = map_fp.addr;
+    int i;
+    for(i=0; entries != NULL && i<SCH_FP_MAX_ENTRIES; i++)
+    {
+        if(entries[i].unixtime != 0 && entries[i].unixtime == timetodo)
+            return &entries[i];
+    }
+    return NULL;
+}
+
+/**
+ * Checksum (FNV-1a) of the payload log metadata, without the check field
+ */
+static uint32_t _storage_ring_check(const storage_ring_meta_t *meta)
+{
+    const uint8_t *bytes = (const uint8_t *)meta;
+    uint32_t hash = 2166136261u;
+    size_t i;
+    for(i=0; i<offsetof(storage_ring_meta_t, check); i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+static storage_ring_meta_t *_storage_ring_meta(storage_map_t *map)
+{
+    return (storage_ring_meta_t *)map->addr + map->meta;
+}
+
+/**
+ * Write a new version of the payload log metadata over the copy that is not
+ * current, then use it as the current one. Samples written before calling
+ * this function are stored before the new metadata.
+ */
+static void _storage_ring_commit(storage_map_t *map, uint32_t head, uint32_t tail)
+{
+    storage_ring_meta_t meta = *_storage_ring_meta(map);
+    meta.seq++;
+    meta.head = head;
+    meta.tail = tail;
+    meta.check = _storage_ring_check(&meta);
+
+    __sync_synchronize();
+    int next = 1 - map->meta;
+    ((storage_ring_meta_t *)map->addr)[next] = meta;
+    _storage_map_sync(map, 0, STORAGE_RING_HEADER);
+    map->meta = next;
+}
+
+static int _storage_ring_init(int payload, int drop)
+{
+    storage_map_t *map = &map_payload[payload];
+    uint32_t size = data_map[payload].size;
+    uint32_t capacity = (SCH_SECTIONS_PER_PAYLOAD*SCH_SIZE_PER_SECTION)/size;
+
+    int created = _storage_map_open(map, data_map[payload].table, STORAGE_RING_HEADER + capacity*size, drop);
+    if(created < 0)
+        return -1;
+
+    // Use the valid metadata copy with the greatest version
+    storage_ring_meta_t *meta = map->addr;
+    int i, valid[2];
+    for(i=0; i<2; i++)
+    {
+        valid[i] = !created && meta[i].magic == STORAGE_MAP_MAGIC &&
+                   meta[i].check == _storage_ring_check(&meta[i]) &&
+                   meta[i].size == size && meta[i].capacity == capacity &&
+                   meta[i].head - meta[i].tail <= capacity;
+    }
+    if(valid[0] || valid[1])
+    {
+        if(valid[0] && valid[1])
+            map->meta = (int32_t)(meta[1].seq - meta[0].seq) > 0 ? 1 : 0;
+        else
+            map->meta = valid[1];
+        LOGD(tag, "Payload %d log has samples %u to %u", payload,
+             _storage_ring_meta(map)->tail, _storage_ring_meta(map)->head);
+        return 0;
+    }
+
+    // Start an empty log
+    if(!created)
+        LOGW(tag, "Invalid metadata in payload %d log, resetting it", payload);
+    memset(meta, 0, STORAGE_RING_HEADER);
+    meta[0].magic = STORAGE_MAP_MAGIC;
+    meta[0].size = size;
+    meta[0].capacity = capacity;
+    meta[0].check = _storage_ring_check(&meta[0]);
+    map->meta = 0;
+    _storage_map_sync(map, 0, STORAGE_RING_HEADER);
+    return 0;
+}
+
+static int _storage_ring_set(int index, void *data, int n, int payload)
+{
+    storage_map_t *map = &map_payload[payload];
+    if(map->addr == NULL || index < 0 || n < 0)
+    {
+        LOGE(tag, "Failed to add sample %d to payload %d", index, payload);
+        return -1;
+    }
+
+    storage_ring_meta_t *meta = _storage_ring_meta(map);
+    uint32_t size = meta->size;
+    uint32_t capacity = meta->capacity;
+    uint32_t head = meta->head;
+    uint32_t tail = meta->tail;
+    uint32_t from = (uint32_t)index;
+    uint32_t to = from + (uint32_t)n;
+    const char *samples = data;
+
+    // Only the last samples fit in the log
+    if(to - from > capacity)
+    {
+        samples += (to - from - capacity)*size;
+        from = to - capacity;
+    }
+
+    // Samples not following the stored ones start a new log, dropping the
+    // stored samples only if they were acknowledged
+    int ack = -1;
+    if(from < tail || from > head || to - tail > capacity)
+        ack = storage_repo_get_value_idx(data_map[payload].sys_ack, DAT_REPO_SYSTEM);
+    if(from < tail || from > head)
+    {
+        if(head != tail && (ack < 0 || (uint32_t)ack < head))
+        {
+            LOGW(tag, "Sample %d of payload %d is out of the log, samples %u to %u not acknowledged (%d)",
+                 index, payload, tail, head - 1, ack);
+            return -1;
+        }
+        LOGW(tag, "Sample %d of payload %d is out of the log (%u to %u), resetting it", index, payload, tail, head);
+        head = tail = from;
+        _storage_ring_commit(map, head, tail);
+    }
+
+    // Drop the oldest samples before writing over them, only if they were
+    // acknowledged, as the nanomind payload sections
+    if(to - tail > capacity)
+    {
+        if(ack < 0 || (uint32_t)ack < to - capacity)
+        {
+            LOGW(tag, "Payload %d log full, samples %u to %u not acknowledged (%d)",
+                 payload, tail, to - capacity - 1, ack);
+            return -1;
+        }
+        tail = to - capacity;
+        _storage_ring_commit(map, head, tail);
+    }
+
+    // Write the samples, wrapping at the end of the file
+    char *records = (char *)map->addr + STORAGE_RING_HEADER;
+    uint32_t slot = from % capacity;
+    uint32_t count = to - from;
+    uint32_t first = count < capacity - slot ? count : capacity - slot;
+    memcpy(records + slot*size, samples, first*size);
+    memcpy(records, samples + first*size, (count - first)*size);
+    _storage_map_sync(map, STORAGE_RING_HEADER + slot*size, first*size);
+    _storage_map_sync(map, STORAGE_RING_HEADER, (count - first)*size);
+
+    // Publish the new samples
+    if(to > head)
+        _storage_ring_commit(map, to, tail);
+    return 0;
+}
+
+/**
+ * Copy the samples from @index to @index+n-1 that are in the log of @payload
+ * to @data. Samples not found are set to zero.
+ *
+ * @return Number of samples found, -1 Error
+ */
+static int _storage_ring_get(int index, void *data, int n, int payload)
+{
+    storage_map_t *map = &map_payload[payload];
+    memset(data, 0, n*data_map[payload].size);
+    if(map->addr == NULL || index < 0 || n < 0)
+    {
+        LOGE(tag, "Failed to get sample %d of payload %d", index, payload);
+        return -1;
+    }
+
+    storage_ring_meta_t *meta = _storage_ring_meta(map);
+    uint32_t size = meta->size;
+    uint32_t from = (uint32_t)index > meta->tail ? (uint32_t)index : meta->tail;
+    uint32_t to = (uint32_t)(index + n) < meta->head ? (uint32_t)(index + n) : meta->head;
+    const char *records = (const char *)map->addr + STORAGE_RING_HEADER;
+
+    uint32_t i;
+    for(i=from; i<to; i++)
+        memcpy((char *)data + (i - index)*size, records + (i % meta->capacity)*size, size);
+
+    int found = to > from ? (int)(to - from) : 0;
+    if(found != n)
+        LOGE(tag, "Only %d of %d samples of payload %d found", found, n, payload);
+    return found;
+}
+#endif
@@ -0,0 +1,225 @@
+/*                                 SUCHAI
+ *                      NANOSATELLITE FLIGHT SOFTWARE
+ *
+ *      Copyright 2019, Carlos Gonzalez Cortes, carlgonz@uchile.cl
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "flash_sim.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char *tag = "flash_sim";
+
+/*
+ * Simulation file layout: the flash, the FRAM and the erase count of each
+ * flash block.
+ */
+#define FLASH_SIM_FRAM_OFFSET   (FLASH_SIM_SIZE)
+#define FLASH_SIM_WEAR_OFFSET   (FLASH_SIM_FRAM_OFFSET+FLASH_SIM_FRAM_SIZE)
+#define FLASH_SIM_FILE_SIZE     (FLASH_SIM_WEAR_OFFSET+FLASH_SIM_BLOCKS*sizeof(uint32_t))
+
+static uint8_t *sim_addr = NULL;        ///< Mapped simulation file
+static uint8_t *sim_flash = NULL;       ///< Flash contents
+static uint8_t *sim_fram = NULL;        ///< FRAM contents
+static uint32_t *sim_wear = NULL;       ///< Erase count of each flash block
+static flash_sim_stats_t sim_stats;     ///< Simulation statistics
+
+/**
+ * Check that the simulation is open and the range is inside the memory
+ *
+ * @param addr First address of the range
+ * @param len Length of the range
+ * @param size Memory size
+ * @return 0 OK, -1 Error
+ */
+static int flash_sim_check(uint32_t addr, size_t len, size_t size)
+{
+    if(sim_addr == NULL)
+    {
+        LOGE(tag, "Simulation is not open");
+        return -1;
+    }
+    if((size_t)addr + len > size)
+    {
+        LOGE(tag, "Address range %u + %lu is out of bounds", (unsigned int)addr, (unsigned long)len);
+        return -1;
+    }
+    return 0;
+}
+
+int flash_sim_init(const char *file)
+{
+    struct stat st;
+
+    flash_sim_close();
+    int fd = open(file, O_RDWR | O_CREAT, 0644);
+    if(fd < 0 || fstat(fd, &st) != 0)
+    {
+        LOGE(tag, "Can't open file %s. Error: %s", file, strerror(errno));
+        if(fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    int created = st.st_size != FLASH_SIM_FILE_SIZE;
+    if(created)
+    {
+        if(st.st_size != 0)
+            LOGW(tag, "File %s has %ld bytes instead of %lu, resetting it", file, (long)st.st_size, (unsigned long)FLASH_SIM_FILE_SIZE);
+        if(ftruncate(fd, 0) != 0 || ftruncate(fd, FLASH_SIM_FILE_SIZE) != 0)
+        {
+            LOGE(tag, "Can't resize file %s. Error: %s", file, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+
+    // The mapping keeps a reference to the file
+    void *addr = mmap(NULL, FLASH_SIM_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED)
+    {
+        LOGE(tag, "Can't map file %s. Error: %s", file, strerror(errno));
+        return -1;
+    }
+
+    sim_addr = (uint8_t *)addr;
+    sim_flash = sim_addr;
+    sim_fram = sim_addr + FLASH_SIM_FRAM_OFFSET;
+    sim_wear = (uint32_t *)(sim_addr + FLASH_SIM_WEAR_OFFSET);
+
+    // A new flash is erased, the FRAM and the erase counts are zeroed
+    if(created)
+        memset(sim_flash, 0xFF, FLASH_SIM_SIZE);
+
+    flash_sim_reset_stats();
+    LOGD(tag, "Opened %s (%s)", file, created ? "new" : "existing");
+    return 0;
+}
+
+int flash_sim_close(void)
+{
+    if(sim_addr == NULL)
+        return 0;
+
+    int rc = msync(sim_addr, FLASH_SIM_FILE_SIZE, MS_SYNC);
+    munmap(sim_addr, FLASH_SIM_FILE_SIZE);
+    sim_addr = NULL;
+    sim_flash = NULL;
+    sim_fram = NULL;
+    sim_wear = NULL;
+    return rc == 0 ? 0 : -1;
+}
+
+void flash_sim_get_stats(flash_sim_stats_t *stats)
+{
+    *stats = sim_stats;
+}
+
+void flash_sim_reset_stats(void)
+{
+    memset(&sim_stats, 0, sizeof(sim_stats));
+}
+
+int flash_sim_get_erases(uint32_t addr)
+{
+    if(flash_sim_check(addr, 1, FLASH_SIM_SIZE) != 0)
+        return -1;
+    return (int)sim_wear[addr/FLASH_SIM_BLOCK_SIZE];
+}
+
+int spn_fl512s_read_data(uint8_t partition, uint32_t addr, uint8_t *data, uint16_t len)
+{
+    if(partition != 0 || flash_sim_check(addr, len, FLASH_SIM_SIZE) != 0)
+        return -1;
+
+    memcpy(data, sim_flash + addr, len);
+
+    sim_stats.reads++;
+    sim_stats.bytes_read += len;
+    sim_stats.time_us += FLASH_SIM_CMD_US + (uint64_t)len*FLASH_SIM_BYTE_NS/1000;
+    return 0;
+}
+
+int spn_fl512s_write_data(uint8_t partition, uint32_t addr, uint8_t *data, uint16_t len)
+{
+    if(partition != 0 || flash_sim_check(addr, len, FLASH_SIM_SIZE) != 0)
+        return -1;
+
+    // NOR flash, programming only clears bits
+    int i, errors = 0;
+    for(i=0; i<len; i++)
+    {
+        if((sim_flash[addr+i] & data[i]) != data[i])
+            errors++;
+        sim_flash[addr+i] &= data[i];
+    }
+    if(errors)
+        LOGW(tag, "Write in address %u tried to set bits in %d bytes", (unsigned int)addr, errors);
+
+    // Each page in the range is programmed with its own command
+    uint32_t pages = len == 0 ? 0 : (addr+len-1)/FLASH_SIM_PAGE_SIZE - addr/FLASH_SIM_PAGE_SIZE + 1;
+
+    sim_stats.writes++;
+    sim_stats.bit_errors += errors;
+    sim_stats.pages += pages;
+    sim_stats.bytes_written += len;
+    sim_stats.time_us += pages*(FLASH_SIM_CMD_US + FLASH_SIM_PAGE_US) + (uint64_t)len*FLASH_SIM_BYTE_NS/1000;
+    return 0;
+}
+
+int spn_fl512s_erase_block(uint8_t partition, uint32_t addr)
+{
+    if(partition != 0 || flash_sim_check(addr, 1, FLASH_SIM_SIZE) != 0)
+        return -1;
+
+    uint32_t block = addr/FLASH_SIM_BLOCK_SIZE;
+    memset(sim_flash + block*FLASH_SIM_BLOCK_SIZE, 0xFF, FLASH_SIM_BLOCK_SIZE);
+    sim_wear[block]++;
+
+    sim_stats.erases++;
+    sim_stats.time_us += FLASH_SIM_CMD_US + FLASH_SIM_ERASE_US;
+    return 0;
+}
+
+int gs_fm33256b_fram_read(uint8_t device, uint16_t addr, void *data, size_t len)
+{
+    if(device != 0 || flash_sim_check(addr, len, FLASH_SIM_FRAM_SIZE) != 0)
+        return -1;
+
+    memcpy(data, sim_fram + addr, len);
+
+    sim_stats.fram_reads++;
+    sim_stats.time_us += FLASH_SIM_CMD_US + (uint64_t)len*FLASH_SIM_BYTE_NS/1000;
+    return 0;
+}
+
+int gs_fm33256b_fram_write(uint8_t device, uint16_t addr, const void *data, size_t len)
+{
+    if(device != 0 || flash_sim_check(addr, len, FLASH_SIM_FRAM_SIZE) != 0)
+        return -1;
+
+    memcpy(sim_fram + addr, data, len);
+
+    sim_stats.fram_writes++;
+    sim_stats.time_us += FLASH_SIM_CMD_US + (uint64_t)len*FLASH_SIM_BYTE_NS/1000;
+    return 0;
+}
@@ -21,11 +21,14 @@
 
 /**
  * Init data storage system.
- * In this case we use SQLite, so this function open a database in file
+ * In this case we use SQLite, so this function open a database in file and
+ * sets the journal and durability profile (@see SCH_STORAGE_WAL, SCH_STORAGE_SYNC)
+ * If @SCH_STORAGE_MODE is 3 no database is used, each table is stored in a
+ * memory mapped file named <file>.<table>.
  *
  * @note: non-reentrant function, use mutex to sync access
  *
- * @param file Str. File path to SQLite database
+ * @param file Str. File path to SQLite database, or prefix of the mapped files
  * @return 0 OK, -1 Error
  */
 int storage_init(const char *file);
@@ -59,6 +62,10 @@ int storage_table_flight_plan_init(int drop);
  * Create new table in the opened database (@relatesalso storage_init)
  * for a payload. If the table exists do nothing. If drop is set to
  * 1 then drop an existing table and then creates an empty one.
+ * If @SCH_STORAGE_PAYLOAD_BLOB is set, creates only one table that stores the
+ * samples of all payloads as packed structs. If @SCH_STORAGE_MODE is 3, each
+ * payload is stored in a circular log of fixed size samples that overwrites
+ * the oldest ones when full.
  *
  * @note: NOT IMPLEMENTED
  * @note: non-reentrant function, use mutex to sync access
@@ -79,9 +86,24 @@ int storage_table_payload_init(int drop);
  */
 int storage_repo_get_value_idx(int index, char *table);
 
+/**
+ * Get the first @n INT (integer) values from table, ordered by index, with
+ * only one query.
+ *
+ * @note: non-reentrant function, use mutex to sync access
+ *
+ * @param values Int *. Array of @n elements to store the values. Values not
+ * found in the table are set to -1
+ * @param n Int. Number of values to read, from index 0 to @n-1
+ * @param table Str. Table name
+ * @return 0 OK, -1 Error
+ */
+int storage_repo_get_values(int *values, int n, char *table);
+
 /**
  * Get a INT (integer) value from table by name
  *
+ * @note: not supported if @SCH_STORAGE_MODE is 3
  * @note: non-reentrant function, use mutex to sync access
  *
  * @param name Str. Value name
@@ -102,9 +124,24 @@ int storage_repo_get_value_str(char *name, char *table);
  */
 int storage_repo_set_value_idx(int index, int value, char *table);
 
+/**
+ * Set or update the value of many INT (integer) variables by index in one
+ * transaction.
+ *
+ * @note: non-reentrant function, use mutex to sync access
+ *
+ * @param index Int *. Array of @n variables indexes
+ * @param values Int *. Array of @n values to set
+ * @param n Int. Number of variables to set
+ * @param table Str. Table name
+ * @return 0 OK, -1 Error
+ */
+int storage_repo_set_values(int *index, int *values, int n, char *table);
+
 /**
  * Set or update the value of a INT (integer) variable by name.
  *
+ * @note: not supported if @SCH_STORAGE_MODE is 3
  * @note: non-reentrant function, use mutex to sync access
  *
  * @param name Str. Variable name
@@ -151,6 +188,18 @@ int storage_flight_plan_get(int timetodo, char* command, char* args, int* repeat
  */
 int storage_flight_plan_erase(int timetodo);
 
+/**
+ * Get the execution time of the entries in the flight plan table, sorted by
+ * time. Used to build the flight plan time index.
+ *
+ * @note: non-reentrant function, use mutex to sync access
+ *
+ * @param times Int *. Array to store up to @n times
+ * @param n Int. Max number of times to get
+ * @return Number of times found, -1 Error
+ */
+int storage_flight_plan_get_times(int *times, int n);
+
 /**
  * Reset the table in the opened database (@relatesalso storage_init) in the
  * form (time, command, args, repeat).
@@ -161,6 +210,26 @@ int storage_flight_plan_erase(int timetodo);
  */
 int storage_flight_plan_reset(void);
 
+/**
+ * Start a flight plan transaction. The flight plan changes until
+ * storage_flight_plan_end are committed or rolled back at once.
+ *
+ * @note: non-reentrant function, use mutex to sync access
+ *
+ * @return 0 OK, -1 Error
+ */
+int storage_flight_plan_begin(void);
+
+/**
+ * End a flight plan transaction started with storage_flight_plan_begin.
+ *
+ * @note: non-reentrant function, use mutex to sync access
+ *
+ * @param commit Int. 1 to commit the changes, 0 to roll them back
+ * @return 0 OK, -1 Error
+ */
+int storage_flight_plan_end(int commit);
+
 /**
  * Show the table in the opened database (@relatesalso storage_init) in the
  * form (time, command, args, repeat).
@@ -184,6 +253,30 @@ int storage_show_table(void);
  */
 int storage_set_payload_data(int index, void * data, int payload);
 
+/**
+ * Set @n consecutive samples of a payload, from @index to @index+n-1, in one
+ * transaction. If one sample fails none of them is stored.
+ *
+ * @note: non-reentrant function, use mutex to sync access
+ *
+ * @param index Int. Index of the first sample
+ * @param data Pointer to an array of @n payload structs
+ * @param n Int. Number of samples
+ * @param payload Int. payload to store
+ * @return 0 OK, -1 Error
+ */
+int storage_set_payload_data_n(int index, void* data, int n, int payload);
+
+/**
+ * Write the buffered payload samples to the storage. This driver writes the
+ * samples when they are set, so there is nothing to do.
+ *
+ * @note: non-reentrant function, use mutex to sync access
+ *
+ * @return 0 OK, -1 Error
+ */
+int storage_flush_payload_data(void);
+
 /**
  * Get a value for specific payload with index value
  * in database
@@ -198,7 +291,21 @@ int storage_set_payload_data(int index, void * data, int payload);
 int storage_get_payload_data(int index, void* data, int payload);
 
 /**
- * Close the opened database
+ * Get @n consecutive samples of a payload, from @index to @index+n-1, with
+ * only one query. Samples not found are set to zero.
+ *
+ * @note: non-reentrant function, use mutex to sync access
+ *
+ * @param index Int. Index of the first sample
+ * @param data Pointer to an array of @n payload structs
+ * @param n Int. Number of samples
+ * @param payload Int. payload to get value
+ * @return 0 OK, -1 Error
+ */
+int storage_get_payload_data_n(int index, void* data, int n, int payload);
+
+/**
+ * Close the opened database, finalizing the cached prepared statements
  *
  * @note: non-reentrant function, use mutex to sync access
  *
@@ -0,0 +1,148 @@
+/**
+ * @file flash_sim.h
+ * @date 2019
+ * @copyright GNU GPL v3
+ *
+ * Simulation of the Nanomind A3200 storage chips in Linux, to run the
+ * nanomind storage driver (src/drivers/nanomind/data_storage.c) in a Linux
+ * target. Implements the functions of the S25FL512S NOR flash and the
+ * FM33256B FRAM drivers used by data_storage.c.
+ *
+ * The memories are stored in a memory mapped file. The flash keeps the NOR
+ * semantics: a write can only clear bits and only the erase of a whole block
+ * sets them back to 1. Each operation adds its modeled latency to the
+ * simulation statistics and the erase count of each block is kept in the
+ * file, so the flash wear is tracked across executions.
+ *
+ * Build with -DSCH_FLASH_SIM and the nanomind include directory before the
+ * Linux one to use the nanomind storage driver with this simulation.
+ */
+
+#ifndef _FLASH_SIM_H
+#define _FLASH_SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "utils.h"
+
+#define FLASH_SIM_SIZE          (64*1024*1024)  ///< Flash size in bytes (S25FL512S)
+#define FLASH_SIM_BLOCK_SIZE    (256*1024)      ///< Flash erase block size in bytes
+#define FLASH_SIM_PAGE_SIZE     (512)           ///< Flash program page size in bytes
+#define FLASH_SIM_BLOCKS        (FLASH_SIM_SIZE/FLASH_SIM_BLOCK_SIZE)  ///< Number of flash blocks
+#define FLASH_SIM_FRAM_SIZE     (32*1024)       ///< FRAM size in bytes (FM33256B)
+
+#define FLASH_SIM_CMD_US        (20)            ///< Latency of one SPI transaction [us]
+#define FLASH_SIM_BYTE_NS       (160)           ///< Latency to transfer one byte, 50 MHz SPI [ns]
+#define FLASH_SIM_PAGE_US       (340)           ///< Latency to program one flash page [us]
+#define FLASH_SIM_ERASE_US      (520000)        ///< Latency to erase one flash block [us]
+
+/**
+ * Simulation statistics, since the simulation was opened or the
+ * statistics were reset
+ */
+typedef struct flash_sim_stats {
+    uint32_t reads;             ///< Flash read operations
+    uint32_t writes;            ///< Flash write operations
+    uint32_t pages;             ///< Flash pages programmed by the writes
+    uint32_t erases;            ///< Flash block erases
+    uint32_t bit_errors;        ///< Written bytes that tried to set bits from 0 to 1
+    uint32_t fram_reads;        ///< FRAM read operations
+    uint32_t fram_writes;       ///< FRAM write operations
+    uint64_t bytes_read;        ///< Bytes read from the flash
+    uint64_t bytes_written;     ///< Bytes written to the flash
+    uint64_t time_us;           ///< Modeled time spent in all operations [us]
+} flash_sim_stats_t;
+
+/**
+ * Open the simulated memories stored in @file. If the file does not exist
+ * it is created with the flash erased and the FRAM cleared.
+ *
+ * @param file Str. Path to the file with the simulated memories
+ * @return 0 OK, -1 Error
+ */
+int flash_sim_init(const char *file);
+
+/**
+ * Sync and close the simulated memories
+ *
+ * @return 0 OK, -1 Error
+ */
+int flash_sim_close(void);
+
+/**
+ * Get the simulation statistics
+ *
+ * @param stats Pointer to the struct to fill
+ */
+void flash_sim_get_stats(flash_sim_stats_t *stats);
+
+/**
+ * Reset the simulation statistics. The block erase counts are not reset.
+ */
+void flash_sim_reset_stats(void);
+
+/**
+ * Get the number of times the flash block containing @addr was erased since
+ * the file was created
+ *
+ * @param addr Flash address
+ * @return Erase count, or -1 if the address is out of bounds
+ */
+int flash_sim_get_erases(uint32_t addr);
+
+/**
+ * Simulation of the S25FL512S driver read. Read @len bytes from @addr.
+ *
+ * @param partition Flash partition, only 0 is simulated
+ * @param addr Flash address
+ * @param data Buffer to store the data
+ * @param len Bytes to read
+ * @return 0 OK, -1 Error
+ */
+int spn_fl512s_read_data(uint8_t partition, uint32_t addr, uint8_t *data, uint16_t len);
+
+/**
+ * Simulation of the S25FL512S driver write. Program @len bytes in @addr, the
+ * bits set to 1 in @data keep their current value.
+ *
+ * @param partition Flash partition, only 0 is simulated
+ * @param addr Flash address
+ * @param data Data to write
+ * @param len Bytes to write
+ * @return 0 OK, -1 Error
+ */
+int spn_fl512s_write_data(uint8_t partition, uint32_t addr, uint8_t *data, uint16_t len);
+
+/**
+ * Simulation of the S25FL512S driver block erase. Set all the bytes of the
+ * block containing @addr to 0xFF.
+ *
+ * @param partition Flash partition, only 0 is simulated
+ * @param addr Flash address in the block to erase
+ * @return 0 OK, -1 Error
+ */
+int spn_fl512s_erase_block(uint8_t partition, uint32_t addr);
+
+/**
+ * Simulation of the FM33256B driver FRAM read
+ *
+ * @param device FRAM device, only 0 is simulated
+ * @param addr FRAM address
+ * @param data Buffer to store the data
+ * @param len Bytes to read
+ * @return 0 OK, -1 Error
+ */
+int gs_fm33256b_fram_read(uint8_t device, uint16_t addr, void *data, size_t len);
+
+/**
+ * Simulation of the FM33256B driver FRAM write
+ *
+ * @param device FRAM device, only 0 is simulated
+ * @param addr FRAM address
+ * @param data Data to write
+ * @param len Bytes to write
+ * @return 0 OK, -1 Error
+ */
+int gs_fm33256b_fram_write(uint8_t device, uint16_t addr, const void *data, size_t len);
+
+#endif //_FLASH_SIM_H
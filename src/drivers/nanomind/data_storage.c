@@ -3,7 +3,10 @@
 //
 
 #include "data_storage.h"
+#include <inttypes.h>
+#ifndef SCH_FLASH_SIM
 #include "suchai-drivers-obc/lib/libthirdparty/include/gs/thirdparty/fram/fm33256b.h"
+#endif
 
 static const char *tag = "data_storage";
 
@@ -19,7 +22,118 @@ typedef struct {
     uint32_t exec, peri, name_len, args_len;
 } numbers_container_t;
 
-static int max_command_size = (SCH_CMD_MAX_STR_NAME+SCH_CMD_MAX_STR_PARAMS)*sizeof(char)+sizeof(uint32_t)+sizeof(numbers_container_t);
+/*
+ * Flight plan log. The flight plan is stored as an append-only log of records
+ * in one of two flash sections, so setting or deleting a command is one flash
+ * write. Deleted commands are marked with tombstone records. A RAM index with
+ * the time and address of the live records is rebuilt at boot by replaying
+ * the log, so commands are found without reading the flash.
+ *
+ * When the active section is full, the live records are compacted into the
+ * other section, that becomes the active one. This is the only time a
+ * section is erased. Each section starts with a header, written after the
+ * compaction is complete, the valid header with the greatest sequence number
+ * marks the active section.
+ *
+ * Records have a fixed header and a variable length body, aligned to 4 bytes:
+ *  - FP_LOG_SET: header, numbers_container_t, name(name_len) args(args_len)
+ *  - FP_LOG_DEL: header
+ *  - FP_LOG_BEGIN, FP_LOG_COMMIT, FP_LOG_ABORT: header
+ *
+ * The records between FP_LOG_BEGIN and FP_LOG_COMMIT are a transaction
+ * (see storage_flight_plan_begin). They are replayed only if the commit
+ * record was written, so a reset in the middle of a transaction leaves the
+ * flight plan as it was before it started.
+ */
+#define FP_LOG_SECTIONS (2)             ///< Flash sections used by the flight plan log
+#define FP_LOG_MAGIC (0x46504C47)       ///< Flight plan log section magic number
+#define FP_LOG_SET (0x5345)             ///< Record of a command set
+#define FP_LOG_DEL (0x4445)             ///< Tombstone record of a deleted command
+#define FP_LOG_BEGIN (0x4247)           ///< Start of a transaction
+#define FP_LOG_COMMIT (0x434D)          ///< End of a transaction, its records are applied
+#define FP_LOG_ABORT (0x4142)           ///< End of a transaction, its records are discarded
+#define FP_LOG_FREE (0xFFFF)            ///< Erased flash, end of the log
+
+/**
+ * Flight plan log section header
+ */
+typedef struct fp_log_section {
+    uint32_t magic;             ///< FP_LOG_MAGIC
+    uint32_t seq;               ///< Section sequence number, incremented on each compaction
+} fp_log_section_t;
+
+/**
+ * Flight plan log record header
+ */
+typedef struct fp_log_record {
+    uint32_t timetodo;          ///< Execution time of the command
+    uint16_t type;              ///< FP_LOG_SET, FP_LOG_DEL or FP_LOG_FREE
+    uint16_t len;               ///< Record length in bytes, including the header
+} fp_log_record_t;
+
+/** Max. length of a record, aligned to 4 bytes */
+#define FP_LOG_MAX_RECORD ((sizeof(fp_log_record_t)+sizeof(numbers_container_t)+SCH_CMD_MAX_STR_NAME+SCH_CMD_MAX_STR_PARAMS+3) & ~3)
+
+/**
+ * Flight plan log index entry
+ */
+typedef struct fp_log_index {
+    uint32_t timetodo;          ///< Execution time of the command
+    uint32_t add;               ///< Address of the record in flash
+    uint16_t len;               ///< Record length in bytes
+} fp_log_index_t;
+
+static int fp_log_active = 0;           ///< Active section
+static uint32_t fp_log_seq = 0;         ///< Sequence number of the active section
+static uint32_t fp_log_head = 0;        ///< Offset of the next record in the active section
+static fp_log_index_t fp_log_index[SCH_FP_MAX_ENTRIES];  ///< Live records
+static int fp_log_n = 0;                ///< Number of live records
+static int fp_log_txn = 0;              ///< 1 if a transaction is open
+static fp_log_index_t fp_log_txn_index[SCH_FP_MAX_ENTRIES];  ///< Live records before the transaction
+static int fp_log_txn_n = 0;            ///< Number of live records before the transaction
+
+static int flight_plan_load(void);
+
+/*
+ * Payload logs. The sections of each payload are used as a circular log, the
+ * sample with index i is stored in the section (i/samples per section) modulo
+ * SCH_SECTIONS_PER_PAYLOAD. A section is erased when the write head enters
+ * it, and only if its samples were acknowledged (sys_ack), so sampling
+ * continues after the sections fill and erases are spread evenly across the
+ * sections. Each section starts with a header with the index of its first
+ * sample and its erase counter.
+ */
+#define PAYLOAD_LOG_MAGIC (0x504C4F47)  ///< Payload section magic number
+
+/**
+ * Payload section header
+ */
+typedef struct payload_section {
+    uint32_t magic;             ///< PAYLOAD_LOG_MAGIC, other value if the section was not used
+    uint32_t first;             ///< Index of the first sample stored in the section
+    uint32_t erases;            ///< Number of times the section was erased
+} payload_section_t;
+
+static payload_section_t payload_sections[SCH_SECTIONS_PER_PAYLOAD*last_sensor];  ///< Payload sections headers
+
+/*
+ * Payload write buffers. Samples added one by one are combined in a RAM
+ * buffer per payload and programmed in one write when the buffer reaches the
+ * end of a flash page, when the next sample is not contiguous, when the
+ * oldest sample waited SCH_STORAGE_CACHE_PERIOD seconds, or when
+ * storage_flush_payload_data is called. Reads check the buffer, so buffered
+ * samples are always found.
+ */
+typedef struct payload_buffer {
+    int index;                  ///< Index of the first buffered sample
+    int n;                      ///< Number of buffered samples
+    uint32_t add;               ///< Flash address of the first buffered sample
+    time_t since;               ///< Time when the first sample was buffered
+    uint8_t data[SCH_FLASH_PAGE_SIZE];  ///< Buffered samples
+} payload_buffer_t;
+
+static payload_buffer_t payload_buffers[last_sensor];  ///< Payload write buffers
+static int payload_buffer_flush(int payload);
 
 int storage_init(const char *file)
 {
@@ -48,10 +162,16 @@ int storage_init(const char *file)
 //    if (error)
 //        return -1;
 
+#ifdef SCH_FLASH_SIM
+    /* Linux simulation of the FRAM and FLASH NOR, stored in @file */
+    if(flash_sim_init(file) != 0)
+        return -1;
+#endif
+
     /* Init storage addresses */
     int payload_tables_amount = SCH_SECTIONS_PER_PAYLOAD*last_sensor;
     storage_addresses_payloads = malloc(payload_tables_amount*sizeof(uint32_t));
-    int sections_for_fp = (SCH_FP_MAX_ENTRIES*max_command_size)/SCH_SIZE_PER_SECTION + 1;
+    int sections_for_fp = FP_LOG_SECTIONS;
     storage_addresses_flight_plan = malloc(sections_for_fp*sizeof(uint32_t));
 
     for (int i = 0; i < payload_tables_amount; i++)
@@ -69,10 +189,11 @@ int storage_table_repo_init(char* table, int drop)
 
 int storage_table_flight_plan_init(int drop)
 {
-    int rc = 0;
+    // Loads the flight plan log index
+    int rc = flight_plan_load();
 
-    // If set to drop the memory, it erases the flight plan sections
-    if (drop == 1)
+    // If set to drop the memory, it starts an empty flight plan log
+    if (rc == 0 && drop == 1)
         rc = storage_flight_plan_reset();
 
     return rc;
@@ -91,6 +212,14 @@ int storage_repo_get_value_idx(int index, char *table)
     return (int)(data.data32);
 }
 
+int storage_repo_get_values(int *values, int n, char *table)
+{
+    // Values are consecutive uint32_t, read all of them at once
+    uint16_t len = (uint16_t)(n*sizeof(uint32_t));
+    gs_fm33256b_fram_read(0, 0, (uint8_t *)values, len);
+    return 0;
+}
+
 int storage_repo_get_value_str(char *name, char *table)
 {
     return 0;
@@ -110,44 +239,30 @@ int storage_repo_set_value_idx(int index, int value, char *table)
     return 0;
 }
 
+int storage_repo_set_values(int *index, int *values, int n, char *table)
+{
+    int i;
+    for(i=0; i<n; i++)
+        storage_repo_set_value_idx(index[i], values[i], table);
+    return 0;
+}
+
 int storage_repo_set_value_str(char *name, int value, char *table)
 {
     return 0;
 }
 
 /**
- * Function for finding the storage index of a command based on it's timetodo field.
- *
- * IMPORTANT: Flight plan entries are saved as consecutive binary values using the following scheme:
- * timetodo(uint32_t) executions(uint32_t) periodical(uint32_t) name_length(uint32_t) args_length(uint32_t) name(char*SCH_CMD_MAX_STR_NAME) args(char*SCH_CMD_MAX_STR_PARAMS)
- *
- * The total size of each command is then stored in 'max_command_size'.
+ * Find the live record of a command in the flight plan log index
  *
  * @param timetodo Execution time of the command to find
- * @return The command's index, -1 if not found or error
+ * @return Position of the command in fp_log_index, -1 if not found
  */
 static int flight_plan_find_index(int timetodo)
 {
-    // Calculates information on how the flight plan is stored
-    int commands_per_section = SCH_SIZE_PER_SECTION/max_command_size;
-
-    int entries = dat_get_system_var(dat_fpl_queue);
-
-    // For every index
-    for (int i = 0; i < entries; i++)
+    for (int i = 0; i < fp_log_n; i++)
     {
-        // Translates the index into an address in memory
-        int section_index = i/commands_per_section;
-        int index_in_section = i%commands_per_section;
-
-        uint32_t add = storage_addresses_flight_plan[section_index] + index_in_section*max_command_size;
-
-        // Reads the entry's timetodo
-        uint32_t found_time;
-        spn_fl512s_read_data(0, add, (uint8_t*)&found_time, sizeof(uint32_t));
-
-        // If found, returns
-        if (found_time == (uint32_t)timetodo)
+        if (fp_log_index[i].timetodo == (uint32_t)timetodo)
             return i;
     }
 
@@ -156,151 +271,396 @@ static int flight_plan_find_index(int timetodo)
 }
 
 /**
- * Function for deleting a flight plan entry on a given index.
+ * Remove a command from the flight plan log index
  *
- * @param index Storage index of the entry
- * @return 0 if OK, -1 if Error
+ * @param index Position of the command in fp_log_index
  */
-static int flight_plan_erase_index(int index)
+static void flight_plan_index_remove(int index)
 {
-    int entries = dat_get_system_var(dat_fpl_queue);
+    fp_log_index[index] = fp_log_index[--fp_log_n];
+    dat_set_system_var(dat_fpl_queue, fp_log_n);
+}
 
-    if (index < 0 || index >= entries)
+/**
+ * Check that the strings of a command record fit in the record and in the
+ * command buffers, before copying them
+ *
+ * @param container Numbers of the record
+ * @param len Length of the record, with its header
+ * @return 0 if OK, -1 if the record is invalid
+ */
+static int flight_plan_check_record(numbers_container_t *container, uint32_t len)
+{
+    uint32_t fixed = sizeof(fp_log_record_t) + sizeof(numbers_container_t);
+    if (len < fixed || container->name_len >= SCH_CMD_MAX_STR_NAME || container->args_len >= SCH_CMD_MAX_STR_PARAMS ||
+        fixed + container->name_len + container->args_len > len)
     {
-        LOGW(tag, "Failed attempt at erasing flight plan entry index %d, out of bounds", index);
+        LOGE(tag, "Invalid flight plan record (%u bytes, name %u, args %u)", (unsigned int)len,
+             (unsigned int)container->name_len, (unsigned int)container->args_len);
         return -1;
     }
+    return 0;
+}
 
-    // Generates a buffer for the flight plan entries
-    uint8_t section_data[entries*max_command_size];
+/**
+ * Copy a record of the active section to the compacted section
+ *
+ * @param entry Record to copy
+ * @param base Address of the compacted section
+ * @param head Offset of the next record in the compacted section, updated
+ * @return Address of the copy, 0 if Error
+ */
+static uint32_t flight_plan_copy_record(fp_log_index_t *entry, uint32_t base, uint32_t *head)
+{
+    uint32_t record[FP_LOG_MAX_RECORD/sizeof(uint32_t)];
+    spn_fl512s_read_data(0, entry->add, (uint8_t *)record, entry->len);
 
-    // Calculates memory address of the section
-    int commands_per_section = SCH_SIZE_PER_SECTION/max_command_size;
-    int section_index = index/commands_per_section;
-    int index_in_section = index%commands_per_section;
+    uint32_t add = base + *head;
+    if (spn_fl512s_write_data(0, add, (uint8_t *)record, entry->len) != 0)
+    {
+        LOGE(tag, "Failed attempt at writing data in storage address %u", (unsigned int)add);
+        return 0;
+    }
+    *head += entry->len;
+    return add;
+}
 
-    uint32_t add = storage_addresses_flight_plan[section_index];
+/**
+ * Write a header only record (tombstone or transaction mark) in the compacted
+ * section
+ *
+ * @param timetodo Execution time of the command, 0 for transaction marks
+ * @param type Record type
+ * @param base Address of the compacted section
+ * @param head Offset of the next record in the compacted section, updated
+ * @return 0 if OK, -1 if Error
+ */
+static int flight_plan_copy_mark(uint32_t timetodo, uint16_t type, uint32_t base, uint32_t *head)
+{
+    fp_log_record_t mark = {timetodo, type, sizeof(fp_log_record_t)};
+    uint32_t add = base + *head;
+    if (spn_fl512s_write_data(0, add, (uint8_t *)&mark, sizeof(mark)) != 0)
+    {
+        LOGE(tag, "Failed attempt at writing data in storage address %u", (unsigned int)add);
+        return -1;
+    }
+    *head += sizeof(mark);
+    return 0;
+}
 
-    // Reads the whole section
-    spn_fl512s_read_data(0, add, (uint8_t*)section_data, (uint16_t)entries*max_command_size);
+/**
+ * Start a new, empty, flight plan log in the inactive section. Used to
+ * compact the log, and to create it. If a transaction is open, the records
+ * before the transaction are copied first, followed by a FP_LOG_BEGIN record
+ * and the changes of the transaction, so it can still be discarded.
+ *
+ * @param copy 1 to copy the live records to the new section, 0 to drop them
+ * @return 0 if OK, -1 if Error
+ */
+static int flight_plan_compact(int copy)
+{
+    int next = (fp_log_active + 1) % FP_LOG_SECTIONS;
+    uint32_t base = storage_addresses_flight_plan[next];
+    int n = copy ? fp_log_n : 0;
 
-    // Deletes the section
-    LOGI(tag, "Deleting section in address %u", (unsigned int)add);
-    int rc = spn_fl512s_erase_block(0, add);
+    LOGI(tag, "Compacting flight plan log in address %u (%d commands)", (unsigned int)base, n);
+    int rc = spn_fl512s_erase_block(0, base);
     if (rc != 0)
     {
-        LOGE(tag, "Failed attempt at deleting data in storage address %u", (unsigned int)add);
+        LOGE(tag, "Failed attempt at deleting data in storage address %u", (unsigned int)base);
         return -1;
     }
 
-    // Counts the amount of entries written
-    int written_entries = 0;
+    // New addresses, applied once the new section is complete
+    uint32_t add[SCH_FP_MAX_ENTRIES] = {0};
+    uint32_t txn_add[SCH_FP_MAX_ENTRIES];
+    uint32_t head = sizeof(fp_log_section_t);
 
-    // Rewrites all commands, except the one that was going to be erased and any that were 'null'
-    for (int i = 0; i < entries; i++)
+    // Records before the transaction, shared with the live ones if unchanged
+    for (int i = 0; fp_log_txn && i < fp_log_txn_n; i++)
     {
-        int buffer_index = i*max_command_size;
-        int timetodo = *((int*)&(section_data[buffer_index]));
-
-        // If the address had a command, and it wasn't the one to erase
-        if (i != index_in_section && timetodo != 0)
+        txn_add[i] = flight_plan_copy_record(&fp_log_txn_index[i], base, &head);
+        if (txn_add[i] == 0)
+            return -1;
+        for (int j = 0; j < n; j++)
         {
-            // Writes
-            rc = spn_fl512s_write_data(0, add, &(section_data[buffer_index]), max_command_size);
-
-            if (rc != 0)
-            {
-                LOGE(tag, "Failed attempt at writing data in storage address %u", (unsigned int)add);
-                dat_set_system_var(dat_fpl_queue, written_entries);
-                return -1;
-            }
-
-            // Moves to the next address
-            add += max_command_size;
-            written_entries++;
+            if (fp_log_index[j].add == fp_log_txn_index[i].add)
+                add[j] = txn_add[i];
         }
     }
+    if (fp_log_txn && flight_plan_copy_mark(0, FP_LOG_BEGIN, base, &head) != 0)
+        return -1;
+
+    // Copies the live records after the header
+    for (int i = 0; i < n; i++)
+    {
+        if (add[i] == 0 && (add[i] = flight_plan_copy_record(&fp_log_index[i], base, &head)) == 0)
+            return -1;
+    }
 
-    // Sets the amount of entries written
-    dat_set_system_var(dat_fpl_queue, written_entries);
+    // Commands deleted in the transaction
+    for (int i = 0; fp_log_txn && i < fp_log_txn_n; i++)
+    {
+        int found = 0;
+        for (int j = 0; j < n && !found; j++)
+            found = fp_log_index[j].timetodo == fp_log_txn_index[i].timetodo;
+        if (!found && flight_plan_copy_mark(fp_log_txn_index[i].timetodo, FP_LOG_DEL, base, &head) != 0)
+            return -1;
+    }
 
+    // The header makes the new section the active one
+    fp_log_section_t section = {FP_LOG_MAGIC, fp_log_seq + 1};
+    rc = spn_fl512s_write_data(0, base, (uint8_t *)&section, sizeof(section));
+    if (rc != 0)
+    {
+        LOGE(tag, "Failed attempt at writing data in storage address %u", (unsigned int)base);
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++)
+        fp_log_index[i].add = add[i];
+    for (int i = 0; fp_log_txn && i < fp_log_txn_n; i++)
+        fp_log_txn_index[i].add = txn_add[i];
+
+    fp_log_active = next;
+    fp_log_seq = section.seq;
+    fp_log_head = head;
+    fp_log_n = n;
+    dat_set_system_var(dat_fpl_queue, fp_log_n);
     return 0;
 }
 
-int storage_flight_plan_set(int timetodo, char* command, char* args, int executions, int periodical)
+/**
+ * Append a record to the flight plan log, compacting the log if the active
+ * section is full
+ *
+ * @param header Record, starting with its header
+ * @return Address of the record, 0 if Error
+ */
+static uint32_t flight_plan_append(fp_log_record_t *header)
 {
-    // Finds an index with an empty entry
-    int entries = dat_get_system_var(dat_fpl_queue);
-    int index = entries;
-
-    if (index >= SCH_FP_MAX_ENTRIES)
+    if (fp_log_head + header->len > SCH_SIZE_PER_SECTION)
     {
-        LOGE(tag, "Flight plan storage no longer has space for another command");
-        return -1;
+        if (flight_plan_compact(1) != 0 || fp_log_head + header->len > SCH_SIZE_PER_SECTION)
+            return 0;
     }
 
-    // Calculates memory address
-    int commands_per_section = SCH_SIZE_PER_SECTION/max_command_size;
-    int section_index = index/commands_per_section;
-    int index_in_section = index%commands_per_section;
+    uint32_t add = storage_addresses_flight_plan[fp_log_active] + fp_log_head;
+    int rc = spn_fl512s_write_data(0, add, (uint8_t *)header, header->len);
+    if (rc != 0)
+    {
+        LOGE(tag, "Failed attempt at writing data in storage address %u", (unsigned int)add);
+        return 0;
+    }
 
-    uint32_t add = storage_addresses_flight_plan[section_index] + index_in_section*max_command_size;
+    fp_log_head += header->len;
+    return add;
+}
 
-    // Casts timetodo
-    uint32_t found_time = (uint32_t)timetodo;
+/**
+ * Append a tombstone record for a command and remove it from the index
+ *
+ * @param index Position of the command in fp_log_index
+ * @return 0 if OK, -1 if Error
+ */
+static int flight_plan_erase_index(int index)
+{
+    if (index < 0 || index >= fp_log_n)
+    {
+        LOGW(tag, "Failed attempt at erasing flight plan entry index %d, out of bounds", index);
+        return -1;
+    }
 
-    // Writes the timetodo value
-    int rc;
-    rc = spn_fl512s_write_data(0, add, (uint8_t*)&found_time, sizeof(uint32_t));
+    fp_log_record_t tombstone;
+    tombstone.timetodo = fp_log_index[index].timetodo;
+    tombstone.type = FP_LOG_DEL;
+    tombstone.len = sizeof(fp_log_record_t);
 
-    if (rc != 0)
+    // The command is not copied if the append compacts the log
+    fp_log_index_t entry = fp_log_index[index];
+    flight_plan_index_remove(index);
+    if (flight_plan_append(&tombstone) == 0)
     {
-        LOGE(tag, "Failed attempt at writing data in storage address %u", (unsigned int)add);
+        fp_log_index[fp_log_n++] = entry;
+        dat_set_system_var(dat_fpl_queue, fp_log_n);
         return -1;
     }
 
-    add += sizeof(uint32_t);
+    return 0;
+}
 
-    // Container for writing all other numeric values in one go
-    numbers_container_t numbers_container;
+/**
+ * Open a transaction, keeping the live records to undo it
+ */
+static void flight_plan_txn_start(void)
+{
+    memcpy(fp_log_txn_index, fp_log_index, sizeof(fp_log_index));
+    fp_log_txn_n = fp_log_n;
+    fp_log_txn = 1;
+}
+
+/**
+ * Close the open transaction, if any, restoring the live records from before
+ * it started
+ */
+static void flight_plan_txn_undo(void)
+{
+    if (!fp_log_txn)
+        return;
+    memcpy(fp_log_index, fp_log_txn_index, sizeof(fp_log_index));
+    fp_log_n = fp_log_txn_n;
+    fp_log_txn = 0;
+    dat_set_system_var(dat_fpl_queue, fp_log_n);
+}
 
-    numbers_container.exec = executions;
-    numbers_container.peri = periodical;
-    numbers_container.name_len = strlen(command);
-    numbers_container.args_len = strlen(args);
+/**
+ * Rebuild the flight plan log index replaying the records of the active
+ * section. If there is no valid section a new log is created.
+ *
+ * @return 0 if OK, -1 if Error
+ */
+static int flight_plan_load(void)
+{
+    // The valid section with the greatest sequence number is the active one
+    int active = -1;
+    fp_log_seq = 0;
+    for (int i = 0; i < FP_LOG_SECTIONS; i++)
+    {
+        fp_log_section_t section;
+        spn_fl512s_read_data(0, storage_addresses_flight_plan[i], (uint8_t *)&section, sizeof(section));
+        if (section.magic == FP_LOG_MAGIC && (active < 0 || section.seq > fp_log_seq))
+        {
+            active = i;
+            fp_log_seq = section.seq;
+        }
+    }
 
-    // Writes said values
-    rc = spn_fl512s_write_data(0, add, (uint8_t*)&numbers_container, sizeof(numbers_container_t));
+    fp_log_n = 0;
+    fp_log_txn = 0;
+    if (active < 0)
+    {
+        LOGI(tag, "Creating flight plan log");
+        fp_log_active = FP_LOG_SECTIONS - 1;
+        return flight_plan_compact(0);
+    }
 
-    if (rc != 0)
+    fp_log_active = active;
+    uint32_t base = storage_addresses_flight_plan[active];
+    fp_log_head = sizeof(fp_log_section_t);
+    while (fp_log_head + sizeof(fp_log_record_t) <= SCH_SIZE_PER_SECTION)
     {
-        LOGE(tag, "Failed attempt at writing data in storage address %u", (unsigned int)add);
-        return -1;
+        fp_log_record_t header;
+        spn_fl512s_read_data(0, base + fp_log_head, (uint8_t *)&header, sizeof(header));
+        if (header.type == FP_LOG_FREE)
+            break;
+
+        if ((header.type != FP_LOG_SET && header.type != FP_LOG_DEL && header.type != FP_LOG_BEGIN &&
+             header.type != FP_LOG_COMMIT && header.type != FP_LOG_ABORT) || header.len < sizeof(header) ||
+            (header.type == FP_LOG_SET && header.len < sizeof(header) + sizeof(numbers_container_t)) ||
+            header.len > FP_LOG_MAX_RECORD || fp_log_head + header.len > SCH_SIZE_PER_SECTION)
+        {
+            // Torn record, the next append compacts the log without it
+            LOGW(tag, "Invalid flight plan record in address %u", (unsigned int)(base + fp_log_head));
+            fp_log_head = SCH_SIZE_PER_SECTION;
+            break;
+        }
+
+        // Transaction marks, the records of a transaction are undone without its commit
+        if (header.type == FP_LOG_BEGIN || header.type == FP_LOG_ABORT)
+            flight_plan_txn_undo();
+        if (header.type == FP_LOG_BEGIN)
+            flight_plan_txn_start();
+        if (header.type == FP_LOG_COMMIT)
+            fp_log_txn = 0;
+        if (header.type == FP_LOG_BEGIN || header.type == FP_LOG_COMMIT || header.type == FP_LOG_ABORT)
+        {
+            fp_log_head += header.len;
+            continue;
+        }
+
+        int index = flight_plan_find_index((int)header.timetodo);
+        if (index >= 0)
+            fp_log_index[index] = fp_log_index[--fp_log_n];
+        if (header.type == FP_LOG_SET && fp_log_n < SCH_FP_MAX_ENTRIES)
+        {
+            fp_log_index_t entry = {header.timetodo, base + fp_log_head, header.len};
+            fp_log_index[fp_log_n++] = entry;
+        }
+
+        fp_log_head += header.len;
     }
 
-    add += sizeof(numbers_container_t);
+    // Close a transaction without commit, so the next records are not part of it
+    if (fp_log_txn)
+    {
+        LOGW(tag, "Flight plan transaction not committed, discarding its changes");
+        flight_plan_txn_undo();
+        fp_log_record_t abort = {0, FP_LOG_ABORT, sizeof(fp_log_record_t)};
+        if (flight_plan_append(&abort) == 0)
+            return -1;
+    }
 
-    // Writes the command's name
-    rc = spn_fl512s_write_data(0, add, (uint8_t*)command, sizeof(char)*numbers_container.name_len);
+    dat_set_system_var(dat_fpl_queue, fp_log_n);
+    LOGD(tag, "Flight plan log section %d, %d commands, %u bytes used", active, fp_log_n, (unsigned int)fp_log_head);
+    return 0;
+}
 
-    if (rc != 0)
+int storage_flight_plan_set(int timetodo, char* command, char* args, int executions, int periodical)
+{
+    // Strings must fit with their null terminator when read back (see
+    // flight_plan_check_record)
+    size_t name_len = strnlen(command, SCH_CMD_MAX_STR_NAME);
+    size_t args_len = strnlen(args, SCH_CMD_MAX_STR_PARAMS);
+    if (name_len >= SCH_CMD_MAX_STR_NAME || args_len >= SCH_CMD_MAX_STR_PARAMS)
     {
-        LOGE(tag, "Failed attempt at writing data in storage address %u", (unsigned int)add);
+        LOGE(tag, "Flight plan command too long (%d, %d)", (int)name_len, (int)args_len);
         return -1;
     }
 
-    add += sizeof(char)*SCH_CMD_MAX_STR_NAME;
-
-    // Writes the command's arguments
-    rc = spn_fl512s_write_data(0, add, (uint8_t*)args, sizeof(char)*numbers_container.args_len);
+    // A command with the same time is replaced
+    int index = flight_plan_find_index(timetodo);
 
-    if (rc != 0)
+    if (index < 0 && fp_log_n >= SCH_FP_MAX_ENTRIES)
     {
-        LOGE(tag, "Failed attempt at writing data in storage address %u", (unsigned int)add);
+        LOGE(tag, "Flight plan storage no longer has space for another command");
         return -1;
     }
 
-    dat_set_system_var(dat_fpl_queue, entries+1);
+    // Builds the record
+    uint32_t record[FP_LOG_MAX_RECORD/sizeof(uint32_t)];
+    fp_log_record_t *header = (fp_log_record_t *)record;
+    numbers_container_t *numbers_container = (numbers_container_t *)(header + 1);
+    char *str = (char *)(numbers_container + 1);
+
+    numbers_container->exec = executions;
+    numbers_container->peri = periodical;
+    numbers_container->name_len = name_len;
+    numbers_container->args_len = args_len;
+
+    memcpy(str, command, numbers_container->name_len);
+    memcpy(str + numbers_container->name_len, args, numbers_container->args_len);
+    int len = sizeof(fp_log_record_t) + sizeof(numbers_container_t) + numbers_container->name_len + numbers_container->args_len;
+
+    header->timetodo = (uint32_t)timetodo;
+    header->type = FP_LOG_SET;
+    header->len = (uint16_t)((len + 3) & ~3);
+    memset((uint8_t *)record + len, 0xFF, header->len - len);
+
+    // Writes the record
+    uint32_t add = flight_plan_append(header);
+    if (add == 0)
+        return -1;
+
+    if (index >= 0)
+    {
+        // The compaction may have moved the entries
+        index = flight_plan_find_index(timetodo);
+        if (index >= 0)
+            flight_plan_index_remove(index);
+    }
+    fp_log_index_t entry = {header->timetodo, add, header->len};
+    fp_log_index[fp_log_n++] = entry;
+    dat_set_system_var(dat_fpl_queue, fp_log_n);
 
     return 0;
 }
@@ -313,36 +673,29 @@ int storage_flight_plan_get(int timetodo, char* command, char* args, int* execut
     if (index < 0)
         return -1;
 
-    // Calculates memory address
-    int commands_per_section = SCH_SIZE_PER_SECTION/max_command_size;
-    int section_index = index/commands_per_section;
-    int index_in_section = index%commands_per_section;
-
-    uint32_t add = storage_addresses_flight_plan[section_index] + index_in_section*max_command_size + sizeof(uint32_t);
-
-    // Container for reading all the numeric values in one go
-    numbers_container_t numbers_container;
-
-    // Finds the numeric values
-    spn_fl512s_read_data(0, add, (uint8_t*)&numbers_container, sizeof(numbers_container_t));
-
-    add += sizeof(numbers_container_t);
+    // Reads the record
+    uint32_t record[FP_LOG_MAX_RECORD/sizeof(uint32_t)];
+    fp_log_record_t *header = (fp_log_record_t *)record;
+    numbers_container_t *numbers_container = (numbers_container_t *)(header + 1);
+    char *str = (char *)(numbers_container + 1);
 
-    // Malloc for command name and parameters
-    command[numbers_container.name_len] = '\0';
-    args[numbers_container.args_len] = '\0';
-
-    // Finds the command name string and sets it
-    spn_fl512s_read_data(0, add, (uint8_t*)command, numbers_container.name_len*sizeof(char));
-
-    add += SCH_CMD_MAX_STR_NAME*sizeof(char);
+    spn_fl512s_read_data(0, fp_log_index[index].add, (uint8_t *)record, fp_log_index[index].len);
+    if (flight_plan_check_record(numbers_container, fp_log_index[index].len) != 0)
+    {
+        // Drops the record, it can not be executed
+        flight_plan_erase_index(index);
+        return -1;
+    }
 
-    // Finds the parameters string and sets it
-    spn_fl512s_read_data(0, add, (uint8_t*)args, numbers_container.args_len*sizeof(char));
+    // Sets the command name and parameters
+    memcpy(command, str, numbers_container->name_len);
+    command[numbers_container->name_len] = '\0';
+    memcpy(args, str + numbers_container->name_len, numbers_container->args_len);
+    args[numbers_container->args_len] = '\0';
 
     // Sets the executions and periodical values
-    *executions = (int)numbers_container.exec;
-    *periodical = (int)numbers_container.peri;
+    *executions = (int)numbers_container->exec;
+    *periodical = (int)numbers_container->peri;
 
     // Deletes the command from storage
     int rc;
@@ -385,44 +738,59 @@ int storage_flight_plan_erase(int timetodo)
     return rc;
 }
 
-int storage_flight_plan_reset(void)
+int storage_flight_plan_get_times(int *times, int n)
 {
-    int entries = dat_get_system_var(dat_fpl_queue);
+    int found = 0;
 
-    int commands_per_section = SCH_SIZE_PER_SECTION/max_command_size;
+    for (int i = 0; i < fp_log_n && found < n; i++)
+        times[found++] = (int)fp_log_index[i].timetodo;
 
-    // Amount of sections that the flight plan uses
-    int fp_sections = (entries/commands_per_section) + 1;
+    return found;
+}
 
-    // Deletes all flight plan memory sections
-    for (int i = 0; i < fp_sections; i++)
-    {
-        LOGI(tag, "Deleting section in address %u\n", (unsigned int)storage_addresses_flight_plan[i]);
-        int rc = spn_fl512s_erase_block(0, storage_addresses_flight_plan[i]);
-        if (rc != 0)
-        {
-            LOGE(tag, "Failed attempt at deleting data in storage address %u", (unsigned int)storage_addresses_flight_plan[i]);
-            dat_set_system_var(dat_fpl_queue, entries >= 0 ? entries : 0);
-            return -1;
-        }
+int storage_flight_plan_reset(void)
+{
+    // Starts an empty log in the other section
+    return flight_plan_compact(0);
+}
 
-        // An entries section gets erased
-        entries -= commands_per_section;
+int storage_flight_plan_begin(void)
+{
+    if (fp_log_txn)
+    {
+        LOGE(tag, "Flight plan transaction already open");
+        return -1;
     }
 
-    // The entries amount can't be below zero
-    entries = (entries < 0) ? 0 : entries;
-
-    dat_set_system_var(dat_fpl_queue, entries);
+    // The mark is written before keeping the records, it may compact the log
+    fp_log_record_t begin = {0, FP_LOG_BEGIN, sizeof(fp_log_record_t)};
+    if (flight_plan_append(&begin) == 0)
+        return -1;
 
+    flight_plan_txn_start();
     return 0;
 }
 
-int storage_show_table(void)
+int storage_flight_plan_end(int commit)
 {
-    int entries = dat_get_system_var(dat_fpl_queue);
+    if (!fp_log_txn)
+    {
+        LOGE(tag, "Flight plan transaction not open");
+        return -1;
+    }
+
+    // The changes are discarded in RAM, as in the log, if the mark is not written
+    fp_log_record_t end = {0, commit ? FP_LOG_COMMIT : FP_LOG_ABORT, sizeof(fp_log_record_t)};
+    int rc = flight_plan_append(&end) == 0 ? -1 : 0;
+    if (rc != 0 || !commit)
+        flight_plan_txn_undo();
+    fp_log_txn = 0;
+    return rc;
+}
 
-    if (entries == 0)
+int storage_show_table(void)
+{
+    if (fp_log_n == 0)
     {
         LOGI(tag, "Flight plan table empty");
         return 0;
@@ -430,90 +798,337 @@ int storage_show_table(void)
 
     LOGI(tag, "Flight plan table");
 
-    int commands_per_section = SCH_SIZE_PER_SECTION/max_command_size;
-
-    for (int index = 0; index < entries; index++)
+    for (int index = 0; index < fp_log_n; index++)
     {
-        // Calculates memory address
-        int section_index = index/commands_per_section;
-        int index_in_section = index%commands_per_section;
+        // Reads the record
+        uint32_t record[FP_LOG_MAX_RECORD/sizeof(uint32_t)];
+        fp_log_record_t *header = (fp_log_record_t *)record;
+        numbers_container_t *container = (numbers_container_t *)(header + 1);
+        char *str = (char *)(container + 1);
 
-        uint32_t add = storage_addresses_flight_plan[section_index] + index_in_section*max_command_size;
+        spn_fl512s_read_data(0, fp_log_index[index].add, (uint8_t *)record, fp_log_index[index].len);
+        if (flight_plan_check_record(container, fp_log_index[index].len) != 0)
+            continue;
 
-        // Finds numeric values
-        uint32_t timetodo;
-        numbers_container_t container;
+        // Finds string values
+        char command[SCH_CMD_MAX_STR_NAME];
+        char args[SCH_CMD_MAX_STR_PARAMS];
 
-        spn_fl512s_read_data(0, add, (uint8_t*)&timetodo, sizeof(uint32_t));
+        memcpy(command, str, container->name_len);
+        command[container->name_len] = '\0';
+        memcpy(args, str + container->name_len, container->args_len);
+        args[container->args_len] = '\0';
 
-        add += sizeof(uint32_t);
+        // Prints a row of the table
 
-        spn_fl512s_read_data(0, add, (uint8_t*)&container, sizeof(numbers_container_t));
+        time_t timef = header->timetodo;
 
-        add += sizeof(numbers_container_t);
+        printf("%s\t%s\t%s\t%" PRIu32 "\n", ctime(&timef), command, args, container->peri);
+    }
 
-        // Finds string values
-        char command[container.name_len+1];
-        char args[container.args_len+1];
+    return 0;
+}
 
-        command[container.name_len] = '\0';
-        args[container.args_len] = '\0';
+int storage_close(void)
+{
+    // Do not lose the buffered payload samples
+    storage_flush_payload_data();
+    free(storage_addresses_payloads);
+    free(storage_addresses_flight_plan);
+#ifdef SCH_FLASH_SIM
+    return flash_sim_close();
+#else
+    return 0;
+#endif
+}
 
-        spn_fl512s_read_data(0, add, (uint8_t*)command, sizeof(char)*container.name_len);
+/**
+ * Samples that fit in a payload section, after the section header
+ *
+ * @param payload Payload id
+ * @return Number of samples per section
+ */
+static int payload_samples_per_section(int payload)
+{
+    return (int)((SCH_SIZE_PER_SECTION - sizeof(payload_section_t))/data_map[payload].size);
+}
 
-        add += SCH_CMD_MAX_STR_NAME;
+/**
+ * Find the section and address where a payload sample is stored
+ *
+ * @param index Sample index
+ * @param payload Payload id
+ * @param section Returns the section number, in storage_addresses_payloads
+ * @return Address of the sample
+ */
+static uint32_t payload_address(int index, int payload, int *section)
+{
+    int per_section = payload_samples_per_section(payload);
+    *section = payload*SCH_SECTIONS_PER_PAYLOAD + (index/per_section)%SCH_SECTIONS_PER_PAYLOAD;
+    return storage_addresses_payloads[*section] + sizeof(payload_section_t) + (index%per_section)*data_map[payload].size;
+}
 
-        spn_fl512s_read_data(0, add, (uint8_t*)args, sizeof(char)*container.args_len);
+/**
+ * Check that the section storing the sample @index has the samples of the
+ * current pass through the log
+ *
+ * @param index Sample index
+ * @param payload Payload id
+ * @return 1 if the sample is in the section, 0 if not
+ */
+static int payload_section_valid(int index, int payload)
+{
+    int section;
+    payload_address(index, payload, &section);
+    int per_section = payload_samples_per_section(payload);
+    payload_section_t *header = &payload_sections[section];
+    return header->magic == PAYLOAD_LOG_MAGIC && header->first == (uint32_t)(index - index%per_section);
+}
 
-        // Prints a row of the table
+/**
+ * Erase a payload section and write its header
+ *
+ * @param section Section number, in storage_addresses_payloads
+ * @param first Index of the first sample to be stored in the section
+ * @return 0 if OK, -1 if Error
+ */
+static int payload_section_erase(int section, uint32_t first)
+{
+    payload_section_t *header = &payload_sections[section];
+    payload_section_t new_header = {PAYLOAD_LOG_MAGIC, first, 1};
+    if (header->magic == PAYLOAD_LOG_MAGIC)
+        new_header.erases = header->erases + 1;
 
-        time_t timef = timetodo;
+    uint32_t add = storage_addresses_payloads[section];
+    LOGI(tag, "Deleting section in address %u (%u erases)", (unsigned int)add, (unsigned int)new_header.erases);
+    int rc = spn_fl512s_erase_block(0, add);
+    if (rc != 0)
+    {
+        LOGE(tag, "Failed attempt at deleting data in storage address %u", (unsigned int)add);
+        return -1;
+    }
 
-        printf("%s\t%s\t%s\t%lu\n", ctime(&timef), command, args, container.peri);
+    rc = spn_fl512s_write_data(0, add, (uint8_t *)&new_header, sizeof(payload_section_t));
+    if (rc != 0)
+    {
+        LOGE(tag, "Failed attempt at writing data in storage address %u", (unsigned int)add);
+        return -1;
     }
 
+    *header = new_header;
     return 0;
 }
 
-int storage_close(void)
+/**
+ * Prepare the section that stores the sample @index to be written. When the
+ * write head enters a section with samples of another pass through the log,
+ * older or newer, the section is erased, only if it is unused or all its
+ * samples were acknowledged.
+ *
+ * @param index Sample index
+ * @param payload Payload id
+ * @return 0 if OK, -1 if the section can not be written
+ */
+static int payload_section_prepare(int index, int payload)
 {
-    free(storage_addresses_payloads);
-    free(storage_addresses_flight_plan);
+    if (payload_section_valid(index, payload))
+        return 0;
+
+    int section;
+    payload_address(index, payload, &section);
+    int per_section = payload_samples_per_section(payload);
+    uint32_t first = (uint32_t)(index - index%per_section);
+    payload_section_t *header = &payload_sections[section];
+
+    if (header->magic == PAYLOAD_LOG_MAGIC)
+    {
+        // The ack is read from the FRAM, it may be older than the cached one
+        int ack = storage_repo_get_value_idx(data_map[payload].sys_ack, DAT_REPO_SYSTEM);
+        if (ack < 0 || (uint32_t)ack < header->first + per_section)
+        {
+            LOGW(tag, "Payload %d section %d not erased, samples not acknowledged (%d < %u)",
+                 payload, section, ack, (unsigned int)(header->first + per_section));
+            return -1;
+        }
+    }
+
+    return payload_section_erase(section, first);
+}
+
+/**
+ * Write the buffered samples of a payload to the flash
+ *
+ * @param payload Payload id
+ * @return 0 if OK, -1 if Error. The buffer is emptied in any case
+ */
+static int payload_buffer_flush(int payload)
+{
+    payload_buffer_t *buffer = &payload_buffers[payload];
+    if (buffer->n == 0)
+        return 0;
+
+    int len = buffer->n*data_map[payload].size;
+    LOGI(tag, "Writing in address: %u, %d bytes\n", (unsigned int)buffer->add, len);
+    int ret = spn_fl512s_write_data(0, buffer->add, buffer->data, (uint16_t)len);
+    if (ret != 0)
+        LOGE(tag, "Failed attempt at writing %d samples of payload %d", buffer->n, payload);
+
+    buffer->n = 0;
+    return ret == 0 ? 0 : -1;
+}
+
+/**
+ * Add a sample to the payload write buffer. The section storing the sample
+ * is prepared before, so the sample can be written when the buffer is
+ * flushed.
+ *
+ * @param index Sample index
+ * @param data Pointer to the sample
+ * @param payload Payload id
+ * @return 0 if OK, -1 if Error
+ */
+static int payload_buffer_add(int index, void *data, int payload)
+{
+    payload_buffer_t *buffer = &payload_buffers[payload];
+    int size = data_map[payload].size;
+    int section;
+    uint32_t add = payload_address(index, payload, &section);
+
+    // The buffer only holds contiguous samples, to be written at once
+    if (buffer->n > 0 && (index != buffer->index + buffer->n ||
+                          add != buffer->add + buffer->n*size ||
+                          (buffer->n + 1)*size > SCH_FLASH_PAGE_SIZE))
+    {
+        if (payload_buffer_flush(payload) != 0)
+            return -1;
+    }
+
+    if (payload_section_prepare(index, payload) != 0)
+        return -1;
+
+    if (buffer->n == 0)
+    {
+        buffer->index = index;
+        buffer->add = add;
+        buffer->since = time(NULL);
+    }
+    memcpy(buffer->data + buffer->n*size, data, size);
+    buffer->n++;
+
+    // Program the page once the buffer reaches its end
+    uint32_t end = add + size;
+    if (end/SCH_FLASH_PAGE_SIZE != buffer->add/SCH_FLASH_PAGE_SIZE ||
+        time(NULL) - buffer->since >= SCH_STORAGE_CACHE_PERIOD)
+        return payload_buffer_flush(payload);
+
     return 0;
 }
 
+/**
+ * Copy the buffered samples in the range @index to @index+n-1 to @data
+ *
+ * @param index Index of the first sample
+ * @param data Pointer to an array of @n samples
+ * @param n Number of samples
+ * @param payload Payload id
+ */
+static void payload_buffer_read(int index, void *data, int n, int payload)
+{
+    payload_buffer_t *buffer = &payload_buffers[payload];
+    int from = index > buffer->index ? index : buffer->index;
+    int to = index + n < buffer->index + buffer->n ? index + n : buffer->index + buffer->n;
+    int size = data_map[payload].size;
+
+    if (from < to)
+        memcpy((uint8_t *)data + (from - index)*size, buffer->data + (from - buffer->index)*size, (to - from)*size);
+}
+
+int storage_flush_payload_data(void)
+{
+    int rc = 0;
+    for(int i = 0; i < last_sensor; ++i)
+        rc |= payload_buffer_flush(i);
+    return rc;
+}
+
 int storage_set_payload_data(int index, void* data, int payload)
 {
+#if SCH_FLASH_WRITE_BUFFER
     if(payload >= last_sensor)
     {
         LOGE(tag, "Payload id: %d greater than maximum id: %d", payload, last_sensor);
         return -1;
     }
 
-    int payloads_per_section = SCH_SIZE_PER_SECTION/data_map[payload].size;
-
-    int payload_section = index/payloads_per_section;
-    int index_in_section = index%payloads_per_section;
+    if (index < 0)
+    {
+        LOGE(tag, "Payload index: %d is out of bounds", index);
+        return -1;
+    }
 
-    int section_index = payload*SCH_SECTIONS_PER_PAYLOAD + payload_section;
+    if (data_map[payload].size <= SCH_FLASH_PAGE_SIZE)
+        return payload_buffer_add(index, data, payload);
+#endif
+    return storage_set_payload_data_n(index, data, 1, payload);
+}
 
-    uint32_t add = storage_addresses_payloads[section_index] + index_in_section*data_map[payload].size;
+int storage_set_payload_data_n(int index, void* data, int n, int payload)
+{
+    if(payload >= last_sensor)
+    {
+        LOGE(tag, "Payload id: %d greater than maximum id: %d", payload, last_sensor);
+        return -1;
+    }
 
-    if (payload_section >= SCH_SECTIONS_PER_PAYLOAD)
+    if (index < 0)
     {
-        LOGE(tag, "Payload address: %u is out of bounds", (unsigned int)add);
+        LOGE(tag, "Payload index: %d is out of bounds", index);
         return -1;
     }
 
-    LOGI(tag, "Writing in address: %u, %d bytes\n", (unsigned int)add, data_map[payload].size);
-    int ret = spn_fl512s_write_data(0, add, data, data_map[payload].size);
-    if(ret != 0){
+    // Keep the samples in order, the batch is written directly
+    if (payload_buffer_flush(payload) != 0)
         return -1;
+
+    int payloads_per_section = payload_samples_per_section(payload);
+
+    // Write the samples that fall in the same section with only a few writes
+    while(n > 0)
+    {
+        int index_in_section = index%payloads_per_section;
+        int n_section = payloads_per_section - index_in_section;
+        if(n_section > n)
+            n_section = n;
+        // The SPI driver length is 16 bits
+        if(n_section > UINT16_MAX/data_map[payload].size)
+            n_section = UINT16_MAX/data_map[payload].size;
+
+        if (payload_section_prepare(index, payload) != 0)
+            return -1;
+
+        int section;
+        uint32_t add = payload_address(index, payload, &section);
+        int len = n_section*data_map[payload].size;
+
+        LOGI(tag, "Writing in address: %u, %d bytes\n", (unsigned int)add, len);
+        int ret = spn_fl512s_write_data(0, add, data, len);
+        if(ret != 0){
+            return -1;
+        }
+
+        data = (uint8_t *)data + len;
+        index += n_section;
+        n -= n_section;
     }
     return 0;
 }
 
 int storage_get_payload_data(int index, void* data, int payload)
+{
+    return storage_get_payload_data_n(index, data, 1, payload);
+}
+
+int storage_get_payload_data_n(int index, void* data, int n, int payload)
 {
     if(payload >= last_sensor)
     {
@@ -521,48 +1136,81 @@ int storage_get_payload_data(int index, void* data, int payload)
         return -1;
     }
 
-    int payloads_per_section = SCH_SIZE_PER_SECTION/data_map[payload].size;
+    if (index < 0)
+    {
+        LOGE(tag, "payload index: %d is out of bounds", index);
+        return -1;
+    }
 
-    int payload_section = index/payloads_per_section;
-    int index_in_section = index%payloads_per_section;
+    int payloads_per_section = payload_samples_per_section(payload);
 
-    int section_index = payload*SCH_SECTIONS_PER_PAYLOAD + payload_section;
+    // Read the samples that are contiguous in the same section with only a few reads
+    while(n > 0)
+    {
+        int index_in_section = index%payloads_per_section;
+        int n_section = payloads_per_section - index_in_section;
+        if(n_section > n)
+            n_section = n;
+        // The SPI driver length is 16 bits
+        if(n_section > UINT16_MAX/data_map[payload].size)
+            n_section = UINT16_MAX/data_map[payload].size;
+
+        // Samples of previous passes through the log were overwritten
+        if (!payload_section_valid(index, payload))
+        {
+            LOGE(tag, "payload %d index: %d is not stored", payload, index);
+            return -1;
+        }
 
-    uint32_t add = storage_addresses_payloads[section_index] + index_in_section*data_map[payload].size;
+        int section;
+        uint32_t add = payload_address(index, payload, &section);
+        int len = n_section*data_map[payload].size;
 
-    if (payload_section >= SCH_SECTIONS_PER_PAYLOAD)
-    {
-        LOGE(tag, "payload address: %u is out of bounds", (unsigned int)add);
-        return -1;
-    }
+        // Buffered samples are not in the flash yet
+        payload_buffer_t *buffer = &payload_buffers[payload];
+        if (buffer->n == 0 || index < buffer->index || index + n_section > buffer->index + buffer->n)
+        {
+            LOGV(tag, "Reading in address: %u, %d bytes\n", (unsigned int)add, len);
+            spn_fl512s_read_data(0, add, (uint8_t *)data, len);
+        }
+        payload_buffer_read(index, data, n_section, payload);
 
-    LOGV(tag, "Reading in address: %u, %d bytes\n", (unsigned int)add, data_map[payload].size);
-//    printf("Reading values of size %u \n", data_map[payload]);
-//    spn_fl512s_read_data(add, (uint8_t *) data, data_map[payload]);
-    spn_fl512s_read_data(0, add, (uint8_t *)data, data_map[payload].size);
-//    printf("Reading value %d \n", *(uint8_t*)data);
-//    LOGV(tag, "Read 0x%X", (unsigned int)data.data32);
+        data = (uint8_t *)data + len;
+        index += n_section;
+        n -= n_section;
+    }
     return 0;
 }
 
 int storage_delete_memory_sections()
 {
-    // Deleting Payload Memory Sections
+    // The buffered samples are deleted too
+    for(int i = 0; i < last_sensor; ++i)
+        payload_buffers[i].n = 0;
+
+    // Deleting Payload Memory Sections, ready for the first pass through the log
     for(int i = 0;  i < SCH_SECTIONS_PER_PAYLOAD*last_sensor; ++i)
     {
-        LOGI(tag, "deleting section in address %u\n", (unsigned int)storage_addresses_payloads[i]);
-        int rc = spn_fl512s_erase_block(0, storage_addresses_payloads[i]);
+        int payload = i/SCH_SECTIONS_PER_PAYLOAD;
+        uint32_t first = (uint32_t)((i%SCH_SECTIONS_PER_PAYLOAD)*payload_samples_per_section(payload));
+        int rc = payload_section_erase(i, first);
         if (rc != 0)
-        {
-            LOGE(tag, "Failed attempt at deleting data in storage address %u", (unsigned int)storage_addresses_payloads[i]);
             return -1;
-        }
     }
     return 0;
 }
 
 int storage_table_payload_init(int drop)
 {
-    // FIXME: IMPLEMENT
+    for(int i = 0; i < last_sensor; ++i)
+        payload_buffers[i].n = 0;
+
+    // Loads the payload sections headers
+    for(int i = 0;  i < SCH_SECTIONS_PER_PAYLOAD*last_sensor; ++i)
+        spn_fl512s_read_data(0, storage_addresses_payloads[i], (uint8_t *)&payload_sections[i], sizeof(payload_section_t));
+
+    if (drop)
+        return storage_delete_memory_sections();
+
     return 0;
 }
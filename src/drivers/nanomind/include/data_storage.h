@@ -7,7 +7,11 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#ifdef SCH_FLASH_SIM
+#include "flash_sim.h"
+#else
 #include "drivers.h"
+#endif
 #include "utils.h"
 #include "config.h"
 #include "globals.h"
@@ -30,7 +34,8 @@ typedef union _data32{
  *
  * @note: non-reentrant function, use mutex to sync access
  *
- * @param file Str. File path to SQLite database
+ * @param file Str. Not used, or the file with the simulated memories if
+ * built with SCH_FLASH_SIM (@relatesalso flash_sim_init)
  * @return 0 OK, -1 Error
  */
 int storage_init(const char *file);
@@ -54,6 +59,9 @@ int storage_table_repo_init(char *table, int drop);
  * form (time, command, args, repeat). If the table exists do nothing. If drop is set to
  * 1 then drop an existing table and then creates an empty one.
  *
+ * The flight plan is an append-only log in two NOR FLASH sections, this
+ * function loads the index of the log, or creates the log if there is none.
+ *
  * @note: non-reentrant function, use mutex to sync access
  *
  * @param drop Int. Set to 1 to drop the existing table before create one
@@ -76,6 +84,19 @@ int storage_table_flight_plan_init(int drop);
  */
 int storage_repo_get_value_idx(int index, char *table);
 
+/**
+ * Get the first @n INT (integer) values from table with only one FRAM read.
+ * The values are stored at @index*4 as in storage_repo_get_value_idx.
+ *
+ * @note: non-reentrant function, use mutex to sync access
+ *
+ * @param values Int *. Array of @n elements to store the values
+ * @param n Int. Number of values to read, from index 0 to @n-1
+ * @param table Str. Table name
+ * @return 0 OK, -1 Error
+ */
+int storage_repo_get_values(int *values, int n, char *table);
+
 /**
  * Get a INT (integer) value from table by name
  *
@@ -103,6 +124,20 @@ int storage_repo_get_value_str(char *name, char *table);
  */
 int storage_repo_set_value_idx(int index, int value, char *table);
 
+/**
+ * Set or update the value of many INT (integer) variables by index in one
+ * transaction.
+ *
+ * @note: non-reentrant function, use mutex to sync access
+ *
+ * @param index Int *. Array of @n variables indexes
+ * @param values Int *. Array of @n values to set
+ * @param n Int. Number of variables to set
+ * @param table Str. Table name
+ * @return 0 OK, -1 Error
+ */
+int storage_repo_set_values(int *index, int *values, int n, char *table);
+
 /**
  * Set or update the value of a INT (integer) variable by name.
  *
@@ -153,7 +188,20 @@ int storage_flight_plan_get(int timetodo, char* command, char* args, int* repeat
 int storage_flight_plan_erase(int timetodo);
 
 /**
- * Reset the flight plan table.
+ * Get the execution time of the entries in the flight plan table, in storage
+ * order. Used to build the flight plan time index.
+ *
+ * @note: non-reentrant function, use mutex to sync access
+ *
+ * @param times Int *. Array to store up to @n times
+ * @param n Int. Max number of times to get
+ * @return Number of times found, -1 Error
+ */
+int storage_flight_plan_get_times(int *times, int n);
+
+/**
+ * Reset the flight plan table. A new empty log is started in the other
+ * flight plan section.
  *
  * @note: non-reentrant function, use mutex to sync access
  *
@@ -161,6 +209,29 @@ int storage_flight_plan_erase(int timetodo);
  */
 int storage_flight_plan_reset(void);
 
+/**
+ * Start a flight plan transaction. The flight plan changes until
+ * storage_flight_plan_end are committed or rolled back at once.
+ *
+ * @note: non-reentrant function, use mutex to sync access
+ *
+ * @return 0 OK, -1 Error
+ */
+int storage_flight_plan_begin(void);
+
+/**
+ * End a flight plan transaction started with storage_flight_plan_begin.
+ *
+ * @note: entries are written to the flash as they are set, the changes can
+ * not be rolled back.
+ *
+ * @note: non-reentrant function, use mutex to sync access
+ *
+ * @param commit Int. 1 to commit the changes, 0 to roll them back
+ * @return 0 OK, -1 Error
+ */
+int storage_flight_plan_end(int commit);
+
 /**
  * Show the flight plan table, printing all values in the
  * form (time, command, args, repeat).
@@ -174,7 +245,9 @@ int storage_show_table(void);
 // TODO: Check why this function isn't in Linux/include/data_storage.h
 /**
  * Set or update a value in index address for specific payload
- * in NOR FLASH
+ * in NOR FLASH. If SCH_FLASH_WRITE_BUFFER is set the sample is kept in a RAM
+ * buffer until a flash page is complete (@relatesalso
+ * storage_flush_payload_data)
  *
  * @note: non-reentrant function, use mutex to sync access
  *
@@ -194,6 +267,20 @@ int storage_set_payload_data(int index, void * data, int payload);
  */
 //int storage_add_payload_data(void * data, int payload, int lastindex);
 
+/**
+ * Set @n consecutive samples of a payload, from @index to @index+n-1, in
+ * NOR FLASH. Samples in the same section are written together.
+ *
+ * @note: non-reentrant function, use mutex to sync access
+ *
+ * @param index Int. index of the first sample
+ * @param data Pointer to an array of @n payload structs
+ * @param n Int. Number of samples
+ * @param payload Int. payload to store
+ * @return 0 OK, -1 Error
+ */
+int storage_set_payload_data_n(int index, void* data, int n, int payload);
+
 // TODO: Check why this function isn't in Linux/include/data_storage.h
 /**
  * Get a value from index address for specific payload
@@ -208,6 +295,20 @@ int storage_set_payload_data(int index, void * data, int payload);
  */
 int storage_get_payload_data(int index, void* data, int payload);
 
+/**
+ * Get @n consecutive samples of a payload, from @index to @index+n-1, from
+ * NOR FLASH. Samples in the same section are read together.
+ *
+ * @note: non-reentrant function, use mutex to sync access
+ *
+ * @param index Int. index of the first sample
+ * @param data Pointer to an array of @n payload structs
+ * @param n Int. Number of samples
+ * @param payload Int. payload to get
+ * @return 0 OK, -1 Error
+ */
+int storage_get_payload_data_n(int index, void* data, int n, int payload);
+
 /**
  * Get recent values from for specific payload
  * in NOR FLASH
@@ -222,7 +323,19 @@ int storage_get_payload_data(int index, void* data, int payload);
 //int storage_get_recent_payload_data(void* data, int payload, int delay);
 
 /**
- * Delete all memory sections in NOR FLASH
+ * Write the payload samples buffered in RAM to NOR FLASH. Samples set one by
+ * one are combined up to a flash page before they are written, if
+ * SCH_FLASH_WRITE_BUFFER is set. Reads always find the buffered samples.
+ *
+ * @note: non-reentrant function, use mutex to sync access
+ *
+ * @return 0 OK, -1 Error
+ */
+int storage_flush_payload_data(void);
+
+/**
+ * Delete all memory sections in NOR FLASH. The payload sections are ready to
+ * store samples from index 0.
  *
  * @note: non-reentrant function, use mutex to sync access
  * @return OK 0, Error -1
@@ -241,9 +354,17 @@ int storage_delete_memory_sections(void);
 int storage_close(void);
 
 /**
- * FIXME: IMPLEMENT
- * @param drop
- * @return
+ * Load the payload sections. Each payload is stored as a circular log in
+ * SCH_SECTIONS_PER_PAYLOAD NOR FLASH sections, the sample with index i is
+ * overwritten by the sample with index i plus the capacity of the log. A
+ * section is erased when the write head enters it, only if the samples it
+ * stores were acknowledged (sys_ack), otherwise the write fails. Each section
+ * keeps the number of times it was erased.
+ *
+ * @note: non-reentrant function, use mutex to sync access
+ *
+ * @param drop Int. Set to 1 to delete all the payload samples
+ * @return 0 OK, -1 Error
  */
 int storage_table_payload_init(int drop);
 
@@ -37,11 +37,24 @@ void cmd_com_init(void)
     cmd_add("com_debug", com_debug, "", 0);
     cmd_add("com_set_node", com_set_node, "%d", 1);
     cmd_add("com_get_node", com_get_node, "", 0);
+
+    // Commands using the communication bus are serialized among them
+    cmd_set_class("com_ping", CMD_CLASS_IO);
+    cmd_set_class("com_send_rpt", CMD_CLASS_IO);
+    cmd_set_class("com_send_cmd", CMD_CLASS_IO);
+    cmd_set_class("com_send_tc", CMD_CLASS_IO);
+    cmd_set_class("com_send_data", CMD_CLASS_IO);
+    cmd_set_class("com_get_node", CMD_CLASS_SHARED);
 #ifdef SCH_USE_NANOCOM
     cmd_add("com_reset_wdt", com_reset_wdt, "%d", 1);
     cmd_add("com_get_config", com_get_config, "%s", 1);
     cmd_add("com_set_config", com_set_config, "%s %s", 2);
     cmd_add("com_update_status", com_set_config, "", 2);
+    cmd_set_class("com_reset_wdt", CMD_CLASS_IO);
+    cmd_set_class("com_get_config", CMD_CLASS_IO);
+    cmd_set_class("com_set_config", CMD_CLASS_IO);
+    cmd_set_class("com_update_status", CMD_CLASS_IO);
+    cmd_set_prio("com_reset_wdt", CMD_PRIO_CRITICAL);
 #endif
 }
 
@@ -54,7 +67,7 @@ int com_ping(char *fmt, char *params, int nparams)
     }
 
     int node;
-    if(sscanf(params, fmt, &node) == nparams)
+    if(cmd_scan_params(params, fmt, &node) == nparams)
     {
         int rc = csp_ping((uint8_t)node, 3000, 10, CSP_O_NONE);
         LOGI(tag, "Ping to %d took %d", node, rc);
@@ -77,7 +90,7 @@ int com_send_rpt(char *fmt, char *params, int nparams)
     memset(msg, '\0', SCH_CMD_MAX_STR_PARAMS);
 
     // format: <node> <string>
-    if(sscanf(params, fmt, &node, msg) == nparams)
+    if(cmd_scan_params(params, fmt, &node, msg) == nparams)
     {
         // Create a packet with the message
         size_t msg_len = strlen(msg);
@@ -125,7 +138,7 @@ int com_send_cmd(char *fmt, char *params, int nparams)
     memset(msg, '\0', SCH_CMD_MAX_STR_PARAMS);
 
     //format: <node> <command> [parameters]
-    n_args = sscanf(params, fmt, &node, &next);
+    n_args = cmd_scan_params(params, fmt, &node, &next);
     if(n_args == nparams && next > 1)
     {
         strncpy(msg, params+next, (size_t)SCH_CMD_MAX_STR_PARAMS);
@@ -165,7 +178,7 @@ int com_send_tc_frame(char *fmt, char *params, int nparams)
     memset(tc_frame, '\0', COM_FRAME_MAX_LEN);
 
     //format: <node> <command> [parameters];...;<command> [parameters]
-    n_args = sscanf(params, fmt, &node, &next);
+    n_args = cmd_scan_params(params, fmt, &node, &next);
     if(n_args == nparams && next > 1)
     {
         strncpy(tc_frame, params+next, (size_t)SCH_CMD_MAX_STR_PARAMS);
@@ -237,7 +250,7 @@ int com_set_node(char *fmt, char *params, int nparams)
     }
 
     int node;
-    if(sscanf(params, fmt, &node) == nparams)
+    if(cmd_scan_params(params, fmt, &node) == nparams)
     {
         trx_node = node;
         LOGI(tag, "TRX node set to %d", node);
@@ -264,7 +277,7 @@ int com_reset_wdt(char *fmt, char *params, int nparams)
     else
     {
         //format: <node>
-        n_args = sscanf(params, fmt, &node);
+        n_args = cmd_scan_params(params, fmt, &node);
         // If no params received, try to reset the current trx_node
         if(n_args != nparams)
             node = trx_node;
@@ -304,7 +317,7 @@ int com_get_config(char *fmt, char *params, int nparams)
     }
 
     // Format: <param_name>
-    n_args = sscanf(params, fmt, &param);
+    n_args = cmd_scan_params(params, fmt, &param);
     if(n_args == nparams)
     {
         int table = 0;
@@ -366,7 +379,7 @@ int com_set_config(char *fmt, char *params, int nparams)
     }
 
     // Format: <param_name> <value>
-    n_args = sscanf(params, fmt, &param, &value);
+    n_args = cmd_scan_params(params, fmt, &param, &value);
     if(n_args == nparams)
     {
         int table = 0;
@@ -26,6 +26,12 @@ void cmd_console_init(void)
 {
     cmd_add("test", con_debug_msg, "%s", 1);
     cmd_add("help", con_help, "", 0);
+    cmd_add("help_codes", con_help_codes, "", 0);
+
+    // Commands that can run in parallel
+    cmd_set_class("test", CMD_CLASS_SHARED);
+    cmd_set_class("help", CMD_CLASS_SHARED);
+    cmd_set_class("help_codes", CMD_CLASS_SHARED);
 }
 
 /**
@@ -41,7 +47,7 @@ int con_debug_msg(char *fmt, char *params, int nparams)
         return CMD_FAIL;
     }
     char msg[SCH_CMD_MAX_STR_PARAMS];
-    if(sscanf(params,fmt, msg) == nparams)
+    if(cmd_scan_params(params, fmt, msg) == nparams)
     {
         printf("[Debug Msg] %s\n", msg);
         return CMD_OK;
@@ -57,3 +63,9 @@ int con_help(char *fmt, char *params, int nparams)
 //    osSemaphoreGiven(&log_mutex);
     return CMD_OK;
 }
+
+int con_help_codes(char *fmt, char *params, int nparams)
+{
+    cmd_print_codes();
+    return CMD_OK;
+}
@@ -35,6 +35,10 @@ void cmd_drp_init(void)
     cmd_add("drp_clear_gnd_wdt", drp_clear_gnd_wdt, "", 0);
     cmd_add("drp_test_system_vars", drp_test_system_vars, "", 0);
     cmd_add("drp_set_deployed", drp_set_deployed, "%d", 1);
+    cmd_add("drp_sync", drp_sync, "", 0);
+
+    // Commands that can run in parallel, the others are exclusive
+    cmd_set_class("drp_get_vars", CMD_CLASS_SHARED);
 }
 
 int drp_execute_before_flight(char *fmt, char *params, int nparams)
@@ -43,7 +47,7 @@ int drp_execute_before_flight(char *fmt, char *params, int nparams)
         return CMD_ERROR;
 
     int magic;
-    if(nparams == sscanf(params, fmt, &magic))
+    if(nparams == cmd_scan_params(params, fmt, &magic))
     {
         if(magic == SCH_DRP_MAGIC)
         {
@@ -95,7 +99,7 @@ int drp_update_sys_var_idx(char *fmt, char *params, int nparams)
         return CMD_FAIL;
     }
     int index, value;
-    if(sscanf(params, fmt, &index, &value) == nparams)
+    if(cmd_scan_params(params, fmt, &index, &value) == nparams)
     {
         dat_system_t var_index = (dat_system_t)index;
         if(var_index < dat_system_last_var)
@@ -127,7 +131,7 @@ int drp_update_hours_alive(char *fmt, char *params, int nparams)
     int value;  // Value to add
     int current;  // Current value to update
 
-    if(sscanf(params, fmt, &value) == nparams)
+    if(cmd_scan_params(params, fmt, &value) == nparams)
     {
         // Adds <value> to current hours alive
         current = dat_get_system_var(dat_obc_hrs_alive);
@@ -180,7 +184,7 @@ int drp_test_system_vars(char *fmt, char *params, int nparams)
 int drp_set_deployed(char *fmt, char *params, int nparams)
 {
     int deployed;
-    if(sscanf(params, fmt, &deployed) == nparams)
+    if(cmd_scan_params(params, fmt, &deployed) == nparams)
     {
         dat_set_system_var(dat_dep_deployed, deployed);
         return CMD_OK;
@@ -191,3 +195,10 @@ int drp_set_deployed(char *fmt, char *params, int nparams)
         return CMD_ERROR;
     }
 }
+
+int drp_sync(char *fmt, char *params, int nparams)
+{
+    int rc = dat_flush_system_vars();
+    rc |= dat_flush_payload_data();
+    return rc == 0 ? CMD_OK : CMD_FAIL;
+}
@@ -102,7 +102,7 @@ int eps_set_heater(char *fmt, char *params, int nparams)
     int heater, on_off;
     uint8_t state[2];
 
-    if(sscanf(params, fmt, &heater, &on_off) == nparams)
+    if(cmd_scan_params(params, fmt, &heater, &on_off) == nparams)
     {
         LOGI(tag, "Setting heater %d to state %d", heater, on_off);
         eps_heater((uint8_t) heater, (uint8_t) on_off, state);
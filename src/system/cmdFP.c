@@ -28,6 +28,9 @@ void cmd_fp_init(void)
     cmd_add("fp_del_cmd", fp_delete, "%d %d %d %d %d %d", 6);
     cmd_add("fp_show", fp_show, "", 0);
     cmd_add("fp_reset", fp_reset,"", 0);
+    cmd_add("fp_stage", fp_stage, "%p", 1);
+    cmd_add("fp_commit", fp_commit, "%d %d", 2);
+    cmd_add("fp_discard", fp_discard, "%d", 1);
     cmd_add("fp_test_params", test_fp_params, "%d %s %d", 3);
 }
 
@@ -40,7 +43,7 @@ int fp_set(char *fmt, char *params, int nparams)
     char args[SCH_CMD_MAX_STR_PARAMS];
     int executions,periodical;
 
-    if(sscanf(params, fmt, &day, &month, &year, &hour, &min, &sec, &command, &args, &executions, &periodical) == nparams)
+    if(cmd_scan_params(params, fmt, &day, &month, &year, &hour, &min, &sec, &command, &args, &executions, &periodical) == nparams)
     {
         str_time.tm_mday = day;
         str_time.tm_mon = month-1;
@@ -73,7 +76,7 @@ int fp_set_unix(char *fmt, char *params, int nparams)
     char command[SCH_CMD_MAX_STR_PARAMS];
     char args[SCH_CMD_MAX_STR_PARAMS];
 
-    if(sscanf(params, fmt, &unixtime, &command, &args, &executions, &periodical) == nparams)
+    if(cmd_scan_params(params, fmt, &unixtime, &command, &args, &executions, &periodical) == nparams)
     {
         int rc = dat_set_fp(unixtime, command, args, executions, periodical);
 
@@ -96,7 +99,7 @@ int fp_delete(char* fmt, char* params, int nparams)
     time_t unixtime;
     int day, month, year, hour, min, sec;
 
-    if(sscanf(params, fmt, &day, &month, &year, &hour, &min, &sec) == nparams)
+    if(cmd_scan_params(params, fmt, &day, &month, &year, &hour, &min, &sec) == nparams)
     {
         str_time.tm_mday = day;
         str_time.tm_mon = month-1;
@@ -144,11 +147,128 @@ int fp_reset(char* fmt, char* params, int nparams)
         return CMD_FAIL;
 }
 
+/**
+ * Decode one packed flight plan entry (see fp_stage)
+ *
+ * @param buff Packed entry
+ * @param len Bytes available in @buff
+ * @param unixtime Pointer for saving the execution time
+ * @param executions Pointer for saving the amount of executions
+ * @param periodical Pointer for saving the period
+ * @param command Buffer of SCH_CMD_MAX_STR_NAME bytes for the command name
+ * @param args Buffer of SCH_CMD_MAX_STR_PARAMS bytes for the arguments
+ * @return Number of bytes used, -1 if the entry is invalid or truncated
+ */
+static int fp_unpack_entry(const uint8_t *buff, int len, int *unixtime, int *executions, int *periodical, char *command, char *args)
+{
+    if(len < FP_ENTRY_HEADER)
+        return -1;
+
+    *unixtime = (int)(((uint32_t)buff[0] << 24) | ((uint32_t)buff[1] << 16) | ((uint32_t)buff[2] << 8) | buff[3]);
+    *periodical = (int)(((uint32_t)buff[4] << 24) | ((uint32_t)buff[5] << 16) | ((uint32_t)buff[6] << 8) | buff[7]);
+    *executions = (buff[8] << 8) | buff[9];
+    int pos = FP_ENTRY_HEADER;
+
+    const uint8_t *end = memchr(buff + pos, '\0', (size_t)(len - pos));
+    if(end == NULL || end - (buff + pos) >= SCH_CMD_MAX_STR_NAME)
+        return -1;
+    strcpy(command, (const char *)(buff + pos));
+    pos = (int)(end - buff) + 1;
+
+    end = memchr(buff + pos, '\0', (size_t)(len - pos));
+    if(pos >= len || end == NULL || end - (buff + pos) >= SCH_CMD_MAX_STR_PARAMS)
+        return -1;
+    strcpy(args, (const char *)(buff + pos));
+    pos = (int)(end - buff) + 1;
+
+    return pos;
+}
+
+int fp_stage(char *fmt, char *params, int nparams)
+{
+    if(params == NULL)
+        return CMD_ERROR;
+
+    // The list length must fit in the parameters received
+    const uint8_t *buff = (const uint8_t *)params;
+    int plen = cmd_params_len(params);
+    int session = buff[0];
+    int len = plen < 2 ? 0 : buff[1];
+    if(plen < 2 || 2 + len > plen)
+    {
+        LOGW(tag, "fp_stage used with %d bytes of entries in %d bytes of params", len, plen);
+        return CMD_FAIL;
+    }
+    int unixtime, executions, periodical;
+    char command[SCH_CMD_MAX_STR_NAME];
+    char args[SCH_CMD_MAX_STR_PARAMS];
+    int pos, used, n = 0;
+
+    // Check the whole list before staging any entry
+    for(pos = 0; pos < len; pos += used)
+    {
+        used = fp_unpack_entry(buff + 2 + pos, len - pos, &unixtime, &executions, &periodical, command, args);
+        if(used < 0)
+        {
+            LOGW(tag, "fp_stage used with an invalid entry at byte %d", pos);
+            return CMD_FAIL;
+        }
+    }
+
+    for(pos = 0; pos < len; pos += used, n++)
+    {
+        used = fp_unpack_entry(buff + 2 + pos, len - pos, &unixtime, &executions, &periodical, command, args);
+        if(dat_stage_fp(session, unixtime, command, args, executions, periodical) != 0)
+            return CMD_FAIL;
+    }
+
+    LOGD(tag, "%d flight plan commands staged", n);
+    return CMD_OK;
+}
+
+int fp_commit(char *fmt, char *params, int nparams)
+{
+    int session, replace;
+    if(cmd_scan_params(params, fmt, &session, &replace) == nparams)
+    {
+        int rc = dat_commit_fp(session, replace);
+
+        if(rc >= 0)
+            return CMD_OK;
+        else
+            return CMD_FAIL;
+    }
+    else
+    {
+        LOGW(tag, "fp_commit used with invalid params: %s", params);
+        return CMD_FAIL;
+    }
+}
+
+int fp_discard(char *fmt, char *params, int nparams)
+{
+    int session;
+    if(cmd_scan_params(params, fmt, &session) != nparams)
+    {
+        LOGW(tag, "fp_discard used with invalid params: %s", params);
+        return CMD_FAIL;
+    }
+
+    int n = dat_discard_fp(session);
+    if(n < 0)
+    {
+        LOGW(tag, "Flight plan stage used by other session");
+        return CMD_FAIL;
+    }
+    LOGI(tag, "%d staged flight plan commands discarded", n);
+    return CMD_OK;
+}
+
 int test_fp_params(char* fmt, char* params,int nparams)
 {
     int num1, num2;
     char str[SCH_CMD_MAX_STR_PARAMS];
-    if(sscanf(params, fmt, &num1, &str, &num2) == nparams)
+    if(cmd_scan_params(params, fmt, &num1, &str, &num2) == nparams)
     {
         printf("The parameters are: %d ; %s ; %d \n",num1, str ,num2);
         return CMD_OK;
@@ -65,7 +65,7 @@ int gssb_pwr(char *fmt, char *params, int nparams)
         return CMD_ERROR_SYNTAX;
 
     int vcc_on, vcc2_on;
-    if(sscanf(params, fmt, &vcc_on, &vcc2_on) != nparams)
+    if(cmd_scan_params(params, fmt, &vcc_on, &vcc2_on) != nparams)
         return CMD_ERROR_SYNTAX;
     
     if (vcc_on > 0)
@@ -90,7 +90,7 @@ int gssb_select_addr(char *fmt, char *params, int nparams)
     if (params == NULL)
         return CMD_ERROR_SYNTAX;
 
-    if(sscanf(params, fmt, &addr) == nparams)
+    if(cmd_scan_params(params, fmt, &addr) == nparams)
     {
         if(addr > 0)
             i2c_addr = addr;
@@ -109,7 +109,7 @@ int gssb_bus_scan(char *fmt, char *params, int nparams)
     int start;
     int end;
 
-    if(params == NULL || (sscanf(params, fmt, &start, &end) != nparams))
+    if(params == NULL || (cmd_scan_params(params, fmt, &start, &end) != nparams))
     {
         start = 1;
         end = 100;
@@ -178,7 +178,7 @@ int gssb_sunsensor_conf(char *fmt, char *params, int nparams)
         return CMD_ERROR_SYNTAX;
 
     //conf = atoi(ctx->argv[1]);
-    if(sscanf(params, fmt, &conf) == nparams) {
+    if(cmd_scan_params(params, fmt, &conf) == nparams) {
         if (gs_gssb_sun_sensor_conf(i2c_addr, i2c_timeout_ms, (uint16_t)conf) != GS_OK)
             return CMD_ERROR_FAIL;
         return CMD_ERROR_NONE;
@@ -203,7 +203,7 @@ int gssb_set_i2c_addr(char *fmt, char *params, int nparams)
         return CMD_ERROR_SYNTAX;
 
     //new_i2c_addr = atoi(ctx->argv[1]);
-    if(sscanf(params, fmt, &new_i2c_addr) != nparams)
+    if(cmd_scan_params(params, fmt, &new_i2c_addr) != nparams)
         return CMD_ERROR_SYNTAX;
 
     // Set new i2c address
@@ -317,7 +317,7 @@ int gssb_msp_outside_temp_calibrate(char *fmt, char *params, int nparams)
     if (params == NULL)
         return CMD_ERROR_SYNTAX;
 
-    if(sscanf(params, fmt, &curr, &res) != nparams)
+    if(cmd_scan_params(params, fmt, &curr, &res) != nparams)
         return CMD_ERROR_SYNTAX;
 
     if ((curr > 400000) || (curr < 100000)) {
@@ -405,7 +405,7 @@ int gssb_interstage_burn_settings(char *fmt, char *params, int nparams)
         printf("Settings locked:\t %"PRIu8"\r\n", settings.locked);
 
     /* Else set settings */
-    } else if (sscanf(params, fmt, &std_time, &increment_ms, &short_cnt_down,
+    } else if (cmd_scan_params(params, fmt, &std_time, &increment_ms, &short_cnt_down,
             &max_repeat, &rep_time_s, &switch_polarity, &reboot_deploy_cnt) == nparams) {
         /* First fetch settings and check that the interstage is unlocked and if it
          * is not then print warning about the settings cannot be changed */
@@ -508,7 +508,7 @@ int gssb_interstage_arm(char *fmt, char *params, int nparams)
     if (params == NULL)
         return CMD_ERROR_SYNTAX;
 
-    if(sscanf(params, fmt, &arm_auto) != nparams)
+    if(cmd_scan_params(params, fmt, &arm_auto) != nparams)
         return CMD_ERROR_SYNTAX;
 
     if (arm_auto)
@@ -539,7 +539,7 @@ int gssb_interstage_state(char *fmt, char *params, int nparams)
         return CMD_ERROR_SYNTAX;
 
     //armed_manual = atoi(ctx->argv[1]);
-    if(sscanf(params, fmt, &armed_manual) != nparams)
+    if(cmd_scan_params(params, fmt, &armed_manual) != nparams)
         return CMD_ERROR_SYNTAX;
 
     if (gs_gssb_istage_settings_unlock(i2c_addr, i2c_timeout_ms) != GS_OK) {
@@ -564,7 +564,7 @@ int gssb_interstage_state(char *fmt, char *params, int nparams)
 int gssb_interstage_settings_unlock(char *fmt, char *params, int nparams)
 {
     int unlock;
-    if (sscanf(params, fmt, &unlock) != nparams)
+    if (cmd_scan_params(params, fmt, &unlock) != nparams)
         return CMD_ERROR_SYNTAX;
 
     if (unlock) {
@@ -638,7 +638,7 @@ int gssb_ar6_burn(char *fmt, char *params, int nparams)
     int duration;
     if (params == NULL)
         return CMD_ERROR_SYNTAX;
-    if (sscanf(params, fmt, &duration) != nparams)
+    if (cmd_scan_params(params, fmt, &duration) != nparams)
         return CMD_ERROR_SYNTAX;
 
     if ((duration > 20) || (duration < 0)) {
@@ -710,7 +710,7 @@ int gssb_common_burn_channel(char *fmt, char *params, int nparams)
     if (params == NULL)
         return CMD_ERROR_SYNTAX;
 
-    if(sscanf(params, fmt, &channel, &duration) != nparams)
+    if(cmd_scan_params(params, fmt, &channel, &duration) != nparams)
         return CMD_ERROR_SYNTAX;
 
     if ((channel > 10) || (channel < 0)) {
@@ -910,7 +910,7 @@ int gssb_common_backup_settings(char *fmt, char *params, int nparams)
     gs_gssb_backup_settings_t settings;
     int minutes, backup_active, max_burn_duration;
 
-    if (sscanf(params, fmt, &minutes, &backup_active, &max_burn_duration) == nparams) {
+    if (cmd_scan_params(params, fmt, &minutes, &backup_active, &max_burn_duration) == nparams) {
         if ((minutes > 5000) || (minutes < 0)) {
             printf("Minutes until deploy out of range [0 - 5000]\r\n");
             return CMD_ERROR_SYNTAX;
@@ -29,6 +29,7 @@ void cmd_obc_init(void)
     cmd_add("obc_debug", obc_debug, "%d", 1);
     cmd_add("obc_reset", obc_reset, "", 0);
     cmd_add("obc_get_mem", obc_get_os_memory, "", 0);
+    cmd_add("obc_get_cmd_pool", obc_get_cmd_pool, "", 0);
     cmd_add("obc_set_time", obc_set_time,"%d",1);
     cmd_add("obc_get_time", obc_get_time, "%d", 1);
     cmd_add("obc_reset_wdt", obc_reset_wdt, "", 0);
@@ -38,6 +39,18 @@ void cmd_obc_init(void)
     cmd_add("obc_pwm_pwr", obc_pwm_pwr, "%d", 1);
     cmd_add("obc_get_sensors", obc_get_sensors, "", 0);
     cmd_add("obc_update_status", obc_update_status, "", 0);
+
+    // Commands that can run in parallel, the others are exclusive
+    cmd_set_class("obc_ident", CMD_CLASS_SHARED);
+    cmd_set_class("obc_debug", CMD_CLASS_SHARED);
+    cmd_set_class("obc_get_mem", CMD_CLASS_SHARED);
+    cmd_set_class("obc_get_cmd_pool", CMD_CLASS_SHARED);
+    cmd_set_class("obc_get_time", CMD_CLASS_SHARED);
+    cmd_set_class("obc_reset_wdt", CMD_CLASS_SHARED);
+
+    // Commands that must not wait behind other commands
+    cmd_set_prio("obc_reset_wdt", CMD_PRIO_CRITICAL);
+    cmd_set_prio("obc_reset", CMD_PRIO_HIGH);
 }
 
 int obc_ident(char* fmt, char* params, int nparams)
@@ -55,7 +68,7 @@ int obc_debug(char *fmt, char *params, int nparams)
         return CMD_FAIL;
     }
     int dbg_type;
-    if(sscanf(params, fmt, &dbg_type) == nparams)
+    if(cmd_scan_params(params, fmt, &dbg_type) == nparams)
     {
         #ifdef AVR32
             switch(dbg_type)
@@ -99,6 +112,9 @@ int obc_reset_wdt(char *fmt, char *params, int nparams)
 
 int obc_reset(char *fmt, char *params, int nparams)
 {
+    // Do not lose the cached status variables and payload samples
+    dat_flush_system_vars();
+    dat_flush_payload_data();
     printf("Resetting system NOW!!\n");
 
     #ifdef LINUX
@@ -157,6 +173,19 @@ int obc_get_os_memory(char *fmt, char *params, int nparams)
     #endif
 }
 
+int obc_get_cmd_pool(char *fmt, char *params, int nparams)
+{
+    cmd_pool_stats_t stats;
+    cmd_pool_get_stats(&stats);
+    printf("Commands pool size:        %d\n", stats.size);
+    printf("Commands in use:           %d\n", stats.in_use);
+    printf("Commands max used (HWM):   %d\n", stats.max_used);
+    printf("Commands from heap:        %d\n", stats.heap_cmds);
+    printf("Parameters from heap:      %d\n", stats.heap_params);
+    printf("Allocation failures:       %d\n", stats.failures);
+    return CMD_OK;
+}
+
 int obc_set_time(char* fmt, char* params,int nparams)
 {
     if(params == NULL)
@@ -165,7 +194,7 @@ int obc_set_time(char* fmt, char* params,int nparams)
         return CMD_FAIL;
     }
     int time_to_set;
-    if(sscanf(params, fmt, &time_to_set) == nparams){
+    if(cmd_scan_params(params, fmt, &time_to_set) == nparams){
         int rc = dat_set_time(time_to_set);
         if (rc == 0)
             return CMD_OK;
@@ -187,7 +216,7 @@ int obc_get_time(char *fmt, char *params, int nparams)
         return CMD_FAIL;
     }
     int format;
-    if(sscanf(params, fmt, &format) == nparams)
+    if(cmd_scan_params(params, fmt, &format) == nparams)
     {
         int rc = dat_show_time(format);
         if (rc == 0)
@@ -205,6 +234,12 @@ int obc_get_time(char *fmt, char *params, int nparams)
 int obc_system(char* fmt, char* params, int nparams)
 {
 #ifdef LINUX
+    // The whole parameters string is the command line, but if the parameters
+    // were added with cmd_add_params_var they are stored in binary format
+    char cmdline[SCH_CMD_MAX_STR_PARAMS];
+    if(params != NULL && params[0] == '\0' && cmd_scan_params(params, fmt, cmdline) == 1)
+        params = cmdline;
+
     if(params != NULL)
     {
         int rc = system(params);
@@ -235,7 +270,7 @@ int obc_set_pwm_duty(char* fmt, char* params, int nparams)
 #ifdef NANOMIND
     int channel;
     int duty;
-    if(sscanf(params, fmt, &channel, &duty) == nparams)
+    if(cmd_scan_params(params, fmt, &channel, &duty) == nparams)
     {
         LOGI(tag, "Setting duty %d to Channel %d", duty, channel);
         gs_a3200_pwm_enable(channel);
@@ -260,7 +295,7 @@ int obc_set_pwm_freq(char* fmt, char* params, int nparams)
     int channel;
     float freq;
     
-    if(sscanf(params, fmt, &channel, &freq) != nparams)
+    if(cmd_scan_params(params, fmt, &channel, &freq) != nparams)
         return CMD_ERROR;
     
     /* The pwm cant handle frequencies above 433 Hz or below 0.1 Hz */
@@ -284,7 +319,7 @@ int obc_pwm_pwr(char *fmt, char *params, int nparams)
     if(params == NULL)
         return CMD_ERROR;
     
-    if(sscanf(params, fmt, &enable) != nparams)
+    if(cmd_scan_params(params, fmt, &enable) != nparams)
         return CMD_ERROR;
     
     /* Turn on/off power channel */
@@ -30,6 +30,15 @@ void cmd_tm_init(void)
     cmd_add("tm_send_all", tm_send_all, "%u %u", 2);
     cmd_add("tm_send_from", tm_send_from, "%u %u %u", 3);
     cmd_add("tm_set_ack", tm_set_ack, "%u %u", 2);
+
+    // Commands sending telemetry are serialized with other IO commands
+    cmd_set_class("tm_send_status", CMD_CLASS_IO);
+    cmd_set_class("tm_send_last", CMD_CLASS_IO);
+    cmd_set_class("tm_send_all", CMD_CLASS_IO);
+    cmd_set_class("tm_send_from", CMD_CLASS_IO);
+
+    // Bulk telemetry downloads must not delay other commands
+    cmd_set_prio("tm_send_all", CMD_PRIO_LOW);
 }
 
 int tm_send_status(char *fmt, char *params, int nparams)
@@ -42,7 +51,7 @@ int tm_send_status(char *fmt, char *params, int nparams)
 
     int dest_node;
     //Format: <node>
-    if(nparams == sscanf(params, fmt, &dest_node))
+    if(nparams == cmd_scan_params(params, fmt, &dest_node))
     {
         com_data_t data;
         memset(&data, 0, sizeof(data));
@@ -87,7 +96,14 @@ int tm_parse_status(char *fmt, char *params, int nparams)
     return CMD_OK;
 }
 
-void send_tel_from_to(int from, int des, int payload, int dest_node)
+/**
+ * Send the payload samples with index from @from to @des-1, filling each frame
+ * with one storage read. Stops at the first sample range that can not be read,
+ * frames are not sent with missing samples.
+ *
+ * @return 0 if all samples were sent, -1 if a read failed
+ */
+int send_tel_from_to(int from, int des, int payload, int dest_node)
 {
     int structs_per_frame = (COM_FRAME_MAX_LEN) / data_map[payload].size;
     uint16_t payload_size = data_map[payload].size;
@@ -98,10 +114,6 @@ void send_tel_from_to(int from, int des, int payload, int dest_node)
         n_frames += 1;
     }
 
-    int index_pay = dat_get_system_var(data_map[payload].sys_index);
-//    int index_ack = dat_get_system_var(data_map[payload].sys_ack);
-//    int delay = index_pay - index_ack;
-
     int i;
     for(i=0; i < n_frames; ++i) {
         com_data_t data;
@@ -111,17 +123,15 @@ void send_tel_from_to(int from, int des, int payload, int dest_node)
         data.frame.type = (uint16_t)(TM_TYPE_PAYLOAD + payload);
         data.frame.ndata = (uint32_t)structs_per_frame;
 
-        int j;
-        for(j=0; j < structs_per_frame; ++j) {
-            if( (i*structs_per_frame) +j >= n_samples ) {
-                data.frame.ndata = (uint32_t) j;
-                break;
-            }
-
-            char buff[payload_size];
-            dat_get_recent_payload_sample(buff, payload, (n_samples+(index_pay-des)) - (i*structs_per_frame+j+1));
-            int mem_delay = (j*payload_size);
-            memcpy(data.frame.data.data8+mem_delay, buff, payload_size);
+        // Fill the frame with one read
+        int first = from + i*structs_per_frame;
+        if(first + structs_per_frame > des) {
+            data.frame.ndata = (uint32_t)(des - first);
+        }
+        if(dat_get_payload_range(payload, first, first + data.frame.ndata, data.frame.data.data8) < 0)
+        {
+            LOGE(tag, "Error reading payload %d samples %d to %d", payload, first, first + data.frame.ndata);
+            return -1;
         }
 
         LOGI(tag, "Sending %d structs of payload %d", data.frame.ndata, (int)payload);
@@ -129,6 +139,7 @@ void send_tel_from_to(int from, int des, int payload, int dest_node)
 
         print_buff(data.frame.data.data8, payload_size*structs_per_frame);
     }
+    return 0;
 }
 
 int tm_get_last(char *fmt, char *params, int nparams)
@@ -140,7 +151,7 @@ int tm_get_last(char *fmt, char *params, int nparams)
     }
 
     uint32_t payload;
-    if(nparams == sscanf(params, fmt, &payload))
+    if(nparams == cmd_scan_params(params, fmt, &payload))
     {
         if(payload >= last_sensor) {
             return CMD_FAIL;
@@ -175,7 +186,7 @@ int tm_send_last(char *fmt, char *params, int nparams)
 
     uint32_t dest_node;
     uint32_t payload;
-    if(nparams == sscanf(params, fmt, &payload, &dest_node))
+    if(nparams == cmd_scan_params(params, fmt, &payload, &dest_node))
     {
         if(payload >= last_sensor) {
             return CMD_FAIL;
@@ -191,7 +202,8 @@ int tm_send_last(char *fmt, char *params, int nparams)
             structs_per_frame = index_pay;
         }
 
-        send_tel_from_to(index_pay-structs_per_frame, index_pay, payload, dest_node);
+        if(send_tel_from_to(index_pay-structs_per_frame, index_pay, payload, dest_node) != 0)
+            return CMD_FAIL;
         return CMD_OK;
     }
     else
@@ -212,14 +224,15 @@ int tm_send_all(char *fmt, char *params, int nparams)
     uint32_t dest_node;
     uint32_t payload;
 
-    if(nparams == sscanf(params, fmt, &payload, &dest_node)) {
+    if(nparams == cmd_scan_params(params, fmt, &payload, &dest_node)) {
 
         if(payload >= last_sensor) {
             return CMD_FAIL;
         }
         int index_pay = dat_get_system_var(data_map[payload].sys_index);
         int index_ack = dat_get_system_var(data_map[payload].sys_ack);
-        send_tel_from_to(index_ack, index_pay, payload, dest_node);
+        if(send_tel_from_to(index_ack, index_pay, payload, dest_node) != 0)
+            return CMD_FAIL;
         return CMD_OK;
     }
     else
@@ -240,7 +253,7 @@ int tm_send_from(char *fmt, char *params, int nparams)
     uint32_t payload;
     uint32_t samples;
 
-    if(nparams == sscanf(params, fmt, &payload, &dest_node, &samples)) {
+    if(nparams == cmd_scan_params(params, fmt, &payload, &dest_node, &samples)) {
 
         if(payload >= last_sensor) {
             return CMD_FAIL;
@@ -258,7 +271,8 @@ int tm_send_from(char *fmt, char *params, int nparams)
             des = index_pay;
         }
 
-        send_tel_from_to(index_ack, des, payload, dest_node);
+        if(send_tel_from_to(index_ack, des, payload, dest_node) != 0)
+            return CMD_FAIL;
         return CMD_OK;
     }
     else
@@ -278,7 +292,7 @@ int tm_set_ack(char *fmt, char *params, int nparams) {
     uint32_t payload;
     uint32_t k_samples;
 
-    if(nparams == sscanf(params, fmt, &payload, &k_samples)) {
+    if(nparams == cmd_scan_params(params, fmt, &payload, &k_samples)) {
 
         if(payload >= last_sensor) {
             LOGE(tag, "payload not found")
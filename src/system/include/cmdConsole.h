@@ -39,4 +39,15 @@ int con_debug_msg(char *fmt, char *params, int nparams);
  */
 int con_help(char *fmt, char *params, int nparams);
 
+/**
+ * Export the command codes table as CSV lines "code,name,params" to be read
+ * by ground tools (see cmd_print_codes)
+ *
+ * @param fmt Str. Parameters format ""
+ * @param params Str. Parameters as string ""
+ * @param nparams Int. Number of parameters 0
+ * @return  CMD_OK if executed correctly or CMD_FAIL in case of errors
+ */
+int con_help_codes(char *fmt, char *params, int nparams);
+
 #endif /* CMD_CONSOLE_H */
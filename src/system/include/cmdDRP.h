@@ -112,4 +112,15 @@ int drp_test_system_vars(char *fmt, char *params, int nparams);
  */
 int drp_set_deployed(char *fmt, char *params, int nparams);
 
+/**
+ * Write the cached status variables and the buffered payload samples to the
+ * permanent storage.
+ *
+ * @param fmt Str. Parameters format ""
+ * @param params Str. Parameters as string ""
+ * @param nparams Int. Number of parameters 0
+ * @return  CMD_OK if executed correctly or CMD_FAIL in case of errors
+ */
+int drp_sync(char *fmt, char *params, int nparams);
+
 #endif /* CMD_DRP_H */
@@ -17,6 +17,11 @@
 #include "repoCommand.h"
 #include "repoData.h"
 
+/**
+ * Size of the fixed part of a packed flight plan entry (see fp_stage)
+ */
+#define FP_ENTRY_HEADER (2*sizeof(uint32_t) + sizeof(uint16_t))
+
 /**
  * This function registers the list of command in the system, initializing the
  * functions array. This function must be called at every system start up.
@@ -81,6 +86,63 @@ int fp_show(char* fmt, char* params, int nparams);
  */
 int fp_reset(char* fmt, char* params, int nparams);
 
+/**
+ * Stage a list of commands to be added to the flight plan by fp_commit. Used
+ * to upload a flight plan in bulk, the list can be split into several
+ * fp_stage commands sent in one or more frames. Entries are packed as binary,
+ * numbers in big endian:
+ *
+ *      <session:1> <len:1> { <unixtime:4> <periodical:4> <executions:2> <command> <args> }
+ *
+ * Where @session is an id chosen by the uploader, used again in fp_commit or
+ * fp_discard, @len is the number of bytes of the entries and @command and
+ * @args are null terminated strings. If any entry is invalid, or @len exceeds
+ * the parameters length (see cmd_params_len), no entry is staged. The stage
+ * is refused while other session has staged commands.
+ *
+ * @param fmt Str. Parameters format "%p"
+ * @param params uint8_t *. Packed list of entries
+ * @param nparams Int. Number of parameters 1
+ * @return  CMD_OK if executed correctly or CMD_FAIL in case of errors
+ *
+ * @code
+ *      // Stage "obc_debug 1" at 1542925093, executed once, not periodical,
+ *      // in session 7
+ *      uint8_t list[] = {7, 22, 0x5B, 0xF7, 0x2B, 0x25, 0, 0, 0, 0, 0, 1,
+ *                        'o', 'b', 'c', '_', 'd', 'e', 'b', 'u', 'g', 0, '1', 0};
+ *      cmd_t *cmd = cmd_get_str("fp_stage");
+ *      cmd_add_params_raw(cmd, list, sizeof(list));
+ *      cmd_send(cmd);
+ * @endcode
+ */
+int fp_stage(char *fmt, char *params, int nparams);
+
+/**
+ * Commit the commands staged with fp_stage to the flight plan at once. The
+ * flight plan is replaced or the staged commands are merged into it. The
+ * flight plan is not modified in case of errors.
+ *
+ * @param fmt Str. Parameters format "%d %d"
+ * @param params Str. Parameters as string "<session> <replace>", the session
+ * used in fp_stage and 1 to replace the flight plan, 0 to merge the staged
+ * commands
+ * @param nparams Int. Number of parameters 2
+ * @return  CMD_OK if executed correctly or CMD_FAIL in case of errors
+ */
+int fp_commit(char *fmt, char *params, int nparams);
+
+/**
+ * Discard the commands staged with fp_stage
+ *
+ * @param fmt Str. Parameters format "%d"
+ * @param params Str. Parameters as string "<session>", the session used in
+ * fp_stage
+ * @param nparams Int. Number of parameters 1
+ * @return  CMD_OK if executed correctly or CMD_FAIL if the stage belongs to
+ * other session
+ */
+int fp_discard(char *fmt, char *params, int nparams);
+
 /**
  * Test that the command parameters are well read
  *
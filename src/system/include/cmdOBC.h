@@ -84,6 +84,17 @@ int obc_reset(char *fmt, char *params, int nparams);
  */
 int obc_get_os_memory(char *fmt, char *params, int nparams);
 
+/**
+ * Print the commands pool usage statistics, including the high-water mark and
+ * the number of allocations that fell back to the heap.
+ *
+ * @param fmt Str. Parameters format ""
+ * @param params Str. Parameters as string ""
+ * @param nparams Int. Number of parameters 0
+ * @return  CMD_OK if executed correctly or CMD_FAIL in case of errors
+ */
+int obc_get_cmd_pool(char *fmt, char *params, int nparams);
+
 /**
  * Set the system time only if is not running Linux
  *
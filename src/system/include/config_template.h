@@ -68,6 +68,8 @@
 #define SCH_TRX_PORT_TC         (10)               ///< Telecommands port
 #define SCH_TRX_PORT_RPT        (11)               ///< Digirepeater port (resend packets)
 #define SCH_TRX_PORT_CMD        (12)               ///< Commands port (execute console commands)
+#define SCH_TRX_PORT_TC_BIN     (13)               ///< Binary telecommands port (see cmd_parse_from_bin)
+#define SCH_TRX_TC_TIMEOUT      (1000)             ///< Max milliseconds waiting for the TC results before replying
 #define SCH_COMM_ZMQ_OUT        "{{SCH_ZMQ_OUT}}"  ///< Out socket URI
 #define SCH_COMM_ZMQ_IN         "{{SCH_ZMQ_IN}}"   ///< In socket URI
 #define SCH_TX_INHIBIT          10                 /// Default silent time in seconds [0, 1800 (30min)]
@@ -77,14 +79,25 @@
 #define SCH_TX_BAUD             4800               /// Default TRX baudrate [4800|9600|19200
 
 /* Data repository settings */
-#define SCH_STORAGE_MODE        {{SCH_STORAGE}}    ///< Status repository location. (0) RAM, (1) Single external.
+#define SCH_STORAGE_MODE        {{SCH_STORAGE}}    ///< Status repository location. (0) RAM, (1) SQLite, (2) PostgreSQL, (3) Memory mapped files
 #define SCH_STORAGE_TRIPLE_WR   {{SCH_STORAGE_TRIPLE_WR}}   ///< Tripled writing enabled (0 | 1)
-#define SCH_STORAGE_FILE        "/tmp/suchai.db"   ///< File to store the database, only if @SCH_STORAGE_MODE is 1
+#define SCH_STORAGE_CACHE       1   ///< Cache system variables in RAM, only if @SCH_STORAGE_MODE > 0 (0 | 1)
+#define SCH_STORAGE_CACHE_PERIOD 10 ///< Seconds between writes of modified system variables to storage
+#define SCH_STORAGE_FILE        "/tmp/suchai.db"   ///< File to store the database (1), or prefix of the mapped files (3)
+#define SCH_STORAGE_WAL         1   ///< Use the SQLite write-ahead log journal, only if @SCH_STORAGE_MODE is 1 (0 | 1)
+#define SCH_STORAGE_SYNC        1   ///< SQLite synchronous level. (0) OFF, (1) NORMAL, (2) FULL, also syncs every write of mapped files
+#define SCH_STORAGE_MMAP_SIZE   (4*1024*1024)   ///< Database bytes mapped in memory by SQLite, 0 to disable
+#define SCH_STORAGE_PAGE_CACHE  1024 ///< SQLite page cache size in KiB
+#define SCH_STORAGE_CHECKPOINT  1000 ///< Pages in the write-ahead log that trigger a checkpoint
+#define SCH_STORAGE_BUSY_TIMEOUT 1000 ///< Milliseconds waiting for a locked database
+#define SCH_STORAGE_PAYLOAD_BLOB 0  ///< Payload samples storage. (0) One column per field, (1) Packed structs as BLOBs
 #define SCH_STORAGE_PGUSER      "{{SCH_STORAGE_PGUSER}}"
 
 #define SCH_SECTIONS_PER_PAYLOAD 2                 ///< Memory blocks for storing each payload type TODO: Make configurable per payload
 #define SCH_SIZE_PER_SECTION 256*1024              ///< Size of each memory block in flash storage
 #define SCH_FLASH_INIT_MEMORY 0                    ///< Initial address in flash storage
+#define SCH_FLASH_PAGE_SIZE 512                    ///< Size of a program page in flash storage
+#define SCH_FLASH_WRITE_BUFFER 1                   ///< Combine payload samples in RAM up to a flash page, written at most @SCH_STORAGE_CACHE_PERIOD seconds later (0 | 1)
 
 /**
  * Memory settings.
@@ -105,12 +118,26 @@
 #define SCH_TASK_HKP_STACK        (5*256)   ///< Housekeeping task stack size in words
 #define SCH_TASK_CSP_STACK        (5*256)     ///< CSP route task stack size in words
 
+#ifdef LINUX
+    #define SCH_TASK_EXE_WORKERS  (4)       ///< Number of executer tasks running commands in parallel
+#else
+    #define SCH_TASK_EXE_WORKERS  (1)       ///< Number of executer tasks running commands in parallel
+#endif
+
 #define SCH_BUFF_MAX_LEN          (256)     ///< General buffers max length in bytes
 #define SCH_BUFFERS_CSP           (5)       ///< Number of available CSP buffers
 #define SCH_FP_MAX_ENTRIES        (25)      ///< Max number of flight plan entries
+#define SCH_FP_MAX_SLEEP          (10)      ///< Max seconds the flight plan task sleeps waiting for the next entry
+#define SCH_FP_MAX_LATE           (2)       ///< Seconds a flight plan entry can be late before applying SCH_FP_LATE_POLICY
+#define SCH_FP_LATE_POLICY        (2)       ///< Late flight plan entries are: (0) executed, (1) skipped, (2) executed once coalescing periodic repetitions
 #define SCH_CMD_MAX_ENTRIES       (255)      ///< Max number of commands in the repository
 #define SCH_CMD_MAX_STR_PARAMS    (64)      ///< Limit for the parameters length
 #define SCH_CMD_MAX_STR_NAME      (64)      ///< Limit for the length of the name of a command
 #define SCH_CMD_MAX_STR_FORMAT    (32)      ///< Limit for the length of the format field of a command
+#define SCH_CMD_POOL_SIZE         (32)      ///< Number of preallocated commands (with parameters buffer)
+#define SCH_CMD_POOL_HEAP         (1)       ///< Use the heap if the commands pool is exhausted (0 | 1)
+#define SCH_CMD_PRIO_QUEUE_LEN    (25)      ///< Max commands waiting in the dispatcher per priority level
+#define SCH_CMD_PRIO_AGING        (1000)    ///< Milliseconds waiting to promote a command one priority level
+#define SCH_CMD_FUTURES           (8)       ///< Max commands sent with cmd_send_async waiting for its result
 
 #endif //SUCHAI_CONFIG_H
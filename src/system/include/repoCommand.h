@@ -40,12 +40,22 @@
 
 /* Macros */
 /**
- * Send command to execution using dispatcherQueue (must be initialized). Blocks
- * if the queue is full
+ * Send command to execution using the dispatcher queues (must be initialized).
+ * The command is queued with its registered priority (see cmd_set_prio).
+ * Blocks if the queue is full
  *
  * @param cmd *cmd_type, pointer to command
  */
-#define cmd_send(cmd) if(cmd != NULL){osQueueSend(dispatcher_queue, &cmd, portMAX_DELAY);}
+#define cmd_send(cmd) if(cmd != NULL){cmd_queue_send(cmd, portMAX_DELAY);}
+
+/**
+ * Send command to execution with priority @p, overriding the priority the
+ * command was registered with (see cmd_set_prio). Blocks if the queue is full.
+ *
+ * @param cmd *cmd_type, pointer to command
+ * @param p Int. CMD_PRIO_CRITICAL, CMD_PRIO_HIGH, CMD_PRIO_NORMAL or CMD_PRIO_LOW
+ */
+#define cmd_send_prio(cmd, p) if(cmd != NULL){(cmd)->prio = (p); cmd_queue_send(cmd, portMAX_DELAY);}
 
 /* Command definitions */
 /**
@@ -55,12 +65,33 @@
 #define CMD_FAIL 0      ///< Command not executed as expected
 #define CMD_ERROR -1    ///< Command returned an error
 
+/**
+ * Command concurrency classes. Define which commands can be executed at the
+ * same time when more than one executer is available (SCH_TASK_EXE_WORKERS).
+ * Commands are dispatched in order, so a command waits until all the running
+ * commands it conflicts with have finished.
+ */
+#define CMD_CLASS_EXCLUSIVE 0   ///< Runs alone, the default for every command
+#define CMD_CLASS_SHARED 1      ///< Runs in parallel with shared and IO commands
+#define CMD_CLASS_IO 2          ///< Runs in parallel with shared commands, serialized with other IO commands
+
+/**
+ * Command priorities. The dispatcher executes first the commands with higher
+ * priority (lower value), waiting commands are promoted one level every
+ * SCH_CMD_PRIO_AGING milliseconds.
+ */
+#define CMD_PRIO_CRITICAL 0     ///< Critical commands, such as watchdog resets
+#define CMD_PRIO_HIGH 1         ///< High priority commands
+#define CMD_PRIO_NORMAL 2       ///< Default priority
+#define CMD_PRIO_LOW 3          ///< Background commands, such as periodic debug
+#define CMD_PRIO_LEVELS 4       ///< Number of priority levels
+
 /**
  *  Defines the prototype of a command
  */
 typedef int (*cmdFunction)(char *fmt, char *params, int nparams);
 
-#define IF_PARSE_PARAMS(...) if(sscanf(params, fmt, ##__VA_ARGS) == nparams)
+#define IF_PARSE_PARAMS(...) if(cmd_scan_params(params, fmt, ##__VA_ARGS__) == nparams)
 
 /**
  * Structure to store a command sent to
@@ -70,10 +101,26 @@ typedef struct cmd_type{
     int id;                     ///< Command id
     int nparams;                ///< Number of parameters
     char *fmt;                  ///< Format of parameters
+    char *args;                 ///< Precompiled parameters types, NULL if not supported
     char *params;               ///< List of parameters (use malloc)
+    int params_len;             ///< Length of params in bytes
+    int params_bin;             ///< 1 if params is a binary vector (see cmd_add_params_var)
+    int exec_class;             ///< Concurrency class (CMD_CLASS_*)
+    int prio;                   ///< Priority (CMD_PRIO_*)
+    int future;                 ///< Handle to report the result (see cmd_send_async), -1 if none
+    portTick queued;            ///< Tick when the command was queued, to age its priority
     cmdFunction function;       ///< Command function
 } cmd_t;
 
+/**
+ * Structure to report the result of an executed command to the dispatcher
+ * using executer_stat_queue
+ */
+typedef struct cmd_stat_type{
+    int result;                 ///< Command result (CMD_OK, CMD_FAIL, CMD_ERROR)
+    int exec_class;             ///< Concurrency class of the executed command
+} cmd_stat_t;
+
 /**
  * Structure to store the list of
  * available commands by name
@@ -81,10 +128,39 @@ typedef struct cmd_type{
 typedef struct cmd_list_type{
     int nparams;                ///< Number of parameters
     char *fmt;                  ///< Format of parameters
+    char *args;                 ///< Precompiled parameters types (use malloc)
     char *name;                 ///< Command name (use malloc)
+    uint16_t code;              ///< Stable command code, used in binary TC frames
+    int exec_class;             ///< Concurrency class (CMD_CLASS_*)
+    int prio;                   ///< Default priority (CMD_PRIO_*)
     cmdFunction function;       ///< Command function
 } cmd_list_t;
 
+/**
+ * Command pool usage statistics
+ */
+typedef struct cmd_pool_stats_type{
+    int size;                   ///< Number of commands in the pool
+    int in_use;                 ///< Commands currently taken from the pool
+    int max_used;               ///< High-water mark of commands taken from the pool
+    int heap_cmds;              ///< Commands allocated from the heap (pool exhausted)
+    int heap_params;            ///< Parameters allocated from the heap (too large)
+    int failures;               ///< Allocations failed (SCH_CMD_POOL_HEAP disabled)
+} cmd_pool_stats_t;
+
+/**
+ * Commands waiting for the dispatcher, one queue per priority level. Created
+ * by cmd_repo_init with SCH_CMD_PRIO_QUEUE_LEN elements each.
+ */
+extern osQueue dispatcher_prio_queue[CMD_PRIO_LEVELS];
+
+/**
+ * Length of dispatcher_queue. There is at most one wake-up mark per command
+ * waiting in the priority queues or at their heads in the dispatcher, and
+ * one per result of the executers, so sending a mark does not block.
+ */
+#define CMD_DISPATCHER_QUEUE_LEN (CMD_PRIO_LEVELS*(SCH_CMD_PRIO_QUEUE_LEN+1)+SCH_TASK_EXE_WORKERS)
+
 /* Function definitions */
 
 /**
@@ -94,7 +170,8 @@ typedef struct cmd_list_type{
  * @param fparams Str. defines format of parameters, separated by spaces
  * @param nparam Int. number of parameters, according to @fparams
  * @return Int. Length of command list in case of success or CMD_ERROR (-1) if
- * an error occurred.
+ * an error occurred, also if the code of @name (see cmd_get_code_str) is
+ * already used by a different command.
  *
  * @code
  *      // Adds command foo with 2 params: integer and string
@@ -105,6 +182,103 @@ typedef struct cmd_list_type{
  */
 int cmd_add(char *name, cmdFunction function, char *fmt, int nparams);
 
+/**
+ * Queue a command to be executed. The command is added to the dispatcher queue
+ * of its priority level (@cmd->prio) and a wake-up mark is sent to
+ * dispatcher_queue. Usually called through cmd_send or cmd_send_prio.
+ *
+ * @param cmd cmd_t *. Command to execute
+ * @param timeout Max time to wait if the priority queue or dispatcher_queue
+ * are full
+ * @return Int. CMD_OK if the command was queued, CMD_ERROR otherwise. In case
+ * of errors the caller still owns the command.
+ */
+int cmd_queue_send(cmd_t *cmd, uint32_t timeout);
+
+/**
+ * Send a command to execution without blocking. If @handle is not NULL a
+ * future is attached to the command to retrieve its result with cmd_wait.
+ * The command is consumed if it was queued. If the dispatcher queue is full
+ * the future is released and the caller still owns the command, to retry or
+ * free it with cmd_free.
+ *
+ * @param cmd cmd_t *. Command to execute
+ * @param handle Int *. Returns the future handle, or -1 in case of errors.
+ * Can be NULL if the result is not required.
+ * @return Int. CMD_OK if the command was queued, CMD_FAIL if the command was
+ * queued but there are no free futures (SCH_CMD_FUTURES) to return its result,
+ * CMD_ERROR if the dispatcher queue is full and the command was not queued.
+ *
+ * @code
+ *      int handle, result;
+ *      cmd_t *cmd = cmd_get_str("obc_get_mem");
+ *      if(cmd_send_async(cmd, &handle) == CMD_OK)
+ *      {
+ *          if(cmd_wait(handle, 1000, &result) != CMD_OK)
+ *              cmd_future_release(handle); // Not finished yet, give up
+ *      }
+ * @endcode
+ */
+int cmd_send_async(cmd_t *cmd, int *handle);
+
+/**
+ * Wait for the result of a command sent with cmd_send_async. Once the result
+ * is returned the handle is released and must not be used again.
+ *
+ * @param handle Int. Future handle returned by cmd_send_async
+ * @param timeout Max time to wait for the command result
+ * @param result Int *. Returns the command result (CMD_OK, CMD_FAIL,
+ * CMD_ERROR). Can be NULL.
+ * @return Int. CMD_OK if the command was executed, CMD_FAIL if the timeout
+ * expired (the handle is still valid) or CMD_ERROR if the handle is invalid.
+ */
+int cmd_wait(int handle, uint32_t timeout, int *result);
+
+/**
+ * Release a future without waiting for the command result. The command is
+ * still executed, its result is discarded.
+ *
+ * @param handle Int. Future handle returned by cmd_send_async
+ */
+void cmd_future_release(int handle);
+
+/**
+ * Report the result of an executed command to its future. Used by the
+ * executer, does nothing if @handle is -1.
+ *
+ * @param handle Int. Future handle (cmd_t.future)
+ * @param result Int. Command result
+ */
+void cmd_future_complete(int handle, int result);
+
+/**
+ * Set the concurrency class of a registered command. By default all commands
+ * are CMD_CLASS_EXCLUSIVE.
+ *
+ * @param name Str. Command name
+ * @param exec_class Int. CMD_CLASS_EXCLUSIVE, CMD_CLASS_SHARED or CMD_CLASS_IO
+ * @return Int. CMD_OK in case of success or CMD_ERROR if the command does not
+ * exist.
+ *
+ * @code
+ *      cmd_add("com_ping", com_ping, "%d", 1);
+ *      cmd_set_class("com_ping", CMD_CLASS_IO);
+ * @endcode
+ */
+int cmd_set_class(char *name, int exec_class);
+
+/**
+ * Set the default priority of a registered command. By default all commands
+ * are CMD_PRIO_NORMAL. Use cmd_send_prio to override the priority of a single
+ * command.
+ *
+ * @param name Str. Command name
+ * @param prio Int. CMD_PRIO_CRITICAL, CMD_PRIO_HIGH, CMD_PRIO_NORMAL or CMD_PRIO_LOW
+ * @return Int. CMD_OK in case of success or CMD_ERROR if the command does not
+ * exist.
+ */
+int cmd_set_prio(char *name, int prio);
+
 /**
  * Create a new command by name
  *
@@ -123,6 +297,29 @@ cmd_t * cmd_get_str(char *name);
  */
 cmd_t * cmd_get_idx(int idx);
 
+/**
+ * Create a new command by code. The code is a stable 16 bits identifier
+ * derived from the command name (see cmd_get_code_str), used to send commands
+ * in binary TC frames.
+ *
+ * @param code Int. Command code
+ * @return cmd_t * Pointer to command structure already initialized. Null if
+ *                 command does not exists.
+ */
+cmd_t * cmd_get_code(int code);
+
+/**
+ * Get the code of a command name. The code is the 32 bits djb2 hash of the name
+ * folded to 16 bits ((h ^ (h >> 16)) & 0xFFFF), so it does not change between
+ * firmware versions and ground tools can compute it. Command names with the same
+ * code are rejected by cmd_add. Use the help_codes command (cmd_print_codes)
+ * to export the codes of all the registered commands.
+ *
+ * @param name Str. Command name
+ * @return Int. Command code or CMD_ERROR if @name is NULL
+ */
+int cmd_get_code_str(char *name);
+
 /**
  * Find the name of a command by id. This function allocates memory for the
  * string so the user must free the array.
@@ -170,7 +367,10 @@ void cmd_add_params_str(cmd_t *cmd, char *params);
 
 /**
  * Fills command parameters by variables using the registered parameters format.
- * @note variables are converted to string
+ * @note variables are stored in a binary format, precompiled from the
+ * parameters format when the command was registered, that handlers read with
+ * cmd_scan_params. Formats using %n, %p, %c, widths or length modifiers are
+ * converted to string.
  *
  * @param cmd cmd_t. Command to fill parameters
  * @param ... List of variables to fill as parameters
@@ -188,6 +388,34 @@ void cmd_add_params_str(cmd_t *cmd, char *params);
  */
 void cmd_add_params_var(cmd_t *cmd, ...);
 
+/**
+ * Reads the command parameters, to be used by command handlers instead of
+ * sscanf. Parameters can be a string (console, TC, flight plan) that is parsed
+ * with sscanf, or a binary vector filled by cmd_add_params_var that is copied
+ * directly to the variables. Binary vectors are marked in the command
+ * (cmd_t.params_bin), so raw parameters (%p) are never read as binary, and
+ * are validated against @fmt and their length before reading them. Binary
+ * strings are copied up to SCH_CMD_MAX_STR_PARAMS bytes, so string variables
+ * must have that size.
+ *
+ * @param params Str. Command parameters
+ * @param fmt Str. Command parameters format
+ * @param ... Pointers to the variables to fill, as in sscanf
+ * @return Int. Number of variables filled, or -1 if @params is NULL, empty
+ * or an invalid binary vector
+ *
+ * @code
+ *      int foo(char *fmt, char *params, int nparams)
+ *      {
+ *          int a; char b[SCH_CMD_MAX_STR_PARAMS];
+ *          if(cmd_scan_params(params, fmt, &a, b) == nparams)
+ *              return CMD_OK;
+ *          return CMD_ERROR;
+ *      }
+ * @endcode
+ */
+int cmd_scan_params(const char *params, const char *fmt, ...);
+
 /**
  * Returns a new command with parameters form a string with the format:
  * <command> [parameters]. The [parameters] field is optional. Returns NULL if
@@ -204,18 +432,78 @@ void cmd_add_params_var(cmd_t *cmd, ...);
  */
 cmd_t *cmd_parse_from_str(char *buff);
 
+/**
+ * Returns a new command from a binary TC frame. A binary frame is a list of
+ * commands with the format:
+ *
+ *      <code:2> <len:1> <params:len>
+ *
+ * @code is the command code, big endian (see cmd_get_code). @params are
+ * encoded following the command parameters format: integers (%d %i %u %x %o)
+ * as zigzag varints, floats (%f %e %g) as 4 bytes big endian and strings (%s)
+ * null terminated. Commands with binary parameters (%p) receive @params as is
+ * and commands with other formats receive @params as a string.
+ *
+ * @param buff Binary TC frame
+ * @param len Length of @buff
+ * @param cmd cmd_t **. Returns a new command or NULL if the command code is
+ * unknown or the parameters are invalid.
+ * @return Int. Number of bytes consumed from @buff or -1 if the frame is
+ * truncated.
+ *
+ * @code
+ *      // drp_set_var 10 200
+ *      uint8_t frame[] = {0xD6, 0xDE, 3, 0x14, 0x90, 0x03};
+ *      cmd_t *cmd;
+ *      int n = cmd_parse_from_bin(frame, sizeof(frame), &cmd);
+ * @endcode
+ */
+int cmd_parse_from_bin(const uint8_t *buff, int len, cmd_t **cmd);
+
 /**
  * Destroys a command and frees the allocated memory
  */
 void cmd_free(cmd_t *cmd);
 
+/**
+ * Get a copy of the command pool usage statistics. Commands and its string
+ * parameters are taken from a preallocated pool of SCH_CMD_POOL_SIZE elements,
+ * the heap is only used, if SCH_CMD_POOL_HEAP is enabled, when the pool is
+ * exhausted or for raw parameters larger than SCH_CMD_MAX_STR_PARAMS.
+ *
+ * @param stats cmd_pool_stats_t *. Structure to fill with the statistics
+ */
+void cmd_pool_get_stats(cmd_pool_stats_t *stats);
+
+/**
+ * Get the length of a parameters buffer owned by a command. Handlers receive
+ * only the parameters, this is how they find the size of binary parameters
+ * (such as %p) before reading them.
+ *
+ * @param params Char *. Parameters of a command (cmd_t.params)
+ * @return Int. Length in bytes, -1 if @params does not belong to a command
+ */
+int cmd_params_len(const char *params);
+
 /**
 * Print the list of registered commands
 */
 void cmd_print_all(void);
 
 /**
- * Initializes the command buffer adding null_cmd
+ * Print the code table of the registered commands as CSV lines
+ * "code,name,params", with a header line, to be read by ground tools. The
+ * params column is the command format string, so it may contain spaces.
+ */
+void cmd_print_codes(void);
+
+/**
+ * Initializes the command buffer adding null_cmd. The command list is sorted
+ * by name and the repository is sealed: command ids do not change anymore and
+ * lookups (cmd_get_str, cmd_get_idx, cmd_get_name) run without locking.
+ * Commands added after init (and cmd_set_class/cmd_set_prio changes) are
+ * published as a new copy of the list, the previous copy is freed once no
+ * lookup is using it.
  *
  * @return 1
  */
@@ -28,6 +28,8 @@
 #include "data_storage.h"
 
 #include "osSemphr.h"
+#include "osQueue.h"
+#include "osDelay.h"
 
 /** Union for easily casting status variable types */
 typedef union fvalue{
@@ -49,6 +51,12 @@ typedef union fvalue{
 /** Copy a float system @var to a status struct @st */
 #define DAT_CPY_SYSTEM_VAR_F(st, var) {fvalue_t v; v.i = (float)dat_get_system_var(var); st->var = v.f;}
 
+/** Copy a system @var from a snapshot @values to a status struct @st */
+#define DAT_CPY_SNAPSHOT_VAR(st, values, var) st->var = values[var]
+
+/** Copy a float system @var from a snapshot @values to a status struct @st */
+#define DAT_CPY_SNAPSHOT_VAR_F(st, values, var) {fvalue_t v; v.i = values[var]; st->var = v.f;}
+
 /** Print the name and value of a integer system status variable */
 #define DAT_PRINT_SYSTEM_VAR(st, var) printf("\t%s: %lu\n", #var, (unsigned long)st->var)
 
@@ -146,6 +154,11 @@ typedef enum dat_system {
     dat_drp_ack_eps,                  ///< EPS data index acknowledge
     dat_drp_ack_lang,                 ///< Langmuir data index acknowledge
 
+    /// FPL: Flight plan execution lateness
+    dat_fpl_late,                 ///< Lateness of the last executed flight plan command [s]
+    dat_fpl_late_max,             ///< Max. lateness of an executed flight plan command [s]
+    dat_fpl_skipped,              ///< Flight plan executions skipped because they were late
+
     /// Add custom status variables here
     //dat_custom,                 ///< Variable description
 
@@ -221,6 +234,11 @@ typedef struct __attribute__((packed)) dat_status_s {
     uint32_t dat_drp_ack_eps;       ///< EPS data index acknowledge
     uint32_t dat_drp_ack_lang;      ///< Langmuir data index acknowledge
 
+    /// FPL: Flight plan execution lateness
+    int32_t dat_fpl_late;           ///< Lateness of the last executed flight plan command [s]
+    int32_t dat_fpl_late_max;       ///< Max. lateness of an executed flight plan command [s]
+    int32_t dat_fpl_skipped;        ///< Flight plan executions skipped because they were late
+
     /// Add custom status variables here
     //uint32_t dat_custom;          ///< Variable description
 
@@ -310,6 +328,38 @@ extern struct __attribute__((__packed__)) map {
     char var_names[200];
 } data_map[last_sensor];
 
+#define DAT_PAYLOAD_MAX_FIELDS (16)     ///< Max. number of fields in a payload struct
+
+/**
+ * Payload struct field, parsed from data_map
+ */
+typedef struct dat_payload_field {
+    char type;              ///< Field type, the format conversion: 'd', 'u' or 'f'
+    uint16_t offset;        ///< Field offset in the payload struct, in bytes
+    uint16_t size;          ///< Field size, in bytes
+    char *name;             ///< Field name, also the table column name
+} dat_payload_field_t;
+
+/**
+ * Payload struct schema, parsed from data_map only once
+ */
+typedef struct dat_payload_desc {
+    int nfields;                                        ///< Number of fields
+    int time_field;                                     ///< Index of the timestamp field, -1 if none
+    dat_payload_field_t fields[DAT_PAYLOAD_MAX_FIELDS]; ///< Fields, in struct order
+    char names[200];                                    ///< Buffer with the fields names
+} dat_payload_desc_t;
+
+/**
+ * Get the schema of a payload struct: fields types, offsets, sizes and names.
+ * Schemas are parsed from data_map in dat_repo_init, or in the first call if
+ * the data repository is not initialized.
+ *
+ * @param payload Payload id
+ * @return Pointer to the payload schema, NULL if the payload id is invalid
+ */
+const dat_payload_desc_t *dat_get_payload_desc(int payload);
+
 /**
  * Initializes payload storage helper variables
  */
@@ -351,6 +401,28 @@ void dat_set_system_var(dat_system_t index, int value);
  */
 int dat_get_system_var(dat_system_t index);
 
+/**
+ * Writes the modified status variables to the permanent storage. Only used if
+ * SCH_STORAGE_CACHE is enabled and SCH_STORAGE_MODE > 0, in that case the
+ * variables are read and written in a RAM cache and modified values are
+ * written to storage in one transaction every SCH_STORAGE_CACHE_PERIOD seconds
+ * or as soon as a critical variable (operation mode, reset counter, deployment
+ * or TRX settings) is modified. Call before resetting the system.
+ *
+ * @return 0 OK, -1 Error
+ */
+int dat_flush_system_vars(void);
+
+/**
+ * Reads all the status repository's fields at once. The repository is locked
+ * only once and, if permanent memory is being used, all the values (and their
+ * copies if SCH_STORAGE_TRIPLE_WR is enabled) are read with only one query.
+ *
+ * @param values Int *. Array of dat_system_last_var elements to store the
+ * values, indexed by dat_system_t
+ */
+void dat_get_system_snapshot(int *values);
+
 /**
  * Copies the status repository's field values to another dat_status_t struct.
  *
@@ -378,11 +450,16 @@ void dat_print_status(dat_status_t *status);
  * Gets an executable command from the flight plan repo.
  *
  * Given an elapsed seconds counter (assumed to be system time), sets the other parameter pointers to the values
- * of the first command found in the repo that is eligible for execution.
+ * of the oldest command in the repo with execution time lower or equal than elapsed_sec, so commands missed while
+ * the system was busy or down are executed in order.
  *
  * Deletes the command from the repo before returning. If the command is periodic, the function saves a copy with
  * updated execution time (the period is added to the time of the next execution execution).
  *
+ * Commands more than SCH_FP_MAX_LATE seconds late are handled according to SCH_FP_LATE_POLICY: (0) executed,
+ * (1) skipped or (2) executed once, coalescing the missed repetitions of periodic commands. The lateness is
+ * recorded in dat_fpl_late and dat_fpl_late_max, and skipped executions are counted in dat_fpl_skipped.
+ *
  * @param elapsed_sec Time for finding executable commands
  * @param command Pointer for saving the command name
  * @param args Pointer for saving the command arguments
@@ -393,14 +470,15 @@ void dat_print_status(dat_status_t *status);
 int dat_get_fp(int elapsed_sec, char* command, char* args, int* executions, int* periodical);
 
 /**
- * Saves a new command into the flight plan repo.
+ * Saves a new command into the flight plan repo. A command already set to
+ * execute at the same time is replaced.
  *
  * @param timetodo Future time when the command should execute
  * @param command Command name
  * @param args Command arguments
  * @param executions Amount of times the command has to execute pero periodic cycle
  * @param periodical Period of periodical execution of the command, in unix-time
- * @return 0 if OK, 1 if no available space was found //
+ * @return 0 if OK, -1 or 1 if no available space was found
  */
 int dat_set_fp(int timetodo, char* command, char* args, int executions, int periodical);
 
@@ -431,6 +509,66 @@ int dat_reset_fp(void);
  */
 int dat_show_fp (void);
 
+/**
+ * Gets the execution time of the next command in the flight plan, from an
+ * index kept in RAM, without reading the flight plan storage.
+ *
+ * @return Unix-time of the earliest command, -1 if the flight plan is empty
+ */
+int dat_get_fp_next(void);
+
+/**
+ * Blocks the calling task until the execution time of the next command in the
+ * flight plan changes, because a command was added before it, or until the
+ * timeout expires. Used by the flight plan task to sleep
+ * until the next command is due.
+ *
+ * @param timeout Max time to wait, in milliseconds
+ * @return 0 if the flight plan changed, -1 if the timeout expired
+ */
+int dat_wait_fp(uint32_t timeout);
+
+/**
+ * Stages a command to be added to the flight plan by dat_commit_fp. Used to
+ * upload a flight plan in bulk, the flight plan is not modified until the
+ * staged commands are committed. A staged command with the same time is
+ * replaced. The stage belongs to the upload session of its first command,
+ * other sessions can not use it until it is committed or discarded.
+ *
+ * @param session Upload session id, chosen by the uploader
+ * @param timetodo Time when the command should be executed
+ * @param command Command to execute
+ * @param args Arguments for the command
+ * @param executions Amount of times the command will be executed per periodic cycle
+ * @param periodical Period of time between executions
+ * @return 0 if OK, -1 if the stage is full (SCH_FP_MAX_ENTRIES) or used by
+ * other session
+ */
+int dat_stage_fp(int session, int timetodo, char* command, char* args, int executions, int periodical);
+
+/**
+ * Commits the staged commands to the flight plan at once, in one storage
+ * transaction. The staged commands replace the whole flight plan, or are
+ * merged into it replacing the commands with the same time. If the resulting
+ * flight plan does not fit in SCH_FP_MAX_ENTRIES, or the storage fails, the
+ * flight plan is not modified. The stage is cleared in any case, unless it
+ * belongs to other session.
+ *
+ * @param session Upload session id used to stage the commands
+ * @param replace 1 to replace the flight plan, 0 to merge the staged commands
+ * @return Number of commands committed, -1 if error
+ */
+int dat_commit_fp(int session, int replace);
+
+/**
+ * Discards the staged commands, without modifying the flight plan
+ *
+ * @param session Upload session id used to stage the commands
+ * @return Number of commands discarded, -1 if the stage belongs to other
+ * session
+ */
+int dat_discard_fp(int session);
+
 /**
  * Gets the current system time in seconds.
  *
@@ -475,59 +613,64 @@ int dat_show_time(int format);
 int dat_add_payload_sample(void* data, int payload);
 
 /**
- * TODO: Change variable name from delay to offset??
- * Gets a data struct from the payload table.
+ * Adds @n consecutive data structs to the payload table in one storage
+ * transaction, and advances the payload index once.
  *
- * @param data Pointer to the struct where the values will be stored
- * @param payload Payload id to get
- * @param delay Delay of the recent value
- * @return 0 if OK, -1 if and error occurred
+ * @param data Pointer to an array of @n structs to add
+ * @param n Number of structs to add
+ * @param payload Payload id to store
+ * @return The next payload index if OK, -1 if an error occurred
  */
-int dat_get_recent_payload_sample(void* data, int payload, int delay);
+int dat_add_payload_samples(void* data, int n, int payload);
 
 /**
- * Deletes all memory sections in NOR FLASH.
+ * Write the payload samples buffered by the storage driver to the permanent
+ * storage. The nanomind flash driver combines samples in RAM up to a flash
+ * page (SCH_FLASH_WRITE_BUFFER), call periodically and before a reset.
  *
  * @return 0 if OK, -1 if an error occurred
  */
-int dat_delete_memory_sections(void);
+int dat_flush_payload_data(void);
 
 /**
- * Print struct contained in data with payload schema
+ * TODO: Change variable name from delay to offset??
+ * Gets a data struct from the payload table.
  *
  * @param data Pointer to the struct where the values will be stored
- * @param payload Payload id
+ * @param payload Payload id to get
+ * @param delay Delay of the recent value
  * @return 0 if OK, -1 if and error occurred
  */
-int dat_print_payload_struct(void* data, unsigned int payload);
+int dat_get_recent_payload_sample(void* data, int payload, int delay);
 
 /**
- * Helper function to get var results in payload struct
+ * Gets the payload samples with index from @from to @to-1 with only one
+ * storage read.
  *
- * @param tok_sym
- * @param tok_var
- * @param order
- * @param var_names
- * @param i
- * @return 0 if OK, -1 if and error occurred
+ * @param payload Payload id to get
+ * @param from Index of the first sample
+ * @param to Index after the last sample, at most the current payload index
+ * @param data Pointer to an array of @to-@from structs where the samples will
+ * be stored
+ * @return Number of samples read if OK, -1 if an error occurred
  */
-int get_payloads_tokens(char** tok_sym, char** tok_var, char* order, char* var_names, int i);
+int dat_get_payload_range(int payload, int from, int to, void* data);
 
 /**
- * Helper function to get value as string in payload struct
+ * Deletes all memory sections in NOR FLASH, or the payload logs of the memory
+ * mapped files storage, and resets the payload indexes and acknowledgements.
  *
- * @param ret_string
- * @param c_type
- * @param buff
+ * @return 0 if OK, -1 if an error occurred
  */
-void get_value_string(char* ret_string, char* c_type, char* buff);
+int dat_delete_memory_sections(void);
 
 /**
- *  Helper function to get size of variable in payload struct
+ * Print struct contained in data with payload schema
  *
- * @param c_type
- * @return
+ * @param data Pointer to the struct where the values will be stored
+ * @param payload Payload id
+ * @return 0 if OK, -1 if and error occurred
  */
-int get_sizeof_type(char* c_type);
+int dat_print_payload_struct(void* data, unsigned int payload);
 
 #endif // DATA_REPO_H
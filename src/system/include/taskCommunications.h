@@ -27,6 +27,19 @@
 #include "repoCommand.h"
 #include "cmdTM.h"
 
+/**
+ * One byte reply codes sent back to the ground station after receiving a TC
+ * or a command frame. If the frame contains many commands the reply is the
+ * highest code of all of them.
+ */
+#define COM_REPLY_OK 200            ///< All commands executed successfully
+#define COM_REPLY_ACCEPTED 202      ///< Commands queued, results not available within SCH_TRX_TC_TIMEOUT
+#define COM_REPLY_BAD_CMD 240       ///< At least one command could not be parsed
+#define COM_REPLY_CMD_FAIL 250      ///< At least one command returned CMD_FAIL or CMD_ERROR
+#define COM_REPLY_BUSY 253          ///< At least one command was not queued, the dispatcher is full
+
+#define COM_MAX_PENDING 4           ///< Max TC frames waiting for the commands results to reply
+
 void taskCommunications(void *param);
 
 #endif //T_COMMUNICATIONS_H
@@ -8,6 +8,12 @@
  * This task implements the dispatcher. Reads commands from queue, determines
  * if the commands is executable, asks to command repository the function to
  * send to taskExecuter. It's an event driven task.
+ *
+ * Received commands are ordered by priority (see cmd_send_prio) before being
+ * sent to the executers, a waiting command gains one priority level every
+ * SCH_CMD_PRIO_AGING milliseconds. A command that conflicts with the running
+ * ones waits at the head of its level without blocking the dispatcher, so
+ * new commands with higher priority are still dispatched.
  */
 
 #ifndef T_DISPATCHER_H
@@ -17,6 +23,7 @@
 #include "globals.h"
 
 #include "osQueue.h"
+#include "osDelay.h"
 
 #include "repoCommand.h"
 #include "repoData.h"
@@ -45,25 +45,27 @@ int main(void)
     dat_repo_init(); // Update status repository
 
     /* Initializing shared Queues */
-    dispatcher_queue = osQueueCreate(25,sizeof(cmd_t *));
+    dispatcher_queue = osQueueCreate(CMD_DISPATCHER_QUEUE_LEN,sizeof(cmd_t *));
     if(dispatcher_queue == 0)
         LOGE(tag, "Error creating dispatcher queue");
-    executer_stat_queue = osQueueCreate(1,sizeof(int));
+    executer_stat_queue = osQueueCreate(SCH_TASK_EXE_WORKERS,sizeof(cmd_stat_t));
     if(executer_stat_queue == 0)
         LOGE(tag, "Error creating executer stat queue");
-    executer_cmd_queue = osQueueCreate(1,sizeof(cmd_t *));
+    executer_cmd_queue = osQueueCreate(SCH_TASK_EXE_WORKERS,sizeof(cmd_t *));
     if(executer_cmd_queue == 0)
         LOGE(tag, "Error creating executer cmd queue");
 
-    int n_threads = 4;
+    int n_threads = 3 + SCH_TASK_EXE_WORKERS;
     os_thread threads_id[n_threads];
 
     LOGI(tag, "Creating basic tasks...");
     /* Crating system task (the others are created inside taskInit) */
     int t_inv_ok = osCreateTask(taskDispatcher,"invoker", SCH_TASK_DIS_STACK, NULL, 3, &threads_id[1]);
-    int t_exe_ok = osCreateTask(taskExecuter, "receiver", SCH_TASK_EXE_STACK, NULL, 4, &threads_id[2]);
     int t_wdt_ok = osCreateTask(taskWatchdog, "watchdog", SCH_TASK_WDT_STACK, NULL, 2, &threads_id[0]);
-    int t_ini_ok = osCreateTask(taskInit, "init", SCH_TASK_INI_STACK, NULL, 3, &threads_id[3]);
+    int t_ini_ok = osCreateTask(taskInit, "init", SCH_TASK_INI_STACK, NULL, 3, &threads_id[2]);
+    int i, t_exe_ok = 0;
+    for(i=0; i<SCH_TASK_EXE_WORKERS; i++)
+        t_exe_ok |= osCreateTask(taskExecuter, "receiver", SCH_TASK_EXE_STACK, NULL, 4, &threads_id[3+i]);
 
     /* Check if the task were created */
     if(t_inv_ok != 0) LOGE(tag, "Task invoker not created!");
@@ -22,10 +22,785 @@
 
 const static char *tag = "repoCmd";
 
+/* Name to index hash table size. Must be a power of two, at least twice the
+ * number of commands to keep the probe sequences short */
+#define CMD_HASH_SIZE (512)
+#if CMD_HASH_SIZE < 2*SCH_CMD_MAX_ENTRIES
+#error "CMD_HASH_SIZE must be at least 2*SCH_CMD_MAX_ENTRIES"
+#endif
+
+/* Full memory barrier, orders the table content and pointer publication */
+#define cmd_barrier() __sync_synchronize()
+
+/**
+ * Command table, the list of registered commands and its name index. After
+ * the repository is sealed a table is never modified, changes are done in a
+ * copy that is published replacing the current table (see cmd_table_publish).
+ */
+typedef struct cmd_table_type{
+    cmd_list_t list[SCH_CMD_MAX_ENTRIES];   ///< Registered commands
+    int16_t hash[CMD_HASH_SIZE];            ///< Open addressing index of list, -1 if empty
+    int16_t code_hash[CMD_HASH_SIZE];       ///< Open addressing index of list by code, -1 if empty
+    int replaced;                           ///< Slot overwritten by the next table, -1 if none
+    struct cmd_table_type *retired;         ///< Next retired table
+} cmd_table_t;
+
 /* Global variables */
-cmd_list_t cmd_list[SCH_CMD_MAX_ENTRIES];
 int cmd_index = 0;
 char cmd_is_sorted = 1;
+char cmd_is_sealed = 0;
+
+osQueue dispatcher_prio_queue[CMD_PRIO_LEVELS];
+
+static cmd_table_t cmd_table_base;
+static cmd_table_t * volatile cmd_table = &cmd_table_base;
+static cmd_table_t *cmd_table_retired = NULL;
+static volatile int cmd_table_readers = 0;     ///< Lock-free readers of the sealed table
+
+/**
+ * djb2 string hash
+ */
+static unsigned int cmd_hash_str(const char *name)
+{
+    unsigned int hash = 5381;
+    while(*name != '\0')
+        hash = hash*33 + (unsigned char)(*name++);
+    return hash;
+}
+
+/**
+ * Stable 16 bits command code, the djb2 hash of the name folded to 16 bits.
+ * Does not depend on the commands order or the firmware configuration, so
+ * ground tools can compute it from the command name.
+ */
+static uint16_t cmd_code_str(const char *name)
+{
+    unsigned int hash = cmd_hash_str(name);
+    return (uint16_t)((hash ^ (hash >> 16)) & 0xFFFF);
+}
+
+/**
+ * Find the slot of the code hash table that holds @code or the empty slot
+ * where it should be inserted.
+ */
+static int cmd_code_slot(cmd_table_t *table, uint16_t code)
+{
+    unsigned int slot = code & (CMD_HASH_SIZE-1);
+    while(table->code_hash[slot] >= 0 && table->list[table->code_hash[slot]].code != code)
+        slot = (slot+1) & (CMD_HASH_SIZE-1);
+    return (int)slot;
+}
+
+/**
+ * Find the slot of the hash table that holds @name or the empty slot where it
+ * should be inserted.
+ */
+static int cmd_hash_slot(cmd_table_t *table, const char *name)
+{
+    unsigned int slot = cmd_hash_str(name) & (CMD_HASH_SIZE-1);
+    while(table->hash[slot] >= 0 && strcmp(table->list[table->hash[slot]].name, name) != 0)
+        slot = (slot+1) & (CMD_HASH_SIZE-1);
+    return (int)slot;
+}
+
+/**
+ * Map @name to the command index @idx. If the name is already registered the
+ * lowest index is kept, so lookups return the same command than a linear scan
+ * of the command list.
+ */
+static void cmd_hash_insert(cmd_table_t *table, const char *name, int idx)
+{
+    int slot = cmd_hash_slot(table, name);
+    if(table->hash[slot] < 0 || table->hash[slot] > idx)
+        table->hash[slot] = (int16_t)idx;
+
+    // Same for the code index, cmd_add rejects different names with the same
+    // code so only duplicated names share a code
+    int code_slot = cmd_code_slot(table, table->list[idx].code);
+    int16_t other = table->code_hash[code_slot];
+    if(other < 0 || other > idx)
+        table->code_hash[code_slot] = (int16_t)idx;
+}
+
+/**
+ * Find a command index by name.
+ * @return Command index or -1 if not found
+ */
+static int cmd_hash_find(cmd_table_t *table, const char *name)
+{
+    return table->hash[cmd_hash_slot(table, name)];
+}
+
+/**
+ * Find a command index by code.
+ * @return Command index or -1 if not found
+ */
+static int cmd_code_find(cmd_table_t *table, uint16_t code)
+{
+    return table->code_hash[cmd_code_slot(table, code)];
+}
+
+/**
+ * Rebuild the hash tables from the current command list content. Used when
+ * commands are moved or overwritten.
+ */
+static void cmd_hash_rebuild(cmd_table_t *table)
+{
+    int i;
+    memset(table->hash, -1, sizeof(table->hash));
+    memset(table->code_hash, -1, sizeof(table->code_hash));
+    for(i=0; i<SCH_CMD_MAX_ENTRIES; i++)
+    {
+        if(table->list[i].name != NULL)
+            cmd_hash_insert(table, table->list[i].name, i);
+    }
+}
+
+/**
+ * Get the current command table to read it. Before the repository is sealed
+ * the table is protected by repo_cmd_sem, after that it is immutable and it is
+ * accessed without locking, only counting the readers so retired tables are
+ * not freed under them. Call cmd_table_read_end when done.
+ *
+ * @param locked Set to 1 if repo_cmd_sem was taken
+ * @return Current command table
+ */
+static cmd_table_t *cmd_table_read_begin(int *locked)
+{
+    *locked = !cmd_is_sealed;
+    if(*locked)
+        osSemaphoreTake(&repo_cmd_sem, portMAX_DELAY);
+    else
+        __sync_fetch_and_add(&cmd_table_readers, 1);  // Full barrier
+    cmd_table_t *table = cmd_table;
+    cmd_barrier();
+    return table;
+}
+
+/**
+ * Free the retired tables if there are no lock-free readers. A reader that
+ * starts after the check gets the current table, which is never retired.
+ * Tables that own the strings of a replaced command are kept until
+ * cmd_repo_close, because commands already created may point to them. Must be
+ * called with repo_cmd_sem taken.
+ */
+static void cmd_table_reclaim(void)
+{
+    cmd_barrier();
+    if(cmd_table_readers != 0)
+        return;
+
+    cmd_table_t **prev = &cmd_table_retired;
+    while(*prev != NULL)
+    {
+        cmd_table_t *old = *prev;
+        if(old->replaced < 0 && old != &cmd_table_base)
+        {
+            *prev = old->retired;
+            free(old);
+        }
+        else
+            prev = &old->retired;
+    }
+}
+
+/**
+ * Finish a read started with cmd_table_read_begin. The last lock-free reader
+ * frees the retired tables, if repo_cmd_sem is not busy.
+ */
+static void cmd_table_read_end(int locked)
+{
+    if(locked)
+        osSemaphoreGiven(&repo_cmd_sem);
+    else if(__sync_sub_and_fetch(&cmd_table_readers, 1) == 0 && cmd_table_retired != NULL &&
+            osSemaphoreTake(&repo_cmd_sem, 0) == CSP_SEMAPHORE_OK)
+    {
+        cmd_table_reclaim();
+        osSemaphoreGiven(&repo_cmd_sem);
+    }
+}
+
+/**
+ * Publish @table as the current command table. The previous table is retired
+ * and freed once no lock-free reader can be using it (see cmd_table_reclaim).
+ * Must be called with repo_cmd_sem taken.
+ *
+ * @param table New command table, a modified copy of the current one
+ * @param replaced Slot overwritten in @table or -1. The strings of the
+ * replaced command are owned by the retired table.
+ */
+static void cmd_table_publish(cmd_table_t *table, int replaced)
+{
+    cmd_table_t *old = cmd_table;
+    old->replaced = replaced;
+    old->retired = cmd_table_retired;
+    cmd_table_retired = old;
+
+    table->replaced = -1;
+    table->retired = NULL;
+    cmd_barrier();
+    cmd_table = table;
+    cmd_table_reclaim();
+}
+
+/**
+ * Command pool node, a command with its inline parameters buffer
+ */
+typedef struct cmd_pool_node_type{
+    cmd_t cmd;                                  ///< Command, must be the first field
+    char params[SCH_CMD_MAX_STR_PARAMS+1];      ///< Inline parameters buffer
+    struct cmd_pool_node_type *next;            ///< Next free node
+} cmd_pool_node_t;
+
+static cmd_pool_node_t cmd_pool[SCH_CMD_POOL_SIZE];
+static cmd_pool_node_t *cmd_pool_free = NULL;
+static cmd_pool_node_t *cmd_pool_heap = NULL;   ///< Commands allocated from the heap
+static osSemaphore cmd_pool_sem;
+static cmd_pool_stats_t cmd_pool_stats;
+
+/**
+ * Reset the command pool, all nodes are marked as free
+ */
+static void cmd_pool_init(void)
+{
+    int i;
+    osSemaphoreCreate(&cmd_pool_sem);
+    osSemaphoreTake(&cmd_pool_sem, portMAX_DELAY);
+    cmd_pool_free = NULL;
+    for(i=SCH_CMD_POOL_SIZE-1; i>=0; i--)
+    {
+        cmd_pool[i].cmd.params = NULL;
+        cmd_pool[i].next = cmd_pool_free;
+        cmd_pool_free = &cmd_pool[i];
+    }
+    memset(&cmd_pool_stats, 0, sizeof(cmd_pool_stats));
+    cmd_pool_stats.size = SCH_CMD_POOL_SIZE;
+    osSemaphoreGiven(&cmd_pool_sem);
+}
+
+/**
+ * Return the pool node that contains @cmd or NULL if the command was
+ * allocated from the heap
+ */
+static cmd_pool_node_t *cmd_pool_node(cmd_t *cmd)
+{
+    cmd_pool_node_t *node = (cmd_pool_node_t *)cmd;
+    if(node >= &cmd_pool[0] && node < &cmd_pool[SCH_CMD_POOL_SIZE])
+        return node;
+    return NULL;
+}
+
+/**
+ * Get a command from the pool. If the pool is exhausted and
+ * SCH_CMD_POOL_HEAP is enabled the command is allocated from the heap, and
+ * kept in cmd_pool_heap so its parameters can be found by cmd_params_len.
+ *
+ * @return Pointer to an uninitialized command or NULL
+ */
+static cmd_t *cmd_pool_alloc(void)
+{
+    cmd_t *cmd = NULL;
+
+    osSemaphoreTake(&cmd_pool_sem, portMAX_DELAY);
+    cmd_pool_node_t *node = cmd_pool_free;
+    if(node != NULL)
+    {
+        cmd_pool_free = node->next;
+        cmd_pool_stats.in_use++;
+        if(cmd_pool_stats.in_use > cmd_pool_stats.max_used)
+            cmd_pool_stats.max_used = cmd_pool_stats.in_use;
+        cmd = &node->cmd;
+    }
+    else
+    {
+#if SCH_CMD_POOL_HEAP
+        cmd_pool_stats.heap_cmds++;
+#else
+        cmd_pool_stats.failures++;
+#endif
+    }
+    osSemaphoreGiven(&cmd_pool_sem);
+
+#if SCH_CMD_POOL_HEAP
+    if(node == NULL)
+    {
+        // The pool is exhausted, malloc is called without the lock
+        node = (cmd_pool_node_t *)malloc(sizeof(cmd_pool_node_t));
+        if(node != NULL)
+        {
+            node->cmd.params = NULL;
+            osSemaphoreTake(&cmd_pool_sem, portMAX_DELAY);
+            node->next = cmd_pool_heap;
+            cmd_pool_heap = node;
+            osSemaphoreGiven(&cmd_pool_sem);
+            cmd = &node->cmd;
+        }
+    }
+#endif
+    if(cmd == NULL)
+        LOGE(tag, "Command pool exhausted (%d)", SCH_CMD_POOL_SIZE);
+
+    return cmd;
+}
+
+/**
+ * Return a command to the pool, or to the heap if it was not allocated from
+ * the pool
+ */
+static void cmd_pool_release(cmd_t *cmd)
+{
+    cmd_pool_node_t *node = cmd_pool_node(cmd);
+    osSemaphoreTake(&cmd_pool_sem, portMAX_DELAY);
+    cmd->params = NULL;
+    if(node != NULL)
+    {
+        node->next = cmd_pool_free;
+        cmd_pool_free = node;
+        cmd_pool_stats.in_use--;
+    }
+    else
+    {
+        cmd_pool_node_t **prev = &cmd_pool_heap;
+        while(*prev != NULL && &(*prev)->cmd != cmd)
+            prev = &(*prev)->next;
+        if(*prev != NULL)
+            *prev = (*prev)->next;
+    }
+    osSemaphoreGiven(&cmd_pool_sem);
+
+    if(node == NULL)
+        free(cmd);
+}
+
+/**
+ * Get a buffer of @len bytes to store the command parameters. The inline
+ * buffer is used if the command belongs to the pool and the parameters fit,
+ * otherwise the heap is used if SCH_CMD_POOL_HEAP is enabled.
+ *
+ * @return Pointer to the parameters buffer or NULL
+ */
+static char *cmd_params_alloc(cmd_t *cmd, size_t len)
+{
+    cmd_pool_node_t *node = cmd_pool_node(cmd);
+
+    // Release previous parameters
+    if(cmd->params != NULL && (node == NULL || cmd->params != node->params))
+        free(cmd->params);
+    cmd->params = NULL;
+    cmd->params_len = 0;
+    cmd->params_bin = 0;
+
+    if(node != NULL && len <= sizeof(node->params))
+    {
+        cmd->params = node->params;
+    }
+    else
+    {
+        osSemaphoreTake(&cmd_pool_sem, portMAX_DELAY);
+#if SCH_CMD_POOL_HEAP
+        cmd_pool_stats.heap_params++;
+#else
+        cmd_pool_stats.failures++;
+#endif
+        osSemaphoreGiven(&cmd_pool_sem);
+#if SCH_CMD_POOL_HEAP
+        cmd->params = (char *)malloc(len);
+#endif
+        if(cmd->params == NULL)
+            LOGE(tag, "Unable to allocate %d bytes of parameters", (int)len);
+    }
+
+    if(cmd->params != NULL)
+        cmd->params_len = (int)len;
+    return cmd->params;
+}
+
+/**
+ * Find the live command that owns @params
+ *
+ * @param params Parameters buffer
+ * @param bin Set to 1 if @params is a binary vector, 0 otherwise
+ * @return Length of @params in bytes, -1 if no command owns the buffer
+ */
+static int cmd_params_find(const char *params, int *bin)
+{
+    int i, len = -1;
+    *bin = 0;
+    if(params == NULL)
+        return -1;
+
+    osSemaphoreTake(&cmd_pool_sem, portMAX_DELAY);
+    cmd_t *cmd = NULL;
+    for(i=0; i<SCH_CMD_POOL_SIZE && cmd == NULL; i++)
+    {
+        if(cmd_pool[i].cmd.params == params)
+            cmd = &cmd_pool[i].cmd;
+    }
+    cmd_pool_node_t *node;
+    for(node = cmd_pool_heap; node != NULL && cmd == NULL; node = node->next)
+    {
+        if(node->cmd.params == params)
+            cmd = &node->cmd;
+    }
+    if(cmd != NULL)
+    {
+        len = cmd->params_len;
+        *bin = cmd->params_bin;
+    }
+    osSemaphoreGiven(&cmd_pool_sem);
+
+    return len;
+}
+
+int cmd_params_len(const char *params)
+{
+    int bin;
+    return cmd_params_find(params, &bin);
+}
+
+void cmd_pool_get_stats(cmd_pool_stats_t *stats)
+{
+    if(stats == NULL)
+        return;
+    osSemaphoreTake(&cmd_pool_sem, portMAX_DELAY);
+    *stats = cmd_pool_stats;
+    osSemaphoreGiven(&cmd_pool_sem);
+}
+
+/**
+ * Get the command table to modify. If the repository is sealed a copy of the
+ * current table is returned, that must be published with cmd_table_write_end.
+ * Must be called with repo_cmd_sem taken.
+ *
+ * @return Table to modify or NULL if there is no memory to copy the table
+ */
+static cmd_table_t *cmd_table_write_begin(void)
+{
+    cmd_table_t *table = cmd_table;
+    if(cmd_is_sealed)
+    {
+        // Readers do not lock the sealed table, so update a copy
+        table = (cmd_table_t *)malloc(sizeof(cmd_table_t));
+        if(table != NULL)
+            memcpy(table, cmd_table, sizeof(cmd_table_t));
+    }
+    return table;
+}
+
+/**
+ * Finish a modification started with cmd_table_write_begin, publishing the
+ * table if the repository is sealed. Must be called with repo_cmd_sem taken.
+ *
+ * @param table Modified table
+ * @param replaced Slot overwritten in @table or -1
+ */
+static void cmd_table_write_end(cmd_table_t *table, int replaced)
+{
+    if(cmd_is_sealed)
+        cmd_table_publish(table, replaced);
+}
+
+/**
+ * Binary parameters. Commands filled with cmd_add_params_var store the
+ * parameters as a typed vector instead of a string, so handlers read them
+ * back with cmd_scan_params without a printf/scanf round trip. Layout:
+ *
+ *      [0] '\0' (empty string for sscanf), [1] CMD_ARGS_MAGIC, [2] nargs, [3] 0
+ *      [4...] nargs types (CMD_ARG_*), padded to 4 bytes
+ *      [...] nargs 4 bytes values (int32, float or string offset)
+ *      [...] null terminated strings
+ */
+#define CMD_ARGS_MAGIC 0xA5
+#define CMD_ARGS_HEADER 4
+#define CMD_ARGS_MAX 16                 ///< Max number of binary parameters
+#define CMD_ARG_INT 'i'                 ///< %d %i %u %x %X %o, stored as 32 bits integer
+#define CMD_ARG_FLOAT 'f'               ///< %f %e %g, stored as float
+#define CMD_ARG_STR 's'                 ///< %s, stored as a null terminated string
+
+/**
+ * Precompile a parameters format into a list of types (CMD_ARG_*). Formats
+ * with other conversions (%n, %p, %c, widths or length modifiers) can not be
+ * stored as binary, so the string path is used for those commands.
+ *
+ * @param fmt Str. Parameters format
+ * @param nparams Int. Number of parameters
+ * @return Null terminated list of types (uses malloc) or NULL if the format is
+ * not supported
+ */
+static char *cmd_args_compile(const char *fmt, int nparams)
+{
+    char types[CMD_ARGS_MAX+1];
+    int n = 0;
+
+    if(nparams <= 0 || nparams > CMD_ARGS_MAX)
+        return NULL;
+
+    for(; *fmt != '\0'; fmt++)
+    {
+        if(*fmt != '%')
+            continue;
+        fmt++;
+        if(*fmt == '%')
+            continue;
+        if(n >= CMD_ARGS_MAX)
+            return NULL;
+        switch(*fmt)
+        {
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+                types[n++] = CMD_ARG_INT;
+                break;
+            case 'f': case 'e': case 'g':
+                types[n++] = CMD_ARG_FLOAT;
+                break;
+            case 's':
+                types[n++] = CMD_ARG_STR;
+                break;
+            default:
+                return NULL;
+        }
+    }
+
+    if(n != nparams)
+        return NULL;
+
+    types[n] = '\0';
+    char *args = (char *)malloc((size_t)n+1);
+    if(args != NULL)
+        memcpy(args, types, (size_t)n+1);
+    return args;
+}
+
+/**
+ * Count the conversions of a scanf format, not including %% and the
+ * suppressed ones (%*d)
+ *
+ * @param fmt Str. Format
+ * @return Number of variables read with @fmt
+ */
+static int cmd_fmt_count(const char *fmt)
+{
+    int n = 0;
+    for(; *fmt != '\0'; fmt++)
+    {
+        if(*fmt != '%')
+            continue;
+        fmt++;
+        if(*fmt == '\0')
+            break;
+        if(*fmt != '%' && *fmt != '*')
+            n++;
+    }
+    return n;
+}
+
+/**
+ * Validate a binary parameters vector before reading it: the number of
+ * parameters must be read by @fmt, and the types, values and strings must
+ * be inside the buffer
+ *
+ * @param params Parameters
+ * @param len Length of @params in bytes
+ * @param fmt Str. Format used to read the parameters
+ * @return Number of parameters, -1 if the vector is invalid
+ */
+static int cmd_args_check(const char *params, int len, const char *fmt)
+{
+    int i;
+    if(params == NULL || len < CMD_ARGS_HEADER || params[0] != '\0' ||
+       (uint8_t)params[1] != CMD_ARGS_MAGIC || params[3] != '\0')
+        return -1;
+
+    int n = (uint8_t)params[2];
+    int values = CMD_ARGS_HEADER + ((n + 3) & ~3);
+    if(n > CMD_ARGS_MAX || n > cmd_fmt_count(fmt) || values + 4*n > len)
+        return -1;
+
+    for(i=0; i<n; i++)
+    {
+        uint32_t offset;
+        switch(params[CMD_ARGS_HEADER + i])
+        {
+            case CMD_ARG_INT:
+            case CMD_ARG_FLOAT:
+                break;
+            case CMD_ARG_STR:
+                memcpy(&offset, params + values + 4*i, 4);
+                if(offset < (uint32_t)(values + 4*n) || offset >= (uint32_t)len ||
+                   memchr(params + offset, '\0', (size_t)len - offset) == NULL)
+                    return -1;
+                break;
+            default:
+                return -1;
+        }
+    }
+    return n;
+}
+
+/**
+ * Value of a binary parameter before packing it
+ */
+typedef union cmd_arg_type{
+    int32_t i;                  ///< CMD_ARG_INT
+    float f;                    ///< CMD_ARG_FLOAT
+    const char *s;              ///< CMD_ARG_STR
+} cmd_arg_t;
+
+/**
+ * Build a binary parameters vector from a list of values
+ *
+ * @param buff Buffer to store the vector
+ * @param size Size of the buffer
+ * @param types List of types (see cmd_args_compile)
+ * @param args Values, one per type
+ * @return Length of the vector or -1 if it does not fit in the buffer or a
+ * string is longer than SCH_CMD_MAX_STR_PARAMS-1
+ */
+static int cmd_args_pack(char *buff, int size, const char *types, const cmd_arg_t *args)
+{
+    int i;
+    int nargs = (int)strlen(types);
+    int values = CMD_ARGS_HEADER + ((nargs + 3) & ~3);
+    int len = values + 4*nargs;
+    if(len > size)
+        return -1;
+
+    memset(buff, 0, (size_t)values);
+    buff[1] = (char)CMD_ARGS_MAGIC;
+    buff[2] = (char)nargs;
+    memcpy(buff + CMD_ARGS_HEADER, types, (size_t)nargs);
+
+    for(i=0; i<nargs; i++)
+    {
+        uint32_t offset;
+        size_t str_len;
+        switch(types[i])
+        {
+            case CMD_ARG_INT:
+                memcpy(buff + values + 4*i, &args[i].i, 4);
+                break;
+            case CMD_ARG_FLOAT:
+                memcpy(buff + values + 4*i, &args[i].f, 4);
+                break;
+            case CMD_ARG_STR:
+                str_len = strlen(args[i].s) + 1;
+                if(str_len > SCH_CMD_MAX_STR_PARAMS || len + (int)str_len > size)
+                    return -1;
+                offset = (uint32_t)len;
+                memcpy(buff + values + 4*i, &offset, 4);
+                memcpy(buff + len, args[i].s, str_len);
+                len += (int)str_len;
+                break;
+            default:
+                return -1;
+        }
+    }
+
+    return len;
+}
+
+/**
+ * Build a binary parameters vector from a list of variables
+ *
+ * @param buff Buffer to store the vector
+ * @param size Size of the buffer
+ * @param types List of types (see cmd_args_compile)
+ * @param args Variables
+ * @return Length of the vector or -1 if it does not fit in the buffer
+ */
+static int cmd_args_build(char *buff, int size, const char *types, va_list args)
+{
+    int i;
+    cmd_arg_t values[CMD_ARGS_MAX];
+    for(i=0; types[i] != '\0'; i++)
+    {
+        if(types[i] == CMD_ARG_INT)
+            values[i].i = (int32_t)va_arg(args, int);
+        else if(types[i] == CMD_ARG_FLOAT)
+            values[i].f = (float)va_arg(args, double);
+        else
+            values[i].s = va_arg(args, char *);
+    }
+    return cmd_args_pack(buff, size, types, values);
+}
+
+int cmd_scan_params(const char *params, const char *fmt, ...)
+{
+    int i, n;
+    va_list args;
+
+    if(params == NULL)
+        return -1;
+
+    // Only a command's own buffer can be binary, strings are not looked up
+    int bin = 0;
+    int len = params[0] == '\0' ? cmd_params_find(params, &bin) : 0;
+
+    va_start(args, fmt);
+    if(!bin)
+    {
+        // String parameters from the console, TC or flight plan
+        n = vsscanf(params, fmt, args);
+        va_end(args);
+        return n;
+    }
+
+    n = cmd_args_check(params, len, fmt);
+    if(n < 0)
+    {
+        LOGE(tag, "Invalid binary parameters (%d bytes)", len);
+        va_end(args);
+        return -1;
+    }
+
+    const char *types = params + CMD_ARGS_HEADER;
+    const char *values = types + ((n + 3) & ~3);
+    for(i=0; i<n; i++)
+    {
+        uint32_t offset;
+        void *var = va_arg(args, void *);
+        switch(types[i])
+        {
+            case CMD_ARG_INT:
+            case CMD_ARG_FLOAT:
+                memcpy(var, values + 4*i, 4);
+                break;
+            case CMD_ARG_STR:
+                memcpy(&offset, values + 4*i, 4);
+                strncpy((char *)var, params + offset, SCH_CMD_MAX_STR_PARAMS-1);
+                ((char *)var)[SCH_CMD_MAX_STR_PARAMS-1] = '\0';
+                break;
+            default:
+                va_end(args);
+                return i;
+        }
+    }
+    va_end(args);
+    return n;
+}
+
+/**
+ * Creates a new command from a registered command entry
+ */
+static cmd_t *cmd_new_from_list(int idx, cmd_list_t *cmd_found)
+{
+    cmd_t *cmd_new = cmd_pool_alloc();
+    if(cmd_new != NULL)
+    {
+        cmd_new->id = idx;
+        cmd_new->fmt = cmd_found->fmt;
+        cmd_new->args = cmd_found->args;
+        cmd_new->function = cmd_found->function;
+        cmd_new->nparams = cmd_found->nparams;
+        cmd_new->exec_class = cmd_found->exec_class;
+        cmd_new->prio = cmd_found->prio;
+        cmd_new->future = -1;
+        cmd_new->queued = 0;
+        cmd_new->params = NULL;
+        cmd_new->params_len = 0;
+        cmd_new->params_bin = 0;
+    }
+    return cmd_new;
+}
 
 int cmd_add(char *name, cmdFunction function, char *fparams, int nparam)
 {
@@ -37,20 +812,57 @@ int cmd_add(char *name, cmdFunction function, char *fparams, int nparam)
         cmd_list_t cmd_new;
         cmd_new.fmt = (char *)malloc(sizeof(char)*(l_fparams+1));
         strncpy(cmd_new.fmt, fparams, l_fparams+1);
+        cmd_new.args = cmd_args_compile(fparams, nparam);
         cmd_new.function = function;
         cmd_new.name = (char *)malloc(sizeof(char)*(l_name+1));
         strncpy(cmd_new.name, name, l_name+1);
         cmd_new.nparams = nparam;
+        cmd_new.code = cmd_code_str(name);
+        cmd_new.exec_class = CMD_CLASS_EXCLUSIVE;
+        cmd_new.prio = CMD_PRIO_NORMAL;
 
         // Copy to command buffer
         osSemaphoreTake(&repo_cmd_sem, portMAX_DELAY);
         {
-            cmd_list[cmd_index] = cmd_new;
+            // The code identifies the command in binary TC frames, so it
+            // must not be shared with a different command name
+            int other = cmd_code_find(cmd_table, cmd_new.code);
+            if(other >= 0 && other != cmd_index && strcmp(cmd_table->list[other].name, name) != 0)
+            {
+                osSemaphoreGiven(&repo_cmd_sem);
+                LOGE(tag, "Unable to add cmd: %s. Code 0x%04X already used by %s",
+                     name, cmd_new.code, cmd_table->list[other].name);
+                free(cmd_new.name);
+                free(cmd_new.fmt);
+                free(cmd_new.args);
+                return CMD_ERROR;
+            }
+
+            cmd_table_t *table = cmd_table_write_begin();
+            if(table == NULL)
+            {
+                osSemaphoreGiven(&repo_cmd_sem);
+                LOGE(tag, "Unable to add cmd: %s. Error allocating memory", name);
+                free(cmd_new.name);
+                free(cmd_new.fmt);
+                free(cmd_new.args);
+                return CMD_ERROR;
+            }
+
+            // Overwriting an used slot invalidates the hash table
+            int replaced = table->list[cmd_index].name != NULL ? cmd_index : -1;
+            table->list[cmd_index] = cmd_new;
+            if(replaced >= 0)
+                cmd_hash_rebuild(table);
+            else
+                cmd_hash_insert(table, cmd_new.name, cmd_index);
             if (strcmp(name, "null") != 0 && cmd_is_sorted && cmd_index > 1)
             {
-                if (strcmp(cmd_list[cmd_index - 1].name, cmd_list[cmd_index].name) > 0)
+                if (strcmp(table->list[cmd_index - 1].name, table->list[cmd_index].name) > 0)
                     cmd_is_sorted = 0;
             }
+
+            cmd_table_write_end(table, replaced);
             cmd_index++;
         }
         osSemaphoreGiven(&repo_cmd_sem);
@@ -63,25 +875,252 @@ int cmd_add(char *name, cmdFunction function, char *fparams, int nparam)
     }
 }
 
-cmd_t * cmd_get_str(char *name)
+int cmd_queue_send(cmd_t *cmd, uint32_t timeout)
 {
-    cmd_t *cmd_new = NULL;
+    if(cmd == NULL)
+        return CMD_ERROR;
 
-    //Find inside command buffer
-    int i, ok;
-    for(i=0; i<SCH_CMD_MAX_ENTRIES; i++)
+    if(cmd->prio < CMD_PRIO_CRITICAL || cmd->prio >= CMD_PRIO_LEVELS)
+        cmd->prio = CMD_PRIO_NORMAL;
+
+    // The command ages from now, while it waits behind other commands
+    cmd->queued = osTaskGetTickCount();
+    if(osQueueSend(dispatcher_prio_queue[cmd->prio], &cmd, timeout) != pdPASS)
     {
-        osSemaphoreTake(&repo_cmd_sem, portMAX_DELAY);
-        ok = strcmp(name, cmd_list[i].name);
-        osSemaphoreGiven(&repo_cmd_sem);
+        LOGW(tag, "Dispatcher queue %d full", cmd->prio);
+        return CMD_ERROR;
+    }
+
+    // Wake up the dispatcher, the command is already available, so the
+    // dispatcher may take it even before receiving this mark. The queue has
+    // room for one mark per waiting command (CMD_DISPATCHER_QUEUE_LEN), and
+    // if it is full the dispatcher is awake and will find the command anyway.
+    cmd_t *mark = NULL;
+    if(osQueueSend(dispatcher_queue, &mark, timeout) != pdPASS)
+        LOGD(tag, "Dispatcher queue full");
+    return CMD_OK;
+}
+
+/**
+ * Futures to return the result of commands sent with cmd_send_async. Each
+ * future has a one element queue where the executer puts the result.
+ */
+#define CMD_FUTURE_FREE 0       ///< Available
+#define CMD_FUTURE_PENDING 1    ///< Command sent, waiting for the result
+#define CMD_FUTURE_DONE 2       ///< Result available in the queue
+#define CMD_FUTURE_ABANDONED 3  ///< Released while pending, discard the result
 
-        if(ok == 0)
+typedef struct cmd_future_type{
+    int state;                  ///< CMD_FUTURE_* state
+    osQueue result;             ///< Queue of one int with the command result
+} cmd_future_t;
+
+static cmd_future_t cmd_futures[SCH_CMD_FUTURES];
+static osSemaphore cmd_future_sem;
+
+/**
+ * Reset the futures, creating the result queues the first time
+ */
+static void cmd_future_init(void)
+{
+    int i;
+    osSemaphoreCreate(&cmd_future_sem);
+    for(i=0; i<SCH_CMD_FUTURES; i++)
+    {
+        cmd_futures[i].state = CMD_FUTURE_FREE;
+        if(cmd_futures[i].result == NULL)
+            cmd_futures[i].result = osQueueCreate(1, sizeof(int));
+        if(cmd_futures[i].result == NULL)
+            LOGE(tag, "Error creating future %d", i);
+    }
+}
+
+/**
+ * Take a free future
+ *
+ * @return Future handle or -1 if there are no free futures
+ */
+static int cmd_future_alloc(void)
+{
+    int i, handle = -1;
+    osSemaphoreTake(&cmd_future_sem, portMAX_DELAY);
+    for(i=0; i<SCH_CMD_FUTURES; i++)
+    {
+        if(cmd_futures[i].state == CMD_FUTURE_FREE && cmd_futures[i].result != NULL)
         {
-            // Create the command by index
-            cmd_new = cmd_get_idx(i);
+            cmd_futures[i].state = CMD_FUTURE_PENDING;
+            handle = i;
             break;
         }
     }
+    osSemaphoreGiven(&cmd_future_sem);
+    return handle;
+}
+
+int cmd_send_async(cmd_t *cmd, int *handle)
+{
+    if(handle != NULL)
+        *handle = -1;
+    if(cmd == NULL)
+        return CMD_ERROR;
+
+    // Without free futures the command is sent anyway, but the result is lost
+    int future = -1;
+    if(handle != NULL && (future = cmd_future_alloc()) < 0)
+        LOGW(tag, "No free futures (%d)", SCH_CMD_FUTURES);
+
+    cmd->future = future;
+    if(cmd_queue_send(cmd, 0) != CMD_OK)
+    {
+        // The command was not queued, so nobody will complete the future.
+        // The caller still owns the command, to retry or free it
+        if(future >= 0)
+        {
+            osSemaphoreTake(&cmd_future_sem, portMAX_DELAY);
+            cmd_futures[future].state = CMD_FUTURE_FREE;
+            osSemaphoreGiven(&cmd_future_sem);
+        }
+        cmd->future = -1;
+        return CMD_ERROR;
+    }
+
+    if(handle != NULL)
+        *handle = future;
+    return (handle != NULL && future < 0) ? CMD_FAIL : CMD_OK;
+}
+
+int cmd_wait(int handle, uint32_t timeout, int *result)
+{
+    if(handle < 0 || handle >= SCH_CMD_FUTURES)
+        return CMD_ERROR;
+
+    osSemaphoreTake(&cmd_future_sem, portMAX_DELAY);
+    int state = cmd_futures[handle].state;
+    osSemaphoreGiven(&cmd_future_sem);
+    if(state != CMD_FUTURE_PENDING && state != CMD_FUTURE_DONE)
+        return CMD_ERROR;
+
+    int cmd_result;
+    if(osQueueReceive(cmd_futures[handle].result, &cmd_result, timeout) != pdPASS)
+        return CMD_FAIL;
+
+    osSemaphoreTake(&cmd_future_sem, portMAX_DELAY);
+    cmd_futures[handle].state = CMD_FUTURE_FREE;
+    osSemaphoreGiven(&cmd_future_sem);
+
+    if(result != NULL)
+        *result = cmd_result;
+    return CMD_OK;
+}
+
+void cmd_future_release(int handle)
+{
+    if(handle < 0 || handle >= SCH_CMD_FUTURES)
+        return;
+
+    int cmd_result;
+    osSemaphoreTake(&cmd_future_sem, portMAX_DELAY);
+    if(cmd_futures[handle].state == CMD_FUTURE_PENDING)
+    {
+        // The executer frees the future when the command finishes
+        cmd_futures[handle].state = CMD_FUTURE_ABANDONED;
+    }
+    else if(cmd_futures[handle].state == CMD_FUTURE_DONE)
+    {
+        // Discard the result
+        osQueueReceive(cmd_futures[handle].result, &cmd_result, 0);
+        cmd_futures[handle].state = CMD_FUTURE_FREE;
+    }
+    osSemaphoreGiven(&cmd_future_sem);
+}
+
+void cmd_future_complete(int handle, int result)
+{
+    if(handle < 0 || handle >= SCH_CMD_FUTURES)
+        return;
+
+    osSemaphoreTake(&cmd_future_sem, portMAX_DELAY);
+    if(cmd_futures[handle].state == CMD_FUTURE_ABANDONED)
+    {
+        cmd_futures[handle].state = CMD_FUTURE_FREE;
+    }
+    else if(cmd_futures[handle].state == CMD_FUTURE_PENDING)
+    {
+        cmd_futures[handle].state = CMD_FUTURE_DONE;
+        osQueueSend(cmd_futures[handle].result, &result, 0);
+    }
+    osSemaphoreGiven(&cmd_future_sem);
+}
+
+int cmd_set_class(char *name, int exec_class)
+{
+    int rc = CMD_ERROR;
+
+    osSemaphoreTake(&repo_cmd_sem, portMAX_DELAY);
+    int idx = cmd_hash_find(cmd_table, name);
+    if(idx >= 0)
+    {
+        cmd_table_t *table = cmd_table_write_begin();
+        if(table != NULL)
+        {
+            table->list[idx].exec_class = exec_class;
+            cmd_table_write_end(table, -1);
+            rc = CMD_OK;
+        }
+    }
+    osSemaphoreGiven(&repo_cmd_sem);
+
+    if(rc != CMD_OK)
+        LOGW(tag, "Unable to set the class of cmd: %s", name);
+    return rc;
+}
+
+int cmd_set_prio(char *name, int prio)
+{
+    int rc = CMD_ERROR;
+    if(prio < CMD_PRIO_CRITICAL || prio >= CMD_PRIO_LEVELS)
+    {
+        LOGW(tag, "Invalid priority %d for cmd: %s", prio, name);
+        return rc;
+    }
+
+    osSemaphoreTake(&repo_cmd_sem, portMAX_DELAY);
+    int idx = cmd_hash_find(cmd_table, name);
+    if(idx >= 0)
+    {
+        cmd_table_t *table = cmd_table_write_begin();
+        if(table != NULL)
+        {
+            table->list[idx].prio = prio;
+            cmd_table_write_end(table, -1);
+            rc = CMD_OK;
+        }
+    }
+    osSemaphoreGiven(&repo_cmd_sem);
+
+    if(rc != CMD_OK)
+        LOGW(tag, "Unable to set the priority of cmd: %s", name);
+    return rc;
+}
+
+cmd_t * cmd_get_str(char *name)
+{
+    cmd_t *cmd_new = NULL;
+    cmd_list_t cmd_found;
+    int locked;
+
+    //Find inside command buffer
+    cmd_table_t *table = cmd_table_read_begin(&locked);
+    int idx = cmd_hash_find(table, name);
+    if(idx >= 0)
+        cmd_found = table->list[idx];
+    cmd_table_read_end(locked);
+
+    if(idx >= 0)
+    {
+        // Create the command by index
+        cmd_new = cmd_new_from_list(idx, &cmd_found);
+    }
 
     if(cmd_new == NULL)
     {
@@ -97,19 +1136,13 @@ cmd_t * cmd_get_idx(int idx)
     if (idx < SCH_CMD_MAX_ENTRIES)
     {
         // Get found command
-        osSemaphoreTake(&repo_cmd_sem, portMAX_DELAY);
-        cmd_list_t cmd_found = cmd_list[idx];
-        osSemaphoreGiven(&repo_cmd_sem);
+        int locked;
+        cmd_table_t *table = cmd_table_read_begin(&locked);
+        cmd_list_t cmd_found = table->list[idx];
+        cmd_table_read_end(locked);
 
         // Creates a new command
-        cmd_new = (cmd_t *)malloc(sizeof(cmd_t));
-
-        // Fill parameters
-        cmd_new->id = idx;
-        cmd_new->fmt = cmd_found.fmt;
-        cmd_new->function = cmd_found.function;
-        cmd_new->nparams = cmd_found.nparams;
-        cmd_new->params = NULL;
+        cmd_new = cmd_new_from_list(idx, &cmd_found);
     }
     else
     {
@@ -125,9 +1158,10 @@ char * cmd_get_name(int idx)
     if (idx < SCH_CMD_MAX_ENTRIES)
     {
         // Get found command
-        osSemaphoreTake(&repo_cmd_sem, portMAX_DELAY);
-        cmd_list_t cmd_found = cmd_list[idx];
-        osSemaphoreGiven(&repo_cmd_sem);
+        int locked;
+        cmd_table_t *table = cmd_table_read_begin(&locked);
+        cmd_list_t cmd_found = table->list[idx];
+        cmd_table_read_end(locked);
 
         LOGV(tag, "Cmd name found: %s", cmd_found.name);
         name = (char *)malloc(strlen(cmd_found.name)+1);
@@ -154,8 +1188,8 @@ void cmd_add_params_raw(cmd_t *cmd, void *params, int len)
     if(cmd != NULL && params != NULL)
     {
         LOGD(tag, "Copying %d bytes as parameters", len);
-        cmd->params = (char *)malloc((size_t)len);
-        memcpy(cmd->params, params, (size_t)len);
+        if(cmd_params_alloc(cmd, (size_t)len) != NULL)
+            memcpy(cmd->params, params, (size_t)len);
     }
 }
 
@@ -172,8 +1206,11 @@ void cmd_add_params_str(cmd_t *cmd, char *params)
     // Check pointers
     if(cmd != NULL && len_param)
     {
-        cmd->params = (char *)malloc(sizeof(char)*(len_param+1));
-        strncpy(cmd->params, params, len_param+1);
+        if(cmd_params_alloc(cmd, sizeof(char)*(len_param+1)) != NULL)
+        {
+            memcpy(cmd->params, params, len_param);
+            cmd->params[len_param] = '\0';
+        }
     }
 }
 
@@ -184,9 +1221,26 @@ void cmd_add_params_var(cmd_t *cmd, ...)
         va_list args;
         va_start(args, cmd);
 
+        // Store the arguments as binary if the format is supported
+        if(cmd->args != NULL)
+        {
+            va_list args_bin;
+            char bin_params[CMD_ARGS_HEADER + CMD_ARGS_MAX*5 + SCH_CMD_MAX_STR_PARAMS];
+            va_copy(args_bin, args);
+            int len = cmd_args_build(bin_params, sizeof(bin_params), cmd->args, args_bin);
+            va_end(args_bin);
+            if(len > 0)
+            {
+                cmd_add_params_raw(cmd, bin_params, len);
+                cmd->params_bin = cmd->params != NULL;
+                va_end(args);
+                return;
+            }
+        }
+
         //Parsing arguments to string
         char str_params[SCH_CMD_MAX_STR_PARAMS];
-        vsprintf(str_params, cmd->fmt, args);
+        vsnprintf(str_params, sizeof(str_params), cmd->fmt, args);
 
         va_end(args);
 
@@ -250,15 +1304,153 @@ cmd_t *cmd_parse_from_str(char *buff)
     return new_cmd;
 }
 
+cmd_t * cmd_get_code(int code)
+{
+    cmd_t *cmd_new = NULL;
+
+    // Find the command index by code
+    int locked;
+    cmd_table_t *table = cmd_table_read_begin(&locked);
+    int idx = code >= 0 && code <= 0xFFFF ? cmd_code_find(table, (uint16_t)code) : -1;
+    cmd_list_t cmd_found;
+    if(idx >= 0)
+        cmd_found = table->list[idx];
+    cmd_table_read_end(locked);
+
+    if(idx >= 0)
+        cmd_new = cmd_new_from_list(idx, &cmd_found);
+    else
+        LOGW(tag, "Command code not found: 0x%04X", code);
+
+    return cmd_new;
+}
+
+int cmd_get_code_str(char *name)
+{
+    return name != NULL ? (int)cmd_code_str(name) : CMD_ERROR;
+}
+
+/**
+ * Decode the parameters of a binary TC frame. Integers are zigzag encoded
+ * varints, floats are 4 bytes big endian and strings are null terminated.
+ *
+ * @param buff Encoded parameters
+ * @param len Length of @buff
+ * @param types List of types (see cmd_args_compile)
+ * @param args Decoded values, strings point to @buff
+ * @return 0 if all the parameters were decoded, -1 if they are truncated or a
+ * string is longer than SCH_CMD_MAX_STR_PARAMS-1
+ */
+static int cmd_args_decode(const uint8_t *buff, int len, const char *types, cmd_arg_t *args)
+{
+    int i, pos = 0;
+    for(i=0; types[i] != '\0'; i++)
+    {
+        uint32_t value = 0;
+        int shift = 0;
+        const uint8_t *end;
+        switch(types[i])
+        {
+            case CMD_ARG_INT:
+                do
+                {
+                    if(pos >= len || shift > 28)
+                        return -1;
+                    value |= (uint32_t)(buff[pos] & 0x7F) << shift;
+                    shift += 7;
+                }
+                while(buff[pos++] & 0x80);
+                args[i].i = (int32_t)((value >> 1) ^ (~(value & 1) + 1));
+                break;
+            case CMD_ARG_FLOAT:
+                if(pos + 4 > len)
+                    return -1;
+                value = ((uint32_t)buff[pos] << 24) | ((uint32_t)buff[pos+1] << 16) |
+                        ((uint32_t)buff[pos+2] << 8) | (uint32_t)buff[pos+3];
+                memcpy(&args[i].f, &value, 4);
+                pos += 4;
+                break;
+            case CMD_ARG_STR:
+                if(pos >= len)
+                    return -1;
+                end = memchr(buff + pos, '\0', (size_t)(len - pos));
+                if(end == NULL || end - (buff + pos) >= SCH_CMD_MAX_STR_PARAMS)
+                    return -1;
+                args[i].s = (const char *)(buff + pos);
+                pos = (int)(end - buff) + 1;
+                break;
+            default:
+                return -1;
+        }
+    }
+    return 0;
+}
+
+int cmd_parse_from_bin(const uint8_t *buff, int len, cmd_t **cmd)
+{
+    *cmd = NULL;
+    if(buff == NULL || len < 3)
+        return -1;
+
+    int code = (buff[0] << 8) | buff[1];
+    int plen = buff[2];
+    if(3 + plen > len)
+    {
+        LOGE(tag, "Binary TC truncated (0x%04X, %d > %d)", code, 3 + plen, len);
+        return -1;
+    }
+
+    cmd_t *new_cmd = cmd_get_code(code);
+    if(new_cmd == NULL)
+        return 3 + plen;
+
+    const uint8_t *params = buff + 3;
+    if(new_cmd->args != NULL)
+    {
+        // Typed parameters, stored as binary
+        cmd_arg_t args[CMD_ARGS_MAX];
+        char bin_params[CMD_ARGS_HEADER + CMD_ARGS_MAX*5 + SCH_CMD_MAX_STR_PARAMS];
+        int bin_len = -1;
+        if(cmd_args_decode(params, plen, new_cmd->args, args) == 0)
+            bin_len = cmd_args_pack(bin_params, sizeof(bin_params), new_cmd->args, args);
+        if(bin_len < 0)
+        {
+            LOGE(tag, "Error decoding parameters of command 0x%04X", code);
+            cmd_free(new_cmd);
+            return 3 + plen;
+        }
+        cmd_add_params_raw(new_cmd, bin_params, bin_len);
+        new_cmd->params_bin = new_cmd->params != NULL;
+    }
+    else if(plen > 0 && strcmp(new_cmd->fmt, "%p") == 0)
+    {
+        // Binary parameters are received as is
+        cmd_add_params_raw(new_cmd, (void *)params, plen);
+    }
+    else if(plen > 0)
+    {
+        // Formats not supported as binary are sent as text
+        char str_params[plen + 1];
+        memcpy(str_params, params, (size_t)plen);
+        str_params[plen] = '\0';
+        cmd_add_params_str(new_cmd, str_params);
+    }
+
+    *cmd = new_cmd;
+    return 3 + plen;
+}
+
 void cmd_free(cmd_t *cmd)
 {
     if(cmd != NULL)
     {
-        // Free the params if allocated, we don't need free cmd->fmt because
-        // it has not been copied with malloc (see cmd_get_idx)
-        free(cmd->params);
-        // Free the structure itself
-        free(cmd);
+        // Free the params if allocated from the heap, we don't need free
+        // cmd->fmt because it has not been copied (see cmd_get_idx)
+        cmd_pool_node_t *node = cmd_pool_node(cmd);
+        if(node == NULL || cmd->params != node->params)
+            free(cmd->params);
+        // Return the structure itself to the pool
+        cmd_pool_release(cmd);
     }
 }
 
@@ -287,11 +1479,13 @@ static void quicksort_by_name(cmd_list_t* commands, int start, int end)
 
 static void sort_cmd_list()
 {
-    if (!cmd_is_sorted)
+    // Sorting changes the commands ids, so a sealed list is never sorted
+    if (!cmd_is_sorted && !cmd_is_sealed)
     {
         LOGD(tag, "Sorting Command List");
 
-        quicksort_by_name(cmd_list, 0, cmd_index-1);
+        quicksort_by_name(cmd_table->list, 0, cmd_index-1);
+        cmd_hash_rebuild(cmd_table);
         cmd_is_sorted = 1;
 
         LOGD(tag, "Command List Sorted");
@@ -305,17 +1499,18 @@ void cmd_print_all(void)
     osSemaphoreTake(&repo_cmd_sem, portMAX_DELAY);
 
     sort_cmd_list();
+    cmd_list_t *cmd_list = cmd_table->list;
 
     //Make sure no LOG functions are used in this zone
     osSemaphoreTake(&log_mutex, portMAX_DELAY);
-    printf("%5s %s %25s\n", "Index", "Name", "Params");
+    printf("%5s %6s %s %25s\n", "Index", "Code", "Name", "Params");
     int i;
     for(i=0; i<cmd_index; i++)
     {
-        int printed = printf("%5d %s", i, cmd_list[i].name);
+        int printed = printf("%5d 0x%04X %s", i, cmd_list[i].code, cmd_list[i].name);
         if (*cmd_list[i].fmt != '\0')
         {
-            for (int g = 0; g < 30 - printed; g++)
+            for (int g = 0; g < 37 - printed; g++)
                 printf((g%2 ? "-" : " "));
             printf("%s\n", cmd_list[i].fmt);
         }
@@ -328,11 +1523,43 @@ void cmd_print_all(void)
 
 }
 
+void cmd_print_codes(void)
+{
+    osSemaphoreTake(&repo_cmd_sem, portMAX_DELAY);
+    cmd_list_t *cmd_list = cmd_table->list;
+
+    //Make sure no LOG functions are used in this zone
+    osSemaphoreTake(&log_mutex, portMAX_DELAY);
+    printf("code,name,params\n");
+    int i;
+    for(i=0; i<cmd_index; i++)
+        printf("0x%04X,%s,%s\n", cmd_list[i].code, cmd_list[i].name, cmd_list[i].fmt);
+    osSemaphoreGiven(&log_mutex);
+    //End log_mutex, can use LOG functions
+
+    osSemaphoreGiven(&repo_cmd_sem);
+}
+
 int cmd_repo_init(void)
 {
-    // Init repository mutex
+    // Init repository mutex, commands pool and futures
     osSemaphoreCreate(&repo_cmd_sem);
+    cmd_pool_init();
+    cmd_future_init();
+
+    // Init dispatcher queues by priority
+    int prio;
+    for(prio=CMD_PRIO_CRITICAL; prio<CMD_PRIO_LEVELS; prio++)
+    {
+        if(dispatcher_prio_queue[prio] == NULL)
+            dispatcher_prio_queue[prio] = osQueueCreate(SCH_CMD_PRIO_QUEUE_LEN, sizeof(cmd_t *));
+        if(dispatcher_prio_queue[prio] == NULL)
+            LOGE(tag, "Error creating dispatcher queue %d", prio);
+    }
     cmd_index = 0;  // Reset registered command counter
+    cmd_is_sealed = 0;
+    memset(cmd_table->hash, -1, sizeof(cmd_table->hash));
+    memset(cmd_table->code_hash, -1, sizeof(cmd_table->code_hash));
 
     // Init repos
 #if SCH_TEST_ENABLED
@@ -368,19 +1595,51 @@ int cmd_repo_init(void)
     // Restore the number of not null commands
     cmd_index = last_cmd_index;
 
+    // Sort once and seal the repository, from now on command ids are fixed
+    // and readers do not need to take repo_cmd_sem
+    osSemaphoreTake(&repo_cmd_sem, portMAX_DELAY);
+    sort_cmd_list();
+    cmd_barrier();
+    cmd_is_sealed = 1;
+    osSemaphoreGiven(&repo_cmd_sem);
+
     return CMD_OK;
 }
 
 void cmd_repo_close(void)
 {
     int i;
+    cmd_table_t *table = cmd_table;
     for(i=0; i<SCH_CMD_MAX_ENTRIES; i++)
     {
-        free(cmd_list[i].name);
-        free(cmd_list[i].fmt);
+        free(table->list[i].name);
+        free(table->list[i].fmt);
+        free(table->list[i].args);
     }
 
+    // Free retired tables and the commands they replaced
+    while(cmd_table_retired != NULL)
+    {
+        cmd_table_t *old = cmd_table_retired;
+        cmd_table_retired = old->retired;
+        if(old->replaced >= 0)
+        {
+            free(old->list[old->replaced].name);
+            free(old->list[old->replaced].fmt);
+            free(old->list[old->replaced].args);
+        }
+        if(old != &cmd_table_base)
+            free(old);
+    }
+    if(table != &cmd_table_base)
+        free(table);
+
+    memset(cmd_table_base.list, 0, sizeof(cmd_table_base.list));
+    memset(cmd_table_base.hash, -1, sizeof(cmd_table_base.hash));
+    memset(cmd_table_base.code_hash, -1, sizeof(cmd_table_base.code_hash));
+    cmd_table = &cmd_table_base;
     cmd_index = 0;
+    cmd_is_sealed = 0;
 }
 
 int cmd_null(char *fparams, char *params, int nparam)
@@ -399,19 +1658,14 @@ int cmd_print(cmd_t* cmd)
 char* cmd_get_fmt(char* name)
 {
     char* format = malloc(sizeof(char)*30);
-    int i, ok;
-    for(i=0; i<SCH_CMD_MAX_ENTRIES; i++)
-    {
-        osSemaphoreTake(&repo_cmd_sem, portMAX_DELAY);
-        ok = strcmp(name, cmd_list[i].name);
-        osSemaphoreGiven(&repo_cmd_sem);
 
-        if(ok == 0)
-        {
-            strcpy(format,cmd_list[i].fmt);
-            break;
-        }
-    }
+    int locked;
+    cmd_table_t *table = cmd_table_read_begin(&locked);
+    int idx = cmd_hash_find(table, name);
+    if(idx >= 0)
+        strcpy(format, table->list[idx].fmt);
+    cmd_table_read_end(locked);
+
     return format;
 }
 
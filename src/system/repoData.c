@@ -30,15 +30,76 @@ time_t sec = 0;
 #endif
 
 
-#if SCH_STORAGE_MODE == 0
+/* System variables are kept in RAM if there is no permanent storage, or if
+ * the write-back cache is enabled. In the later case modified variables are
+ * written to the permanent storage by dat_flush_system_vars */
+#define DAT_SYSTEM_CACHE (SCH_STORAGE_MODE > 0 && SCH_STORAGE_CACHE)
+#define DAT_SYSTEM_IN_RAM (SCH_STORAGE_MODE == 0 || DAT_SYSTEM_CACHE)
 #if SCH_STORAGE_TRIPLE_WR == 1
-        int DAT_SYSTEM_VAR_BUFF[dat_system_last_var*3];
-    #else
-        int DAT_SYSTEM_VAR_BUFF[dat_system_last_var];
-    #endif
+    #define DAT_SYSTEM_COPIES 3
+#else
+    #define DAT_SYSTEM_COPIES 1
+#endif
+
+#if DAT_SYSTEM_IN_RAM
+    int DAT_SYSTEM_VAR_BUFF[dat_system_last_var*DAT_SYSTEM_COPIES];
+#endif
+#if DAT_SYSTEM_CACHE
+    static uint8_t dat_system_dirty[dat_system_last_var*DAT_SYSTEM_COPIES];  ///< Modified, not written to storage
+    static int dat_system_n_dirty = 0;      ///< Number of modified variables
+    static int dat_system_last_flush = 0;   ///< Unix time of the last flush
+    /* Variables written to storage as soon as they are modified, alone,
+     * without flushing the other modified variables. The payload indexes and
+     * acknowledges locate the samples in the payload storage, if they are
+     * lost the samples are overwritten or sent again */
+    static const dat_system_t dat_system_critical[] = {
+        dat_obc_opmode, dat_obc_last_reset, dat_obc_reset_counter,
+        dat_dep_deployed, dat_dep_ant_deployed, dat_dep_date_time,
+        dat_com_freq, dat_com_tx_pwr, dat_com_baud, dat_com_mode, dat_com_bcn_period,
+        dat_drp_temp, dat_drp_ads, dat_drp_eps, dat_drp_lang,
+        dat_drp_ack_temp, dat_drp_ack_ads, dat_drp_ack_eps, dat_drp_ack_lang
+    };
+    static uint8_t dat_system_is_critical[dat_system_last_var];
+#endif
+#if SCH_STORAGE_MODE == 0
     fp_entry_t data_base [SCH_FP_MAX_ENTRIES];
 #endif
 
+/* Flight plan time index. A min-heap with the execution time of every command
+ * in the flight plan, protected by repo_data_fp_sem. The next command is
+ * always on top, so checking if a command is due does not read the storage.
+ * A hash table maps each time to its heap position to find it by time. Both
+ * are allocated and grow with the flight plan */
+typedef struct dat_fp_index_slot {
+    int unixtime;                   ///< Execution time, the key
+    int pos;                        ///< Position in dat_fp_index, -1 if the slot is empty
+} dat_fp_index_slot_t;
+
+static int *dat_fp_index = NULL;
+static int dat_fp_index_n = 0;
+static int dat_fp_index_size = 0;                   ///< Allocated heap entries
+static dat_fp_index_slot_t *dat_fp_index_map = NULL;
+static unsigned int dat_fp_index_mask = 0;          ///< Hash table size - 1
+static osQueue dat_fp_wake = NULL;  ///< Wakes up the flight plan task
+
+/**
+ * Flight plan entry staged to be committed by dat_commit_fp
+ */
+typedef struct dat_fp_staged {
+    int unixtime;                       ///< Unix-time, sets when the command should next execute
+    int executions;                     ///< Amount of times the command will be executed per periodic cycle
+    int periodical;                     ///< Period of time between executions
+    char cmd[SCH_CMD_MAX_STR_NAME];     ///< Command to execute
+    char args[SCH_CMD_MAX_STR_PARAMS];  ///< Command's arguments
+} dat_fp_staged_t;
+
+/* Flight plan entries uploaded in bulk are staged in RAM, protected by
+ * repo_data_fp_sem, and then committed to the flight plan at once. The stage
+ * belongs to the upload session of its first entry until it is cleared */
+static dat_fp_staged_t dat_fp_stage[SCH_FP_MAX_ENTRIES];
+static int dat_fp_stage_n = 0;
+static int dat_fp_stage_session = -1;
+
 struct map data_map[last_sensor] = {
         {"temp_data",      (uint16_t) (sizeof(temp_data_t)),     dat_drp_temp, dat_drp_ack_temp, "%u %f %f %f",                   "timestamp obc_temp_1 obc_temp_2 obc_temp_3"},
         { "ads_data",      (uint16_t) (sizeof(ads_data_t)),      dat_drp_ads,  dat_drp_ack_ads,  "%u %f %f %f %f %f %f",          "timestamp acc_x acc_y acc_z mag_x mag_y mag_z"},
@@ -46,6 +107,80 @@ struct map data_map[last_sensor] = {
         { "langmuir_data", (uint16_t) (sizeof(langmuir_data_t)), dat_drp_lang, dat_drp_ack_lang, "%u %f %f %f %d",                "timestamp sweep_voltage plasma_voltage plasma_temperature particles_counter"}
 };
 
+static dat_payload_desc_t dat_payload_desc[last_sensor];
+static int dat_payload_desc_ready = 0;
+
+/**
+ * Parse the payload structs schemas from data_map, once
+ */
+static void _dat_payload_desc_init(void)
+{
+    int i, j;
+    for(i=0; i<last_sensor; i++)
+    {
+        dat_payload_desc_t *desc = &dat_payload_desc[i];
+        char order[50];
+        strcpy(order, data_map[i].data_order);
+        strcpy(desc->names, data_map[i].var_names);
+
+        // Fields types and offsets
+        int offset = 0;
+        char *tok = strtok(order, " ");
+        for(j=0; tok != NULL && j<DAT_PAYLOAD_MAX_FIELDS; j++)
+        {
+            dat_payload_field_t *field = &desc->fields[j];
+            field->type = tok[1];
+            field->offset = (uint16_t)offset;
+            switch(field->type)
+            {
+                case 'f': field->size = sizeof(float); break;
+                case 'u': field->size = sizeof(unsigned int); break;
+                case 'd': field->size = sizeof(int); break;
+                default:
+                    LOGW(tag, "Unknown type %s in payload %d", tok, i);
+                    field->size = sizeof(int);
+            }
+            offset += field->size;
+            tok = strtok(NULL, " ");
+        }
+        desc->nfields = j;
+        if(tok != NULL)
+            LOGE(tag, "Payload %d has more than %d fields", i, DAT_PAYLOAD_MAX_FIELDS);
+        if(offset != data_map[i].size)
+            LOGW(tag, "Payload %d fields use %d bytes, struct size is %d", i, offset, data_map[i].size);
+
+        // Fields names
+        tok = strtok(desc->names, " ");
+        for(j=0; tok != NULL && j<desc->nfields; j++)
+        {
+            desc->fields[j].name = tok;
+            tok = strtok(NULL, " ");
+        }
+        if(j != desc->nfields)
+        {
+            LOGE(tag, "Payload %d has %d types and %d names", i, desc->nfields, j);
+            desc->nfields = j;
+        }
+
+        desc->time_field = -1;
+        for(j=0; j<desc->nfields && desc->time_field < 0; j++)
+        {
+            if(strcmp(desc->fields[j].name, "timestamp") == 0)
+                desc->time_field = j;
+        }
+    }
+    dat_payload_desc_ready = 1;
+}
+
+const dat_payload_desc_t *dat_get_payload_desc(int payload)
+{
+    if(payload < 0 || payload >= last_sensor)
+        return NULL;
+    if(!dat_payload_desc_ready)
+        _dat_payload_desc_init();
+    return &dat_payload_desc[payload];
+}
+
 void initialize_payload_vars(void){
     int i =0;
     for(i=0; i< last_sensor; ++i) {
@@ -56,6 +191,219 @@ void initialize_payload_vars(void){
     }
 }
 
+/**
+ * Slot of the flight plan index hash table that holds @timetodo or the empty
+ * slot where it should be inserted. The table is never full.
+ */
+static unsigned int _dat_fp_index_slot(int timetodo)
+{
+    unsigned int slot = ((unsigned int)timetodo * 2654435761u) & dat_fp_index_mask;
+    while(dat_fp_index_map[slot].pos >= 0 && dat_fp_index_map[slot].unixtime != timetodo)
+        slot = (slot+1) & dat_fp_index_mask;
+    return slot;
+}
+
+/**
+ * Position of @timetodo in the flight plan time index, -1 if not found
+ */
+static int _dat_fp_index_find(int timetodo)
+{
+    if(dat_fp_index_map == NULL)
+        return -1;
+    return dat_fp_index_map[_dat_fp_index_slot(timetodo)].pos;
+}
+
+/**
+ * Remove @timetodo from the hash table, shifting back the following slots of
+ * its probe sequence so lookups do not need deleted markers
+ */
+static void _dat_fp_index_unmap(int timetodo)
+{
+    unsigned int hole = _dat_fp_index_slot(timetodo);
+    unsigned int slot = hole;
+    if(dat_fp_index_map[hole].pos < 0)
+        return;
+    while(1)
+    {
+        slot = (slot+1) & dat_fp_index_mask;
+        if(dat_fp_index_map[slot].pos < 0)
+            break;
+        // Move the entry to the hole if the hole is between its home slot
+        // and its current slot
+        unsigned int home = ((unsigned int)dat_fp_index_map[slot].unixtime * 2654435761u) & dat_fp_index_mask;
+        if(((slot - home) & dat_fp_index_mask) >= ((slot - hole) & dat_fp_index_mask))
+        {
+            dat_fp_index_map[hole] = dat_fp_index_map[slot];
+            hole = slot;
+        }
+    }
+    dat_fp_index_map[hole].pos = -1;
+}
+
+/**
+ * Empty the flight plan time index, keeping its memory
+ */
+static void _dat_fp_index_clear(void)
+{
+    unsigned int i;
+    dat_fp_index_n = 0;
+    for(i = 0; dat_fp_index_map != NULL && i <= dat_fp_index_mask; i++)
+        dat_fp_index_map[i].pos = -1;
+}
+
+/**
+ * Grow the flight plan time index to hold at least @size times. The hash
+ * table is kept at most half full.
+ *
+ * @return 0 OK, -1 if there is no memory
+ */
+static int _dat_fp_index_reserve(int size)
+{
+    if(size <= dat_fp_index_size)
+        return 0;
+
+    int new_size = dat_fp_index_size > 0 ? dat_fp_index_size : 8;
+    while(new_size < size)
+        new_size *= 2;
+    unsigned int map_size = 1;
+    while(map_size < 2*(unsigned int)new_size)
+        map_size *= 2;
+
+    dat_fp_index_slot_t *map = (dat_fp_index_slot_t *)malloc(map_size*sizeof(dat_fp_index_slot_t));
+    if(map == NULL)
+        return -1;
+    int *heap = (int *)realloc(dat_fp_index, new_size*sizeof(int));
+    if(heap == NULL)
+    {
+        free(map);
+        return -1;
+    }
+    dat_fp_index = heap;
+    dat_fp_index_size = new_size;
+    free(dat_fp_index_map);
+    dat_fp_index_map = map;
+    dat_fp_index_mask = map_size - 1;
+
+    // Rehash the times already in the heap
+    int i;
+    for(i = 0; i <= (int)dat_fp_index_mask; i++)
+        dat_fp_index_map[i].pos = -1;
+    for(i = 0; i < dat_fp_index_n; i++)
+    {
+        unsigned int slot = _dat_fp_index_slot(dat_fp_index[i]);
+        dat_fp_index_map[slot].unixtime = dat_fp_index[i];
+        dat_fp_index_map[slot].pos = i;
+    }
+    return 0;
+}
+
+/**
+ * Put @timetodo in the heap position @i, updating its hash table slot
+ */
+static void _dat_fp_index_place(int i, int timetodo)
+{
+    dat_fp_index[i] = timetodo;
+    dat_fp_index_map[_dat_fp_index_slot(timetodo)].pos = i;
+}
+
+/**
+ * Move the time in position @i up or down to restore the heap order
+ */
+static void _dat_fp_index_fix(int i)
+{
+    int tmp = dat_fp_index[i];
+    // Up, while smaller than the parent
+    while(i > 0 && tmp < dat_fp_index[(i-1)/2])
+    {
+        _dat_fp_index_place(i, dat_fp_index[(i-1)/2]);
+        i = (i-1)/2;
+    }
+    // Down, while greater than the smallest child
+    while(2*i+1 < dat_fp_index_n)
+    {
+        int child = 2*i+1;
+        if(child+1 < dat_fp_index_n && dat_fp_index[child+1] < dat_fp_index[child])
+            child++;
+        if(tmp <= dat_fp_index[child])
+            break;
+        _dat_fp_index_place(i, dat_fp_index[child]);
+        i = child;
+    }
+    _dat_fp_index_place(i, tmp);
+}
+
+/**
+ * Add @timetodo to the flight plan time index, if it is not there yet.
+ * Wakes up the flight plan task if it is the next command.
+ *
+ * @return 0 OK, -1 if the index is full
+ */
+static int _dat_fp_index_add(int timetodo)
+{
+    if(_dat_fp_index_find(timetodo) >= 0)
+        return 0;
+    if(dat_fp_index_n >= SCH_FP_MAX_ENTRIES)
+    {
+        LOGE(tag, "Flight plan full, max. %d commands", SCH_FP_MAX_ENTRIES);
+        return -1;
+    }
+    if(_dat_fp_index_reserve(dat_fp_index_n+1) != 0)
+    {
+        LOGE(tag, "Unable to grow the flight plan index");
+        return -1;
+    }
+
+    // The new slot is claimed here, _dat_fp_index_fix sets its position
+    unsigned int slot = _dat_fp_index_slot(timetodo);
+    dat_fp_index_map[slot].unixtime = timetodo;
+    dat_fp_index_map[slot].pos = dat_fp_index_n;
+    dat_fp_index[dat_fp_index_n++] = timetodo;
+    _dat_fp_index_fix(dat_fp_index_n-1);
+    if(dat_fp_index[0] == timetodo && dat_fp_wake != NULL)
+        osQueueSend(dat_fp_wake, &timetodo, 0);
+    return 0;
+}
+
+/**
+ * Remove @timetodo from the flight plan time index
+ */
+static void _dat_fp_index_del(int timetodo)
+{
+    int i = _dat_fp_index_find(timetodo);
+    if(i < 0)
+        return;
+    _dat_fp_index_unmap(timetodo);
+    dat_fp_index_n--;
+    if(i < dat_fp_index_n)
+    {
+        // The last time fills the hole
+        _dat_fp_index_place(i, dat_fp_index[dat_fp_index_n]);
+        _dat_fp_index_fix(i);
+    }
+}
+
+#if SCH_STORAGE_MODE > 0
+/**
+ * Build the flight plan time index from the commands in the storage
+ */
+static void _dat_fp_index_load(void)
+{
+    _dat_fp_index_clear();
+    if(_dat_fp_index_reserve(SCH_FP_MAX_ENTRIES) != 0)
+    {
+        LOGE(tag, "Unable to allocate the flight plan index");
+        return;
+    }
+
+    // Read the times into the heap array and add them in place, the i-th
+    // time is added at a position <= i so unread times are not overwritten
+    int i, n = storage_flight_plan_get_times(dat_fp_index, SCH_FP_MAX_ENTRIES);
+    for(i=0; i<n; i++)
+        _dat_fp_index_add(dat_fp_index[i]);
+    LOGD(tag, "Flight plan has %d commands", dat_fp_index_n);
+}
+#endif
+
 void dat_repo_init(void)
 {
     // Init repository mutex
@@ -70,6 +418,7 @@ void dat_repo_init(void)
     }
 
     LOGD(tag, "Initializing data repositories buffers...")
+    _dat_payload_desc_init();
     /* TODO: Setup external memories */
 #if (SCH_STORAGE_MODE == 0)
     {
@@ -90,6 +439,7 @@ void dat_repo_init(void)
             data_base[i].executions = 0;
             data_base[i].periodical = 0;
         }
+        _dat_fp_index_clear();
     }
 #elif (SCH_STORAGE_MODE > 0)
     {
@@ -102,6 +452,19 @@ void dat_repo_init(void)
         rc = storage_table_repo_init(DAT_REPO_SYSTEM, 0);
         assertf(rc==0, tag, "Unable to create system variables repository");
 
+#if DAT_SYSTEM_CACHE
+        //Load the system variables cache
+        rc = storage_repo_get_values(DAT_SYSTEM_VAR_BUFF, dat_system_last_var*DAT_SYSTEM_COPIES, DAT_REPO_SYSTEM);
+        assertf(rc==0, tag, "Unable to load system variables");
+        memset(dat_system_dirty, 0, sizeof(dat_system_dirty));
+        memset(dat_system_is_critical, 0, sizeof(dat_system_is_critical));
+        int i;
+        for(i=0; i<sizeof(dat_system_critical)/sizeof(dat_system_critical[0]); i++)
+            dat_system_is_critical[dat_system_critical[i]] = 1;
+        dat_system_n_dirty = 0;
+        dat_system_last_flush = (int)time(NULL);
+#endif
+
         //Init payloads repo
         rc = storage_table_payload_init(0);
         assertf(rc==0, tag, "Unable to create payload repo");
@@ -109,9 +472,13 @@ void dat_repo_init(void)
         //Init system flight plan table
         rc=storage_table_flight_plan_init(0);
         assertf(rc==0, tag, "Unable to create flight plan table");
+        _dat_fp_index_load();
     }
 #endif
 
+    if(dat_fp_wake == NULL)
+        dat_fp_wake = osQueueCreate(1, sizeof(int));
+
 //    /* TODO: Initialize custom variables */
 //    LOGD(tag, "Initializing system variables values...")
 ////    dat_set_system_var(dat_obc_hrs_alive, 0);
@@ -128,11 +495,129 @@ void dat_repo_close(void)
 {
 #if SCH_STORAGE_MODE != 0
     {
+        dat_flush_system_vars();
+        dat_flush_payload_data();
         storage_close();
     }
 #endif
 }
 
+#if DAT_SYSTEM_CACHE
+/**
+ * Write the modified system variables to the permanent storage in one
+ * transaction. Must be called with repo_data_sem taken.
+ *
+ * @return 0 OK, -1 Error
+ */
+static int _dat_flush_system_vars(void)
+{
+    int n = dat_system_last_var*DAT_SYSTEM_COPIES;
+    int index[n];
+    int values[n];
+    int i, n_dirty = 0;
+
+    if(dat_system_n_dirty == 0)
+        return 0;
+
+    for(i=0; i<n; i++)
+    {
+        if(dat_system_dirty[i])
+        {
+            index[n_dirty] = i;
+            values[n_dirty] = DAT_SYSTEM_VAR_BUFF[i];
+            n_dirty++;
+        }
+    }
+
+    int rc = storage_repo_set_values(index, values, n_dirty, DAT_REPO_SYSTEM);
+    if(rc == 0)
+    {
+        memset(dat_system_dirty, 0, sizeof(dat_system_dirty));
+        dat_system_n_dirty = 0;
+    }
+    dat_system_last_flush = (int)time(NULL);
+    return rc;
+}
+
+/**
+ * Mark a cached system variable as modified. Must be called with
+ * repo_data_sem taken.
+ *
+ * @param index Storage index of the modified variable (including copies)
+ */
+static void _dat_system_var_dirty(int index)
+{
+    if(!dat_system_dirty[index])
+    {
+        dat_system_dirty[index] = 1;
+        dat_system_n_dirty++;
+    }
+}
+
+/**
+ * Write only the modified copies of the variable @index to the permanent
+ * storage, other modified variables are left for the next flush. Must be
+ * called with repo_data_sem taken.
+ *
+ * @param index Variable to write
+ * @return 0 OK, -1 Error
+ */
+static int _dat_write_system_var(dat_system_t index)
+{
+    int copies[DAT_SYSTEM_COPIES];
+    int values[DAT_SYSTEM_COPIES];
+    int i, n_dirty = 0;
+
+    for(i=0; i<DAT_SYSTEM_COPIES; i++)
+    {
+        int copy = index + i*dat_system_last_var;
+        if(dat_system_dirty[copy])
+        {
+            copies[n_dirty] = copy;
+            values[n_dirty] = DAT_SYSTEM_VAR_BUFF[copy];
+            n_dirty++;
+        }
+    }
+    if(n_dirty == 0)
+        return 0;
+
+    int rc = storage_repo_set_values(copies, values, n_dirty, DAT_REPO_SYSTEM);
+    if(rc == 0)
+    {
+        for(i=0; i<n_dirty; i++)
+            dat_system_dirty[copies[i]] = 0;
+        dat_system_n_dirty -= n_dirty;
+    }
+    return rc;
+}
+
+/**
+ * Write a critical variable @index to the permanent storage right away, and
+ * all the modified variables if SCH_STORAGE_CACHE_PERIOD seconds have passed
+ * since the last flush. Must be called with repo_data_sem taken.
+ *
+ * @param index Modified variable
+ */
+static void _dat_system_var_sync(dat_system_t index)
+{
+    if((int)time(NULL) - dat_system_last_flush >= SCH_STORAGE_CACHE_PERIOD)
+        _dat_flush_system_vars();
+    else if(dat_system_is_critical[index])
+        _dat_write_system_var(index);
+}
+#endif
+
+int dat_flush_system_vars(void)
+{
+    int rc = 0;
+#if DAT_SYSTEM_CACHE
+    osSemaphoreTake(&repo_data_sem, portMAX_DELAY);
+    rc = _dat_flush_system_vars();
+    osSemaphoreGiven(&repo_data_sem);
+#endif
+    return rc;
+}
+
 /**
  * Function for testing triple writing.
  *
@@ -147,8 +632,12 @@ void _dat_set_system_var(dat_system_t index, int value)
     osSemaphoreTake(&repo_data_sem, portMAX_DELAY);
 
     //Uses internal memory
-#if SCH_STORAGE_MODE == 0
+#if DAT_SYSTEM_IN_RAM
     DAT_SYSTEM_VAR_BUFF[index] = value;
+    #if DAT_SYSTEM_CACHE
+        _dat_system_var_dirty(index);
+        _dat_system_var_sync(index % dat_system_last_var);
+    #endif
     //Uses external memory
 #else
     storage_repo_set_value_idx(index, value, DAT_REPO_SYSTEM);
@@ -174,7 +663,7 @@ int _dat_get_system_var(dat_system_t index)
     osSemaphoreTake(&repo_data_sem, portMAX_DELAY);
 
     //Use internal (volatile) memory
-#if SCH_STORAGE_MODE == 0
+#if DAT_SYSTEM_IN_RAM
     value = DAT_SYSTEM_VAR_BUFF[index];
     //Uses external (non-volatile) memory
 #else
@@ -193,13 +682,22 @@ void dat_set_system_var(dat_system_t index, int value)
     osSemaphoreTake(&repo_data_sem, portMAX_DELAY);
 
     //Uses internal memory
-#if SCH_STORAGE_MODE == 0
+#if DAT_SYSTEM_IN_RAM
     DAT_SYSTEM_VAR_BUFF[index] = value;
         //Uses tripled writing
         #if SCH_STORAGE_TRIPLE_WR == 1
             DAT_SYSTEM_VAR_BUFF[index + dat_system_last_var] = value;
             DAT_SYSTEM_VAR_BUFF[index + dat_system_last_var * 2] = value;
         #endif
+        //Write back to the external memory later
+        #if DAT_SYSTEM_CACHE
+            _dat_system_var_dirty(index);
+            #if SCH_STORAGE_TRIPLE_WR == 1
+                _dat_system_var_dirty(index + dat_system_last_var);
+                _dat_system_var_dirty(index + dat_system_last_var * 2);
+            #endif
+            _dat_system_var_sync(index);
+        #endif
     //Uses external memory
 #else
     storage_repo_set_value_idx(index, value, DAT_REPO_SYSTEM);
@@ -214,6 +712,31 @@ void dat_set_system_var(dat_system_t index, int value)
     osSemaphoreGiven(&repo_data_sem);
 }
 
+/**
+ * Choose the value of a triple written variable, the value that has at least
+ * two equal copies.
+ *
+ * @param index Variable index, used to report errors
+ * @return The voted value, or @value_1 if the three copies are different
+ */
+static int dat_vote_system_var(int index, int value_1, int value_2, int value_3)
+{
+    //Compare value and its copies
+    if (value_1 == value_2 || value_1 == value_3)
+    {
+        return value_1;
+    }
+    else if (value_2 == value_3)
+    {
+        return value_2;
+    }
+    else
+    {
+        LOGE(tag, "Unable to get a correct value for index %d", index);
+        return value_1;
+    }
+}
+
 int dat_get_system_var(dat_system_t index)
 {
     int value_1 = 0;
@@ -224,7 +747,7 @@ int dat_get_system_var(dat_system_t index)
     osSemaphoreTake(&repo_data_sem, portMAX_DELAY);
 
     //Use internal (volatile) memory
-#if SCH_STORAGE_MODE == 0
+#if DAT_SYSTEM_IN_RAM
     value_1 = DAT_SYSTEM_VAR_BUFF[index];
         //Uses tripled writing
         #if SCH_STORAGE_TRIPLE_WR == 1
@@ -244,77 +767,109 @@ int dat_get_system_var(dat_system_t index)
     //Exit critical zone
     osSemaphoreGiven(&repo_data_sem);
 #if SCH_STORAGE_TRIPLE_WR == 1
-    //Compare value and its copies
-    if (value_1 == value_2 || value_1 == value_3)
-    {
-        return value_1;
-    }
-    else if (value_2 == value_3)
-    {
-        return value_2;
-    }
-    else
-    {
-        LOGE(tag, "Unable to get a correct value for index %d", index);
-        return value_1;
-    }
+    return dat_vote_system_var(index, value_1, value_2, value_3);
 #else
     return value_1;
 #endif
 }
 
+void dat_get_system_snapshot(int *values)
+{
+#if SCH_STORAGE_TRIPLE_WR == 1
+    int copies = 3;
+#else
+    int copies = 1;
+#endif
+    int n = dat_system_last_var*copies;
+
+    //Enter critical zone
+    osSemaphoreTake(&repo_data_sem, portMAX_DELAY);
+
+    //Use internal (volatile) memory
+#if DAT_SYSTEM_IN_RAM
+    memcpy(values, DAT_SYSTEM_VAR_BUFF, sizeof(int)*dat_system_last_var);
+    #if SCH_STORAGE_TRIPLE_WR == 1
+        int buff[n];
+        memcpy(buff, DAT_SYSTEM_VAR_BUFF, sizeof(buff));
+    #endif
+    //Uses external (non-volatile) memory, all values and copies at once
+#else
+    int buff[n];
+    storage_repo_get_values(buff, n, DAT_REPO_SYSTEM);
+    memcpy(values, buff, sizeof(int)*dat_system_last_var);
+#endif
+
+    //Exit critical zone
+    osSemaphoreGiven(&repo_data_sem);
+
+#if SCH_STORAGE_TRIPLE_WR == 1
+    int index;
+    for(index=0; index<dat_system_last_var; index++)
+        values[index] = dat_vote_system_var(index, buff[index],
+                                            buff[index + dat_system_last_var],
+                                            buff[index + dat_system_last_var * 2]);
+#endif
+}
+
 void dat_status_to_struct(dat_status_t *status)
 {
     assert(status != NULL);
-    DAT_CPY_SYSTEM_VAR(status, dat_obc_opmode);        ///< General operation mode
-    DAT_CPY_SYSTEM_VAR(status, dat_obc_last_reset);    ///< Last reset source
-    DAT_CPY_SYSTEM_VAR(status, dat_obc_hrs_alive);     ///< Hours since first boot
-    DAT_CPY_SYSTEM_VAR(status, dat_obc_hrs_wo_reset);  ///< Hours since last reset
-    DAT_CPY_SYSTEM_VAR(status, dat_obc_reset_counter); ///< Number of reset since first boot
-    DAT_CPY_SYSTEM_VAR(status, dat_obc_sw_wdt);        ///< Software watchdog timer counter
-    DAT_CPY_SYSTEM_VAR_F(status, dat_obc_temp_1);        ///< Temperature value of the first sensor
-    DAT_CPY_SYSTEM_VAR_F(status, dat_obc_temp_2);        ///< Temperature value of the second sensor
-    DAT_CPY_SYSTEM_VAR_F(status, dat_obc_temp_3);        ///< Temperature value of the gyroscope
-
-    DAT_CPY_SYSTEM_VAR(status, dat_dep_deployed);      ///< Was the satellite deployed?
-    DAT_CPY_SYSTEM_VAR(status, dat_dep_ant_deployed);  ///< Was the antenna deployed?
-    DAT_CPY_SYSTEM_VAR(status, dat_dep_date_time);     ///< Deployment unix time
-
-    DAT_CPY_SYSTEM_VAR(status, dat_rtc_date_time);     /// RTC current unix time
-
-    DAT_CPY_SYSTEM_VAR(status, dat_com_count_tm);      ///< number of TM sent
-    DAT_CPY_SYSTEM_VAR(status, dat_com_count_tc);      ///< number of received TC
-    DAT_CPY_SYSTEM_VAR(status, dat_com_last_tc);       ///< Unix time of the last received tc
-    DAT_CPY_SYSTEM_VAR(status, dat_com_freq);          ///< Frequency [Hz]
-    DAT_CPY_SYSTEM_VAR(status, dat_com_tx_pwr);        ///< TX power (0: 25dBm, 1: 27dBm, 2: 28dBm, 3: 30dBm)
-    DAT_CPY_SYSTEM_VAR(status, dat_com_baud);          ///< Baudrate [bps]
-    DAT_CPY_SYSTEM_VAR(status, dat_com_mode);          ///< Framing mode (1: RAW, 2: ASM, 3: HDLC, 4: Viterbi, 5: GOLAY, 6: AX25)
-    DAT_CPY_SYSTEM_VAR(status, dat_com_bcn_period);    ///< Number of seconds between beacon packets
-
-    DAT_CPY_SYSTEM_VAR(status, dat_fpl_last);          ///< Last executed flight plan (unix time)
-    DAT_CPY_SYSTEM_VAR(status, dat_fpl_queue);         ///< Flight plan queue length
-
-    DAT_CPY_SYSTEM_VAR_F(status, dat_ads_acc_x);         ///< Gyroscope acceleration value along the x axis
-    DAT_CPY_SYSTEM_VAR_F(status, dat_ads_acc_y);         ///< Gyroscope acceleration value along the y axis
-    DAT_CPY_SYSTEM_VAR_F(status, dat_ads_acc_z);         ///< Gyroscope acceleration value along the z axis
-    DAT_CPY_SYSTEM_VAR_F(status, dat_ads_mag_x);         ///< Magnetometer x axis
-    DAT_CPY_SYSTEM_VAR_F(status, dat_ads_mag_y);         ///< Magnetometer y axis
-    DAT_CPY_SYSTEM_VAR_F(status, dat_ads_mag_z);         ///< Magnetometer z axis
-
-    DAT_CPY_SYSTEM_VAR(status, dat_eps_vbatt);         ///< Voltage of battery [mV]
-    DAT_CPY_SYSTEM_VAR(status, dat_eps_cur_sun);       ///< Current from boost converters [mA]
-    DAT_CPY_SYSTEM_VAR(status, dat_eps_cur_sys);       ///< Current out of battery [mA]
-    DAT_CPY_SYSTEM_VAR(status, dat_eps_temp_bat0);     ///< Battery temperature sensor
-
-    DAT_CPY_SYSTEM_VAR(status, dat_drp_temp);
-    DAT_CPY_SYSTEM_VAR(status, dat_drp_ads);
-    DAT_CPY_SYSTEM_VAR(status, dat_drp_eps);
-    DAT_CPY_SYSTEM_VAR(status, dat_drp_lang);
-
-    DAT_CPY_SYSTEM_VAR(status, dat_drp_ack_temp);
-    DAT_CPY_SYSTEM_VAR(status, dat_drp_ack_ads);
-    DAT_CPY_SYSTEM_VAR(status, dat_drp_ack_eps);
-    DAT_CPY_SYSTEM_VAR(status, dat_drp_ack_lang);
+    int values[dat_system_last_var];
+    dat_get_system_snapshot(values);
+
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_obc_opmode);        ///< General operation mode
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_obc_last_reset);    ///< Last reset source
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_obc_hrs_alive);     ///< Hours since first boot
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_obc_hrs_wo_reset);  ///< Hours since last reset
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_obc_reset_counter); ///< Number of reset since first boot
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_obc_sw_wdt);        ///< Software watchdog timer counter
+    DAT_CPY_SNAPSHOT_VAR_F(status, values, dat_obc_temp_1);        ///< Temperature value of the first sensor
+    DAT_CPY_SNAPSHOT_VAR_F(status, values, dat_obc_temp_2);        ///< Temperature value of the second sensor
+    DAT_CPY_SNAPSHOT_VAR_F(status, values, dat_obc_temp_3);        ///< Temperature value of the gyroscope
+
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_dep_deployed);      ///< Was the satellite deployed?
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_dep_ant_deployed);  ///< Was the antenna deployed?
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_dep_date_time);     ///< Deployment unix time
+
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_rtc_date_time);     /// RTC current unix time
+
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_com_count_tm);      ///< number of TM sent
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_com_count_tc);      ///< number of received TC
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_com_last_tc);       ///< Unix time of the last received tc
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_com_freq);          ///< Frequency [Hz]
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_com_tx_pwr);        ///< TX power (0: 25dBm, 1: 27dBm, 2: 28dBm, 3: 30dBm)
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_com_baud);          ///< Baudrate [bps]
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_com_mode);          ///< Framing mode (1: RAW, 2: ASM, 3: HDLC, 4: Viterbi, 5: GOLAY, 6: AX25)
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_com_bcn_period);    ///< Number of seconds between beacon packets
+
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_fpl_last);          ///< Last executed flight plan (unix time)
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_fpl_queue);         ///< Flight plan queue length
+
+    DAT_CPY_SNAPSHOT_VAR_F(status, values, dat_ads_acc_x);         ///< Gyroscope acceleration value along the x axis
+    DAT_CPY_SNAPSHOT_VAR_F(status, values, dat_ads_acc_y);         ///< Gyroscope acceleration value along the y axis
+    DAT_CPY_SNAPSHOT_VAR_F(status, values, dat_ads_acc_z);         ///< Gyroscope acceleration value along the z axis
+    DAT_CPY_SNAPSHOT_VAR_F(status, values, dat_ads_mag_x);         ///< Magnetometer x axis
+    DAT_CPY_SNAPSHOT_VAR_F(status, values, dat_ads_mag_y);         ///< Magnetometer y axis
+    DAT_CPY_SNAPSHOT_VAR_F(status, values, dat_ads_mag_z);         ///< Magnetometer z axis
+
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_eps_vbatt);         ///< Voltage of battery [mV]
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_eps_cur_sun);       ///< Current from boost converters [mA]
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_eps_cur_sys);       ///< Current out of battery [mA]
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_eps_temp_bat0);     ///< Battery temperature sensor
+
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_drp_temp);
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_drp_ads);
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_drp_eps);
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_drp_lang);
+
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_drp_ack_temp);
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_drp_ack_ads);
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_drp_ack_eps);
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_drp_ack_lang);
+
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_fpl_late);          ///< Lateness of the last executed flight plan command [s]
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_fpl_late_max);      ///< Max. lateness of an executed flight plan command [s]
+    DAT_CPY_SNAPSHOT_VAR(status, values, dat_fpl_skipped);       ///< Flight plan executions skipped because they were late
 }
 
 void dat_print_status(dat_status_t *status)
@@ -368,6 +923,10 @@ void dat_print_status(dat_status_t *status)
     DAT_PRINT_SYSTEM_VAR(status, dat_drp_ack_ads);
     DAT_PRINT_SYSTEM_VAR(status, dat_drp_ack_eps);
     DAT_PRINT_SYSTEM_VAR(status, dat_drp_ack_lang);
+
+    DAT_PRINT_SYSTEM_VAR(status, dat_fpl_late);          ///< Lateness of the last executed flight plan command [s]
+    DAT_PRINT_SYSTEM_VAR(status, dat_fpl_late_max);      ///< Max. lateness of an executed flight plan command [s]
+    DAT_PRINT_SYSTEM_VAR(status, dat_fpl_skipped);       ///< Flight plan executions skipped because they were late
 }
 
 #if SCH_STORAGE_MODE == 0
@@ -384,6 +943,15 @@ static int _dat_set_fp_async(int timetodo, char* command, char* args, int execut
 
             data_base[i].cmd = malloc(sizeof(char)*50);
             data_base[i].args = malloc(sizeof(char)*50);
+            if(data_base[i].cmd == NULL || data_base[i].args == NULL)
+            {
+                free(data_base[i].cmd);
+                free(data_base[i].args);
+                data_base[i].unixtime = 0;
+                data_base[i].cmd = NULL;
+                data_base[i].args = NULL;
+                return 1;
+            }
 
             strcpy(data_base[i].cmd, command);
             strcpy(data_base[i].args,args);
@@ -407,11 +975,78 @@ static int _dat_del_fp_async(int timetodo)
             data_base[i].periodical = 0;
             free(data_base[i].args);
             free(data_base[i].cmd);
+            data_base[i].args = NULL;
+            data_base[i].cmd = NULL;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Remove the entry at @timetodo without freeing its strings, which are still
+ * owned by a snapshot of the table (see dat_commit_fp).
+ *
+ * @return 0 if the entry was removed, 1 if not found
+ */
+static int _dat_unlink_fp_async(int timetodo)
+{
+    int i;
+    for(i = 0;i < SCH_FP_MAX_ENTRIES;i++)
+    {
+        if(timetodo == data_base[i].unixtime && timetodo != 0)
+        {
+            data_base[i].unixtime = 0;
+            data_base[i].executions = 0;
+            data_base[i].periodical = 0;
+            data_base[i].args = NULL;
+            data_base[i].cmd = NULL;
             return 0;
         }
     }
     return 1;
 }
+
+/**
+ * Move the entry at @from with command @command to @to. Entries are matched
+ * by time and command because this table allows repeated times.
+ *
+ * @return 0 if OK, -1 if the entry was not found
+ */
+static int _dat_move_fp_async(int from, int to, char* command)
+{
+    int i;
+    for(i = 0;i < SCH_FP_MAX_ENTRIES;i++)
+    {
+        if(from == data_base[i].unixtime && data_base[i].unixtime != 0 && strcmp(command, data_base[i].cmd) == 0)
+        {
+            data_base[i].unixtime = to;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int _dat_get_fp_async(int timetodo, char* command, char* args, int* executions, int* periodical)
+{
+    int i;
+    for(i = 0;i < SCH_FP_MAX_ENTRIES;i++)
+    {
+        if(timetodo == data_base[i].unixtime)
+        {
+            strcpy(command, data_base[i].cmd);
+            strcpy(args,data_base[i].args);
+            *executions = data_base[i].executions;
+            *periodical = data_base[i].periodical;
+
+            _dat_del_fp_async(timetodo);
+            if (*periodical > 0)
+                _dat_set_fp_async(timetodo+*periodical, command, args, *executions, *periodical);
+            return 0;
+        }
+    }
+    return -1;
+}
 #endif
 
 int dat_set_fp(int timetodo, char* command, char* args, int executions, int periodical)
@@ -419,48 +1054,107 @@ int dat_set_fp(int timetodo, char* command, char* args, int executions, int peri
 
     osSemaphoreTake(&repo_data_fp_sem, portMAX_DELAY);
     //Enter critical zone
+    int rc = -1;
+    int replace = _dat_fp_index_find(timetodo) >= 0;
+    if(replace || dat_fp_index_n < SCH_FP_MAX_ENTRIES)
+    {
 #if SCH_STORAGE_MODE == 0
-    //TODO : agregar signal de segment para responder falla
-    int rc = _dat_set_fp_async(timetodo, command, args, executions, periodical);
+        //TODO : agregar signal de segment para responder falla
+        if(replace)
+            _dat_del_fp_async(timetodo);
+        rc = _dat_set_fp_async(timetodo, command, args, executions, periodical);
 #else
-    int rc = storage_flight_plan_set(timetodo, command, args, executions, periodical);
+        if(replace)
+            storage_flight_plan_erase(timetodo);
+        rc = storage_flight_plan_set(timetodo, command, args, executions, periodical);
 #endif
+        if(rc == 0)
+            _dat_fp_index_add(timetodo);
+    }
+    else
+    {
+        LOGE(tag, "Flight plan full, max. %d commands", SCH_FP_MAX_ENTRIES);
+    }
     //Exit critical zone
     osSemaphoreGiven(&repo_data_fp_sem);
     return rc;
 }
 
+/**
+ * Reads a flight plan counter variable, values not initialized yet are zero
+ */
+static int _dat_fp_counter(dat_system_t index)
+{
+    int value = dat_get_system_var(index);
+    return (value < 0 || value == INT_MAX) ? 0 : value;
+}
+
 int dat_get_fp(int elapsed_sec, char* command, char* args, int* executions, int* periodical)
 {
-    int rc;
+    int rc = -1;
+    int late = 0;
+    int skipped = 0;
     osSemaphoreTake(&repo_data_fp_sem, portMAX_DELAY);
     //Enter critical zone
-#if SCH_STORAGE_MODE == 0
-    int i;
-    rc = -1;  // not found by default
-    for(i = 0;i < SCH_FP_MAX_ENTRIES;i++)
+    // Take due commands in order, until one has to be executed
+    while(rc != 0 && dat_fp_index_n > 0 && dat_fp_index[0] <= elapsed_sec)
     {
-        if(elapsed_sec == data_base[i].unixtime)
+        int timetodo = dat_fp_index[0];
+        _dat_fp_index_del(timetodo);
+#if SCH_STORAGE_MODE == 0
+        if(_dat_get_fp_async(timetodo, command, args, executions, periodical) != 0)
+#else
+        if(storage_flight_plan_get(timetodo, command, args, executions, periodical) != 0)
+#endif
         {
-            strcpy(command, data_base[i].cmd);
-            strcpy(args,data_base[i].args);
-            *executions = data_base[i].executions;
-            *periodical = data_base[i].periodical;
+            LOGW(tag, "Flight plan command at %d not found", timetodo);
+            continue;
+        }
 
-            if (data_base[i].periodical > 0)
-                _dat_set_fp_async(elapsed_sec+*periodical,data_base[i].cmd,data_base[i].args,*executions,*periodical);
+        late = elapsed_sec - timetodo;
+        int is_late = late > SCH_FP_MAX_LATE;
+        int next = timetodo + *periodical;
+        if(is_late && SCH_FP_LATE_POLICY != 0 && *periodical > 0 && next <= elapsed_sec)
+        {
+            // Coalesce the missed repetitions, the next one is in the future
+            int missed = (elapsed_sec - next)/(*periodical) + 1;
+#if SCH_STORAGE_MODE == 0
+            _dat_move_fp_async(next, next + missed*(*periodical), command);
+#else
+            // Times are unique in the storage, the entry at next is the one
+            // just rescheduled by storage_flight_plan_get
+            storage_flight_plan_erase(next);
+            storage_flight_plan_set(next + missed*(*periodical), command, args, *executions, *periodical);
+#endif
+            next += missed*(*periodical);
+            skipped += missed;
+        }
+        if(*periodical > 0)
+            _dat_fp_index_add(next);
 
-            _dat_del_fp_async(elapsed_sec);
-            rc = 0;  // found, then break!
-            break;
+        if(is_late && SCH_FP_LATE_POLICY == 1)
+        {
+            LOGW(tag, "Flight plan command %s skipped, %d s late", command, late);
+            skipped++;
+            continue;
         }
+        if(is_late)
+            LOGW(tag, "Flight plan command %s executed %d s late", command, late);
+        rc = 0;
     }
-#else
-    rc =storage_flight_plan_get(elapsed_sec, command, args, executions, periodical);
-#endif
     //Exit critical zone
     osSemaphoreGiven(&repo_data_fp_sem);
 
+    // Lateness metrics
+    if(skipped > 0)
+        dat_set_system_var(dat_fpl_skipped, _dat_fp_counter(dat_fpl_skipped) + skipped);
+    if(rc == 0)
+    {
+        dat_set_system_var(dat_fpl_late, late);
+        if(late > _dat_fp_counter(dat_fpl_late_max))
+            dat_set_system_var(dat_fpl_late_max, late);
+    }
+
     return rc;
 }
 
@@ -474,6 +1168,7 @@ int dat_del_fp(int timetodo)
 #else
     int rc = storage_flight_plan_erase(timetodo);
 #endif
+    _dat_fp_index_del(timetodo);
     //Exit critical zone
     osSemaphoreGiven(&repo_data_fp_sem);
 
@@ -499,6 +1194,7 @@ int dat_reset_fp(void)
 #else
     rc = storage_table_flight_plan_init(1);
 #endif
+    _dat_fp_index_clear();
     //Exit critical zone
     osSemaphoreGiven(&repo_data_fp_sem);
     return rc;
@@ -538,6 +1234,168 @@ int dat_show_fp (void)
     return rc;
 }
 
+int dat_get_fp_next(void)
+{
+    osSemaphoreTake(&repo_data_fp_sem, portMAX_DELAY);
+    int next = dat_fp_index_n > 0 ? dat_fp_index[0] : -1;
+    osSemaphoreGiven(&repo_data_fp_sem);
+    return next;
+}
+
+int dat_wait_fp(uint32_t timeout)
+{
+    int next;
+    if(dat_fp_wake == NULL)
+    {
+        osDelay(timeout);
+        return -1;
+    }
+    return osQueueReceive(dat_fp_wake, &next, timeout) == pdPASS ? 0 : -1;
+}
+
+int dat_stage_fp(int session, int timetodo, char* command, char* args, int executions, int periodical)
+{
+    int rc = 0;
+    osSemaphoreTake(&repo_data_fp_sem, portMAX_DELAY);
+    //Enter critical zone
+    // An entry with the same time is replaced
+    int i;
+    for(i = 0; i < dat_fp_stage_n; i++)
+        if(dat_fp_stage[i].unixtime == timetodo)
+            break;
+
+    if(dat_fp_stage_n > 0 && session != dat_fp_stage_session)
+    {
+        LOGE(tag, "Flight plan stage busy, used by session %d", dat_fp_stage_session);
+        rc = -1;
+    }
+    else if(i < SCH_FP_MAX_ENTRIES)
+    {
+        dat_fp_stage_session = session;
+        dat_fp_staged_t *entry = &dat_fp_stage[i];
+        entry->unixtime = timetodo;
+        entry->executions = executions;
+        entry->periodical = periodical;
+        strncpy(entry->cmd, command, SCH_CMD_MAX_STR_NAME-1);
+        entry->cmd[SCH_CMD_MAX_STR_NAME-1] = '\0';
+        strncpy(entry->args, args, SCH_CMD_MAX_STR_PARAMS-1);
+        entry->args[SCH_CMD_MAX_STR_PARAMS-1] = '\0';
+        if(i == dat_fp_stage_n)
+            dat_fp_stage_n++;
+    }
+    else
+    {
+        LOGE(tag, "Flight plan stage full, max. %d commands", SCH_FP_MAX_ENTRIES);
+        rc = -1;
+    }
+    //Exit critical zone
+    osSemaphoreGiven(&repo_data_fp_sem);
+    return rc;
+}
+
+int dat_commit_fp(int session, int replace)
+{
+    int i, rc = 0;
+    osSemaphoreTake(&repo_data_fp_sem, portMAX_DELAY);
+    //Enter critical zone
+    int n = dat_fp_stage_n;
+    if(n > 0 && session != dat_fp_stage_session)
+    {
+        osSemaphoreGiven(&repo_data_fp_sem);
+        LOGE(tag, "Flight plan stage busy, used by session %d", dat_fp_stage_session);
+        return -1;
+    }
+
+    // Check the resulting flight plan fits before changing it
+    int total = replace ? 0 : dat_fp_index_n;
+    for(i = 0; i < n; i++)
+        if(replace || _dat_fp_index_find(dat_fp_stage[i].unixtime) < 0)
+            total++;
+    if(total > SCH_FP_MAX_ENTRIES)
+    {
+        LOGE(tag, "Flight plan full, max. %d commands", SCH_FP_MAX_ENTRIES);
+        rc = -1;
+    }
+
+#if SCH_STORAGE_MODE == 0
+    // Keep a snapshot of the table to restore it if an entry can not be
+    // added. Removed entries are unlinked, their strings are freed below
+    fp_entry_t snapshot[SCH_FP_MAX_ENTRIES];
+    memcpy(snapshot, data_base, sizeof(snapshot));
+    if(rc == 0 && replace)
+        for(i = 0; i < SCH_FP_MAX_ENTRIES; i++)
+            _dat_unlink_fp_async(data_base[i].unixtime);
+    for(i = 0; rc == 0 && i < n; i++)
+    {
+        dat_fp_staged_t *entry = &dat_fp_stage[i];
+        if(!replace)
+            _dat_unlink_fp_async(entry->unixtime);
+        rc = _dat_set_fp_async(entry->unixtime, entry->cmd, entry->args, entry->executions, entry->periodical) == 0 ? 0 : -1;
+        if(rc != 0)
+            LOGE(tag, "Error adding flight plan command at %d, changes reverted", entry->unixtime);
+    }
+    for(i = 0; i < SCH_FP_MAX_ENTRIES; i++)
+    {
+        // Slots only change by unlinking, so a slot with other strings than
+        // the snapshot owns both. Free the unused ones: the removed entries
+        // if committed, the added entries if not
+        if(data_base[i].cmd == snapshot[i].cmd)
+            continue;
+        fp_entry_t *unused = rc == 0 ? &snapshot[i] : &data_base[i];
+        free(unused->cmd);
+        free(unused->args);
+    }
+    if(rc != 0)
+        memcpy(data_base, snapshot, sizeof(snapshot));
+#else
+    // All the changes are written in one storage transaction
+    if(rc == 0)
+        rc = storage_flight_plan_begin();
+    if(rc == 0)
+    {
+        if(replace)
+            rc = storage_flight_plan_reset();
+        for(i = 0; rc == 0 && i < n; i++)
+        {
+            dat_fp_staged_t *entry = &dat_fp_stage[i];
+            if(!replace && _dat_fp_index_find(entry->unixtime) >= 0)
+                storage_flight_plan_erase(entry->unixtime);
+            rc = storage_flight_plan_set(entry->unixtime, entry->cmd, entry->args, entry->executions, entry->periodical);
+        }
+        if(storage_flight_plan_end(rc == 0) != 0)
+            rc = -1;
+        if(rc != 0)
+            _dat_fp_index_load();  // The storage has the valid flight plan
+    }
+#endif
+
+    if(rc == 0)
+    {
+        if(replace)
+            _dat_fp_index_clear();
+        for(i = 0; i < n; i++)
+            _dat_fp_index_add(dat_fp_stage[i].unixtime);
+        LOGI(tag, "Flight plan: %d commands committed (%s)", n, replace ? "replace" : "merge");
+        rc = n;
+    }
+    dat_fp_stage_n = 0;
+    //Exit critical zone
+    osSemaphoreGiven(&repo_data_fp_sem);
+    return rc;
+}
+
+int dat_discard_fp(int session)
+{
+    osSemaphoreTake(&repo_data_fp_sem, portMAX_DELAY);
+    int n = dat_fp_stage_n;
+    if(n > 0 && session != dat_fp_stage_session)
+        n = -1;
+    else
+        dat_fp_stage_n = 0;
+    osSemaphoreGiven(&repo_data_fp_sem);
+    return n;
+}
+
 time_t dat_get_time(void)
 {
 #ifdef AVR32
@@ -656,6 +1514,53 @@ int dat_add_payload_sample(void* data, int payload)
     }
 }
 
+int dat_add_payload_samples(void* data, int n, int payload)
+{
+    int ret;
+
+    int index = dat_get_system_var(data_map[payload].sys_index);
+    LOGI(tag, "Adding %d samples for payload %d in index %d", n, payload, index);
+
+    //Enter critical zone
+    osSemaphoreTake(&repo_data_sem, portMAX_DELAY);
+
+#if defined(LINUX) || defined(NANOMIND)
+    ret = storage_set_payload_data_n(index, data, n, payload);
+#else
+    ret=0;
+#endif
+    //Exit critical zone
+    osSemaphoreGiven(&repo_data_sem);
+
+    // Update address
+    if(ret==0) {
+        dat_set_system_var(data_map[payload].sys_index, index+n);
+        return index+n;
+    } else {
+        LOGE(tag, "Couldn't set %d samples of payload %d", n, payload);
+        return -1;
+    }
+}
+
+int dat_flush_payload_data(void)
+{
+    int ret;
+
+    //Enter critical zone
+    osSemaphoreTake(&repo_data_sem, portMAX_DELAY);
+#if defined(LINUX) || defined(NANOMIND)
+    ret = storage_flush_payload_data();
+#else
+    ret=0;
+#endif
+    //Exit critical zone
+    osSemaphoreGiven(&repo_data_sem);
+
+    if(ret != 0)
+        LOGE(tag, "Couldn't flush payload samples");
+    return ret;
+}
+
 
 int dat_get_recent_payload_sample(void* data, int payload, int delay)
 {
@@ -685,6 +1590,31 @@ int dat_get_recent_payload_sample(void* data, int payload, int delay)
     return ret;
 }
 
+int dat_get_payload_range(int payload, int from, int to, void* data)
+{
+    int ret;
+
+    int index = dat_get_system_var(data_map[payload].sys_index);
+    LOGV(tag, "Obtaining data of payload %d, from index %d to %d", payload, from, to);
+
+    if(from < 0 || from > to || to > index)
+    {
+        LOGE(tag, "Invalid range [%d, %d) for payload %d with %d samples", from, to, payload, index);
+        return -1;
+    }
+
+    //Enter critical zone
+    osSemaphoreTake(&repo_data_sem, portMAX_DELAY);
+#if defined(LINUX) || defined(NANOMIND)
+    ret = storage_get_payload_data_n(from, data, to-from, payload);
+#else
+    ret=0;
+#endif
+    //Exit critical zone
+    osSemaphoreGiven(&repo_data_sem);
+    return ret == 0 ? to-from : -1;
+}
+
 int dat_delete_memory_sections(void)
 {
     int ret;
@@ -692,116 +1622,50 @@ int dat_delete_memory_sections(void)
     for(int i = 0; i < last_sensor; ++i)
     {
         dat_set_system_var(data_map[i].sys_index, 0);
+        dat_set_system_var(data_map[i].sys_ack, 0);
     }
     //Enter critical zone
     osSemaphoreTake(&repo_data_sem, portMAX_DELAY);
 #ifdef NANOMIND
     ret = storage_delete_memory_sections();
+#elif SCH_STORAGE_MODE == 3
+    // The payload logs only drop acknowledged samples, so they are reset
+    ret = storage_table_payload_init(1);
 #else
     ret=0;
 #endif
     //Exit critical zone
     osSemaphoreGiven(&repo_data_sem);
 #if SCH_FP_ENABLED
-    storage_flight_plan_reset();
+    dat_reset_fp();
 #endif
     return ret;
 }
 
 
-int get_payloads_tokens(char** tok_sym, char** tok_var, char* order, char* var_names, int i)
-{
-    const char s[2] = " ";
-    tok_sym[0] = strtok(order, s);
-
-    int j=0;
-    while(tok_sym[j] != NULL) {
-        j++;
-        tok_sym[j] = strtok(NULL, s);
-    }
-
-    tok_var[0] = strtok(var_names, s);
-
-    j=0;
-    while(tok_var[j] != NULL) {
-        j++;
-        tok_var[j] = strtok(NULL, s);
-    }
-    return j;
-}
-
-void get_value_string(char* ret_string, char* c_type, char* buff)
-{
-    if(strcmp(c_type, "%f") == 0) {
-        sprintf(ret_string, " %f", *((float*)buff));
-    }
-    else if(strcmp(c_type, "%d") == 0) {
-        sprintf(ret_string, " %d", *((int*)buff));
-    }
-    else if(strcmp(c_type, "%u") == 0) {
-        sprintf(ret_string, " %u", *((unsigned int*)buff));
-    }
-}
-
-int get_sizeof_type(char* c_type)
-{
-    if(strcmp(c_type, "%f") == 0) {
-        return sizeof(float);
-    }
-    else if(strcmp(c_type, "%d") == 0) {
-        return sizeof(int);
-    } else if(strcmp(c_type, "%u") == 0) {
-        return sizeof(int);
-    } else {
-        return -1;
-    }
-}
-
 int dat_print_payload_struct(void* data, unsigned int payload)
 {
-    //FIXME: Buffers allocated in stack with magical numbers! Use defined values
-    //FIXME: Use malloc to allocate large buffers, here 1280  bytes allocated!
-    //FIXME: Task stack size: 5*256 = 1280 bytes!
-
-    char* tok_sym[30];
-    char* tok_var[30];
-    char *order = (char *)malloc(50);
-    strcpy(order, data_map[payload].data_order);
-    char *var_names = (char *)malloc(200);
-    strcpy(var_names, data_map[payload].var_names);
-    int nparams = get_payloads_tokens(tok_sym, tok_var, order, var_names, (int)payload);
-
-    char *values = (char *)malloc(500);
-    char *names = (char *)malloc(500);
-    strcpy(names, "");
-    strcpy(values, "");
+    const dat_payload_desc_t *desc = dat_get_payload_desc((int)payload);
+    if(desc == NULL)
+        return -1;
 
     int j;
-    for(j=0; j < nparams; ++j) {
-        int param_size = get_sizeof_type(tok_sym[j]);
-        char buff[param_size];
-        memcpy(buff, data+(j*param_size), param_size);
-
-        char name[20];
-        sprintf(name, " %s", tok_var[j]);
-        strcat(names, name);
-
-        char val[20];
-        get_value_string(val, tok_sym[j], buff);
-        strcat(values, val);
-
-        if(j != nparams-1){
-            strcat(names, ",");
-            strcat(values, ",");
+    for(j=0; j < desc->nfields; ++j)
+        printf(" %s%s", desc->fields[j].name, j != desc->nfields-1 ? "," : ":");
+
+    for(j=0; j < desc->nfields; ++j) {
+        const dat_payload_field_t *field = &desc->fields[j];
+        void *value = (char *)data + field->offset;
+        switch(field->type)
+        {
+            case 'f': printf(" %f", *((float*)value)); break;
+            case 'u': printf(" %u", *((unsigned int*)value)); break;
+            default: printf(" %d", *((int*)value));
         }
+        if(j != desc->nfields-1)
+            printf(",");
     }
-    strcat(names, ":");
-    printf("%s %s\n", names, values);
-
-    free(order);
-    free(var_names);
-    free(values);
-    free(names);
+    printf("\n");
 
     return 0;
 }
\ No newline at end of file
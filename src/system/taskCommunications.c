@@ -21,9 +21,31 @@
 
 static const char *tag = "Communications";
 
-static void com_receive_tc(csp_packet_t *packet);
-static void com_receive_cmd(csp_packet_t *packet);
+/**
+ * A TC frame reply waiting for the results of its commands. The connection
+ * is kept open until all its replies are sent, meanwhile other frames are
+ * received, from the same connection or others.
+ */
+typedef struct com_pending {
+    csp_conn_t *conn;               ///< Connection to reply, NULL if the slot is free
+    int handles[SCH_CMD_FUTURES];   ///< Futures of the commands still running
+    int n_handles;                  ///< Number of futures
+    int rc;                         ///< Reply code of the finished commands
+    portTick start;                 ///< Time when the commands were sent
+} com_pending_t;
+
+static com_pending_t com_pending[COM_MAX_PENDING];
+static int com_n_pending = 0;
+static csp_conn_t *com_conn_reading = NULL;     ///< Connection being read, closed by taskCommunications
+
+static int com_receive_tc(csp_packet_t *packet, int *handles, int *n_handles);
+static int com_receive_tc_bin(csp_packet_t *packet, int *handles, int *n_handles);
+static int com_receive_cmd(csp_packet_t *packet, int *handles, int *n_handles);
 static void com_receive_tm(csp_packet_t *packet);
+static void com_send_reply(csp_conn_t *conn, int code);
+static int com_reply_later(csp_conn_t *conn, int code, int *handles, int n_handles);
+static void com_check_replies(void);
+static int com_count_replies(csp_conn_t *conn);
 
 void taskCommunications(void *param)
 {
@@ -34,8 +56,10 @@ void taskCommunications(void *param)
     csp_conn_t *conn;
     csp_packet_t *packet;
     csp_packet_t *tmp_packet;
-    csp_packet_t *rep_ok_tmp;
-    csp_packet_t *rep_ok;
+    int rep_code;
+    int handles[SCH_CMD_FUTURES];   // Futures of the commands of one frame
+    int n_handles;
+    portTick last_read;             // Time of the last packet of the connection
 
     csp_socket_t *sock = csp_socket(CSP_SO_NONE);
     if((rc = csp_bind(sock, CSP_ANY)) != CSP_ERR_NONE)
@@ -49,22 +73,34 @@ void taskCommunications(void *param)
         return;
     }
 
-    rep_ok_tmp = csp_buffer_get(1);
-    rep_ok_tmp->data[0] = 200;
-    rep_ok_tmp->length = 1;
-
     int count_tc;
 
     while(1)
     {
+        /* Reply the frames whose commands finished */
+        com_check_replies();
+
         /* CSP SERVER */
-        /* Wait for connection, 1000 ms timeout */
-        if((conn = csp_accept(sock, 1000)) == NULL)
+        /* Wait for connection, 1000 ms timeout, or poll while replies are pending */
+        if((conn = csp_accept(sock, com_n_pending > 0 ? 10 : 1000)) == NULL)
             continue; /* Try again later */
 
-        /* Read packets. Timeout is 500 ms */
-        while ((packet = csp_read(conn, 500)) != NULL)
+        /* Read packets. Timeout is 500 ms, read in short slices while
+         * replies are pending to send them on time */
+        com_conn_reading = conn;
+        last_read = osTaskGetTickCount();
+        while(1)
         {
+            packet = csp_read(conn, com_n_pending > 0 ? 10 : 500);
+            if(packet == NULL)
+            {
+                com_check_replies();
+                if(com_n_pending > 0 && osTaskGetTickCount() - last_read < osDefineTime(500))
+                    continue;
+                break;
+            }
+            last_read = osTaskGetTickCount();
+
             count_tc = dat_get_system_var(dat_com_count_tc) + 1;
             dat_set_system_var(dat_com_count_tc, count_tc);
             dat_set_system_var(dat_com_last_tc, (int) time(NULL));
@@ -73,11 +109,18 @@ void taskCommunications(void *param)
             {
                 case SCH_TRX_PORT_TC:
                     /* Process incoming TC */
-                    com_receive_tc(packet);
+                    rep_code = com_receive_tc(packet, handles, &n_handles);
                     csp_buffer_free(packet);
-                    // Create a response packet and send
-                    rep_ok = csp_buffer_clone(rep_ok_tmp);
-                    csp_send(conn, rep_ok, 1000);
+                    // Reply with the commands result once they finish
+                    com_reply_later(conn, rep_code, handles, n_handles);
+                    break;
+
+                case SCH_TRX_PORT_TC_BIN:
+                    /* Process incoming binary TC */
+                    rep_code = com_receive_tc_bin(packet, handles, &n_handles);
+                    csp_buffer_free(packet);
+                    // Reply with the commands result once they finish
+                    com_reply_later(conn, rep_code, handles, n_handles);
                     break;
 
                 case SCH_TRX_PORT_TM:
@@ -88,8 +131,7 @@ void taskCommunications(void *param)
                     com_receive_tm(packet);
                     csp_buffer_free(packet);
                     // Create a response packet and send
-                    rep_ok = csp_buffer_clone(rep_ok_tmp);
-                    csp_send(conn, rep_ok, 1000);
+                    com_send_reply(conn, COM_REPLY_OK);
                     #ifdef SCH_RESEND_TM_NODE
                     // Resend a copy of the packet to another node
                     assert(tmp_packet != NULL);
@@ -121,11 +163,10 @@ void taskCommunications(void *param)
 
                 case SCH_TRX_PORT_CMD:
                     /* Command port, executes console commands */
-                    com_receive_cmd(packet);
+                    rep_code = com_receive_cmd(packet, handles, &n_handles);
                     csp_buffer_free(packet);
-                    // Create a response packet and send
-                    rep_ok = csp_buffer_clone(rep_ok_tmp);
-                    csp_send(conn, rep_ok, 1000);
+                    // Reply with the command result once it finishes
+                    com_reply_later(conn, rep_code, handles, n_handles);
                     break;
 
                 default:
@@ -133,11 +174,179 @@ void taskCommunications(void *param)
                     csp_service_handler(conn, packet);
                     break;
             }
+
+            com_check_replies();
+        }
+
+        /* Close current connection, and handle next. If replies are pending
+         * the connection is closed after sending the last one */
+        com_conn_reading = NULL;
+        if(com_count_replies(conn) == 0)
+            csp_close(conn);
+    }
+}
+
+/**
+ * Send a one byte reply code to the ground station
+ *
+ * @param conn Current connection
+ * @param code Reply code (COM_REPLY_*)
+ */
+static void com_send_reply(csp_conn_t *conn, int code)
+{
+    csp_packet_t *reply = csp_buffer_get(1);
+    if(reply == NULL)
+        return;
+    reply->data[0] = (uint8_t)code;
+    reply->length = 1;
+    if(!csp_send(conn, reply, 1000))
+        csp_buffer_free(reply);
+}
+
+/**
+ * Send a command to execution without blocking the communications task and
+ * track its result.
+ *
+ * @param cmd Command to send, can be NULL (parse error)
+ * @param handles Array of future handles, the new handle is appended
+ * @param n_handles Number of handles in the array, updated
+ * @return Reply code of the command if already known, COM_REPLY_OK otherwise
+ */
+static int com_queue_cmd(cmd_t *cmd, int *handles, int *n_handles)
+{
+    if(cmd == NULL)
+        return COM_REPLY_BAD_CMD;
+
+    // If we run out of futures just send the command, the result is unknown
+    int *handle = *n_handles < SCH_CMD_FUTURES ? &handles[*n_handles] : NULL;
+    int rc = cmd_send_async(cmd, handle);
+    if(rc == CMD_ERROR)
+    {
+        // The dispatcher is full, the command is discarded
+        cmd_free(cmd);
+        return COM_REPLY_BUSY;
+    }
+    if(handle == NULL || *handle < 0)
+        return COM_REPLY_ACCEPTED;
+
+    (*n_handles)++;
+    return COM_REPLY_OK;
+}
+
+/**
+ * Reply a frame once the results of its commands are available, without
+ * blocking the communications task. If there are no commands to wait for the
+ * reply is sent now.
+ *
+ * @param conn Connection to reply
+ * @param code Reply code of the commands already known
+ * @param handles Array of future handles of the commands sent with com_queue_cmd
+ * @param n_handles Number of handles in the array
+ * @return 1 if the reply is pending and the connection must be kept open, 0
+ * if the reply was sent
+ */
+static int com_reply_later(csp_conn_t *conn, int code, int *handles, int n_handles)
+{
+    int i;
+    com_pending_t *pending = NULL;
+
+    for(i=0; n_handles > 0 && i < COM_MAX_PENDING; i++)
+    {
+        if(com_pending[i].conn == NULL)
+        {
+            pending = &com_pending[i];
+            break;
+        }
+    }
+
+    if(pending == NULL)
+    {
+        // Too many pending replies, do not wait for these results
+        for(i=0; i < n_handles; i++)
+            cmd_future_release(handles[i]);
+        if(n_handles > 0 && code < COM_REPLY_ACCEPTED)
+            code = COM_REPLY_ACCEPTED;
+        com_send_reply(conn, code);
+        return 0;
+    }
+
+    pending->conn = conn;
+    memcpy(pending->handles, handles, n_handles*sizeof(int));
+    pending->n_handles = n_handles;
+    pending->rc = code;
+    pending->start = osTaskGetTickCount();
+    com_n_pending++;
+    return 1;
+}
+
+/**
+ * Collect the results of the commands of the pending replies, without
+ * blocking. A reply is sent, and its connection closed, when all its commands
+ * finished or after SCH_TRX_TC_TIMEOUT milliseconds. Futures not completed on
+ * time are released.
+ */
+static void com_check_replies(void)
+{
+    int i, j, result;
+    portTick limit = osDefineTime(SCH_TRX_TC_TIMEOUT);
+
+    for(i=0; com_n_pending > 0 && i < COM_MAX_PENDING; i++)
+    {
+        com_pending_t *pending = &com_pending[i];
+        if(pending->conn == NULL)
+            continue;
+
+        int expired = osTaskGetTickCount() - pending->start >= limit;
+        for(j=0; j < pending->n_handles;)
+        {
+            if(cmd_wait(pending->handles[j], 0, &result) == CMD_OK)
+            {
+                if(result != CMD_OK && pending->rc < COM_REPLY_CMD_FAIL)
+                    pending->rc = COM_REPLY_CMD_FAIL;
+            }
+            else if(expired)
+            {
+                cmd_future_release(pending->handles[j]);
+                if(pending->rc < COM_REPLY_ACCEPTED)
+                    pending->rc = COM_REPLY_ACCEPTED;
+            }
+            else
+            {
+                j++;
+                continue;
+            }
+            // This command is done, remove its handle
+            pending->handles[j] = pending->handles[--pending->n_handles];
         }
 
-        /* Close current connection, and handle next */
-        csp_close(conn);
+        if(pending->n_handles == 0)
+        {
+            csp_conn_t *conn = pending->conn;
+            com_send_reply(conn, pending->rc);
+            pending->conn = NULL;
+            com_n_pending--;
+            // The last reply closes the connection, if it is not being read
+            if(conn != com_conn_reading && com_count_replies(conn) == 0)
+                csp_close(conn);
+        }
+    }
+}
+
+/**
+ * Count the pending replies of a connection
+ *
+ * @param conn Connection
+ * @return Number of replies waiting for their commands results
+ */
+static int com_count_replies(csp_conn_t *conn)
+{
+    int i, n = 0;
+    for(i=0; i < COM_MAX_PENDING; i++)
+    {
+        if(com_pending[i].conn == conn)
+            n++;
     }
+    return n;
 }
 
 /**
@@ -149,9 +358,16 @@ void taskCommunications(void *param)
  *
  * @param packet A csp buffer containing a null terminated string with the
  *               format <command> [parameters];<command> [parameters];...
+ * @param handles Returns the future handles of the commands sent
+ * @param n_handles Returns the number of handles
+ * @return Reply code (COM_REPLY_*) of the commands sent, the results are
+ *         collected with com_reply_later
  */
-static void com_receive_tc(csp_packet_t *packet)
+static int com_receive_tc(csp_packet_t *packet, int *handles, int *n_handles)
 {
+    int rc, rc_send = COM_REPLY_OK;
+    *n_handles = 0;
+
     // Make sure the buffer is a null terminated string
     packet->data[packet->length] = '\0';
 
@@ -164,12 +380,53 @@ static void com_receive_tc(csp_packet_t *packet)
         // Parse and send command for execution
         LOGI(tag, "TC: %s", cmd_str);
         cmd_t *new_cmd = cmd_parse_from_str(cmd_str);
-        if (new_cmd != NULL)
-            cmd_send(new_cmd);
+        rc = com_queue_cmd(new_cmd, handles, n_handles);
+        if(rc > rc_send)
+            rc_send = rc;
 
         // Search for the next ";" separated command
         cmd_str = strtok(NULL, ";");
     }
+
+    return rc_send;
+}
+
+/**
+ * Parse binary TC frames and generates corresponding commands. A binary TC
+ * frame contains a list of commands identified by its code, with the
+ * parameters packed according to the command format, see cmd_parse_from_bin.
+ *
+ * @param packet A csp buffer containing a binary TC frame
+ * @param handles Returns the future handles of the commands sent
+ * @param n_handles Returns the number of handles
+ * @return Reply code (COM_REPLY_*) of the commands sent, the results are
+ *         collected with com_reply_later
+ */
+static int com_receive_tc_bin(csp_packet_t *packet, int *handles, int *n_handles)
+{
+    int rc, rc_send = COM_REPLY_OK;
+    int pos = 0;
+    *n_handles = 0;
+
+    while(pos < packet->length)
+    {
+        // Decode and send the next command for execution
+        cmd_t *new_cmd;
+        int used = cmd_parse_from_bin(packet->data + pos, packet->length - pos, &new_cmd);
+        if(used < 0)
+        {
+            // Truncated frame, the rest can not be decoded
+            rc_send = COM_REPLY_BAD_CMD;
+            break;
+        }
+        LOGI(tag, "TC: 0x%02X%02X (%d bytes)", packet->data[pos], packet->data[pos+1], used);
+        rc = com_queue_cmd(new_cmd, handles, n_handles);
+        if(rc > rc_send)
+            rc_send = rc;
+        pos += used;
+    }
+
+    return rc_send;
 }
 
 /**
@@ -177,16 +434,21 @@ static void com_receive_tc(csp_packet_t *packet)
  *
  * @param packet A csp buffer containing a null terminated string with the
  *               format <command> [parameters]
+ * @param handles Returns the future handle of the command sent
+ * @param n_handles Returns the number of handles
+ * @return Reply code (COM_REPLY_*) of the command sent, the result is
+ *         collected with com_reply_later
  */
-static void com_receive_cmd(csp_packet_t *packet)
+static int com_receive_cmd(csp_packet_t *packet, int *handles, int *n_handles)
 {
+    *n_handles = 0;
+
     // Make sure the buffer is a null terminated string
     packet->data[packet->length] = '\0';
     cmd_t *new_cmd = cmd_parse_from_str((char *)(packet->data));
 
-    // Send command to execution if not null
-    if(new_cmd != NULL)
-        cmd_send(new_cmd);
+    // Send command to execution
+    return com_queue_cmd(new_cmd, handles, n_handles);
 }
 
 /**
@@ -222,16 +484,11 @@ static void com_receive_tm(csp_packet_t *packet)
     {
         int payload = frame->type - TM_TYPE_PAYLOAD; // Payload type
         print_buff16(packet->data16, packet->length/2);
-        int j, delay = 0;
 
         //FIXME: Use a command to add payloads to database
         //Save ndata payload samples to data storage
         assert(frame->ndata*data_map[payload].size <= COM_FRAME_MAX_LEN);
-        for(j=0; j < frame->ndata; j++)
-        {
-            delay = j*data_map[payload].size; // Select next struct
-            dat_add_payload_sample((frame->data.data8)+delay, payload); //Save next struct
-        }
+        dat_add_payload_samples(frame->data.data8, frame->ndata, payload);
     }
     else
     {
@@ -22,6 +22,134 @@
 
 static const char *tag = "Dispatcher";
 
+/* Number of commands running in the executers, by concurrency class */
+static int running[3] = {0, 0, 0};
+static int running_total = 0;
+
+/* Oldest command of each priority level, taken from dispatcher_prio_queue */
+static cmd_t *prio_head[CMD_PRIO_LEVELS];
+
+/**
+ * Find the next command to execute. That is the oldest command of the level
+ * with the highest effective priority, where a command gains one level every
+ * SCH_CMD_PRIO_AGING milliseconds since it was queued (aging prevents
+ * starvation), including the time waiting behind other commands. In
+ * a tie the command with the highest original priority is selected. The
+ * command is left in prio_head until it is sent to the executers.
+ *
+ * @return Priority level of the next command or -1 if there are no waiting
+ * commands
+ */
+static int prio_queue_peek(void)
+{
+    int level, best = -1;
+    long best_prio = 0;
+    portTick now = osTaskGetTickCount();
+    portTick aging = osDefineTime(SCH_CMD_PRIO_AGING);
+
+    for(level = CMD_PRIO_CRITICAL; level < CMD_PRIO_LEVELS; level++)
+    {
+        if(prio_head[level] == NULL)
+        {
+            if(osQueueReceive(dispatcher_prio_queue[level], &prio_head[level], 0) != pdPASS)
+                continue;
+        }
+
+        portTick waiting = now - prio_head[level]->queued;
+        long eff_prio = (long)level - (long)(aging ? waiting/aging : 0);
+        if(best < 0 || eff_prio < best_prio)
+        {
+            best = level;
+            best_prio = eff_prio;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Check if a command of class @exec_class can be started with the commands
+ * that are currently running
+ */
+static int can_run_now(int exec_class)
+{
+    if(running_total >= SCH_TASK_EXE_WORKERS)
+        return 0;
+
+    switch(exec_class)
+    {
+        case CMD_CLASS_SHARED:
+            return running[CMD_CLASS_EXCLUSIVE] == 0;
+        case CMD_CLASS_IO:
+            return running[CMD_CLASS_EXCLUSIVE] == 0 && running[CMD_CLASS_IO] == 0;
+        default:
+            return running_total == 0;
+    }
+}
+
+/**
+ * Read one command result from executer_stat_queue and update the running
+ * commands counters
+ *
+ * @param timeout Max time to wait for a result
+ * @return pdPASS if a result was received
+ */
+static int receive_result(uint32_t timeout)
+{
+    cmd_stat_t cmd_result;
+    int status = osQueueReceive(executer_stat_queue, &cmd_result, timeout);
+    if(status == pdPASS)
+    {
+        int exec_class = cmd_result.exec_class;
+        if(exec_class < CMD_CLASS_EXCLUSIVE || exec_class > CMD_CLASS_IO)
+            exec_class = CMD_CLASS_EXCLUSIVE;
+        running[exec_class]--;
+        running_total--;
+    }
+    return status;
+}
+
+/**
+ * Send the waiting commands to the executers, in priority order, while they
+ * do not conflict with the running commands. A command that conflicts waits
+ * in prio_head until a result or a new command wakes up the dispatcher.
+ */
+static void dispatch_waiting(void)
+{
+    int level;
+    while((level = prio_queue_peek()) >= 0)
+    {
+        cmd_t *new_cmd = prio_head[level];
+
+        /* Check if command is executable */
+        if(!check_if_executable(new_cmd))
+        {
+            prio_head[level] = NULL;
+            cmd_free(new_cmd);
+            continue;
+        }
+
+        int exec_class = new_cmd->exec_class;
+        if(exec_class < CMD_CLASS_EXCLUSIVE || exec_class > CMD_CLASS_IO)
+            exec_class = CMD_CLASS_EXCLUSIVE;
+
+        /* The command waits in prio_head for the conflicting commands, so
+         * new commands with higher priority are still dispatched first */
+        if(!can_run_now(exec_class))
+            return;
+
+        /* Send the command to executer Queue - NON BLOCKING, there is a free
+         * executer because running_total < SCH_TASK_EXE_WORKERS */
+        if(osQueueSend(executer_cmd_queue, &new_cmd, 0) != pdPASS)
+            return;
+
+        prio_head[level] = NULL;
+        running[exec_class]++;
+        running_total++;
+        LOGD(tag, "Cmd: %X, Param: %p, Class: %d, Prio: %d", new_cmd->id, &(new_cmd->params), exec_class, new_cmd->prio);
+    }
+}
+
 void taskDispatcher(void *param)
 {
 	LOGI(tag, "Started");
@@ -29,27 +157,35 @@ void taskDispatcher(void *param)
     int status; /* Status of cmd reading operation */
 
     cmd_t *new_cmd = NULL; /* The new cmd read */
-    int cmd_result;
 
     while(1)
     {
-        /* Read new_cmd from Queue - Blocking */
+        /* Wait for a mark from Queue - Blocking. Marks are sent when a new
+         * command is in dispatcher_prio_queue (see cmd_queue_send) and when
+         * an executer finishes a command (see taskExecuter) */
         status = osQueueReceive(dispatcher_queue, &new_cmd, portMAX_DELAY);
+        if(status != pdPASS)
+            continue;
 
-        if(status == pdPASS)
+        /* A command sent directly to the dispatcher queue */
+        if(new_cmd != NULL)
         {
-            /* Check if command is executable */
-            if (check_if_executable(new_cmd))
+            int prio = new_cmd->prio;
+            if(prio < CMD_PRIO_CRITICAL || prio >= CMD_PRIO_LEVELS)
+                prio = CMD_PRIO_NORMAL;
+            new_cmd->queued = osTaskGetTickCount();
+            if(osQueueSend(dispatcher_prio_queue[prio], &new_cmd, 0) != pdPASS)
             {
-
-                /* Send the command to executer Queue - BLOCKING */
-                osQueueSend(executer_cmd_queue, &new_cmd, portMAX_DELAY);
-                LOGD(tag, "Cmd: %X, Param: %p, Orig: %X", new_cmd->id, &(new_cmd->params), -1);
-
-                /* Get the result from Executer Stat Queue - BLOCKING */
-                osQueueReceive(executer_stat_queue, &cmd_result, portMAX_DELAY);
+                LOGE(tag, "Priority queue %d full, command discarded", prio);
+                cmd_free(new_cmd);
             }
         }
+
+        /* Collect the results already available - NON BLOCKING */
+        while(running_total > 0 && receive_result(0) == pdPASS);
+
+        /* Send the commands with highest priority */
+        dispatch_waiting();
     }
 }
 
@@ -28,7 +28,9 @@ void taskExecuter(void *param)
 
     cmd_t *run_cmd = NULL;
 
-    int cmd_stat, queue_stat;
+    cmd_stat_t cmd_stat;
+    int queue_stat;
+    int future;
         
     while(1)
     {
@@ -47,16 +49,26 @@ void taskExecuter(void *param)
 
             /* Execute the command */
             // TODO: Check that we are dereferencing a valid function pointer
-            cmd_stat = run_cmd->function(run_cmd->fmt, run_cmd->params, run_cmd->nparams);
+            cmd_stat.exec_class = run_cmd->exec_class;
+            cmd_stat.result = run_cmd->function(run_cmd->fmt, run_cmd->params, run_cmd->nparams);
+            future = run_cmd->future;
             cmd_free(run_cmd);
             run_cmd = NULL;
 
+            /* Report the result to the sender, if waiting (see cmd_send_async) */
+            cmd_future_complete(future, cmd_stat.result);
+
             /* Commands may take a long time, so reset the WDT */
             //ClrWdt();
-            LOGI(tag, "Command result: %d", cmd_stat);
+            LOGI(tag, "Command result: %d", cmd_stat.result);
 
             /* Send the result to Dispatcher - BLOCKING */
             osQueueSend(executer_stat_queue, &cmd_stat, portMAX_DELAY);
+
+            /* Wake up the dispatcher, commands may be waiting for this one.
+             * If the queue is full the dispatcher is already awake */
+            cmd_t *mark = NULL;
+            osQueueSend(dispatcher_queue, &mark, 0);
         }
     }
 }
@@ -28,20 +28,29 @@ void taskFlightPlan(void *param)
     LOGI(tag, "Started");
 
     portTick delay_ms = 1000;          //Task period in [ms]
-    portTick xLastWakeTime = osTaskGetTickCount();
 
     time_t elapsed_sec;   // Seconds counter
 
     while(1)
     {
-        osTaskDelayUntil(&xLastWakeTime, delay_ms); //Suspend task
-
 #ifdef AVR32
         elapsed_sec = dat_get_time();
 #else
         elapsed_sec = time(NULL);
 #endif
 
+        // Sleep until the next command is due, or a command is added before it.
+        // The sleep is limited to follow changes of the system time.
+        int next = dat_get_fp_next();
+        if(next < 0 || next > elapsed_sec)
+        {
+            int sleep_sec = SCH_FP_MAX_SLEEP;
+            if(next > elapsed_sec && next - elapsed_sec < SCH_FP_MAX_SLEEP)
+                sleep_sec = next - (int)elapsed_sec;
+            dat_wait_fp((uint32_t)sleep_sec*delay_ms);
+            continue;
+        }
+
         char command[SCH_CMD_MAX_STR_PARAMS];
         char args[SCH_CMD_MAX_STR_PARAMS];
         int executions;
@@ -50,6 +59,7 @@ void taskFlightPlan(void *param)
         int rc = dat_get_fp((int)elapsed_sec, command, args, &executions, &periodical);
 
         if(rc == -1){
+            // Due commands were skipped or not found, check again for pending commands
             continue;
         }
 
@@ -43,10 +43,16 @@ void taskHousekeeping(void *param)
 
         /* 1 second actions */
         dat_set_system_var(dat_rtc_date_time, (int) time(NULL));
+        // Write modified status variables and buffered payload samples to storage
+        if((elapsed_sec % SCH_STORAGE_CACHE_PERIOD) == 0)
+        {
+            dat_flush_system_vars();
+            dat_flush_payload_data();
+        }
         //  Debug command
         cmd_t *cmd_dbg = cmd_get_str("obc_debug");
         cmd_add_params_var(cmd_dbg, 0);
-        cmd_send(cmd_dbg);
+        cmd_send_prio(cmd_dbg, CMD_PRIO_LOW);
 
         /* 1 minute actions */
         // Update status vars
@@ -24,7 +24,7 @@ echo ${WORKSPACE}
 
 # Compiles the project with the test's parameters
 cd ${WORKSPACE}/src/system/include
-python3 configure.py "LINUX" --log_lvl "LOG_LVL_NONE" --sch_comm "0" --sch_fp "0" --sch_hk "0" --sch_test "1" --sch_st_mode "0"
+python3 configure.py "LINUX" --log_lvl "LOG_LVL_NONE" --comm "0" --fp "0" --hk "0" --test "1" --st_mode "0"
 
 # Compiles the test
 cd ${WORKSPACE}/test/test_cmd
@@ -49,14 +49,14 @@ python logs_comparator.py | cat >> test_cmd_comparator_log.txt
 # The test log is called test_unit_log.txt
 
 # Tests for all storage modes
-for i in "0" "1" "2"
+for i in "0" "1" "2" "3"
 do
 
     echo "Test for storage parameter ${i}"
 
     # Compiles the project with the test's parameters
     cd ${WORKSPACE}/src/system/include
-    python3 configure.py "LINUX" --log_lvl "LOG_LVL_NONE" --sch_comm "0" --sch_fp "0" --sch_hk "0" --sch_test "0" --sch_st_mode ${i}
+    python3 configure.py "LINUX" --log_lvl "LOG_LVL_NONE" --comm "0" --fp "0" --hk "0" --test "0" --st_mode ${i}
 
     # Compiles the test
     cd ${WORKSPACE}/test/test_unit
@@ -79,7 +79,7 @@ done
 
 # Compiles the project with the test's parameters
 cd ${WORKSPACE}/src/system/include
-python3 configure.py "LINUX" --log_lvl "LOG_LVL_NONE" --sch_comm "0" --sch_fp "0" --sch_hk "0" --sch_test "0" --sch_st_mode "0"
+python3 configure.py "LINUX" --log_lvl "LOG_LVL_NONE" --comm "0" --fp "0" --hk "0" --test "0" --st_mode "0"
 
 # Compiles the test
 cd ${WORKSPACE}/test/test_load
@@ -100,7 +100,7 @@ echo ""
 
 # Compiles the project with the test's parameters
 cd ${WORKSPACE}/src/system/include
-python3 configure.py "LINUX" --log_lvl "LOG_LVL_NONE" --sch_comm "0" --sch_fp "0" --sch_hk "0" --sch_test "0" --sch_st_mode "0"
+python3 configure.py "LINUX" --log_lvl "LOG_LVL_NONE" --comm "0" --fp "0" --hk "0" --test "0" --st_mode "0"
 
 # Compiles the test
 cd ${WORKSPACE}/test/test_bug_delay
@@ -120,7 +120,7 @@ rm -f ../test_bug_delay_log.txt
 
 # Compiles the project with the test's parameters
 cd ${WORKSPACE}/src/system/include
-python3 configure.py "LINUX" --log_lvl "LOG_LVL_DEBUG" --sch_comm "1" --sch_fp "0" --sch_hk "0" --sch_test "0" --sch_st_mode "0" --sch_node "1"
+python3 configure.py "LINUX" --log_lvl "LOG_LVL_DEBUG" --comm "1" --fp "0" --hk "0" --test "0" --st_mode "0" --node "1"
 
 # Compiles the test
 cd ${WORKSPACE}/test/test_tm_io
@@ -132,4 +132,84 @@ make
 
 # Runs the test, saving a log file
 rm -f ../test_tm_io_log.txt
-./SUCHAI_Flight_Software_Test | cat >> ../test_tm_io_log.txt
\ No newline at end of file
+./SUCHAI_Flight_Software_Test | cat >> ../test_tm_io_log.txt
+
+# ------------------ TEST_BENCH_CMD ------------------
+
+# The benchmark log is called test_bench_cmd_log.txt
+
+# Compiles the project with the test's parameters
+cd ${WORKSPACE}/src/system/include
+python3 configure.py "LINUX" --log_lvl "LOG_LVL_NONE" --comm "0" --fp "0" --hk "0" --test "0" --st_mode "0"
+
+# Compiles the test
+cd ${WORKSPACE}/test/test_bench_cmd
+rm -rf build_test
+mkdir build_test
+cd build_test
+cmake ..
+make
+
+# Runs the test, saving a log file
+rm -f ../test_bench_cmd_log.txt
+./SUCHAI_Flight_Software_Test | cat >> ../test_bench_cmd_log.txt
+
+# ------------------ TEST_BENCH_DISPATCHER ------------------
+
+# The benchmark log is called test_bench_dispatcher_log.txt
+
+# Compiles the project with the test's parameters
+cd ${WORKSPACE}/src/system/include
+python3 configure.py "LINUX" --log_lvl "LOG_LVL_NONE" --comm "0" --fp "0" --hk "0" --test "0" --st_mode "0"
+
+# Compiles the test
+cd ${WORKSPACE}/test/test_bench_dispatcher
+rm -rf build_test
+mkdir build_test
+cd build_test
+cmake ..
+make
+
+# Runs the test, saving a log file
+rm -f ../test_bench_dispatcher_log.txt
+./SUCHAI_Flight_Software_Test | cat >> ../test_bench_dispatcher_log.txt
+
+# ------------------ TEST_BENCH_STORAGE ------------------
+
+# The benchmark log is called test_bench_storage_log.txt
+
+# Compiles the project with the test's parameters
+cd ${WORKSPACE}/src/system/include
+python3 configure.py "LINUX" --log_lvl "LOG_LVL_NONE" --comm "0" --fp "0" --hk "0" --test "0" --st_mode "1"
+
+# Compiles the test
+cd ${WORKSPACE}/test/test_bench_storage
+rm -rf build_test
+mkdir build_test
+cd build_test
+cmake ..
+make
+
+# Runs the test, saving a log file
+rm -f ../test_bench_storage_log.txt
+./SUCHAI_Flight_Software_Test | cat >> ../test_bench_storage_log.txt
+
+# ------------------ TEST_BENCH_FLASH ------------------
+
+# The benchmark log is called test_bench_flash_log.txt
+
+# Compiles the project with the test's parameters
+cd ${WORKSPACE}/src/system/include
+python3 configure.py "LINUX" --log_lvl "LOG_LVL_NONE" --comm "0" --fp "0" --hk "0" --test "0" --st_mode "1"
+
+# Compiles the test
+cd ${WORKSPACE}/test/test_bench_flash
+rm -rf build_test
+mkdir build_test
+cd build_test
+cmake ..
+make
+
+# Runs the test, saving a log file
+rm -f ../test_bench_flash_log.txt
+./SUCHAI_Flight_Software_Test | cat >> ../test_bench_flash_log.txt
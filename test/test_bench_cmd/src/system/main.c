@@ -0,0 +1,112 @@
+/*                                 SUCHAI
+ *                      NANOSATELLITE FLIGHT SOFTWARE
+ *
+ *      Copyright 2018, Carlos Gonzalez Cortes, carlgonz@uchile.cl
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Command lookup microbenchmark. Compares cmd_get_str against the previous
+ * implementation: a linear scan of the command list taking the repository
+ * mutex once per compared entry.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "config.h"
+#include "utils.h"
+#include "osSemphr.h"
+#include "repoCommand.h"
+
+#define BENCH_ROUNDS (2000)
+
+static char *names[SCH_CMD_MAX_ENTRIES];
+static osSemaphore scan_sem;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+/**
+ * Previous cmd_get_str implementation
+ */
+static cmd_t *cmd_get_str_linear(char *name)
+{
+    int i, ok;
+    for(i=0; i<SCH_CMD_MAX_ENTRIES; i++)
+    {
+        osSemaphoreTake(&scan_sem, portMAX_DELAY);
+        ok = strcmp(name, names[i]);
+        osSemaphoreGiven(&scan_sem);
+
+        if(ok == 0)
+            return cmd_get_idx(i);
+    }
+    return NULL;
+}
+
+static double bench(cmd_t *(*get)(char *), int n_cmds, int *errors)
+{
+    int round, i;
+    double start = now_ns();
+    for(round=0; round<BENCH_ROUNDS; round++)
+    {
+        for(i=0; i<n_cmds; i++)
+        {
+            cmd_t *cmd = get(names[i]);
+            if(cmd == NULL || cmd->id != i)
+                (*errors)++;
+            cmd_free(cmd);
+        }
+    }
+    return (now_ns() - start)/((double)BENCH_ROUNDS*n_cmds);
+}
+
+int main(void)
+{
+    int i, n_cmds = 0, errors = 0;
+
+    log_init();
+    cmd_repo_init();
+    osSemaphoreCreate(&scan_sem);
+
+    for(i=0; i<SCH_CMD_MAX_ENTRIES; i++)
+    {
+        names[i] = cmd_get_name(i);
+        if(strcmp(names[i], "null") != 0)
+            n_cmds = i+1;
+    }
+
+    printf("---- Command lookup benchmark ----\n");
+    printf("Registered commands: %d, rounds: %d\n", n_cmds, BENCH_ROUNDS);
+
+    double t_linear = bench(cmd_get_str_linear, n_cmds, &errors);
+    double t_hash = bench(cmd_get_str, n_cmds, &errors);
+
+    printf("Linear scan: %10.1f ns/lookup\n", t_linear);
+    printf("Hash index : %10.1f ns/lookup\n", t_hash);
+    printf("Speedup    : %10.1fx\n", t_linear/t_hash);
+    printf("Errors     : %d\n", errors);
+
+    for(i=0; i<SCH_CMD_MAX_ENTRIES; i++)
+        free(names[i]);
+    cmd_repo_close();
+
+    return errors != 0;
+}
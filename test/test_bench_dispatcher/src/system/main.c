@@ -0,0 +1,128 @@
+/*                                 SUCHAI
+ *                      NANOSATELLITE FLIGHT SOFTWARE
+ *
+ *      Copyright 2018, Carlos Gonzalez Cortes, carlgonz@uchile.cl
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Dispatcher latency benchmark. A background task keeps the dispatcher queue
+ * saturated with low priority commands while critical commands are sent
+ * periodically. The latency from cmd_send to the start of the execution of
+ * the critical command is measured sending it with the same priority than
+ * the background load (FIFO behaviour) and with CMD_PRIO_CRITICAL.
+ */
+
+#include <stdio.h>
+#include "config.h"
+#include "globals.h"
+#include "utils.h"
+#include "osThread.h"
+#include "osQueue.h"
+#include "osDelay.h"
+#include "repoCommand.h"
+#include "taskDispatcher.h"
+#include "taskExecuter.h"
+
+#define BENCH_SAMPLES (20)      ///< Critical commands sent per test
+#define BENCH_PERIOD (50)       ///< Milliseconds between critical commands
+#define BENCH_LOAD_TIME (2)     ///< Execution time of the background commands
+
+static volatile int n_samples = 0;
+static volatile unsigned int lat_sum = 0;
+static volatile unsigned int lat_max = 0;
+
+int bench_load(char *fmt, char *params, int nparams)
+{
+    osDelay(BENCH_LOAD_TIME);
+    return CMD_OK;
+}
+
+int bench_critical(char *fmt, char *params, int nparams)
+{
+    unsigned int sent;
+    if(params != NULL && cmd_scan_params(params, fmt, &sent) == nparams)
+    {
+        unsigned int latency = (unsigned int)osTaskGetTickCount() - sent;
+        lat_sum += latency;
+        if(latency > lat_max)
+            lat_max = latency;
+        n_samples++;
+        return CMD_OK;
+    }
+    return CMD_FAIL;
+}
+
+/**
+ * Produces background commands twice as fast as they are executed, so the
+ * queue is always full
+ */
+void taskLoad(void *param)
+{
+    while(1)
+    {
+        cmd_t *cmd = cmd_get_str("bench_load");
+        cmd_send_prio(cmd, CMD_PRIO_LOW);
+        osDelay(BENCH_LOAD_TIME/2);
+    }
+}
+
+static void bench(char *name, int prio)
+{
+    int i;
+    n_samples = 0;
+    lat_sum = 0;
+    lat_max = 0;
+
+    for(i=0; i<BENCH_SAMPLES; i++)
+    {
+        osDelay(BENCH_PERIOD);
+        cmd_t *cmd = cmd_get_str("bench_critical");
+        cmd_add_params_var(cmd, (unsigned int)osTaskGetTickCount());
+        cmd_send_prio(cmd, prio);
+    }
+
+    while(n_samples < BENCH_SAMPLES)
+        osDelay(BENCH_PERIOD);
+
+    printf("%-20s avg: %8.2f ms, max: %8.2f ms\n", name,
+           lat_sum/1000.0/n_samples, lat_max/1000.0);
+}
+
+int main(void)
+{
+    log_init();
+    cmd_repo_init();
+    cmd_add("bench_load", bench_load, "", 0);
+    cmd_add("bench_critical", bench_critical, "%u", 1);
+
+    dispatcher_queue = osQueueCreate(CMD_DISPATCHER_QUEUE_LEN,sizeof(cmd_t *));
+    executer_stat_queue = osQueueCreate(SCH_TASK_EXE_WORKERS,sizeof(cmd_stat_t));
+    executer_cmd_queue = osQueueCreate(SCH_TASK_EXE_WORKERS,sizeof(cmd_t *));
+
+    int i;
+    os_thread threads_id[2+SCH_TASK_EXE_WORKERS];
+    osCreateTask(taskDispatcher, "dispatcher", SCH_TASK_DIS_STACK, NULL, 3, &threads_id[0]);
+    for(i=0; i<SCH_TASK_EXE_WORKERS; i++)
+        osCreateTask(taskExecuter, "executer", SCH_TASK_EXE_STACK, NULL, 4, &threads_id[2+i]);
+    osCreateTask(taskLoad, "load", SCH_TASK_DEF_STACK, NULL, 2, &threads_id[1]);
+
+    printf("---- Dispatcher latency benchmark ----\n");
+    printf("Load: %d ms commands, samples: %d\n", BENCH_LOAD_TIME, BENCH_SAMPLES);
+    bench("FIFO (same prio)", CMD_PRIO_LOW);
+    bench("CMD_PRIO_CRITICAL", CMD_PRIO_CRITICAL);
+
+    return 0;
+}
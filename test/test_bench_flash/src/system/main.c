@@ -0,0 +1,172 @@
+/*                                 SUCHAI
+ *                      NANOSATELLITE FLIGHT SOFTWARE
+ *
+ *      Copyright 2019, Carlos Gonzalez Cortes, carlgonz@uchile.cl
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Nanomind flash storage benchmark. Runs the nanomind storage driver on the
+ * Linux flash simulation (flash_sim.h) and reports the flash operations and
+ * the modeled time of each data repository command, and the erases of each
+ * flash section after the payload logs wrap several times.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "utils.h"
+#include "repoData.h"
+
+// The storage driver is not used when the repositories are kept in RAM
+#if SCH_STORAGE_MODE == 0
+#error "The flash benchmark requires SCH_STORAGE_MODE > 0, run configure.py with --st_mode 1"
+#endif
+
+#define BENCH_PAY_OPS   (5000)
+#define BENCH_FP_OPS    (SCH_FP_MAX_ENTRIES)
+#define BENCH_VAR_OPS   (5000)
+#define BENCH_FP_CHURN  (20000)
+#define BENCH_LAPS      (4)
+
+static flash_sim_stats_t stats;
+
+static void report(const char *name, int ops)
+{
+    flash_sim_stats_t now;
+    flash_sim_get_stats(&now);
+    printf("%-15s: %6.2f reads %6.2f writes %6.2f pages %6.3f erases %6.2f fram %8.1f us\n", name,
+           (double)(now.reads-stats.reads)/ops,
+           (double)(now.writes-stats.writes)/ops,
+           (double)(now.pages-stats.pages)/ops,
+           (double)(now.erases-stats.erases)/ops,
+           (double)(now.fram_reads-stats.fram_reads+now.fram_writes-stats.fram_writes)/ops,
+           (double)(now.time_us-stats.time_us)/ops);
+    stats = now;
+}
+
+int main(void)
+{
+    int i, errors = 0;
+
+    log_init();
+    remove(SCH_STORAGE_FILE);
+    dat_repo_init();
+    flash_sim_get_stats(&stats);
+
+    printf("---- Nanomind flash storage benchmark ----\n");
+    printf("Flash operations per command, modeled time per command\n");
+
+    /* System variables, FRAM only. Common variables are cached and written
+     * in batches, critical variables are written on every set */
+    for(i=0; i<BENCH_VAR_OPS; i++)
+    {
+        dat_set_system_var(dat_obc_hrs_alive, i);
+        errors += dat_get_system_var(dat_obc_hrs_alive) != i;
+    }
+    dat_flush_system_vars();
+    report("Sysvar set+get", BENCH_VAR_OPS);
+
+    for(i=0; i<BENCH_VAR_OPS; i++)
+    {
+        dat_set_system_var(dat_obc_last_reset, i);
+        errors += dat_get_system_var(dat_obc_last_reset) != i;
+    }
+    report("Sysvar critical", BENCH_VAR_OPS);
+
+    /* Payload samples */
+    temp_data_t data = {0, 20.5f, 21.5f, 22.5f}, read;
+    for(i=0; i<BENCH_PAY_OPS; i++)
+    {
+        data.timestamp = i;
+        errors += dat_add_payload_sample(&data, temp_sensors) != i+1;
+    }
+    report("Payload add", BENCH_PAY_OPS);
+
+    // The most recent sample is served from the write buffer
+    for(i=0; i<BENCH_PAY_OPS; i++)
+    {
+        errors += dat_get_recent_payload_sample(&read, temp_sensors, 0) != 0;
+        errors += read.timestamp != BENCH_PAY_OPS-1;
+    }
+    report("Payload get buf", BENCH_PAY_OPS);
+
+    // Samples older than one page are always read from the flash
+    int page_samples = SCH_FLASH_PAGE_SIZE/sizeof(temp_data_t);
+    for(i=0; i<BENCH_PAY_OPS; i++)
+    {
+        int offset = page_samples + i%(BENCH_PAY_OPS-page_samples);
+        errors += dat_get_recent_payload_sample(&read, temp_sensors, offset) != 0;
+        errors += read.timestamp != BENCH_PAY_OPS-1-offset;
+    }
+    report("Payload get old", BENCH_PAY_OPS);
+
+    /* Flight plan */
+    char cmd[SCH_CMD_MAX_STR_NAME], args[SCH_CMD_MAX_STR_PARAMS];
+    int executions, periodical;
+    for(i=0; i<BENCH_FP_OPS; i++)
+        errors += dat_set_fp(1000+i, "obc_get_mem", "", 1, 0) != 0;
+    report("FP set", BENCH_FP_OPS);
+
+    for(i=0; i<BENCH_FP_OPS; i++)
+        errors += dat_get_fp(1000+i, cmd, args, &executions, &periodical) != 0;
+    report("FP get", BENCH_FP_OPS);
+
+    // Enough records to fill the flight plan log and compact it
+    for(i=0; i<BENCH_FP_CHURN; i++)
+    {
+        errors += dat_set_fp(2000+i%BENCH_FP_OPS, "obc_get_mem", "", 1, 0) != 0;
+        errors += dat_del_fp(2000+i%BENCH_FP_OPS) != 0;
+    }
+    report("FP set+del", BENCH_FP_CHURN);
+
+    /* Payload log wear, all samples are acknowledged */
+    // Each section starts with a 12 bytes header
+    int per_lap = SCH_SECTIONS_PER_PAYLOAD*((SCH_SIZE_PER_SECTION-12)/sizeof(temp_data_t));
+    for(i=0; i<BENCH_LAPS*per_lap; i++)
+    {
+        int index = dat_add_payload_sample(&data, temp_sensors);
+        errors += index < 0;
+        if(index % 1000 == 0)
+        {
+            dat_set_system_var(data_map[temp_sensors].sys_ack, index);
+            dat_flush_system_vars();
+        }
+    }
+    report("Payload laps", BENCH_LAPS*per_lap);
+
+    printf("Erases per section after %d laps of %d samples\n", BENCH_LAPS, per_lap);
+    int payload, section;
+    for(payload=0; payload<last_sensor; payload++)
+    {
+        printf("%-15s:", data_map[payload].table);
+        for(section=0; section<SCH_SECTIONS_PER_PAYLOAD; section++)
+            printf(" %4d", flash_sim_get_erases(SCH_FLASH_INIT_MEMORY+(payload*SCH_SECTIONS_PER_PAYLOAD+section)*SCH_SIZE_PER_SECTION));
+        printf("\n");
+    }
+    printf("%-15s:", "flight_plan");
+    for(section=0; section<2; section++)
+        printf(" %4d", flash_sim_get_erases(SCH_FLASH_INIT_MEMORY+(last_sensor*SCH_SECTIONS_PER_PAYLOAD+section)*SCH_SIZE_PER_SECTION));
+    printf("\n");
+
+    flash_sim_get_stats(&stats);
+    printf("Bit errors     : %u\n", (unsigned int)stats.bit_errors);
+    printf("Errors         : %d\n", errors);
+
+    dat_repo_close();
+    remove(SCH_STORAGE_FILE);
+
+    return errors != 0 || stats.bit_errors != 0;
+}
@@ -0,0 +1,229 @@
+/*                                 SUCHAI
+ *                      NANOSATELLITE FLIGHT SOFTWARE
+ *
+ *      Copyright 2019, Carlos Gonzalez Cortes, carlgonz@uchile.cl
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * SQLite storage microbenchmark. Compares the storage driver, that keeps its
+ * prepared statements in a cache, against the previous implementation: build
+ * the SQL query with sqlite3_mprintf and prepare it on every call. Also
+ * compares adding and reading payload samples one by one against doing it in
+ * batches.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "config.h"
+#include "utils.h"
+#include "data_storage.h"
+
+#define BENCH_FILE      "/tmp/suchai_bench.db"
+#define BENCH_TABLE     "bench_system"
+#define BENCH_VARS      (32)
+#define BENCH_GET_OPS   (20000)
+#define BENCH_SET_OPS   (2000)
+#define BENCH_PAY_OPS   (2000)
+#define BENCH_BATCH     (10)
+
+static sqlite3 *legacy_db;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/**
+ * Previous storage_repo_get_value_idx implementation
+ */
+static int legacy_get_value_idx(int index, char *table)
+{
+    int value = -1;
+    sqlite3_stmt* stmt = NULL;
+    char *sql = sqlite3_mprintf("SELECT value FROM %s WHERE idx=\"%d\";", table, index);
+
+    int rc = sqlite3_prepare_v2(legacy_db, sql, -1, &stmt, 0);
+    if(rc != SQLITE_OK)
+        return -1;
+
+    rc = sqlite3_step(stmt);
+    if(rc == SQLITE_ROW)
+        value = sqlite3_column_int(stmt, 0);
+
+    sqlite3_finalize(stmt);
+    sqlite3_free(sql);
+    return value;
+}
+
+/**
+ * Previous storage_repo_set_value_idx implementation
+ */
+static int legacy_set_value_idx(int index, int value, char *table)
+{
+    char *sql = sqlite3_mprintf("INSERT OR REPLACE INTO %s (idx, name, value) "
+                                "VALUES ("
+                                "%d, "
+                                "(SELECT name FROM %s WHERE idx = \"%d\"), "
+                                "%d);",
+                                table, index, table, index, value);
+
+    int rc = sqlite3_exec(legacy_db, sql, NULL, 0, NULL);
+    sqlite3_free(sql);
+    return rc == SQLITE_OK ? 0 : -1;
+}
+
+/**
+ * Previous storage_set_payload_data implementation, for temp_data_t only
+ */
+static int legacy_set_payload_data(int index, temp_data_t *data)
+{
+    char *sql = sqlite3_mprintf("INSERT INTO %s (id, tstz, timestamp, obc_temp_1, obc_temp_2, obc_temp_3) "
+                                "VALUES (%d, current_timestamp, %u, %f, %f, %f)",
+                                data_map[temp_sensors].table, index, data->timestamp,
+                                data->obc_temp_1, data->obc_temp_2, data->obc_temp_3);
+
+    int rc = sqlite3_exec(legacy_db, sql, NULL, 0, NULL);
+    sqlite3_free(sql);
+    return rc == SQLITE_OK ? 0 : -1;
+}
+
+static void report(const char *name, int ops, double t_legacy, double t_cached)
+{
+    printf("%-14s: %10.0f ops/s -> %10.0f ops/s (%.1fx)\n", name,
+           ops/t_legacy, ops/t_cached, t_legacy/t_cached);
+}
+
+int main(void)
+{
+    int i, errors = 0;
+    double start, t_legacy, t_cached;
+
+    log_init();
+    remove(BENCH_FILE);
+    if(storage_init(BENCH_FILE) != 0 || sqlite3_open(BENCH_FILE, &legacy_db) != SQLITE_OK)
+    {
+        printf("Unable to open %s\n", BENCH_FILE);
+        return 1;
+    }
+    // Same durability as the driver connection, see storage_init
+    char *sync = sqlite3_mprintf("PRAGMA synchronous=%d;", SCH_STORAGE_SYNC);
+    sqlite3_exec(legacy_db, sync, NULL, 0, NULL);
+    sqlite3_free(sync);
+
+    // Columnar payload table used by the previous implementation
+    sqlite3_exec(legacy_db, "CREATE TABLE IF NOT EXISTS temp_data(id INTEGER, tstz TIMESTAMPTZ, "
+                            "timestamp BIGINT, obc_temp_1 REAL, obc_temp_2 REAL, obc_temp_3 REAL)",
+                 NULL, 0, NULL);
+
+    storage_table_repo_init(BENCH_TABLE, 0);
+    storage_table_payload_init(0);
+    for(i=0; i<BENCH_VARS; i++)
+        storage_repo_set_value_idx(i, i, BENCH_TABLE);
+
+    printf("---- SQLite storage benchmark ----\n");
+    printf("Before: mprintf + prepare per call, after: cached prepared statements\n");
+
+    /* System variables get */
+    start = now_s();
+    for(i=0; i<BENCH_GET_OPS; i++)
+        errors += legacy_get_value_idx(i%BENCH_VARS, BENCH_TABLE) != i%BENCH_VARS;
+    t_legacy = now_s() - start;
+    start = now_s();
+    for(i=0; i<BENCH_GET_OPS; i++)
+        errors += storage_repo_get_value_idx(i%BENCH_VARS, BENCH_TABLE) != i%BENCH_VARS;
+    t_cached = now_s() - start;
+    report("Sysvar get", BENCH_GET_OPS, t_legacy, t_cached);
+
+    /* System variables set */
+    start = now_s();
+    for(i=0; i<BENCH_SET_OPS; i++)
+        errors += legacy_set_value_idx(i%BENCH_VARS, i, BENCH_TABLE) != 0;
+    t_legacy = now_s() - start;
+    start = now_s();
+    for(i=0; i<BENCH_SET_OPS; i++)
+        errors += storage_repo_set_value_idx(i%BENCH_VARS, i, BENCH_TABLE) != 0;
+    t_cached = now_s() - start;
+    report("Sysvar set", BENCH_SET_OPS, t_legacy, t_cached);
+
+    /* Payload insert */
+    temp_data_t data = {0, 20.5f, 21.5f, 22.5f};
+    start = now_s();
+    for(i=0; i<BENCH_PAY_OPS; i++)
+    {
+        data.timestamp = i;
+        errors += legacy_set_payload_data(i, &data) != 0;
+    }
+    t_legacy = now_s() - start;
+    start = now_s();
+    for(i=0; i<BENCH_PAY_OPS; i++)
+    {
+        data.timestamp = i;
+        errors += storage_set_payload_data(BENCH_PAY_OPS+i, &data, temp_sensors) != 0;
+    }
+    t_cached = now_s() - start;
+    report("Payload insert", BENCH_PAY_OPS, t_legacy, t_cached);
+
+    /* Payload batch insert, one transaction per batch */
+    temp_data_t batch[BENCH_BATCH];
+    for(i=0; i<BENCH_BATCH; i++)
+        batch[i] = data;
+    start = now_s();
+    for(i=0; i<BENCH_PAY_OPS; i++)
+        errors += storage_set_payload_data(2*BENCH_PAY_OPS+i, &data, temp_sensors) != 0;
+    t_legacy = now_s() - start;
+    start = now_s();
+    for(i=0; i<BENCH_PAY_OPS; i+=BENCH_BATCH)
+        errors += storage_set_payload_data_n(3*BENCH_PAY_OPS+i, batch, BENCH_BATCH, temp_sensors) != 0;
+    t_cached = now_s() - start;
+    printf("Batches of %d samples\n", BENCH_BATCH);
+    report("Payload batch", BENCH_PAY_OPS, t_legacy, t_cached);
+
+    /* Payload range read, one query per batch */
+    temp_data_t sample;
+    start = now_s();
+    for(i=0; i<BENCH_PAY_OPS; i++)
+    {
+        storage_get_payload_data(BENCH_PAY_OPS+i, &sample, temp_sensors);
+        errors += sample.timestamp != i;
+    }
+    t_legacy = now_s() - start;
+    start = now_s();
+    for(i=0; i<BENCH_PAY_OPS; i+=BENCH_BATCH)
+    {
+        storage_get_payload_data_n(BENCH_PAY_OPS+i, batch, BENCH_BATCH, temp_sensors);
+        errors += batch[0].timestamp != i || batch[BENCH_BATCH-1].timestamp != i+BENCH_BATCH-1;
+    }
+    t_cached = now_s() - start;
+    report("Payload range", BENCH_PAY_OPS, t_legacy, t_cached);
+
+    /* Check a stored sample */
+    temp_data_t read = {0};
+    storage_get_payload_data(BENCH_PAY_OPS+10, &read, temp_sensors);
+    errors += read.timestamp != 10 || read.obc_temp_3 != data.obc_temp_3;
+    storage_get_payload_data(3*BENCH_PAY_OPS+BENCH_PAY_OPS-1, &read, temp_sensors);
+    errors += read.obc_temp_3 != data.obc_temp_3;
+
+    printf("Errors        : %d\n", errors);
+
+    sqlite3_close(legacy_db);
+    storage_close();
+    remove(BENCH_FILE);
+
+    return errors != 0;
+}
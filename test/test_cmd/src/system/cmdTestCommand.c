@@ -26,7 +26,7 @@ int test_cmd_str_int(char *fmt, char *params, int nparams)
     int valor = 0;
 
     errno = 0;
-    assertf(sscanf(params,fmt, msg, &valor) == nparams, tag, "The format of parameters are: %s and parameters used are: %s",fmt, params);
+    assertf(cmd_scan_params(params, fmt, msg, &valor) == nparams, tag, "The format of parameters are: %s and parameters used are: %s",fmt, params);
     assertf(errno == 0, tag, "The format of parameters are: %s and parameters used are: %s",fmt, params);
     LOGI(tag, "%s: %s_%i","con_str_int", msg, valor);
     return CMD_OK;
@@ -37,7 +37,7 @@ int test_cmd_double_int(char *fmt, char *params, int nparams)
     float v1 = 0, v2 = 0;
     int v3 = 0,v4 = 0;
 
-    assertf(sscanf(params,fmt, &v1, &v2, &v3, &v4) == nparams, tag, "The format of parameters are: %s and parameters used are: %s",fmt, params);
+    assertf(cmd_scan_params(params, fmt, &v1, &v2, &v3, &v4) == nparams, tag, "The format of parameters are: %s and parameters used are: %s",fmt, params);
     LOGI(tag, "%s: %f_%f_%i_%i", "con_double_int",v1,v2,v3,v4);
     return CMD_OK;
 }
@@ -49,7 +49,7 @@ int test_cmd_str_double_int(char *fmt, char *params, int nparams)
     float v2 = 0, v4 = 0;
     int v5 = 0;
 
-    assertf( sscanf(params,fmt, v1, &v2, v3, &v4, &v5) == nparams, tag, "The format of parameters are: %s and parameters used are: %s",fmt, params);
+    assertf( cmd_scan_params(params, fmt, v1, &v2, v3, &v4, &v5) == nparams, tag, "The format of parameters are: %s and parameters used are: %s",fmt, params);
     LOGI(tag, "%s: %s_%f_%s_%f_%i","str_double_int",v1,v2,v3,v4,v5);
     return CMD_OK;
 }
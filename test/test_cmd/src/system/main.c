@@ -40,9 +40,9 @@ int main(void)
     LOGI(tag, "Creating tasks...");
 
     /* Initializing shared Queues */
-    dispatcher_queue = osQueueCreate(25,sizeof(cmd_t *));
-    executer_cmd_queue = osQueueCreate(1,sizeof(cmd_t *));
-    executer_stat_queue = osQueueCreate(1,sizeof(int));
+    dispatcher_queue = osQueueCreate(CMD_DISPATCHER_QUEUE_LEN,sizeof(cmd_t *));
+    executer_cmd_queue = osQueueCreate(SCH_TASK_EXE_WORKERS,sizeof(cmd_t *));
+    executer_stat_queue = osQueueCreate(SCH_TASK_EXE_WORKERS,sizeof(cmd_stat_t));
 
     int n_threads = 3;
     os_thread threads_id[n_threads];
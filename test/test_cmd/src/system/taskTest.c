@@ -12,32 +12,32 @@ void taskTest(void *param)
     LOGI(tag, "Test: test_str_int from string")
     cmd_t *test_cmd = cmd_get_str("test_str_int");
     cmd_add_params_str(test_cmd, "STR1 12");
-    osQueueSend(dispatcher_queue, &test_cmd, portMAX_DELAY);
+    cmd_send(test_cmd);
     osDelay(500);
 
     LOGI(tag, "Test: test_double_int from vars")
     cmd_t *test_cmd2 = cmd_get_str("test_double_int");
     cmd_add_params_var(test_cmd2, 1.08, 2.09, 12, 23);
-    osQueueSend(dispatcher_queue, &test_cmd2, portMAX_DELAY);
+    cmd_send(test_cmd2);
     osDelay(500);
 
     LOGI(tag, "Test: test_str_double_int from string")
     cmd_t *test_cmd3= cmd_get_str("test_str_double_int");
     cmd_add_params_str(test_cmd3, "STR1 12.456 STR2 13.078 456");
-    osQueueSend(dispatcher_queue, &test_cmd3, portMAX_DELAY);
+    cmd_send(test_cmd3);
     osDelay(500);
 
 #if TEST_FAILS
     LOGI(tag, "Test: test_str_int from string with bad parameters numbers")
     cmd_t *test_cmd5 = cmd_get_str("test_str_int");
     cmd_add_params_str(test_cmd5, "STR1 12 12");
-    osQueueSend(dispatcher_queue, &test_cmd5, portMAX_DELAY);
+    cmd_send(test_cmd5);
     osDelay(500);
 
     LOGI(tag, "Test: test_str_int from string with bad parameters type")
     cmd_t * test_cmd4 = cmd_get_str("test_str_int");
     cmd_add_params_str(test_cmd4, "STR1 a12");
-    osQueueSend(dispatcher_queue, &test_cmd4, portMAX_DELAY);
+    cmd_send(test_cmd4);
 #endif
 
     LOGI(tag, "---- Testing DRP commands ----");
@@ -42,13 +42,13 @@ int main(void)
     dat_repo_init(); // Update status repository
 
     /* Initializing shared Queues */
-    dispatcher_queue = osQueueCreate(10,sizeof(cmd_t *));
+    dispatcher_queue = osQueueCreate(CMD_DISPATCHER_QUEUE_LEN,sizeof(cmd_t *));
     if(dispatcher_queue == 0)
         LOGE(tag, "Error creating dispatcher queue");
-    executer_stat_queue = osQueueCreate(1,sizeof(int));
+    executer_stat_queue = osQueueCreate(SCH_TASK_EXE_WORKERS,sizeof(cmd_stat_t));
     if(executer_stat_queue == 0)
         LOGE(tag, "Error creating executer stat queue");
-    executer_cmd_queue = osQueueCreate(1,sizeof(cmd_t *));
+    executer_cmd_queue = osQueueCreate(SCH_TASK_EXE_WORKERS,sizeof(cmd_t *));
     if(executer_cmd_queue == 0)
         LOGE(tag, "Error creating executer cmd queue");
 
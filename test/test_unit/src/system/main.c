@@ -24,6 +24,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 #include "CUnit/Basic.h"
 #include "cmdFP.h"
 #include "cmdOBC.h"
@@ -54,6 +55,8 @@ int clean_suite1(void)
 int init_suite2(void)
 {
     cmd_repo_init();
+    if(dispatcher_queue == NULL)
+        dispatcher_queue = osQueueCreate(CMD_DISPATCHER_QUEUE_LEN, sizeof(cmd_t *));
     return 0;
 }
 
@@ -97,7 +100,7 @@ void testParseCommands(void)
     name = cmd_get_name(cmd->id);
     CU_ASSERT_STRING_EQUAL("obc_get_mem", name)
     CU_ASSERT_PTR_NULL(cmd->params);
-    free(cmd); free(name);
+    cmd_free(cmd); free(name);
 
     // Case 2: command with parameters; command do not req. parameters.
     cmd = cmd_parse_from_str("obc_get_mem foo");
@@ -105,7 +108,7 @@ void testParseCommands(void)
     name = cmd_get_name(cmd->id);
     CU_ASSERT_STRING_EQUAL("obc_get_mem", name)
     CU_ASSERT_STRING_EQUAL("foo", cmd->params);
-    free(cmd); free(name);
+    cmd_free(cmd); free(name);
 
     // Case 3: command with parameters; command require parameters.
     cmd = cmd_parse_from_str("obc_debug 1");
@@ -113,7 +116,7 @@ void testParseCommands(void)
     name = cmd_get_name(cmd->id);
     CU_ASSERT_STRING_EQUAL("obc_debug", name)
     CU_ASSERT_STRING_EQUAL("1", cmd->params);
-    free(cmd); free(name);
+    cmd_free(cmd); free(name);
 
     // Case 4: command without parameters; command require parameters.
     cmd = cmd_parse_from_str("obc_debug");
@@ -121,22 +124,260 @@ void testParseCommands(void)
     name = cmd_get_name(cmd->id);
     CU_ASSERT_STRING_EQUAL("obc_debug", name)
     CU_ASSERT_PTR_NULL(cmd->params);
-    free(cmd); free(name);
+    cmd_free(cmd); free(name);
 
     // Case 5: not valid command
     cmd = cmd_parse_from_str("invalid_command");
     CU_ASSERT_PTR_NULL(cmd);
-    free(cmd);
+    cmd_free(cmd);
 
     // Case 6: empty command
     cmd = cmd_parse_from_str("\0");
     CU_ASSERT_PTR_NULL(cmd);
-    free(cmd);
+    cmd_free(cmd);
 
     // Case 7: \n or \cr command
     cmd = cmd_parse_from_str("\r\n");
     CU_ASSERT_PTR_NULL(cmd);
-    free(cmd);
+    cmd_free(cmd);
+}
+
+// Test of the command pool
+void testCmdPool(void)
+{
+    int i;
+    cmd_t *cmds[SCH_CMD_POOL_SIZE+1];
+    cmd_pool_stats_t stats;
+    char raw[SCH_CMD_MAX_STR_PARAMS*2];
+    memset(raw, 0xAA, sizeof(raw));
+
+    // Take all commands, the last one (and its parameters) comes from the heap
+    for(i=0; i<SCH_CMD_POOL_SIZE+1; i++)
+    {
+        cmds[i] = cmd_parse_from_str("obc_debug 1");
+        CU_ASSERT_PTR_NOT_NULL_FATAL(cmds[i]);
+        CU_ASSERT_STRING_EQUAL("1", cmds[i]->params);
+    }
+    cmd_pool_get_stats(&stats);
+    CU_ASSERT_EQUAL(SCH_CMD_POOL_SIZE, stats.in_use);
+    CU_ASSERT_EQUAL(SCH_CMD_POOL_SIZE, stats.max_used);
+    CU_ASSERT_EQUAL(1, stats.heap_cmds);
+    CU_ASSERT_EQUAL(1, stats.heap_params);
+
+    // Raw parameters larger than the inline buffer
+    cmd_add_params_raw(cmds[0], raw, sizeof(raw));
+    CU_ASSERT_EQUAL(0, memcmp(raw, cmds[0]->params, sizeof(raw)));
+    cmd_pool_get_stats(&stats);
+    CU_ASSERT_EQUAL(2, stats.heap_params);
+
+    for(i=0; i<SCH_CMD_POOL_SIZE+1; i++)
+        cmd_free(cmds[i]);
+    cmd_pool_get_stats(&stats);
+    CU_ASSERT_EQUAL(0, stats.in_use);
+    CU_ASSERT_EQUAL(SCH_CMD_POOL_SIZE, stats.max_used);
+}
+
+void testCmdParamsVar(void)
+{
+    int a, b;
+    void *ptr;
+    char str[SCH_CMD_MAX_STR_PARAMS];
+    cmd_t *cmd;
+
+    // Parameters stored as binary
+    cmd = cmd_get_str("fp_test_params"); // "%d %s %d"
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cmd);
+    cmd_add_params_var(cmd, 10, "hello world", -3);
+    CU_ASSERT_EQUAL(3, cmd_scan_params(cmd->params, cmd->fmt, &a, str, &b));
+    CU_ASSERT_EQUAL(10, a);
+    CU_ASSERT_STRING_EQUAL("hello world", str);
+    CU_ASSERT_EQUAL(-3, b);
+    CU_ASSERT(cmd_params_len(cmd->params) > 0);
+    cmd_free(cmd);
+
+    // Strings that do not fit the handler buffers are not stored as binary
+    char long_str[SCH_CMD_MAX_STR_PARAMS+1];
+    memset(long_str, 'a', SCH_CMD_MAX_STR_PARAMS);
+    long_str[SCH_CMD_MAX_STR_PARAMS] = '\0';
+    cmd = cmd_get_str("fp_test_params");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cmd);
+    cmd_add_params_var(cmd, 10, long_str, -3);
+    CU_ASSERT_NOT_EQUAL('\0', cmd->params[0]);
+    cmd_free(cmd);
+
+    // Raw parameters with the binary header are not read as binary
+    char fake[] = {0, (char)0xA5, (char)0xFF, 0, 's', 's', 's', 's'};
+    cmd = cmd_get_str("fp_test_params");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cmd);
+    cmd_add_params_raw(cmd, fake, sizeof(fake));
+    CU_ASSERT_EQUAL(EOF, cmd_scan_params(cmd->params, cmd->fmt, &a, str, &b));
+    cmd_free(cmd);
+
+    // Empty strings not owned by a command are not read as binary
+    CU_ASSERT_EQUAL(-1, cmd_params_len(""));
+    CU_ASSERT_EQUAL(EOF, cmd_scan_params("", "%d", &a));
+
+    // The same command as string
+    cmd = cmd_parse_from_str("fp_test_params 10 hello -3");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cmd);
+    CU_ASSERT_EQUAL(3, cmd_scan_params(cmd->params, cmd->fmt, &a, str, &b));
+    CU_ASSERT_EQUAL(10, a);
+    CU_ASSERT_STRING_EQUAL("hello", str);
+    CU_ASSERT_EQUAL(-3, b);
+    cmd_free(cmd);
+
+    // Formats with %p are converted to string
+    cmd = cmd_get_str("com_send_data"); // "%p"
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cmd);
+    cmd_add_params_var(cmd, str);
+    CU_ASSERT_NOT_EQUAL('\0', cmd->params[0]);
+    CU_ASSERT_EQUAL(1, cmd_scan_params(cmd->params, cmd->fmt, &ptr));
+    CU_ASSERT_PTR_EQUAL(str, ptr);
+    cmd_free(cmd);
+}
+
+void testCmdParseBin(void)
+{
+    int a, b;
+    char str[SCH_CMD_MAX_STR_PARAMS];
+    cmd_t *cmd;
+
+    // Codes are stable, derived from the command name
+    CU_ASSERT_EQUAL(0xD6DE, cmd_get_code_str("drp_set_var"));
+    int code = cmd_get_code_str("fp_test_params");
+    int code_send = cmd_get_code_str("com_send_cmd");
+
+    uint8_t frame[] = {
+        0xD6, 0xDE, 3, 0x14, 0x90, 0x03,                // drp_set_var 10 200
+        0xFF, 0xFF, 2, 0x00, 0x00,                      // Unknown command
+        (uint8_t)(code >> 8), (uint8_t)code, 5, 0x05, 'h', 'i', '\0', 0x0E,  // fp_test_params -3 hi 7
+        (uint8_t)(code_send >> 8), (uint8_t)code_send, 6, '5', ' ', 'h', 'e', 'l', 'p', // com_send_cmd 5 help
+        0xD6, 0xDE, 3, 0x14                            // Truncated
+    };
+    int pos = 0;
+    int len = sizeof(frame);
+
+    pos += cmd_parse_from_bin(frame + pos, len - pos, &cmd);
+    CU_ASSERT_EQUAL(6, pos);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cmd);
+    CU_ASSERT_EQUAL(2, cmd_scan_params(cmd->params, cmd->fmt, &a, &b));
+    CU_ASSERT_EQUAL(10, a);
+    CU_ASSERT_EQUAL(200, b);
+    cmd_free(cmd);
+
+    pos += cmd_parse_from_bin(frame + pos, len - pos, &cmd);
+    CU_ASSERT_EQUAL(11, pos);
+    CU_ASSERT_PTR_NULL(cmd);
+
+    pos += cmd_parse_from_bin(frame + pos, len - pos, &cmd);
+    CU_ASSERT_EQUAL(19, pos);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cmd);
+    CU_ASSERT_EQUAL(3, cmd_scan_params(cmd->params, cmd->fmt, &a, str, &b));
+    CU_ASSERT_EQUAL(-3, a);
+    CU_ASSERT_STRING_EQUAL("hi", str);
+    CU_ASSERT_EQUAL(7, b);
+    cmd_free(cmd);
+
+    pos += cmd_parse_from_bin(frame + pos, len - pos, &cmd);
+    CU_ASSERT_EQUAL(28, pos);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cmd);
+    CU_ASSERT_STRING_EQUAL("5 help", cmd->params);
+    cmd_free(cmd);
+
+    CU_ASSERT_EQUAL(-1, cmd_parse_from_bin(frame + pos, len - pos, &cmd));
+    CU_ASSERT_PTR_NULL(cmd);
+
+    // Strings longer than the handler buffers are rejected
+    uint8_t long_frame[3 + 2 + SCH_CMD_MAX_STR_PARAMS + 1];
+    memset(long_frame, 'a', sizeof(long_frame));
+    long_frame[0] = (uint8_t)(code >> 8);
+    long_frame[1] = (uint8_t)code;
+    long_frame[2] = sizeof(long_frame) - 3;
+    long_frame[3] = 0x05;
+    long_frame[sizeof(long_frame) - 2] = '\0';
+    long_frame[sizeof(long_frame) - 1] = 0x0E;
+    CU_ASSERT_EQUAL(sizeof(long_frame), cmd_parse_from_bin(long_frame, sizeof(long_frame), &cmd));
+    CU_ASSERT_PTR_NULL(cmd);
+
+    // Different names with the same code are rejected (both are 0xE966)
+    CU_ASSERT_EQUAL(cmd_get_code_str("tst_code_1605"), cmd_get_code_str("tst_code_3060"));
+    CU_ASSERT_NOT_EQUAL(CMD_ERROR, cmd_add("tst_code_1605", obc_ident, "", 0));
+    CU_ASSERT_EQUAL(CMD_ERROR, cmd_add("tst_code_3060", obc_ident, "", 0));
+    cmd = cmd_get_code(0xE966);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cmd);
+    char *name = cmd_get_name(cmd->id);
+    CU_ASSERT_STRING_EQUAL("tst_code_1605", name);
+    free(name);
+    cmd_free(cmd);
+}
+
+/* Take a queued command and complete its future as the executer does */
+static int run_queued_cmd(int result)
+{
+    cmd_t *cmd = NULL;
+    cmd_t *mark = NULL;
+    if(osQueueReceive(dispatcher_prio_queue[CMD_PRIO_NORMAL], &cmd, 0) != pdPASS)
+        return -1;
+    osQueueReceive(dispatcher_queue, &mark, 0);
+    int future = cmd->future;
+    cmd_free(cmd);
+    cmd_future_complete(future, result);
+    return future;
+}
+
+void testCmdFutures(void)
+{
+    int i, result;
+    int handle;
+    int handles[SCH_CMD_FUTURES];
+
+    // Result is not available until the command is executed
+    CU_ASSERT_EQUAL(CMD_OK, cmd_send_async(cmd_parse_from_str("obc_debug 1"), &handle));
+    CU_ASSERT(handle >= 0);
+    CU_ASSERT_EQUAL(CMD_FAIL, cmd_wait(handle, 0, &result));
+    CU_ASSERT_EQUAL(handle, run_queued_cmd(CMD_ERROR));
+    CU_ASSERT_EQUAL(CMD_OK, cmd_wait(handle, 0, &result));
+    CU_ASSERT_EQUAL(CMD_ERROR, result);
+    // The handle was released after returning the result
+    CU_ASSERT_EQUAL(CMD_ERROR, cmd_wait(handle, 0, &result));
+
+    // Without free futures commands are sent but the result is lost
+    for(i=0; i<SCH_CMD_FUTURES; i++)
+        CU_ASSERT_EQUAL(CMD_OK, cmd_send_async(cmd_parse_from_str("obc_debug 1"), &handles[i]));
+    CU_ASSERT_EQUAL(CMD_FAIL, cmd_send_async(cmd_parse_from_str("obc_debug 1"), &handle));
+    CU_ASSERT_EQUAL(-1, handle);
+
+    // Released futures are recycled once the command finishes
+    for(i=0; i<SCH_CMD_FUTURES; i++)
+        cmd_future_release(handles[i]);
+    for(i=0; i<SCH_CMD_FUTURES+1; i++)
+        run_queued_cmd(CMD_OK);
+    CU_ASSERT_EQUAL(-1, run_queued_cmd(CMD_OK));
+    for(i=0; i<SCH_CMD_FUTURES; i++)
+        CU_ASSERT_EQUAL(CMD_OK, cmd_send_async(cmd_parse_from_str("obc_debug 1"), &handles[i]));
+    for(i=0; i<SCH_CMD_FUTURES; i++)
+    {
+        run_queued_cmd(CMD_OK);
+        CU_ASSERT_EQUAL(CMD_OK, cmd_wait(handles[i], 0, &result));
+        CU_ASSERT_EQUAL(CMD_OK, result);
+    }
+
+    // With a full queue the caller keeps the command and the future is free
+    for(i=0; i<SCH_CMD_PRIO_QUEUE_LEN; i++)
+        CU_ASSERT_EQUAL(CMD_OK, cmd_send_async(cmd_parse_from_str("obc_debug 1"), NULL));
+    cmd_t *cmd = cmd_parse_from_str("obc_debug 1");
+    CU_ASSERT_EQUAL(CMD_ERROR, cmd_send_async(cmd, &handle));
+    CU_ASSERT_EQUAL(-1, handle);
+    CU_ASSERT_EQUAL(-1, cmd->future);
+    cmd_free(cmd);
+    for(i=0; i<SCH_CMD_PRIO_QUEUE_LEN; i++)
+        run_queued_cmd(CMD_OK);
+    for(i=0; i<SCH_CMD_FUTURES; i++)
+        CU_ASSERT_EQUAL(CMD_OK, cmd_send_async(cmd_parse_from_str("obc_debug 1"), &handles[i]));
+    for(i=0; i<SCH_CMD_FUTURES; i++)
+        run_queued_cmd(CMD_OK);
+    for(i=0; i<SCH_CMD_FUTURES; i++)
+        CU_ASSERT_EQUAL(CMD_OK, cmd_wait(handles[i], 0, &result));
 }
 
 // Test of fp_set.
@@ -248,6 +489,236 @@ void testDATGET_SYSVAR(void)
 }
 
 
+//Test of dat_get_system_snapshot
+void testDATSNAPSHOT_SYSVAR(void)
+{
+    int values[dat_system_last_var];
+    dat_status_t status;
+
+    for (int i = dat_obc_opmode; i < dat_system_last_var; i++)
+        dat_set_system_var(i, i + 10);
+    // One corrupted copy is fixed by voting
+    _dat_set_system_var(dat_com_count_tc + dat_system_last_var, -1);
+
+    dat_get_system_snapshot(values);
+    for (int i = dat_obc_opmode; i < dat_system_last_var; i++)
+    {
+        CU_ASSERT_EQUAL(values[i], dat_get_system_var(i));
+        CU_ASSERT_EQUAL(values[i], i + 10);
+    }
+
+    dat_status_to_struct(&status);
+    CU_ASSERT_EQUAL(status.dat_obc_opmode, dat_obc_opmode + 10);
+    CU_ASSERT_EQUAL(status.dat_com_count_tc, dat_com_count_tc + 10);
+    CU_ASSERT_EQUAL(status.dat_drp_ack_lang, dat_drp_ack_lang + 10);
+}
+
+//Test of dat_get_payload_desc
+void testDATPAYLOAD_DESC(void)
+{
+    const dat_payload_desc_t *desc = dat_get_payload_desc(eps_sensors);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(desc);
+    CU_ASSERT_EQUAL(desc->nfields, 10);
+    CU_ASSERT_EQUAL(desc->fields[0].type, 'u');
+    CU_ASSERT_STRING_EQUAL(desc->fields[0].name, "timestamp");
+    CU_ASSERT_EQUAL(desc->fields[4].type, 'd');
+    CU_ASSERT_STRING_EQUAL(desc->fields[4].name, "temp1");
+    CU_ASSERT_EQUAL(desc->fields[4].offset, offsetof(eps_data_t, temp1));
+    CU_ASSERT_EQUAL(desc->fields[9].offset, offsetof(eps_data_t, temp6));
+
+    // Fields cover the whole struct
+    for (int i = 0; i < last_sensor; i++)
+    {
+        desc = dat_get_payload_desc(i);
+        dat_payload_field_t last = desc->fields[desc->nfields-1];
+        CU_ASSERT_EQUAL(last.offset + last.size, data_map[i].size);
+    }
+
+    CU_ASSERT_PTR_NULL(dat_get_payload_desc(last_sensor));
+}
+
+//Test of dat_get_fp_next
+void testDATFP_NEXT(void)
+{
+    char command[SCH_CMD_MAX_STR_NAME];
+    char args[SCH_CMD_MAX_STR_PARAMS];
+    int executions, periodical;
+
+    dat_reset_fp();
+    CU_ASSERT_EQUAL(dat_get_fp_next(), -1);
+
+    dat_set_fp(3000, "test_fp_c", "", 1, 0);
+    dat_set_fp(1000, "test_fp_a", "", 1, 100);
+    dat_set_fp(2000, "test_fp_b", "", 1, 0);
+    CU_ASSERT_EQUAL(dat_get_fp_next(), 1000);
+
+    // Not due yet
+    CU_ASSERT_EQUAL(dat_get_fp(999, command, args, &executions, &periodical), -1);
+
+    // The periodic command is set again 100 seconds later
+    CU_ASSERT_EQUAL(dat_get_fp(1000, command, args, &executions, &periodical), 0);
+    CU_ASSERT_STRING_EQUAL(command, "test_fp_a");
+    CU_ASSERT_EQUAL(dat_get_fp_next(), 1100);
+
+    // A command with the same time is replaced
+    dat_set_fp(1100, "test_fp_d", "", 1, 0);
+    CU_ASSERT_EQUAL(dat_get_fp(1100, command, args, &executions, &periodical), 0);
+    CU_ASSERT_STRING_EQUAL(command, "test_fp_d");
+    CU_ASSERT_EQUAL(dat_get_fp(1100, command, args, &executions, &periodical), -1);
+    CU_ASSERT_EQUAL(dat_get_fp_next(), 2000);
+
+    dat_del_fp(2000);
+    CU_ASSERT_EQUAL(dat_get_fp_next(), 3000);
+    dat_reset_fp();
+    CU_ASSERT_EQUAL(dat_get_fp_next(), -1);
+}
+
+void testDATFP_LATE(void)
+{
+    char command[SCH_CMD_MAX_STR_NAME];
+    char args[SCH_CMD_MAX_STR_PARAMS];
+    int executions, periodical;
+
+    dat_reset_fp();
+    dat_set_fp(1000, "test_fp_a", "", 1, 100);
+    dat_set_fp(1050, "test_fp_b", "", 1, 0);
+    dat_set_fp(1060, "test_fp_c", "", 1, 0);
+
+    // Slightly late commands are executed
+    CU_ASSERT_EQUAL(dat_get_fp(1000 + SCH_FP_MAX_LATE, command, args, &executions, &periodical), 0);
+    CU_ASSERT_STRING_EQUAL(command, "test_fp_a");
+    CU_ASSERT_EQUAL(dat_get_system_var(dat_fpl_late), SCH_FP_MAX_LATE);
+    CU_ASSERT_EQUAL(dat_get_fp_next(), 1050);
+
+    // Missed commands are taken in order
+    int skipped = dat_get_system_var(dat_fpl_skipped);
+    skipped = (skipped < 0 || skipped == INT_MAX) ? 0 : skipped;
+#if SCH_FP_LATE_POLICY == 1
+    CU_ASSERT_EQUAL(dat_get_fp(1365, command, args, &executions, &periodical), -1);
+    CU_ASSERT_EQUAL(dat_get_system_var(dat_fpl_skipped), skipped + 5);
+#else
+    CU_ASSERT_EQUAL(dat_get_fp(1365, command, args, &executions, &periodical), 0);
+    CU_ASSERT_STRING_EQUAL(command, "test_fp_b");
+    CU_ASSERT_EQUAL(dat_get_system_var(dat_fpl_late), 315);
+    CU_ASSERT_EQUAL(dat_get_fp(1365, command, args, &executions, &periodical), 0);
+    CU_ASSERT_STRING_EQUAL(command, "test_fp_c");
+    CU_ASSERT(dat_get_system_var(dat_fpl_late_max) >= 315);
+    CU_ASSERT_EQUAL(dat_get_fp(1365, command, args, &executions, &periodical), 0);
+    CU_ASSERT_STRING_EQUAL(command, "test_fp_a");
+#endif
+
+#if SCH_FP_LATE_POLICY == 0
+    // Every missed repetition is executed
+    CU_ASSERT_EQUAL(dat_get_fp(1365, command, args, &executions, &periodical), 0);
+    CU_ASSERT_EQUAL(dat_get_fp(1365, command, args, &executions, &periodical), 0);
+    CU_ASSERT_EQUAL(dat_get_fp(1365, command, args, &executions, &periodical), -1);
+#elif SCH_FP_LATE_POLICY == 2
+    // Missed repetitions are coalesced
+    CU_ASSERT_EQUAL(dat_get_fp(1365, command, args, &executions, &periodical), -1);
+    CU_ASSERT_EQUAL(dat_get_system_var(dat_fpl_skipped), skipped + 2);
+#endif
+    CU_ASSERT_EQUAL(dat_get_fp_next(), 1400);
+    dat_reset_fp();
+
+#if SCH_STORAGE_MODE == 0 && SCH_FP_LATE_POLICY == 2
+    // Coalescing moves the rescheduled command, not others at the same time
+    dat_set_fp(2100, "test_fp_e", "", 1, 0);
+    dat_set_fp(2000, "test_fp_d", "", 1, 100);
+    CU_ASSERT_EQUAL(dat_get_fp(2365, command, args, &executions, &periodical), 0);
+    CU_ASSERT_STRING_EQUAL(command, "test_fp_d");
+    CU_ASSERT_EQUAL(dat_get_fp(2365, command, args, &executions, &periodical), 0);
+    CU_ASSERT_STRING_EQUAL(command, "test_fp_e");
+    CU_ASSERT_EQUAL(dat_get_fp_next(), 2400);
+    CU_ASSERT_EQUAL(dat_get_fp(2400, command, args, &executions, &periodical), 0);
+    CU_ASSERT_STRING_EQUAL(command, "test_fp_d");
+    dat_reset_fp();
+#endif
+}
+
+void testDATFP_BULK(void)
+{
+    char command[SCH_CMD_MAX_STR_NAME];
+    char args[SCH_CMD_MAX_STR_PARAMS];
+    int executions, periodical;
+    int i;
+
+    dat_reset_fp();
+    dat_set_fp(1000, "test_fp_a", "", 1, 0);
+
+    // Packed list with two entries, session 7: (2000, test_fp_b, 1, 1, 0) and (3000, test_fp_c, "", 2, 100)
+    uint8_t list[] = {
+        7, 43,
+        0x00, 0x00, 0x07, 0xD0, 0, 0, 0, 0, 0, 1, 't', 'e', 's', 't', '_', 'f', 'p', '_', 'b', 0, '1', 0,
+        0x00, 0x00, 0x0B, 0xB8, 0, 0, 0, 100, 0, 2, 't', 'e', 's', 't', '_', 'f', 'p', '_', 'c', 0, 0
+    };
+    cmd_t *cmd = cmd_get_str("fp_stage");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cmd);
+    cmd_add_params_raw(cmd, list, sizeof(list));
+    CU_ASSERT_EQUAL(cmd->function(cmd->fmt, cmd->params, cmd->nparams), CMD_OK);
+    cmd_free(cmd);
+
+    // Binary TC frames keep the packed list as is
+    int code = cmd_get_code_str("fp_stage");
+    uint8_t frame[] = {(uint8_t)(code >> 8), (uint8_t)code, 4, 7, 2, 0, 0};
+    CU_ASSERT_EQUAL(cmd_parse_from_bin(frame, sizeof(frame), &cmd), 7);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cmd);
+    CU_ASSERT_EQUAL(memcmp(cmd->params, frame + 3, 4), 0);
+    cmd_free(cmd);
+
+    // Lists longer than the params received are rejected
+    frame[4] = 43;
+    CU_ASSERT_EQUAL(cmd_parse_from_bin(frame, sizeof(frame), &cmd), 7);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cmd);
+    CU_ASSERT_EQUAL(cmd->function(cmd->fmt, cmd->params, cmd->nparams), CMD_FAIL);
+    cmd_free(cmd);
+    CU_ASSERT_EQUAL(fp_stage("%p", (char *)list, 1), CMD_FAIL);
+
+    // The flight plan is not modified until commit, and the stage can only
+    // be used by its session
+    CU_ASSERT_EQUAL(dat_get_fp_next(), 1000);
+    CU_ASSERT_EQUAL(dat_stage_fp(8, 2500, "test_fp_d", "", 1, 0), -1);
+    CU_ASSERT_EQUAL(dat_commit_fp(8, 0), -1);
+    CU_ASSERT_EQUAL(dat_discard_fp(8), -1);
+    CU_ASSERT_EQUAL(dat_commit_fp(7, 0), 2);
+    CU_ASSERT_EQUAL(dat_get_fp(1000, command, args, &executions, &periodical), 0);
+    CU_ASSERT_EQUAL(dat_get_fp(2000, command, args, &executions, &periodical), 0);
+    CU_ASSERT_STRING_EQUAL(command, "test_fp_b");
+    CU_ASSERT_STRING_EQUAL(args, "1");
+    CU_ASSERT_EQUAL(dat_get_fp_next(), 3000);
+
+    // Truncated lists are not staged
+    list[1] = 30;
+    cmd = cmd_get_str("fp_stage");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cmd);
+    cmd_add_params_raw(cmd, list, sizeof(list));
+    CU_ASSERT_EQUAL(cmd->function(cmd->fmt, cmd->params, cmd->nparams), CMD_FAIL);
+    cmd_free(cmd);
+    CU_ASSERT_EQUAL(dat_discard_fp(7), 0);
+
+    // A flight plan that does not fit is not committed
+    for(i = 0; i < SCH_FP_MAX_ENTRIES; i++)
+        CU_ASSERT_EQUAL(dat_stage_fp(1, 4000 + i, "test_fp_d", "", 1, 0), 0);
+    CU_ASSERT_EQUAL(dat_stage_fp(1, 5000, "test_fp_d", "", 1, 0), -1);
+    CU_ASSERT_EQUAL(dat_commit_fp(1, 0), -1);
+    CU_ASSERT_EQUAL(dat_get_fp_next(), 3000);
+
+    // Replace the flight plan
+    for(i = 0; i < SCH_FP_MAX_ENTRIES; i++)
+        dat_stage_fp(2, 4000 + i, "test_fp_d", "", 1, 0);
+    CU_ASSERT_EQUAL(dat_commit_fp(2, 1), SCH_FP_MAX_ENTRIES);
+    CU_ASSERT_EQUAL(dat_get_fp(3000, command, args, &executions, &periodical), -1);
+    CU_ASSERT_EQUAL(dat_get_fp_next(), 4000);
+    CU_ASSERT_EQUAL(dat_get_fp(4000, command, args, &executions, &periodical), 0);
+    CU_ASSERT_STRING_EQUAL(command, "test_fp_d");
+
+    // Merge replaces commands with the same time
+    dat_stage_fp(3, 4001, "test_fp_e", "", 1, 0);
+    CU_ASSERT_EQUAL(dat_commit_fp(3, 0), 1);
+    CU_ASSERT_EQUAL(dat_get_fp(4001, command, args, &executions, &periodical), 0);
+    CU_ASSERT_STRING_EQUAL(command, "test_fp_e");
+    dat_reset_fp();
+}
+
 /* The main() function for setting up and running the tests.
  * Returns a CUE_SUCCESS on successful running, another
  * CUnit error code on failure.
@@ -286,7 +757,11 @@ int main()
     }
 
     /* add the tests to the suite */
-    if ((NULL == CU_add_test(pSuite, "test of cmd_parse_from_str()", testParseCommands))){
+    if ((NULL == CU_add_test(pSuite, "test of cmd_parse_from_str()", testParseCommands)) ||
+            (NULL == CU_add_test(pSuite, "test of commands pool", testCmdPool)) ||
+            (NULL == CU_add_test(pSuite, "test of cmd_add_params_var()", testCmdParamsVar)) ||
+            (NULL == CU_add_test(pSuite, "test of cmd_parse_from_bin()", testCmdParseBin)) ||
+            (NULL == CU_add_test(pSuite, "test of commands futures", testCmdFutures))){
         CU_cleanup_registry();
         return CU_get_error();
     }
@@ -303,7 +778,12 @@ int main()
     /* add the tests to the suite */
     if ((NULL == CU_add_test(pSuite, "test of drp_test_system_vars", testSYSVARS)) ||
             (NULL == CU_add_test(pSuite, "test of dat_set_system_var", testDATSET_SYSVAR)) ||
-            (NULL == CU_add_test(pSuite, "test of dat_get_system_var", testDATGET_SYSVAR))){
+            (NULL == CU_add_test(pSuite, "test of dat_get_system_var", testDATGET_SYSVAR)) ||
+            (NULL == CU_add_test(pSuite, "test of dat_get_system_snapshot", testDATSNAPSHOT_SYSVAR)) ||
+            (NULL == CU_add_test(pSuite, "test of dat_get_payload_desc", testDATPAYLOAD_DESC)) ||
+            (NULL == CU_add_test(pSuite, "test of dat_get_fp_next", testDATFP_NEXT)) ||
+            (NULL == CU_add_test(pSuite, "test of late flight plan commands", testDATFP_LATE)) ||
+            (NULL == CU_add_test(pSuite, "test of flight plan bulk upload", testDATFP_BULK))){
         CU_cleanup_registry();
         return CU_get_error();
     }